@@ -0,0 +1,83 @@
+// Micro-benchmark: passing a list to a function and defining a function
+// should cost the same whatever the size of the list or the function body.
+// Build with `make bench`.
+#include "../include/hexa.h"
+#include <time.h>
+
+#define CALLS 1000000
+#define DEPTH 1000
+#define DEFINITIONS 100000
+
+void initGlobalEnvironment(Environment* env);
+
+// Run source repeatedly, each run makes DEPTH nested calls
+static double timeCalls(const char* source, Environment* env) {
+    Value expr = parse(source);
+    pushRoot(expr);
+    clock_t start = clock();
+    for (int i = 0; i < CALLS / DEPTH; i++) {
+        interpret(expr, env);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    popRoots(1);
+    return seconds;
+}
+
+int main() {
+    int sizes[] = {10, 1000, 100000};
+    int sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+    initVM();
+
+    Value setup = parse("[def loop [fn [f n] [if [< n 1] nil [do-loop f n]]]]");
+    interpret(setup, env);
+    setup = parse("[def do-loop [fn [f n] [f big] [loop f [- n 1]]]]");
+    interpret(setup, env);
+    setup = parse("[def id [fn [x] x]]");
+    interpret(setup, env);
+
+    printf("%10s %14s %14s\n", "size", "ns/call", "ns/fn");
+
+    for (int s = 0; s < sizeCount; s++) {
+        int n = sizes[s];
+
+        // A list argument of n elements
+        Value big = makeList();
+        for (int i = 0; i < n; i++) {
+            appendToList(AS_LIST(big), makeNumber(i));
+        }
+        defineVariable(env, internCString("big"), big);
+
+        // A function whose body holds n expressions
+        Value body = makeList();
+        appendToList(AS_LIST(body), makeSymbol("fn"));
+        appendToList(AS_LIST(body), makeList());
+        for (int i = 0; i < n; i++) {
+            appendToList(AS_LIST(body), makeNumber(i));
+        }
+        defineVariable(env, internCString("body"), body);
+
+        char source[128];
+        snprintf(source, sizeof(source), "[loop id %d]", DEPTH);
+        double callSeconds = timeCalls(source, env);
+
+        // Evaluating a quoted fn form builds a new function every time
+        Environment* frame = createEnclosedEnvironment(env);
+        clock_t start = clock();
+        for (int i = 0; i < DEFINITIONS; i++) {
+            evaluate(body, frame);
+        }
+        double fnSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        printf("%10d %14.2f %14.2f\n", n,
+               callSeconds * 1e9 / CALLS, fnSeconds * 1e9 / DEFINITIONS);
+    }
+
+    popRoots(1);
+    freeObjects();
+    freeSymbols();
+    return 0;
+}
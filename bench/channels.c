@@ -0,0 +1,96 @@
+// Benchmark: messages between interpreters on channels. Ping-pong sends a
+// message to an actor and waits for it to come back, for the latency of a
+// round trip, with a number and with a list that has to be copied. Fan-out
+// and fan-in has a feeder actor send jobs to 1 up to N worker actors, which
+// send their results back to this thread, for throughput. Build with `make
+// bench`, and pass the most workers to try (the number of cores by default).
+#define _POSIX_C_SOURCE 200809L
+#include "../include/hexa.h"
+#include <time.h>
+
+#define ROUND_TRIPS 20000
+#define JOBS 50000
+
+static const char* program =
+    "[def ponger [fn [in out] [loop [m [recv in]] "
+    "  [if [= m nil] 'done [do [send out m] [recur [recv in]]]]]]]\n"
+    "[def pinger [fn [out in m n] [dotimes [i n] [do [send out m] [recv in]]] n]]\n"
+    "[def work [fn [x] [loop [i 0 acc x] "
+    "  [if [< i 20] [recur [+ i 1] [mod [+ [* acc 31] i] 1000003]] acc]]]]\n"
+    "[def feeder [fn [jobs n] [dotimes [i n] [send jobs i]] [close jobs]]]\n"
+    "[def worker [fn [jobs results] [loop [j [recv jobs]] "
+    "  [if [= j nil] 'done [do [send results [work j]] [recur [recv jobs]]]]]]]\n"
+    "[def collect [fn [results n total] "
+    "  [if [= n 0] total [collect results [- n 1] [+ total [recv results]]]]]]\n";
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Microseconds per round trip of message to an actor and back
+static double pingPong(HexaVM* hexa, const char* message) {
+    runSource(hexa, "[def ping [chan 1]] [def pong [chan 1]] [def player [actor ponger ping pong]]",
+              false);
+
+    char source[128];
+    snprintf(source, sizeof(source), "[pinger ping pong %s %d]", message, ROUND_TRIPS);
+    double start = now();
+    runSource(hexa, source, false);
+    double seconds = now() - start;
+
+    runSource(hexa, "[close ping] [recv player]", false);
+    return seconds * 1e6 / ROUND_TRIPS;
+}
+
+// Seconds to run JOBS jobs on workers, which must add up to expected
+static double fanOutFanIn(HexaVM* hexa, int workers, int64_t expected) {
+    double start = now();
+    char source[96];
+    snprintf(source, sizeof(source), "[def jobs [chan 256]] [def results [chan 256]] [actor feeder jobs %d]",
+             JOBS);
+    runSource(hexa, source, false);
+    for (int i = 0; i < workers; i++) {
+        runSource(hexa, "[actor worker jobs results]", false);
+    }
+    snprintf(source, sizeof(source), "[collect results %d 0]", JOBS);
+    Value total = runSource(hexa, source, false);
+    double seconds = now() - start;
+
+    if (!IS_INT(total) || AS_INT(total) != expected) {
+        fprintf(stderr, "The workers computed the wrong result.\n");
+        exit(1);
+    }
+    return seconds;
+}
+
+int main(int argc, char* argv[]) {
+    int maxWorkers = argc > 1 ? atoi(argv[1]) : processorCount();
+    if (maxWorkers < 1) maxWorkers = 1;
+
+    HexaVM* hexa = newHexaVM();
+    runSource(hexa, program, false);
+
+    printf("ping-pong, %d round trips\n", ROUND_TRIPS);
+    printf("  number: %8.2f us/round trip\n", pingPong(hexa, "1"));
+    printf("  list:   %8.2f us/round trip\n", pingPong(hexa, "'[1 \"two\" [3.5 four]]"));
+
+    char source[96];
+    snprintf(source, sizeof(source), "[let [total 0] [dotimes [i %d] [set total [+ total [work i]]]] total]",
+             JOBS);
+    double start = now();
+    Value expected = runSource(hexa, source, false);
+    double loop = now() - start;
+
+    printf("fan-out and fan-in, %d jobs\n", JOBS);
+    printf("%8s %10s %12s %10s\n", "workers", "seconds", "jobs/s", "speedup");
+    printf("%8s %10.3f %12.0f %10s\n", "loop", loop, JOBS / loop, "");
+    for (int workers = 1; workers <= maxWorkers; workers++) {
+        double seconds = fanOutFanIn(hexa, workers, AS_INT(expected));
+        printf("%8d %10.3f %12.0f %9.2fx\n", workers, seconds, JOBS / seconds, loop / seconds);
+    }
+
+    freeHexaVM(hexa);
+    return 0;
+}
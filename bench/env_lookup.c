@@ -0,0 +1,44 @@
+// Micro-benchmark: global lookup cost as the number of globals grows.
+// Build with `make bench`.
+#include "../include/hexa.h"
+#include <time.h>
+
+#define LOOKUPS 10000000
+
+int main() {
+    int sizes[] = {10, 100, 1000, 10000, 100000};
+    int sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+    
+    printf("%10s %12s\n", "globals", "ns/lookup");
+    
+    for (int s = 0; s < sizeCount; s++) {
+        int n = sizes[s];
+        Environment* env = createEnvironment();
+        Symbol** names = malloc(sizeof(Symbol*) * n);
+        
+        for (int i = 0; i < n; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "global-%d", i);
+            names[i] = internCString(name);
+            defineVariable(env, names[i], makeNumber(i));
+        }
+        
+        // Stride through the names so lookups don't stay in one cache line
+        double sum = 0;
+        unsigned int index = 0;
+        clock_t start = clock();
+        for (int i = 0; i < LOOKUPS; i++) {
+            index = (index + 7919) % n;
+            sum += AS_NUMBER(getVariable(env, names[index]));
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        
+        printf("%10d %12.2f\n", n, seconds * 1e9 / LOOKUPS);
+        if (sum < 0) printf("%g\n", sum);
+        
+        free(names);
+    }
+    
+    freeObjects();
+    return 0;
+}
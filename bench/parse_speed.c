@@ -0,0 +1,65 @@
+// Micro-benchmark: parse throughput on a large generated source file, with
+// top-level forms allocated from arenas and from the heap. Build with
+// `make bench`.
+#include "../include/hexa.h"
+#include <time.h>
+
+#define FORMS 200000
+#define RUNS 5
+
+static char* generateSource(size_t* length) {
+    size_t capacity = (size_t)FORMS * 128;
+    char* source = malloc(capacity);
+    size_t used = 0;
+
+    for (int i = 0; i < FORMS; i++) {
+        used += snprintf(source + used, capacity - used,
+                         "[def f%d [fn [a b] [if [< a b] [print \"a is smaller\" a] [* b %d.5]]]]\n",
+                         i % 1000, i);
+    }
+
+    *length = used;
+    return source;
+}
+
+// Best of RUNS, in MB/s
+static double parseSpeed(const char* source, size_t length, bool arena) {
+    setParseArena(arena);
+
+    double best = 0;
+    for (int run = 0; run < RUNS; run++) {
+        initLexer(source);
+        initParser();
+
+        clock_t start = clock();
+        int forms = 0;
+        while (getCurrentToken().type != TOKEN_EOF) {
+            parseExpression();
+            forms++;
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        if (forms != FORMS) printf("parsed %d forms, expected %d\n", forms, FORMS);
+        double speed = length / seconds / (1024 * 1024);
+        if (speed > best) best = speed;
+
+        // Nothing is rooted, so this frees every parsed form
+        collectGarbage();
+    }
+    return best;
+}
+
+int main() {
+    size_t length;
+    char* source = generateSource(&length);
+
+    printf("source: %.1f MB, %d forms\n", length / (1024.0 * 1024), FORMS);
+    printf("%10s %10s\n", "mode", "MB/s");
+    printf("%10s %10.1f\n", "heap", parseSpeed(source, length, false));
+    printf("%10s %10.1f\n", "arena", parseSpeed(source, length, true));
+
+    free(source);
+    freeObjects();
+    freeSymbols();
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Benchmark: pmap and preduce of a scoring function over a large list with
+// pools of 1 up to N workers, next to a plain loop on one thread. Each item
+// costs the same, so throughput should grow with the workers up to the
+// number of cores. Build with `make bench`, and pass the most workers to
+// try (the number of cores by default).
+#define _POSIX_C_SOURCE 200809L
+#include "../include/hexa.h"
+#include <time.h>
+
+#define ITEMS 20000
+
+static const char* program =
+    "[def score [fn [x] [loop [i 0 acc x] "
+    "  [if [< i 300] [recur [+ i 1] [mod [+ [* acc 31] i] 1000003]] acc]]]]\n"
+    "[def add-scores [fn [a b] [+ a b]]]\n"
+    "[def sequential [fn [n] [let [total 0] "
+    "  [dotimes [i n] [set total [+ total [score i]]]] total]]]\n";
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Seconds to run source, which must return expected
+static double timeRun(HexaVM* hexa, const char* source, int64_t expected) {
+    double start = now();
+    Value result = runSource(hexa, source, false);
+    double seconds = now() - start;
+
+    // pmap's result is checked by reducing it
+    if (IS_LIST(result)) {
+        int64_t total = 0;
+        for (int i = 0; i < AS_LIST(result)->count; i++) {
+            total += AS_INT(AS_LIST(result)->items[i]);
+        }
+        result = makeInt(total);
+    }
+    if (!IS_INT(result) || AS_INT(result) != expected) {
+        fprintf(stderr, "%s computed the wrong result.\n", source);
+        exit(1);
+    }
+    return seconds;
+}
+
+int main(int argc, char* argv[]) {
+    int maxWorkers = argc > 1 ? atoi(argv[1]) : processorCount();
+    if (maxWorkers < 1) maxWorkers = 1;
+
+    HexaVM* hexa = newHexaVM();
+    runSource(hexa, program, false);
+
+    // The items 0 to ITEMS - 1
+    Value items = makeList();
+    for (int i = 0; i < ITEMS; i++) {
+        appendToList(AS_LIST(items), makeInt(i));
+    }
+    defineVariable(hexaGlobals(hexa), internCString("items"), items);
+
+    char source[64];
+    snprintf(source, sizeof(source), "[sequential %d]", ITEMS);
+    Value total = runSource(hexa, source, false);
+    double sequential = timeRun(hexa, source, AS_INT(total));
+    printf("%8s %10s %12s %10s\n", "workers", "seconds", "items/s", "speedup");
+    printf("%8s %10.3f %12.0f %10s\n", "loop", sequential, ITEMS / sequential, "");
+
+    for (int workers = 1; workers <= maxWorkers; workers++) {
+        setThreadCount(workers);
+        double map = timeRun(hexa, "[pmap score items]", AS_INT(total));
+        double reduce = timeRun(hexa, "[preduce add-scores 0 [pmap score items]]", AS_INT(total));
+        printf("%8d %10.3f %12.0f %9.2fx   pmap\n", workers, map, ITEMS / map, sequential / map);
+        printf("%8d %10.3f %12.0f %9.2fx   pmap + preduce\n", workers, reduce, ITEMS / reduce,
+               sequential / reduce);
+    }
+
+    freeHexaVM(hexa);
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Benchmark: 100000 tasks that each yield 10 times. Reports the heap a task
+// takes before it starts and once it is suspended, and the time a switch
+// to a task and back takes. Build with `make bench`, and pass another task
+// count to try.
+#define _POSIX_C_SOURCE 200809L
+#include "../include/hexa.h"
+#include <time.h>
+
+#define YIELDS 10
+
+static const char* program =
+    "[def worker [fn [n] [dotimes [i n] [yield]] n]]\n"
+    "[def last nil]\n";
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Bytes on the heap once garbage is collected
+static size_t liveBytes() {
+    collectGarbage();
+    return heapBytesAllocated();
+}
+
+int main(int argc, char* argv[]) {
+    int tasks = argc > 1 ? atoi(argv[1]) : 100000;
+    if (tasks < 1) tasks = 1;
+
+    HexaVM* hexa = newHexaVM();
+    runSource(hexa, program, false);
+
+    char source[96];
+    snprintf(source, sizeof(source), "[dotimes [i %d] [set last [spawn worker %d]]]", tasks, YIELDS);
+    size_t before = liveBytes();
+    double start = now();
+    runSource(hexa, source, false);
+    double spawning = now() - start;
+    size_t spawned = liveBytes();
+
+    // Every task starts and suspends in its first yield
+    start = now();
+    runSource(hexa, "[yield]", false);
+    double starting = now() - start;
+    size_t suspended = liveBytes();
+
+    // The rest of the yields, then each task returns
+    start = now();
+    Value result = runSource(hexa, "[await last]", false);
+    double switching = now() - start;
+    if (!IS_INT(result) || AS_INT(result) != YIELDS) {
+        fprintf(stderr, "The last task returned the wrong result.\n");
+        return 1;
+    }
+    size_t done = liveBytes();
+
+    printf("%d tasks, %d yields each\n", tasks, YIELDS);
+    printf("spawn:             %8.1f ns/task  %6.0f bytes/task\n", spawning * 1e9 / tasks,
+           (double)(spawned - before) / tasks);
+    printf("start and suspend: %8.1f ns/task  %6.0f bytes/task\n", starting * 1e9 / tasks,
+           (double)(suspended - before) / tasks);
+    printf("switch:            %8.1f ns/yield\n", switching * 1e9 / ((double)tasks * YIELDS));
+    printf("done:                                %6.0f bytes/task\n", (double)(done - before) / tasks);
+
+    freeHexaVM(hexa);
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Benchmark: the same program run by 1 up to N threads at once, each with an
+// interpreter of its own. Every thread does the same work, so with nothing
+// shared the wall time stays flat and throughput grows with the thread
+// count, up to the number of cores. Build with `make bench`, and pass the
+// largest thread count to try (the number of cores by default).
+#define _POSIX_C_SOURCE 200809L
+#include "../include/hexa.h"
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+#define RUNS 20
+
+static const char* program =
+    "[def fib [fn [n] [if [< n 2] n [+ [fib [- n 1]] [fib [- n 2]]]]]]\n"
+    "[def count [fn [n] [loop [i 0 acc 0] [if [< i n] [recur [+ i 1] [+ acc i]] acc]]]]\n";
+
+static const char* work = "[+ [fib 22] [count 100000]]";
+
+static void runWorker(void* result) {
+    HexaVM* hexa = newHexaVM();
+    runSource(hexa, program, false);
+
+    Value value = NIL_VAL;
+    for (int i = 0; i < RUNS; i++) {
+        value = runSource(hexa, work, false);
+    }
+    *(int64_t*)result = IS_INT(value) ? AS_INT(value) : -1;
+    freeHexaVM(hexa);
+}
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (maxThreads < 1) maxThreads = 1;
+    if (maxThreads > MAX_THREADS) maxThreads = MAX_THREADS;
+
+    printf("%8s %10s %12s %10s\n", "threads", "seconds", "runs/s", "speedup");
+
+    double baseline = 0;
+    for (int count = 1; count <= maxThreads; count++) {
+        HexaThread* threads[MAX_THREADS];
+        int64_t results[MAX_THREADS];
+
+        double start = now();
+        for (int i = 0; i < count; i++) {
+            threads[i] = startThread(runWorker, &results[i]);
+        }
+        for (int i = 0; i < count; i++) {
+            joinThread(threads[i]);
+        }
+        double seconds = now() - start;
+
+        for (int i = 0; i < count; i++) {
+            if (results[i] != 17711 + 4999950000) {
+                fprintf(stderr, "Thread %d computed %" PRId64 ".\n", i, results[i]);
+                return 1;
+            }
+        }
+
+        double throughput = count * RUNS / seconds;
+        if (count == 1) baseline = throughput;
+        printf("%8d %10.3f %12.1f %9.2fx\n", count, seconds, throughput, throughput / baseline);
+    }
+    return 0;
+}
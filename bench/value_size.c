@@ -0,0 +1,41 @@
+// Micro-benchmark: memory footprint of a 1M-element list. Build with
+// `make bench`, which also builds bench_value_size_union with the tagged
+// union representation (HEXA_NO_NAN_BOXING) for comparison.
+#include "../include/hexa.h"
+#include <time.h>
+
+#define ELEMENTS 1000000
+
+int main() {
+    size_t before = heapBytesAllocated();
+    
+    clock_t start = clock();
+    Value list = makeList();
+    for (int i = 0; i < ELEMENTS; i++) {
+        appendToList(AS_LIST(list), makeNumber(i));
+    }
+    double buildSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    size_t bytes = heapBytesAllocated() - before;
+    
+    // Walk the list so the read side of the representation is timed too
+    start = clock();
+    double sum = 0;
+    for (int i = 0; i < AS_LIST(list)->count; i++) {
+        sum += AS_NUMBER(AS_LIST(list)->items[i]);
+    }
+    double sumSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+#ifdef NAN_BOXING
+    printf("representation: NaN-boxed\n");
+#else
+    printf("representation: tagged union\n");
+#endif
+    printf("sizeof(Value):  %zu bytes\n", sizeof(Value));
+    printf("%d-element list: %zu bytes (%.2f bytes/element)\n", ELEMENTS, bytes, (double)bytes / ELEMENTS);
+    printf("build: %.2f ms, sum: %.2f ms\n", buildSeconds * 1000, sumSeconds * 1000);
+    if (sum < 0) printf("%g\n", sum);
+    
+    freeObjects();
+    return 0;
+}
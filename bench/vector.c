@@ -0,0 +1,129 @@
+// Benchmark: persistent vectors next to lists, which are arrays. Each
+// operation keeps the old version, as conj, assoc and pop do, so an array
+// has to be copied whole where a vector copies one path of its trie. Also
+// times building in place, with a transient and with appendToList, and
+// going through the items. Collections run as they would between calls.
+// Build with `make bench`.
+#define _POSIX_C_SOURCE 200809L
+#include "../include/hexa.h"
+#include <time.h>
+
+#define ITEMS 100000
+#define ARRAY_ITEMS 20000
+#define UPDATES 100000
+#define ARRAY_UPDATES 2000
+#define PASSES 100
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Keep version alive over a collection, as a variable would
+static Value keep(Value version) {
+    pushRoot(version);
+    collectGarbageIfNeeded();
+    popRoots(1);
+    return version;
+}
+
+static void report(const char* name, int operations, double seconds) {
+    printf("  %-28s %10.1f ns/op\n", name, seconds * 1e9 / operations);
+}
+
+int main() {
+    srand(1);
+    int* indexes = malloc(sizeof(int) * UPDATES);
+    for (int i = 0; i < UPDATES; i++) indexes[i] = rand() % ITEMS;
+
+    printf("append, keeping each version\n");
+    double start = now();
+    Value vector = makeVector();
+    for (int i = 0; i < ITEMS; i++) {
+        Value args[2] = {vector, makeInt(i)};
+        vector = keep(nativeConj(2, args));
+    }
+    report("vector conj", ITEMS, now() - start);
+
+    start = now();
+    Value array = makeList();
+    for (int i = 0; i < ARRAY_ITEMS; i++) {
+        List* old = AS_LIST(array);
+        Value copy = makeListIn(NULL, old->items, old->count);
+        appendToList(AS_LIST(copy), makeInt(i));
+        array = keep(copy);
+    }
+    report("array copy, 20000 items", ARRAY_ITEMS, now() - start);
+
+    printf("append in place\n");
+    start = now();
+    Vector* transient = beginTransient(NULL);
+    for (int i = 0; i < ITEMS; i++) transientAppend(transient, makeInt(i));
+    Value built = endTransient(transient);
+    report("vector transient", ITEMS, now() - start);
+
+    start = now();
+    array = makeList();
+    for (int i = 0; i < ITEMS; i++) appendToList(AS_LIST(array), makeInt(i));
+    report("array appendToList", ITEMS, now() - start);
+
+    // The versions built above are garbage from here on
+    pushRoot(built);
+    pushRoot(array);
+
+    printf("random update of %d items, keeping each version\n", ITEMS);
+    start = now();
+    Value updated = built;
+    for (int i = 0; i < UPDATES; i++) {
+        Value args[3] = {updated, makeInt(indexes[i]), makeInt(-i)};
+        updated = keep(nativeAssoc(3, args));
+    }
+    report("vector assoc", UPDATES, now() - start);
+
+    start = now();
+    Value copied = array;
+    for (int i = 0; i < ARRAY_UPDATES; i++) {
+        List* old = AS_LIST(copied);
+        Value copy = makeListIn(NULL, old->items, old->count);
+        AS_LIST(copy)->items[indexes[i]] = makeInt(-i);
+        copied = keep(copy);
+    }
+    report("array copy", ARRAY_UPDATES, now() - start);
+
+    printf("iteration over %d items, %d passes\n", ITEMS, PASSES);
+    Vector* items = AS_VECTOR(built);
+    int64_t sum = 0;
+    start = now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (int i = 0; i < items->count; i++) sum += AS_INT(vectorGet(items, i));
+    }
+    report("vector nth", ITEMS * PASSES, now() - start);
+
+    start = now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (int i = 0; i < items->count; i += VECTOR_WIDTH) {
+            Value* chunk = vectorChunk(items, i);
+            int count = items->count - i < VECTOR_WIDTH ? items->count - i : VECTOR_WIDTH;
+            for (int j = 0; j < count; j++) sum += AS_INT(chunk[j]);
+        }
+    }
+    report("vector by leaf", ITEMS * PASSES, now() - start);
+
+    List* list = AS_LIST(array);
+    start = now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (int i = 0; i < list->count; i++) sum += AS_INT(list->items[i]);
+    }
+    report("array", ITEMS * PASSES, now() - start);
+
+    if (sum != (int64_t)ITEMS * (ITEMS - 1) / 2 * PASSES * 3) {
+        fprintf(stderr, "The passes added up to the wrong sum.\n");
+        return 1;
+    }
+
+    popRoots(2);
+    free(indexes);
+    freeObjects();
+    return 0;
+}
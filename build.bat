@@ -3,7 +3,8 @@ echo Building Hexa Language Interpreter (C Edition)
 
 if not exist "build" mkdir build
 
-gcc -Wall -Wextra -std=c99 -I./include -o build\hexai.exe src\main.c src\lexer.c src\parser.c src\value.c src\environment.c src\evaluator.c
+rem Nested calls in --tree-walk mode use the C stack, reserve 8 MB like Linux does
+gcc -Wall -Wextra -std=c99 -I./include -Wl,--stack,8388608 -o build\hexai.exe src\main.c src\lexer.c src\parser.c src\value.c src\environment.c src\evaluator.c src\symbol.c src\compiler.c src\vm.c src\memory.c src\optimizer.c src\jit.c src\emitter.c src\macro.c src\memo.c src\context.c src\parallel.c src\task.c src\channel.c src\vector.c -lm
 
 if %errorlevel% neq 0 (
     echo Build failed!
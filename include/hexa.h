@@ -5,6 +5,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+// Values are NaN-boxed into 8 bytes unless built with HEXA_NO_NAN_BOXING,
+// which selects a tagged union instead
+#ifndef HEXA_NO_NAN_BOXING
+#define NAN_BOXING
+#endif
+
+// Interpreter state lives in variables of this storage class, one copy per
+// thread, so each thread runs an interpreter of its own (see HexaVM)
+#if defined(_MSC_VER)
+#define HEXA_THREAD_LOCAL __declspec(thread)
+#else
+#define HEXA_THREAD_LOCAL __thread
+#endif
 
 // Type definitions
 typedef enum {
@@ -13,10 +29,15 @@ typedef enum {
     TOKEN_RBRACKET,     // ]
     TOKEN_IDENTIFIER,   // symbols, names
     TOKEN_STRING,       // "text"
-    TOKEN_NUMBER,       // 123, 45.6
+    TOKEN_NUMBER,       // 45.6
+    TOKEN_INTEGER,      // 123
     TOKEN_BOOLEAN,      // true, false
     TOKEN_NIL,          // nil
     TOKEN_COMMENT,      // ; comment
+    TOKEN_QUOTE,        // 'x reads as [quote x]
+    TOKEN_QUASIQUOTE,   // `x reads as [quasiquote x]
+    TOKEN_UNQUOTE,      // ,x reads as [unquote x]
+    TOKEN_UNQUOTE_SPLICING, // ,@x reads as [unquote-splicing x]
     TOKEN_ERROR         // For error tokens
 } TokenType;
 
@@ -36,54 +57,350 @@ typedef enum {
     VAL_SYMBOL,
     VAL_LIST,
     VAL_FUNCTION,
-    VAL_NATIVE
+    VAL_NATIVE,
+    VAL_INT,
+    VAL_TASK,
+    VAL_CHANNEL,
+    VAL_VECTOR
 } ValueType;
 
+// Integers are 48-bit so they fit the payload of a NaN-boxed value. Results
+// outside this range become doubles, in both value representations.
+#define HEXA_INT_MAX    ((int64_t)0x00007fffffffffff)
+#define HEXA_INT_MIN    (-HEXA_INT_MAX - 1)
+#define INT_FITS(i)     ((i) >= HEXA_INT_MIN && (i) <= HEXA_INT_MAX)
+
+// Special forms, named by the symbol at the head of a list
+typedef enum {
+    SPECIAL_NONE,
+    SPECIAL_FN,
+    SPECIAL_DEF,
+    SPECIAL_IF,
+    SPECIAL_LET,
+    SPECIAL_DO,
+    SPECIAL_WHILE,
+    SPECIAL_QUOTE,
+    SPECIAL_AND,
+    SPECIAL_OR,
+    SPECIAL_COND,
+    SPECIAL_DEFMACRO,
+    SPECIAL_QUASIQUOTE,
+    SPECIAL_SET,
+    SPECIAL_LOOP,
+    SPECIAL_RECUR,
+    SPECIAL_DOTIMES,
+    SPECIAL_FORM_COUNT
+} SpecialForm;
+
+typedef struct Environment Environment;
+typedef struct Closure Closure;
+typedef struct Memo Memo;
+typedef struct Task Task;
+typedef struct Queue Queue;
+
+// Interned symbol, every name has exactly one Symbol so they compare by pointer
+typedef struct Symbol {
+    uint32_t hash;
+    int length;
+    uint8_t special;    // The SpecialForm this symbol names, tagged when interned
+
+    // Where the name was last found among the globals, valid while
+    // cacheVersion is globalsVersion
+    Environment* cachedIn;
+    uint32_t cacheVersion;
+    int cacheSlot;
+
+    Closure* macro;     // The macro this symbol names, or NULL
+
+    char chars[];
+} Symbol;
+
+#ifdef NAN_BOXING
+typedef uint64_t Value;
+#else
 typedef struct Value Value;
+#endif
 typedef struct List List;
+typedef struct Chunk Chunk;
+typedef struct JitCode JitCode;
 typedef Value (*NativeFn)(int argCount, Value* args);
 
+// Strings, lists, functions and environments live on a garbage-collected
+// heap and are shared between values: copying one is a pointer copy.
+typedef enum {
+    OBJ_STRING,
+    OBJ_LIST,
+    OBJ_FUNCTION,
+    OBJ_CLOSURE,
+    OBJ_NATIVE,
+    OBJ_ENVIRONMENT,
+    OBJ_ARENA,
+    OBJ_TASK,
+    OBJ_CHANNEL,
+    OBJ_VECTOR,
+    OBJ_VECTOR_NODE
+} ObjType;
+
+typedef struct Obj {
+    ObjType type;
+    bool isMarked;
+    bool inArena;
+    struct Obj* next;   // Every heap object, for the sweep phase. For objects
+                        // allocated in an arena, the arena they belong to.
+} Obj;
+
+// Bump allocation for parse trees. Forms are packed into large blocks that
+// the collector keeps or frees as a whole, so an object allocated in an arena
+// may only refer to objects of the same top-level form.
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock* block;      // Block being filled
+    size_t formStart;       // Where in it the current form starts
+} Arena;
+
+typedef struct {
+    Obj obj;
+    int length;
+    char chars[];
+} String;
+
 struct List {
+    Obj obj;
     int count;
     int capacity;
     Value* items;
 };
 
+// Built-ins the VM can run inline when called with two integers
+typedef enum {
+    NATIVE_OP_NONE,
+    NATIVE_OP_ADD,
+    NATIVE_OP_SUBTRACT,
+    NATIVE_OP_MULTIPLY,
+    NATIVE_OP_EQUAL,
+    NATIVE_OP_LESS,
+    NATIVE_OP_GREATER,
+    NATIVE_OP_LESS_EQUAL,
+    NATIVE_OP_GREATER_EQUAL
+} NativeOp;
+
 typedef struct {
+    Obj obj;
     NativeFn function;
     const char* name;
-} NativeFunction;
+    uint8_t op;         // The NativeOp it performs on two arguments
+    bool pure;          // Same result for the same arguments and no effects, so calls may be folded
+} Native;
 
+// The compiled, immutable part of a function shared by all its closures
 typedef struct {
+    Obj obj;
     int arity;
-    List body;
-    List params;
+    List* form;         // The [fn [params] body...] expression it was made from
+    List* params;
+    Value* body;        // Body expressions, stored in form
+    int bodyCount;
+    Chunk* chunk;       // Compiled body, NULL until compiled
+    int capturesFrame;  // Whether the body creates closures, -1 until checked
+    uint32_t epoch;     // foldEpoch when the chunk and capturesFrame were derived
 } Function;
 
+struct Closure {
+    Obj obj;
+    Function* function;
+    Environment* env;   // Environment the function was created in
+    Memo* memo;         // Results by arguments for a closure made by memo, or NULL
+};
+
+// A channel as a value of this heap. The queue of messages it refers to is
+// shared with the other interpreters that hold the channel, see [chan].
+typedef struct {
+    Obj obj;
+    Queue* queue;
+} Channel;
+
+#ifdef NAN_BOXING
+
+// Doubles are stored as themselves. Every other value hides in the payload of
+// a quiet NaN: nil and booleans as small constants, heap objects and symbols
+// as 48-bit pointers with the sign bit set, told apart by SYMBOL_BIT, and
+// integers as 48-bit two's complement tagged with SYMBOL_BIT alone.
+#define SIGN_BIT    ((uint64_t)0x8000000000000000)
+#define QNAN        ((uint64_t)0x7ffc000000000000)
+#define SYMBOL_BIT  ((uint64_t)0x0001000000000000)
+
+#define INT_MASK    ((uint64_t)0x0000ffffffffffff)
+#define INT_SIGN    ((uint64_t)0x0000800000000000)
+
+#define TAG_NIL     1
+#define TAG_FALSE   2
+#define TAG_TRUE    3
+
+#define NIL_VAL     ((Value)(QNAN | TAG_NIL))
+#define FALSE_VAL   ((Value)(QNAN | TAG_FALSE))
+#define TRUE_VAL    ((Value)(QNAN | TAG_TRUE))
+
+#define IS_NIL(value)       ((value) == NIL_VAL)
+#define IS_BOOLEAN(value)   (((value) | 1) == TRUE_VAL)
+#define IS_DOUBLE(value)    (((value) & QNAN) != QNAN)
+#define IS_INT(value)       (((value) & (SIGN_BIT | QNAN | SYMBOL_BIT)) == (QNAN | SYMBOL_BIT))
+#define IS_NUMBER(value)    (IS_DOUBLE(value) || IS_INT(value))
+#define IS_OBJ(value)       (((value) & (SIGN_BIT | QNAN | SYMBOL_BIT)) == (SIGN_BIT | QNAN))
+#define IS_SYMBOL(value)    (((value) & (SIGN_BIT | QNAN | SYMBOL_BIT)) == (SIGN_BIT | QNAN | SYMBOL_BIT))
+
+#define AS_BOOLEAN(value)   ((value) == TRUE_VAL)
+#define AS_DOUBLE(value)    valueToNumber(value)
+#define AS_INT(value)       ((int64_t)(((value) & INT_MASK) ^ INT_SIGN) - (int64_t)INT_SIGN)
+#define AS_NUMBER(value)    (IS_INT(value) ? (double)AS_INT(value) : AS_DOUBLE(value))
+#define AS_OBJ(value)       ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+#define AS_SYMBOL(value)    ((Symbol*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN | SYMBOL_BIT)))
+
+#define OBJ_VAL(object)     ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object)))
+#define SYMBOL_VAL(symbol)  ((Value)(SIGN_BIT | QNAN | SYMBOL_BIT | (uint64_t)(uintptr_t)(symbol)))
+#define INT_VAL(integer)    ((Value)(QNAN | SYMBOL_BIT | ((uint64_t)(integer) & INT_MASK)))
+
+static inline double valueToNumber(Value value) {
+    double number;
+    memcpy(&number, &value, sizeof(Value));
+    return number;
+}
+
+static inline Value numberToValue(double number) {
+    Value value;
+    memcpy(&value, &number, sizeof(Value));
+    return value;
+}
+
+static inline bool isObjType(Value value, ObjType type) {
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#define IS_STRING(value)    isObjType(value, OBJ_STRING)
+#define IS_LIST(value)      isObjType(value, OBJ_LIST)
+#define IS_FUNCTION(value)  isObjType(value, OBJ_CLOSURE)
+#define IS_NATIVE(value)    isObjType(value, OBJ_NATIVE)
+#define IS_TASK(value)      isObjType(value, OBJ_TASK)
+#define IS_CHANNEL(value)   isObjType(value, OBJ_CHANNEL)
+#define IS_VECTOR(value)    isObjType(value, OBJ_VECTOR)
+
+static inline ValueType valueType(Value value) {
+    if (IS_DOUBLE(value)) return VAL_NUMBER;
+    if (IS_INT(value)) return VAL_INT;
+    if (IS_SYMBOL(value)) return VAL_SYMBOL;
+    if (IS_OBJ(value)) {
+        switch (AS_OBJ(value)->type) {
+            case OBJ_STRING: return VAL_STRING;
+            case OBJ_LIST: return VAL_LIST;
+            case OBJ_NATIVE: return VAL_NATIVE;
+            case OBJ_TASK: return VAL_TASK;
+            case OBJ_CHANNEL: return VAL_CHANNEL;
+            case OBJ_VECTOR: return VAL_VECTOR;
+            default: return VAL_FUNCTION;
+        }
+    }
+    return IS_NIL(value) ? VAL_NIL : VAL_BOOLEAN;
+}
+
+#else
+
 struct Value {
     ValueType type;
     union {
         bool boolean;
         double number;
-        char* string;
-        char* symbol;
-        List list;
-        Function function;
-        NativeFunction native;
+        int64_t integer;
+        Obj* obj;
+        Symbol* symbol;
     } as;
 };
 
-// Define nil value
-#define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
+#define NIL_VAL     ((Value){VAL_NIL, {.number = 0}})
+
+#define IS_NIL(value)       ((value).type == VAL_NIL)
+#define IS_BOOLEAN(value)   ((value).type == VAL_BOOLEAN)
+#define IS_DOUBLE(value)    ((value).type == VAL_NUMBER)
+#define IS_INT(value)       ((value).type == VAL_INT)
+#define IS_NUMBER(value)    (IS_DOUBLE(value) || IS_INT(value))
+#define IS_OBJ(value)       (((value).type >= VAL_STRING && (value).type <= VAL_NATIVE && \
+                              (value).type != VAL_SYMBOL) || (value).type >= VAL_TASK)
+#define IS_SYMBOL(value)    ((value).type == VAL_SYMBOL)
+#define IS_STRING(value)    ((value).type == VAL_STRING)
+#define IS_LIST(value)      ((value).type == VAL_LIST)
+#define IS_FUNCTION(value)  ((value).type == VAL_FUNCTION)
+#define IS_NATIVE(value)    ((value).type == VAL_NATIVE)
+#define IS_TASK(value)      ((value).type == VAL_TASK)
+#define IS_CHANNEL(value)   ((value).type == VAL_CHANNEL)
+#define IS_VECTOR(value)    ((value).type == VAL_VECTOR)
+
+#define AS_BOOLEAN(value)   ((value).as.boolean)
+#define AS_DOUBLE(value)    ((value).as.number)
+#define AS_INT(value)       ((value).as.integer)
+#define AS_NUMBER(value)    (IS_INT(value) ? (double)AS_INT(value) : AS_DOUBLE(value))
+#define AS_OBJ(value)       ((value).as.obj)
+#define AS_SYMBOL(value)    ((value).as.symbol)
+
+#define valueType(value)    ((value).type)
+
+#endif
+
+// Vectors are persistent lists: updating one makes a new version that
+// shares all but the changed path with the old. Items live in a trie of
+// nodes with VECTOR_WIDTH slots, and the last 1 to VECTOR_WIDTH items in a
+// tail node outside it, so appending mostly touches the tail.
+#define VECTOR_BITS 5
+#define VECTOR_WIDTH (1 << VECTOR_BITS)
+#define VECTOR_MASK (VECTOR_WIDTH - 1)
+
+typedef struct VectorNode {
+    Obj obj;
+    uint64_t edit;      // The transient that may change it in place, 0 for none
+    int count;          // Children or items in use
+    bool leaf;
+    union {
+        struct VectorNode* children[VECTOR_WIDTH];
+        Value items[VECTOR_WIDTH];
+    } as;
+} VectorNode;
+
+typedef struct {
+    Obj obj;
+    int count;
+    int shift;          // Index bits above a leaf's own, at the root
+    uint64_t edit;      // While being built as a transient, otherwise 0
+    VectorNode* root;
+    VectorNode* tail;
+} Vector;
+
+#define AS_STRING(value)    ((String*)AS_OBJ(value))
+#define AS_LIST(value)      ((List*)AS_OBJ(value))
+#define AS_CLOSURE(value)   ((Closure*)AS_OBJ(value))
+#define AS_NATIVE(value)    ((Native*)AS_OBJ(value))
+#define AS_TASK(value)      ((Task*)AS_OBJ(value))
+#define AS_CHANNEL(value)   ((Channel*)AS_OBJ(value))
+#define AS_VECTOR(value)    ((Vector*)AS_OBJ(value))
 
 // Utility functions
 Value makeNumber(double num);
+Value makeInt(int64_t integer);
 Value makeBoolean(bool value);
 Value makeString(const char* string);
+Value makeStringIn(Arena* arena, const char* chars, int length);
 Value makeSymbol(const char* symbol);
+Value makeSymbolValue(Symbol* symbol);
 Value makeList();
-Value makeFunction(int arity);
+Value makeListIn(Arena* arena, Value* items, int count);
+Value makeFunction(Function* function, Environment* env);
+Value closureValue(Closure* closure);
+Value listValue(List* list);
+Value taskValue(Task* task);
+Value channelValue(Channel* channel);
+Value vectorValue(Vector* vector);
+Environment* globalsOf(Value function);
 Value makeNative(NativeFn function, const char* name);
+Function* newFunction(List* form);
+bool createsClosure(Value expr);
+bool functionCapturesFrame(Function* function);
 
 // List functions
 void initList(List* list);
@@ -92,22 +409,166 @@ void appendToList(List* list, Value value);
 
 // Value functions
 void printValue(Value value);
-void freeValue(Value value);
-Value copyValue(Value value);
 bool valuesEqual(Value a, Value b);
+uint32_t hashValue(Value value);
+bool isTruthy(Value value);
+
+// Symbol table
+Symbol* internSymbol(const char* chars, int length);
+Symbol* internCString(const char* chars);
+void markSymbols();
+void freeSymbols();
+
+// The special form a list is, SPECIAL_NONE for calls
+static inline SpecialForm specialForm(List* list) {
+    if (list->count == 0 || !IS_SYMBOL(list->items[0])) return SPECIAL_NONE;
+    return (SpecialForm)AS_SYMBOL(list->items[0])->special;
+}
 
 // Environment
 typedef struct {
-    char* key;
+    Symbol* key;
     Value value;
 } Entry;
 
-typedef struct Environment {
+#define ENV_INLINE_ENTRIES 4
+
+struct Environment {
+    Obj obj;
     int count;
     int capacity;
-    Entry* entries;
-    struct Environment* enclosing;
-} Environment;
+    Entry* entries;     // inlineEntries, or an open-addressing table once hashed
+    bool hashed;
+    bool pooled;        // A reusable call frame that is not on the heap
+    Entry inlineEntries[ENV_INLINE_ENTRIES];
+    Environment* enclosing;
+};
+
+// Frames of functions that never create closures can't outlive their call,
+// so they come from a stack of reusable environments instead of the heap
+typedef struct {
+    Environment** frames;
+    int count;          // Frames in use
+    int capacity;       // Frames allocated so far
+} FramePool;
+
+// Calls may nest this deep before a stack overflow error, see --max-depth
+#define HEXA_DEFAULT_MAX_DEPTH 10000
+
+// Functions are compiled to machine code on this many calls, see --jit-threshold
+#define HEXA_JIT_THRESHOLD 100
+
+// Memoized functions keep this many results unless memo is given a size
+#define HEXA_MEMO_DEFAULT_SIZE 10000
+
+// Channels hold this many messages unless chan is given a capacity
+#define HEXA_CHANNEL_DEFAULT_CAPACITY 64
+
+// The JIT emits x86-64 code for the System V calling convention into mmap'd
+// memory and relies on 8-byte values, elsewhere functions stay in bytecode
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) && \
+    defined(NAN_BOXING) && !defined(HEXA_NO_JIT)
+#define HEXA_JIT
+#endif
+
+// Bytecode
+typedef enum {
+    OP_CONSTANT,        // Push constants[u16]
+    OP_NIL,             // Push nil
+    OP_GET_VARIABLE,    // Push value of the symbol constants[u16], searched by name
+    OP_GET_GLOBAL,      // Push value of the global constants[u16]
+    OP_DEFINE_GLOBAL,   // Bind the global constants[u16] to the top of the stack
+    OP_GET_LOCAL,       // Push frame slot u8, named constants[u16]
+    OP_GET_ENCLOSING,   // Push slot u8 of the frame u8 levels out, named constants[u16]
+    OP_DEFINE_LOCAL,    // Bind frame slot u8 named constants[u16] to the top of the stack
+    OP_SET_VARIABLE,    // Assign the top of the stack to the symbol constants[u16], searched by name
+    OP_SET_GLOBAL,      // Assign the top of the stack to the global constants[u16]
+    OP_SET_LOCAL,       // Assign the top of the stack to frame slot u8, named constants[u16]
+    OP_SET_ENCLOSING,   // Assign it to slot u8 of the frame u8 levels out, named constants[u16]
+    OP_CLOSURE,         // Push the function constants[u16] closed over the current frame
+    OP_PUSH_SCOPE,      // Enter a let scope of u8 slots, from the frame pool if u8 is set
+    OP_POP_SCOPE,       // Leave the innermost let scope
+    OP_POP,             // Discard the top of the stack
+    OP_DUP,             // Push the top of the stack again
+    OP_JUMP,            // Jump forward by u16
+    OP_JUMP_IF_FALSE,   // Pop the condition, jump forward by u16 if falsey
+    OP_LOOP,            // Jump backward by u16
+    OP_CALL,            // Call the value below u8 arguments
+    OP_TAIL_CALL,       // Like OP_CALL, but a function replaces the current frame
+    OP_CALL_BINARY,     // OP_CALL or OP_TAIL_CALL (the u8) of a NativeOp built-in with 2 arguments
+    OP_ERROR,           // Report the message constants[u16] and push nil
+    OP_RETURN           // Return the top of the stack to the caller
+} OpCode;
+
+// The value of the global named by a constant, as of globalsVersion version
+typedef struct {
+    uint32_t version;
+    Value value;
+} GlobalCache;
+
+struct Chunk {
+    int count;
+    int capacity;
+    uint8_t* code;
+    List constants;
+    GlobalCache* caches;    // One per constant, for OP_GET_GLOBAL
+    int slotCount;          // Frame size for function bodies
+    int calls;              // Calls of the function, counted until it is hot
+    JitCode* jit;           // Machine code for the function body, or NULL
+};
+
+// The VM's record of a running chunk
+typedef struct {
+    Closure* closure;   // NULL for top-level code
+    Chunk* chunk;
+    uint8_t* ip;
+    Environment* env;
+    int base;           // Stack index the frame's values start at
+} CallFrame;
+
+// A task's call frames, value stack and frame pool. They are swapped into
+// the VM while the task runs and kept here while it is suspended.
+typedef struct {
+    CallFrame* frames;
+    int frameCount;
+    int frameCapacity;
+    Value* stack;
+    int stackCount;
+    int stackCapacity;
+    FramePool pool;
+} TaskStack;
+
+typedef enum {
+    TASK_READY,         // In the run queue
+    TASK_RUNNING,
+    TASK_WAITING,       // Suspended in await until another task is done
+    TASK_DONE
+} TaskState;
+
+// A call running as a coroutine, see [spawn f args...]
+struct Task {
+    Obj obj;
+    TaskState state;
+    Value function;
+    List* args;         // Until the task starts
+    Environment* globals;   // The globals function runs with, NULL for natives
+    Value result;       // The function's result once done, or what await resumes with
+    bool started;
+    TaskStack stack;
+    Task* next;         // The next task in the run queue or the same waiters list
+    Task* waiters;      // Tasks waiting for this one to be done
+};
+
+// Runs the instruction at ip for machine code and returns the frame, which
+// natives it calls may have moved. Returns NULL, having done nothing, if the
+// instruction pushes a frame and the VM has to run it.
+typedef CallFrame* (*JitStep)(CallFrame* frame, uint8_t* ip);
+
+// What machine code needs from the VM
+typedef struct {
+    Value** stackTop;
+    JitStep step;
+} JitRuntime;
 
 // Function prototypes for lexer
 void initLexer(const char* source);
@@ -118,17 +579,287 @@ void initParser();
 Token getCurrentToken();
 Value parseExpression();
 Value parse(const char* source);
+void setParseArena(bool enabled);
+void markParserRoots();
+void freeParser();
 
 // Function prototypes for evaluator
 Value evaluate(Value expr, Environment* env);
 Environment* createEnvironment();
 Environment* createEnclosedEnvironment(Environment* enclosing);
-void defineVariable(Environment* env, const char* name, Value value);
-Value getVariable(Environment* env, const char* name);
-bool assignVariable(Environment* env, const char* name, Value value);
-void freeEnvironment(Environment* env);
+Environment* createFrame(Environment* enclosing, int slotCount);
+void initFramePool();
+Environment* acquireFrame(Environment* enclosing, int slotCount);
+void releaseFrame(Environment* env);
+void markFramePool();
+void freeFramePool();
+void swapFramePool(FramePool* saved);
+void markSavedFramePool(FramePool* saved);
+void freeSavedFramePool(FramePool* saved);
+void defineVariable(Environment* env, Symbol* name, Value value);
+Value getVariable(Environment* env, Symbol* name);
+bool lookupVariable(Environment* env, Symbol* name, Value* value);
+extern HEXA_THREAD_LOCAL uint32_t globalsVersion;
+bool assignVariable(Environment* env, Symbol* name, Value value);
 void initGlobalEnvironment(Environment* env);
 
+// Function prototypes for compiler
+Chunk* newChunk();
+void freeChunk(Chunk* chunk);
+Chunk* compile(Value expr);
+Chunk* compileFunction(Function* function);
+Chunk* compileGlobalFunction(Function* function);
+
+// Function prototypes for JIT
+JitCode* jitCompile(Chunk* chunk, const JitRuntime* runtime);
+void runJit(JitCode* jit, CallFrame* frame);
+void freeJitCode(JitCode* jit);
+
+// Function prototypes for macros
+Value expandMacros(Value expr);
+Value desugarForm(List* form);
+bool isDesugared(List* form);
+void markMacroRoots();
+void freeMacros();
+
+// Function prototypes for memoization
+Memo* newMemo(int arity, int capacity);
+Memo* newMemoLike(Memo* memo);
+void freeMemo(Memo* memo);
+void markMemo(Memo* memo);
+bool memoLookup(Memo* memo, Value* args, Value* result);
+void memoStore(Memo* memo, Value* args, Value result);
+Value nativeMemo(int argCount, Value* args);
+Value nativeMemoStats(int argCount, Value* args);
+
+// Function prototypes for tasks
+Value nativeSpawn(int argCount, Value* args);
+Value nativeYield(int argCount, Value* args);
+Value nativeAwait(int argCount, Value* args);
+bool maySuspend(Value callee);
+void blackenTask(Task* task);
+void freeTask(Task* task);
+void markTaskRoots();
+void freeTasks();
+
+// Function prototypes for vectors
+Value makeVector();
+Value vectorFromItems(Value* items, int count);
+Vector* beginTransient(Vector* vector);
+void transientAppend(Vector* transient, Value value);
+Value endTransient(Vector* transient);
+Value vectorGet(Vector* vector, int index);
+Value* vectorChunk(Vector* vector, int index);
+Value vectorToList(Vector* vector);
+Value nativeConj(int argCount, Value* args);
+Value nativeAssoc(int argCount, Value* args);
+Value nativeNth(int argCount, Value* args);
+Value nativePop(int argCount, Value* args);
+Value nativeConcat(int argCount, Value* args);
+Value nativeCount(int argCount, Value* args);
+
+// Function prototypes for channels
+Value nativeChan(int argCount, Value* args);
+Value nativeSend(int argCount, Value* args);
+Value nativeRecv(int argCount, Value* args);
+Value nativeSelect(int argCount, Value* args);
+Value nativeClose(int argCount, Value* args);
+Queue* newQueue(int capacity);
+void retainQueue(Queue* queue);
+void releaseQueue(Queue* queue);
+void closeQueue(Queue* queue);
+bool sendTo(Queue* queue, Value value);
+Value makeChannel(Queue* queue);
+void freeChannels();
+
+// Function prototypes for optimizer
+extern HEXA_THREAD_LOCAL uint32_t foldEpoch;
+Value optimize(Value expr, Environment* globals);
+void invalidateFolds();
+void refreshFunction(Function* function);
+void recordSourceForm(List* form, List* source);
+List* sourceForm(List* form);
+void markOptimizerRoots();
+void freeOptimizer();
+
+// Called before running a function, in case its form was restored since
+static inline void checkFoldEpoch(Function* function) {
+    if (function->epoch != foldEpoch) refreshFunction(function);
+}
+
+// Allocation counters for --alloc-stats
+typedef struct {
+    size_t allocations;     // Calls to reallocate that grew or created a block
+    size_t bytes;           // Bytes those calls added
+    size_t calls;           // Function calls, native or not
+    size_t callAllocations; // Allocations made while setting up calls
+} AllocStats;
+
+extern HEXA_THREAD_LOCAL AllocStats allocStats;
+
+// Function prototypes for memory management
+void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+Obj* allocateObject(size_t size, ObjType type);
+void initArena(Arena* arena);
+void beginArenaForm(Arena* arena);
+void* arenaAllocate(Arena* arena, size_t size);
+Obj* allocateArenaObject(Arena* arena, size_t size, ObjType type);
+Obj* asObject(Value value);
+void pushRoot(Value value);
+void pushEnvironmentRoot(Environment* env);
+void popRoots(int count);
+void markValue(Value value);
+void markObject(Obj* object);
+void collectGarbage();
+void collectGarbageIfNeeded();
+size_t heapBytesAllocated();
+void setGCInitialHeap(size_t bytes);
+void setGCGrowthFactor(double factor);
+void printGCStats();
+void printAllocStats();
+void freeObjects();
+
+// Inline cache and quickening counters for --ic-stats
+typedef struct {
+    size_t globalHits;      // Global lookups answered from a cache
+    size_t globalMisses;
+    size_t quickened;       // Calls rewritten to OP_CALL_BINARY
+    size_t binaryHits;      // OP_CALL_BINARY runs done inline on two integers
+    size_t binaryMisses;    // OP_CALL_BINARY runs that called the native
+    size_t deoptimized;     // OP_CALL_BINARY rewritten back for a new callee
+} CacheStats;
+
+extern HEXA_THREAD_LOCAL CacheStats cacheStats;
+
+// Function prototypes for virtual machine
+void initVM();
+Value interpret(Value expr, Environment* env);
+Value callFunction(Value callee, int argCount, Value* args, Environment* globals);
+void markVMRoots();
+void freeVM();
+bool resumeTask(Task* task);
+bool suspendTask();
+void markTaskStack(TaskStack* stack);
+void freeTaskStack(TaskStack* stack);
+void setMaxCallDepth(int depth);
+int maxCallDepth();
+void setJitEnabled(bool enabled);
+void setJitThreshold(int calls);
+void printCacheStats();
+
+// The result of op on a and b if both are integers and it can be computed
+// inline, otherwise false and the native has to run
+static inline bool binaryOnInts(NativeOp op, Value a, Value b, Value* result) {
+    if (!IS_INT(a) || !IS_INT(b)) return false;
+
+    int64_t x = AS_INT(a);
+    int64_t y = AS_INT(b);
+    switch (op) {
+        case NATIVE_OP_ADD: *result = makeInt(x + y); return true;
+        case NATIVE_OP_SUBTRACT: *result = makeInt(x - y); return true;
+        case NATIVE_OP_EQUAL: *result = makeBoolean(x == y); return true;
+        case NATIVE_OP_LESS: *result = makeBoolean(x < y); return true;
+        case NATIVE_OP_GREATER: *result = makeBoolean(x > y); return true;
+        case NATIVE_OP_LESS_EQUAL: *result = makeBoolean(x <= y); return true;
+        case NATIVE_OP_GREATER_EQUAL: *result = makeBoolean(x >= y); return true;
+        default: return false;
+    }
+}
+
+// The values of a running function in a program compiled by --emit-c
+typedef struct CompiledFrame {
+    Value* values;
+    int count;
+    struct CompiledFrame* previous;
+} CompiledFrame;
+
+extern HEXA_THREAD_LOCAL bool programUnwinding;
+
+// Function prototypes for the C emitter and the programs it generates
+bool emitProgram(const char* source, const char* path, Environment* globals, FILE* out);
+void programStart(Value* constants, int constantCount, Value* closures, int closureCount);
+int programFinish();
+void programRun(const char* source);
+void programResult(Value result);
+Value programQuote(const char* source);
+Value programClosure(Symbol* name);
+void programDefine(Symbol* name, Value value);
+Value programSet(Symbol* name, Value value);
+Value lookupProgramGlobal(GlobalCache* cache, Symbol* name);
+Value programCall(Value callee, int argCount, Value* args);
+bool programEnter(CompiledFrame* frame, Value* values, int count);
+void programLeave(CompiledFrame* frame);
+void markProgramFrames();
+
+// The global name, through a cache of its own
+static inline Value programGlobal(GlobalCache* cache, Symbol* name) {
+    if (cache->version == globalsVersion) return cache->value;
+    return lookupProgramGlobal(cache, name);
+}
+
+// A call of callee on a and b, inline when callee is the built-in for op
+static inline Value programBinary(Value callee, NativeOp op, Value a, Value b) {
+    Value result;
+    if (IS_NATIVE(callee) && AS_NATIVE(callee)->op == op && binaryOnInts(op, a, b, &result)) {
+        return result;
+    }
+    Value args[2] = {a, b};
+    return programCall(callee, 2, args);
+}
+
+// Whether callee is closure, so its compiled body can be called directly
+static inline bool isClosure(Value callee, Value closure) {
+    return IS_FUNCTION(callee) && IS_FUNCTION(closure) && AS_CLOSURE(callee) == AS_CLOSURE(closure);
+}
+
+// Function prototypes for evaluator
+void markEvaluatorRoots();
+void freeEvaluator();
+bool callNativeQuietly(Native* native, int argCount, Value* args, Value* result);
+
+// An interpreter with its own heap, symbols, VM and global environment. The
+// state of each lives in HEXA_THREAD_LOCAL variables, so a thread has at most
+// one HexaVM, made and used on that thread, and threads with one each run
+// in parallel without sharing anything.
+typedef struct HexaVM HexaVM;
+
+// Function prototypes for interpreters and the threads that run them
+HexaVM* newHexaVM();
+void freeHexaVM(HexaVM* hexa);
+Environment* hexaGlobals(HexaVM* hexa);
+void setTreeWalk(HexaVM* hexa, bool enabled);
+void setOptimize(HexaVM* hexa, bool enabled, bool dump);
+Value runForm(HexaVM* hexa, Value expr);
+Value runSource(HexaVM* hexa, const char* source, bool printResults);
+
+typedef struct HexaThread HexaThread;
+HexaThread* startThread(void (*body)(void* arg), void* arg);
+void joinThread(HexaThread* thread);
+void detachThread(HexaThread* thread);
+void yieldThread();
+void* allocateShared(size_t size);
+void* reallocateShared(void* memory, size_t size);
+
+typedef struct HexaLock HexaLock;
+typedef struct HexaCondition HexaCondition;
+HexaLock* newLock();
+void freeLock(HexaLock* lock);
+void acquireLock(HexaLock* lock);
+void releaseLock(HexaLock* lock);
+HexaCondition* newCondition();
+void freeCondition(HexaCondition* condition);
+void waitCondition(HexaCondition* condition, HexaLock* lock);
+void signalAll(HexaCondition* condition);
+int processorCount();
+
+// Function prototypes for parallel map and reduce, and actors
+void setThreadCount(int count);
+int threadCount();
+Value nativePmap(int argCount, Value* args);
+Value nativePreduce(int argCount, Value* args);
+Value nativeActor(int argCount, Value* args);
+void freeWorkers();
+
 // Error handling
 void error(const char* message);
 void runtimeError(const char* format, ...);
@@ -0,0 +1,712 @@
+#include "../include/hexa.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// [chan capacity] makes a channel, a bounded queue of messages that any
+// number of interpreters, on any threads, send to with [send ch value] and
+// receive from with [recv ch]. send waits while the channel is full and recv
+// while it is empty, and [select ch...] receives from whichever of several
+// channels has a message first. [close ch] ends a channel: sends to it fail,
+// and once it is empty, receives from it are nil.
+//
+// Interpreters don't share heaps, so a message is a copy of the value sent.
+// Nil, booleans and numbers travel in the queue as they are. Other values are
+// written to a buffer that the receiver reads back into its own heap, and a
+// channel in them refers to the same queue, so a message can carry a channel
+// to reply on. Functions and tasks can't be sent.
+//
+// The queue is a ring of cells, each with a sequence number that tells
+// senders and receivers whose turn it is to use it (Vyukov's bounded MPMC
+// queue), so sending and receiving take no lock. A thread that has to wait
+// spins a while if other processors may make progress, then lets the other
+// threads run once, and only then sleeps until a receiver makes room or a
+// sender sends. Sleeping and waking take system calls, and yielding first
+// lets a thread on the same processor fill or empty the queue a batch at a
+// time.
+
+// Channels hold at most this many messages
+#define CHANNEL_MAX_CAPACITY (1 << 24)
+
+// Tries to send or receive before sleeping, when there are other processors
+#define SPINS 1000
+
+#define CACHE_LINE 64
+
+// Atomic operations on memory that threads share. Loads acquire, stores
+// release and the rest are sequentially consistent.
+#ifdef _MSC_VER
+static inline int64_t loadAcquire(int64_t* address) {
+    return _InterlockedCompareExchange64((volatile long long*)address, 0, 0);
+}
+
+static inline void storeRelease(int64_t* address, int64_t value) {
+    _InterlockedExchange64((volatile long long*)address, value);
+}
+
+static inline bool compareAndSwap(int64_t* address, int64_t expected, int64_t desired) {
+    return _InterlockedCompareExchange64((volatile long long*)address, desired, expected) == expected;
+}
+
+static inline int loadInt(int* address) {
+    return _InterlockedCompareExchange((volatile long*)address, 0, 0);
+}
+
+static inline void storeInt(int* address, int value) {
+    _InterlockedExchange((volatile long*)address, value);
+}
+
+static inline int addInt(int* address, int delta) {
+    return _InterlockedExchangeAdd((volatile long*)address, delta) + delta;
+}
+#else
+static inline int64_t loadAcquire(int64_t* address) {
+    return __atomic_load_n(address, __ATOMIC_ACQUIRE);
+}
+
+static inline void storeRelease(int64_t* address, int64_t value) {
+    __atomic_store_n(address, value, __ATOMIC_RELEASE);
+}
+
+static inline bool compareAndSwap(int64_t* address, int64_t expected, int64_t desired) {
+    return __atomic_compare_exchange_n(address, &expected, desired, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+}
+
+static inline int loadInt(int* address) {
+    return __atomic_load_n(address, __ATOMIC_SEQ_CST);
+}
+
+static inline void storeInt(int* address, int value) {
+    __atomic_store_n(address, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int addInt(int* address, int delta) {
+    return __atomic_add_fetch(address, delta, __ATOMIC_SEQ_CST);
+}
+#endif
+
+// A slot of the ring. A sender may fill it when sequence is its position,
+// and a receiver empty it when sequence is its position + 1.
+typedef struct {
+    int64_t sequence;
+    Value value;        // The message, when it needs no buffer
+    uint8_t* message;   // The buffer the message was written to, or NULL
+} Cell;
+
+// A thread sleeping until a channel it waits on changes
+typedef struct {
+    HexaLock* lock;
+    HexaCondition* condition;
+    bool woken;
+} Waiter;
+
+// A waiter in one queue's list of waiters
+typedef struct WaitNode {
+    Waiter* waiter;
+    struct WaitNode* next;
+    bool listed;        // Still on the list, not yet taken off by a wakeup
+} WaitNode;
+
+struct Queue {
+    // Senders and receivers move these on, each on a cache line of its own
+    int64_t sendPosition;
+    char sendPadding[CACHE_LINE - sizeof(int64_t)];
+    int64_t receivePosition;
+    char receivePadding[CACHE_LINE - sizeof(int64_t)];
+
+    Cell* cells;
+    int64_t capacity;       // A power of two
+    int references;         // Channels and unreceived messages referring to it
+    int closed;
+    HexaLock* lock;         // Guards the lists of waiters
+    WaitNode* receivers;    // Threads waiting for a message
+    WaitNode* senders;      // Threads waiting for room
+    int receiversWaiting;   // The length of each list, read without the lock
+    int sendersWaiting;
+};
+
+static HEXA_THREAD_LOCAL Waiter* waiter;
+static HEXA_THREAD_LOCAL int spins = -1;
+static HEXA_THREAD_LOCAL unsigned selectTurn;
+
+// A queue for capacity messages, rounded up to a power of two, that one
+// channel refers to
+Queue* newQueue(int capacity) {
+    int64_t size = 2;
+    while (size < capacity) size *= 2;
+
+    Queue* queue = allocateShared(sizeof(Queue));
+    memset(queue, 0, sizeof(Queue));
+    queue->cells = allocateShared(sizeof(Cell) * size);
+    for (int64_t i = 0; i < size; i++) {
+        queue->cells[i].sequence = i;
+        queue->cells[i].message = NULL;
+    }
+    queue->capacity = size;
+    queue->references = 1;
+    queue->lock = newLock();
+    return queue;
+}
+
+static bool tryPush(Queue* queue, Value value, uint8_t* message) {
+    int64_t position = loadAcquire(&queue->sendPosition);
+    for (;;) {
+        Cell* cell = &queue->cells[position & (queue->capacity - 1)];
+        int64_t difference = loadAcquire(&cell->sequence) - position;
+        if (difference == 0) {
+            if (compareAndSwap(&queue->sendPosition, position, position + 1)) {
+                cell->value = value;
+                cell->message = message;
+                storeRelease(&cell->sequence, position + 1);
+                return true;
+            }
+        } else if (difference < 0) {
+            // The cell still holds the message from a lap ago: full
+            return false;
+        }
+        position = loadAcquire(&queue->sendPosition);
+    }
+}
+
+static bool tryPop(Queue* queue, Value* value, uint8_t** message) {
+    int64_t position = loadAcquire(&queue->receivePosition);
+    for (;;) {
+        Cell* cell = &queue->cells[position & (queue->capacity - 1)];
+        int64_t difference = loadAcquire(&cell->sequence) - (position + 1);
+        if (difference == 0) {
+            if (compareAndSwap(&queue->receivePosition, position, position + 1)) {
+                *value = cell->value;
+                *message = cell->message;
+                storeRelease(&cell->sequence, position + queue->capacity);
+                return true;
+            }
+        } else if (difference < 0) {
+            // Nothing has been sent to the cell yet: empty
+            return false;
+        }
+        position = loadAcquire(&queue->receivePosition);
+    }
+}
+
+// Waiting
+
+static Waiter* thisWaiter() {
+    if (waiter == NULL) {
+        waiter = allocateShared(sizeof(Waiter));
+        waiter->lock = newLock();
+        waiter->condition = newCondition();
+        waiter->woken = false;
+    }
+    return waiter;
+}
+
+static int spinLimit() {
+    if (spins == -1) spins = processorCount() > 1 ? SPINS : 0;
+    return spins;
+}
+
+static void wake(Waiter* sleeper) {
+    acquireLock(sleeper->lock);
+    sleeper->woken = true;
+    signalAll(sleeper->condition);
+    releaseLock(sleeper->lock);
+}
+
+// Wake every thread waiting on list, after a change to the queue, taking
+// them off the list so the next change needn't. A thread counts itself in
+// waiting before it looks at the queue for the last time, and reading the
+// count with an atomic add orders the two: either the thread sees the
+// change, or it is on the list by now.
+static void wakeAll(Queue* queue, WaitNode** list, int* waiting) {
+    if (addInt(waiting, 0) == 0) return;
+
+    acquireLock(queue->lock);
+    while (*list != NULL) {
+        WaitNode* node = *list;
+        *list = node->next;
+        node->listed = false;
+        addInt(waiting, -1);
+        wake(node->waiter);
+    }
+    releaseLock(queue->lock);
+}
+
+static void startWaiting(Queue* queue, WaitNode* node, bool sending) {
+    WaitNode** list = sending ? &queue->senders : &queue->receivers;
+    acquireLock(queue->lock);
+    node->waiter = thisWaiter();
+    node->next = *list;
+    node->listed = true;
+    *list = node;
+    addInt(sending ? &queue->sendersWaiting : &queue->receiversWaiting, 1);
+    releaseLock(queue->lock);
+}
+
+static void stopWaiting(Queue* queue, WaitNode* node, bool sending) {
+    WaitNode** list = sending ? &queue->senders : &queue->receivers;
+    acquireLock(queue->lock);
+    if (node->listed) {
+        while (*list != node) list = &(*list)->next;
+        *list = node->next;
+        addInt(sending ? &queue->sendersWaiting : &queue->receiversWaiting, -1);
+    }
+    releaseLock(queue->lock);
+}
+
+// Forget wakeups from before, when this thread waited on other queues
+static void resetWaiter() {
+    Waiter* self = thisWaiter();
+    acquireLock(self->lock);
+    self->woken = false;
+    releaseLock(self->lock);
+}
+
+static void sleepUntilWoken() {
+    Waiter* self = thisWaiter();
+    acquireLock(self->lock);
+    while (!self->woken) {
+        waitCondition(self->condition, self->lock);
+    }
+    self->woken = false;
+    releaseLock(self->lock);
+}
+
+// Messages
+
+typedef enum {
+    MESSAGE_VALUE,      // A value that needs no heap, as it is
+    MESSAGE_STRING,     // Length, then the characters
+    MESSAGE_SYMBOL,     // Likewise, interned by the receiver
+    MESSAGE_LIST,       // Count, then the items
+    MESSAGE_VECTOR,     // Likewise
+    MESSAGE_CHANNEL     // A queue, with a reference the message holds
+} MessageTag;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+    const char* error;  // Why the value can't be sent, or NULL
+} Writer;
+
+static void writeBytes(Writer* writer, const void* bytes, size_t count) {
+    if (writer->count + count > writer->capacity) {
+        if (writer->capacity < 64) writer->capacity = 64;
+        while (writer->count + count > writer->capacity) writer->capacity *= 2;
+        writer->bytes = reallocateShared(writer->bytes, writer->capacity);
+    }
+    memcpy(writer->bytes + writer->count, bytes, count);
+    writer->count += count;
+}
+
+static void writeTag(Writer* writer, MessageTag tag) {
+    uint8_t byte = (uint8_t)tag;
+    writeBytes(writer, &byte, 1);
+}
+
+static void writeInt(Writer* writer, int32_t number) {
+    writeBytes(writer, &number, sizeof(number));
+}
+
+static void writeValue(Writer* writer, Value value) {
+    if (IS_SYMBOL(value)) {
+        writeTag(writer, MESSAGE_SYMBOL);
+        writeInt(writer, AS_SYMBOL(value)->length);
+        writeBytes(writer, AS_SYMBOL(value)->chars, AS_SYMBOL(value)->length);
+    } else if (!IS_OBJ(value)) {
+        writeTag(writer, MESSAGE_VALUE);
+        writeBytes(writer, &value, sizeof(Value));
+    } else if (IS_STRING(value)) {
+        writeTag(writer, MESSAGE_STRING);
+        writeInt(writer, AS_STRING(value)->length);
+        writeBytes(writer, AS_STRING(value)->chars, AS_STRING(value)->length);
+    } else if (IS_LIST(value)) {
+        List* list = AS_LIST(value);
+        writeTag(writer, MESSAGE_LIST);
+        writeInt(writer, list->count);
+        for (int i = 0; i < list->count; i++) {
+            writeValue(writer, list->items[i]);
+        }
+    } else if (IS_VECTOR(value)) {
+        Vector* vector = AS_VECTOR(value);
+        writeTag(writer, MESSAGE_VECTOR);
+        writeInt(writer, vector->count);
+        for (int i = 0; i < vector->count; i++) {
+            writeValue(writer, vectorGet(vector, i));
+        }
+    } else if (IS_CHANNEL(value)) {
+        Queue* queue = AS_CHANNEL(value)->queue;
+        retainQueue(queue);
+        writeTag(writer, MESSAGE_CHANNEL);
+        writeBytes(writer, &queue, sizeof(Queue*));
+    } else {
+        // Keep the message whole so its channels can be released
+        writer->error = IS_TASK(value) ? "Cannot send a task." : "Cannot send a function.";
+        writeValue(writer, NIL_VAL);
+    }
+}
+
+static int32_t readInt(const uint8_t** cursor) {
+    int32_t number;
+    memcpy(&number, *cursor, sizeof(number));
+    *cursor += sizeof(number);
+    return number;
+}
+
+// The value at cursor, made in this heap. Allocating never collects, so the
+// parts made so far stay alive.
+static Value readValue(const uint8_t** cursor) {
+    MessageTag tag = (MessageTag)*(*cursor)++;
+    switch (tag) {
+        case MESSAGE_VALUE: {
+            Value value;
+            memcpy(&value, *cursor, sizeof(Value));
+            *cursor += sizeof(Value);
+            return value;
+        }
+        case MESSAGE_STRING:
+        case MESSAGE_SYMBOL: {
+            int length = readInt(cursor);
+            const char* chars = (const char*)*cursor;
+            *cursor += length;
+            return tag == MESSAGE_STRING ? makeStringIn(NULL, chars, length)
+                                         : makeSymbolValue(internSymbol(chars, length));
+        }
+        case MESSAGE_LIST: {
+            int count = readInt(cursor);
+            Value value = makeList();
+            List* list = AS_LIST(value);
+            if (count > 0) {
+                list->items = reallocate(NULL, 0, sizeof(Value) * count);
+                list->capacity = count;
+            }
+            while (list->count < count) {
+                list->items[list->count] = readValue(cursor);
+                list->count++;
+            }
+            return value;
+        }
+        case MESSAGE_VECTOR: {
+            int count = readInt(cursor);
+            Vector* transient = beginTransient(NULL);
+            for (int i = 0; i < count; i++) {
+                transientAppend(transient, readValue(cursor));
+            }
+            return endTransient(transient);
+        }
+        case MESSAGE_CHANNEL: {
+            Queue* queue;
+            memcpy(&queue, *cursor, sizeof(Queue*));
+            *cursor += sizeof(Queue*);
+            return makeChannel(queue);
+        }
+    }
+    return NIL_VAL;
+}
+
+// Skip the value at cursor, releasing the queues in it
+static void dropValue(const uint8_t** cursor) {
+    MessageTag tag = (MessageTag)*(*cursor)++;
+    switch (tag) {
+        case MESSAGE_VALUE:
+            *cursor += sizeof(Value);
+            break;
+        case MESSAGE_STRING:
+        case MESSAGE_SYMBOL: {
+            int length = readInt(cursor);
+            *cursor += length;
+            break;
+        }
+        case MESSAGE_LIST:
+        case MESSAGE_VECTOR: {
+            int count = readInt(cursor);
+            for (int i = 0; i < count; i++) {
+                dropValue(cursor);
+            }
+            break;
+        }
+        case MESSAGE_CHANNEL: {
+            Queue* queue;
+            memcpy(&queue, *cursor, sizeof(Queue*));
+            *cursor += sizeof(Queue*);
+            releaseQueue(queue);
+            break;
+        }
+    }
+}
+
+// Free a message nobody will receive
+static void dropMessage(uint8_t* message) {
+    if (message == NULL) return;
+    const uint8_t* cursor = message;
+    dropValue(&cursor);
+    free(message);
+}
+
+// Turn value into a message for a cell: itself, or written to *message
+static bool encode(Value* value, uint8_t** message) {
+    *message = NULL;
+    if (!IS_OBJ(*value) && !IS_SYMBOL(*value)) return true;
+
+    Writer writer = {NULL, 0, 0, NULL};
+    writeValue(&writer, *value);
+    if (writer.error != NULL) {
+        dropMessage(writer.bytes);
+        runtimeError("%s", writer.error);
+        return false;
+    }
+    *message = writer.bytes;
+    *value = NIL_VAL;
+    return true;
+}
+
+// The value a cell held, in this heap
+static Value decode(Value value, uint8_t* message) {
+    if (message == NULL) return value;
+    const uint8_t* cursor = message;
+    value = readValue(&cursor);
+    free(message);
+    return value;
+}
+
+// Sending and receiving
+
+// Put the message in queue, waiting while it is full. False if the queue
+// is closed, leaving the message to the caller.
+static bool sendMessage(Queue* queue, Value value, uint8_t* message) {
+    for (;;) {
+        for (int spin = spinLimit() + 1; spin >= 0; spin--) {
+            if (loadInt(&queue->closed)) return false;
+            if (tryPush(queue, value, message)) {
+                wakeAll(queue, &queue->receivers, &queue->receiversWaiting);
+                return true;
+            }
+            if (spin == 1) yieldThread();
+        }
+
+        WaitNode node;
+        resetWaiter();
+        startWaiting(queue, &node, true);
+        bool closed = loadInt(&queue->closed);
+        bool sent = !closed && tryPush(queue, value, message);
+        if (!closed && !sent) sleepUntilWoken();
+        stopWaiting(queue, &node, true);
+        if (sent) {
+            wakeAll(queue, &queue->receivers, &queue->receiversWaiting);
+            return true;
+        }
+    }
+}
+
+// Send value to queue. False if it is closed or the value can't be sent.
+bool sendTo(Queue* queue, Value value) {
+    uint8_t* message;
+    if (!encode(&value, &message)) return false;
+    if (sendMessage(queue, value, message)) return true;
+    dropMessage(message);
+    return false;
+}
+
+// Take a message from the first of count queues, starting at first, that
+// has one
+static bool takeAny(Queue** queues, int count, int first, Value* value, uint8_t** message) {
+    for (int i = 0; i < count; i++) {
+        int index = (first + i) % count;
+        if (tryPop(queues[index], value, message)) {
+            wakeAll(queues[index], &queues[index]->senders, &queues[index]->sendersWaiting);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool allClosed(Queue** queues, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!loadInt(&queues[i]->closed)) return false;
+    }
+    return true;
+}
+
+// Take a message from whichever of count queues has one first, waiting
+// while none has. False once they are all closed and empty.
+static bool receive(Queue** queues, int count, Value* value, uint8_t** message) {
+    // Start at a different queue each time so none is starved
+    int first = (int)(selectTurn++ % (unsigned)count);
+    WaitNode local[8];
+    WaitNode* nodes = count <= 8 ? local : allocateShared(sizeof(WaitNode) * count);
+
+    bool received;
+    for (;;) {
+        received = false;
+        for (int spin = spinLimit() + 1; spin >= 0 && !received; spin--) {
+            received = takeAny(queues, count, first, value, message);
+            if (!received && spin == 1) yieldThread();
+        }
+        if (received) break;
+
+        // Messages sent before the queues were closed are still received
+        if (allClosed(queues, count)) {
+            received = takeAny(queues, count, first, value, message);
+            break;
+        }
+
+        resetWaiter();
+        for (int i = 0; i < count; i++) {
+            startWaiting(queues[i], &nodes[i], false);
+        }
+        received = takeAny(queues, count, first, value, message);
+        if (!received && !allClosed(queues, count)) sleepUntilWoken();
+        for (int i = 0; i < count; i++) {
+            stopWaiting(queues[i], &nodes[i], false);
+        }
+        if (received) break;
+    }
+
+    if (nodes != local) free(nodes);
+    return received;
+}
+
+void retainQueue(Queue* queue) {
+    addInt(&queue->references, 1);
+}
+
+// Drop a reference to queue, freeing it and the messages it still holds
+// after the last
+void releaseQueue(Queue* queue) {
+    if (addInt(&queue->references, -1) > 0) return;
+
+    Value value;
+    uint8_t* message;
+    while (tryPop(queue, &value, &message)) {
+        dropMessage(message);
+    }
+    free(queue->cells);
+    freeLock(queue->lock);
+    free(queue);
+}
+
+// Refuse sends from now on and wake every thread waiting on queue
+void closeQueue(Queue* queue) {
+    storeInt(&queue->closed, 1);
+    wakeAll(queue, &queue->receivers, &queue->receiversWaiting);
+    wakeAll(queue, &queue->senders, &queue->sendersWaiting);
+}
+
+// A channel of this heap for queue, taking over a reference the caller holds
+Value makeChannel(Queue* queue) {
+    Channel* channel = (Channel*)allocateObject(sizeof(Channel), OBJ_CHANNEL);
+    channel->queue = queue;
+    return channelValue(channel);
+}
+
+// Free this thread's waiter once its interpreter is freed
+void freeChannels() {
+    if (waiter == NULL) return;
+    freeLock(waiter->lock);
+    freeCondition(waiter->condition);
+    free(waiter);
+    waiter = NULL;
+}
+
+static bool checkChannel(Value value) {
+    if (!IS_CHANNEL(value)) {
+        runtimeError("Expected a channel.");
+        return false;
+    }
+    return true;
+}
+
+// [chan] or [chan capacity]
+Value nativeChan(int argCount, Value* args) {
+    if (argCount > 1) {
+        runtimeError("Expected 0 or 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+
+    int capacity = HEXA_CHANNEL_DEFAULT_CAPACITY;
+    if (argCount == 1) {
+        if (!IS_INT(args[0]) || AS_INT(args[0]) < 1 || AS_INT(args[0]) > CHANNEL_MAX_CAPACITY) {
+            runtimeError("Channel capacity must be an integer from 1 to %d.", CHANNEL_MAX_CAPACITY);
+            return NIL_VAL;
+        }
+        capacity = (int)AS_INT(args[0]);
+    }
+    return makeChannel(newQueue(capacity));
+}
+
+// [send ch value] is true once the value is sent, false if ch is closed
+Value nativeSend(int argCount, Value* args) {
+    if (argCount != 2) {
+        runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!checkChannel(args[0])) return NIL_VAL;
+
+    Value value = args[1];
+    uint8_t* message;
+    if (!encode(&value, &message)) return NIL_VAL;
+    if (sendMessage(AS_CHANNEL(args[0])->queue, value, message)) return makeBoolean(true);
+    dropMessage(message);
+    return makeBoolean(false);
+}
+
+// [recv ch] is the next message, or nil once ch is closed and empty
+Value nativeRecv(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!checkChannel(args[0])) return NIL_VAL;
+
+    Queue* queue = AS_CHANNEL(args[0])->queue;
+    Value value;
+    uint8_t* message;
+    if (!receive(&queue, 1, &value, &message)) return NIL_VAL;
+    return decode(value, message);
+}
+
+// [select ch...] or [select channels] is the next message of whichever of
+// the channels has one first, or nil once they are all closed and empty
+Value nativeSelect(int argCount, Value* args) {
+    // The list replaces the vector among the arguments, which keep it alive
+    if (argCount == 1 && IS_VECTOR(args[0])) args[0] = vectorToList(AS_VECTOR(args[0]));
+
+    Value* channels = args;
+    int count = argCount;
+    if (argCount == 1 && IS_LIST(args[0])) {
+        channels = AS_LIST(args[0])->items;
+        count = AS_LIST(args[0])->count;
+    }
+    if (count == 0) {
+        runtimeError("Expected at least 1 channel.");
+        return NIL_VAL;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!checkChannel(channels[i])) return NIL_VAL;
+    }
+
+    Queue* local[8];
+    Queue** queues = count <= 8 ? local : allocateShared(sizeof(Queue*) * count);
+    for (int i = 0; i < count; i++) {
+        queues[i] = AS_CHANNEL(channels[i])->queue;
+    }
+    Value value;
+    uint8_t* message;
+    bool received = receive(queues, count, &value, &message);
+    if (queues != local) free(queues);
+    return received ? decode(value, message) : NIL_VAL;
+}
+
+// [close ch]
+Value nativeClose(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!checkChannel(args[0])) return NIL_VAL;
+
+    closeQueue(AS_CHANNEL(args[0])->queue);
+    return NIL_VAL;
+}
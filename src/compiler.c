@@ -0,0 +1,739 @@
+#include "../include/hexa.h"
+#include <stdarg.h>
+
+#define SLOTS_MAX (UINT8_MAX + 1)
+
+// One compiler per function body being compiled, linked to the compiler of
+// the enclosing body. Parameters and every name the body defines get a fixed
+// slot, so references resolve to (depth, slot) pairs here instead of being
+// searched for by name at runtime.
+typedef struct Compiler {
+    struct Compiler* enclosing;
+    Chunk* chunk;
+    Function* function;     // NULL for top-level code, whose definitions are globals
+    bool scope;             // A let body, sharing the chunk of the enclosing compiler
+    Symbol* slots[SLOTS_MAX];
+    int slotCount;
+    bool slotsFull;         // Whether a name got no slot for want of room
+
+    // For the scope of a loop, its bindings and where its body starts. In
+    // a loop body tail position means the tail of the loop, where a recur
+    // jumps back to the start instead of returning.
+    List* loopBindings;
+    int loopStart;
+
+    const char* error;      // Why the chunk's code can't run as compiled, or NULL
+} Compiler;
+
+// Special forms compile through a table indexed by their symbol's tag
+typedef void (*CompileSpecialFn)(Compiler* compiler, List* form, bool tail);
+
+// Forward declarations
+static void compileExpression(Compiler* compiler, Value expr, bool tail);
+
+Chunk* newChunk() {
+    Chunk* chunk = reallocate(NULL, 0, sizeof(Chunk));
+    chunk->count = 0;
+    chunk->capacity = 0;
+    chunk->code = NULL;
+    initList(&chunk->constants);
+    chunk->caches = NULL;
+    chunk->slotCount = 0;
+    chunk->calls = 0;
+    chunk->jit = NULL;
+    return chunk;
+}
+
+// Constants are heap values in their own right, the collector frees them
+void freeChunk(Chunk* chunk) {
+    if (chunk->jit != NULL) freeJitCode(chunk->jit);
+    reallocate(chunk->caches, sizeof(GlobalCache) * chunk->constants.count, 0);
+    freeList(&chunk->constants);
+    reallocate(chunk->code, chunk->capacity, 0);
+    reallocate(chunk, sizeof(Chunk), 0);
+}
+
+static void emitByte(Compiler* compiler, uint8_t byte) {
+    Chunk* chunk = compiler->chunk;
+    if (chunk->capacity < chunk->count + 1) {
+        int oldCapacity = chunk->capacity;
+        chunk->capacity = oldCapacity < 8 ? 8 : oldCapacity * 2;
+        chunk->code = reallocate(chunk->code, oldCapacity, chunk->capacity);
+    }
+
+    chunk->code[chunk->count] = byte;
+    chunk->count++;
+}
+
+static void emitShort(Compiler* compiler, uint16_t value) {
+    emitByte(compiler, (value >> 8) & 0xff);
+    emitByte(compiler, value & 0xff);
+}
+
+// Code that can't be encoded, like a jump further than its offset reaches,
+// fails the whole chunk. endCompiler replaces it by code reporting error,
+// so bytecode that would run wrong never runs.
+static void failChunk(Compiler* compiler, const char* error) {
+    while (compiler->scope) compiler = compiler->enclosing;
+    if (compiler->error == NULL) compiler->error = error;
+}
+
+static int addConstant(Compiler* compiler, Value constant) {
+    List* constants = &compiler->chunk->constants;
+    if (constants->count > UINT16_MAX) {
+        failChunk(compiler, "Too many constants in one chunk.");
+        return 0;
+    }
+
+    appendToList(constants, constant);
+    return constants->count - 1;
+}
+
+static void emitWithConstant(Compiler* compiler, OpCode op, Value constant) {
+    int index = addConstant(compiler, constant);
+    emitByte(compiler, op);
+    emitShort(compiler, (uint16_t)index);
+}
+
+// Malformed special forms are reported when they run, like the tree-walker does
+static void emitError(Compiler* compiler, const char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    emitWithConstant(compiler, OP_ERROR, makeString(message));
+}
+
+static int emitJump(Compiler* compiler, OpCode op) {
+    emitByte(compiler, op);
+    emitShort(compiler, 0xffff);
+    return compiler->chunk->count - 2;
+}
+
+static void patchJump(Compiler* compiler, int offset) {
+    Chunk* chunk = compiler->chunk;
+
+    // -2 to adjust for the jump offset itself
+    int jump = chunk->count - offset - 2;
+    if (jump > UINT16_MAX) {
+        failChunk(compiler, "Too much code to jump over.");
+    }
+
+    chunk->code[offset] = (jump >> 8) & 0xff;
+    chunk->code[offset + 1] = jump & 0xff;
+}
+
+static int findSlot(Compiler* compiler, Symbol* name) {
+    for (int i = 0; i < compiler->slotCount; i++) {
+        if (compiler->slots[i] == name) return i;
+    }
+    return -1;
+}
+
+static void addSlot(Compiler* compiler, Symbol* name) {
+    if (findSlot(compiler, name) != -1) return;
+    if (compiler->slotCount == SLOTS_MAX) {
+        compiler->slotsFull = true;
+        return;
+    }
+    compiler->slots[compiler->slotCount++] = name;
+}
+
+// Give every name defined in a function body a slot. Nested fn bodies and
+// let, loop and dotimes scopes get their own environments, so they are
+// skipped here.
+static void collectLocals(Compiler* compiler, Value expr) {
+    if (!IS_LIST(expr)) return;
+
+    List* list = AS_LIST(expr);
+    SpecialForm special = specialForm(list);
+    if (special == SPECIAL_FN || special == SPECIAL_LET || special == SPECIAL_LOOP ||
+        special == SPECIAL_DOTIMES) {
+        return;
+    }
+
+    if (special == SPECIAL_DEF && list->count == 3 && IS_SYMBOL(list->items[1])) {
+        addSlot(compiler, AS_SYMBOL(list->items[1]));
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        collectLocals(compiler, list->items[i]);
+    }
+}
+
+static void initCompiler(Compiler* compiler, Compiler* enclosing, Function* function) {
+    compiler->enclosing = enclosing;
+    compiler->chunk = newChunk();
+    compiler->function = function;
+    compiler->scope = false;
+    compiler->slotCount = 0;
+    compiler->slotsFull = false;
+    compiler->loopBindings = NULL;
+    compiler->error = NULL;
+
+    if (function == NULL) return;
+
+    for (int i = 0; i < function->params->count; i++) {
+        addSlot(compiler, AS_SYMBOL(function->params->items[i]));
+    }
+    for (int i = 0; i < function->bodyCount; i++) {
+        collectLocals(compiler, function->body[i]);
+    }
+    if (compiler->slotsFull) failChunk(compiler, "Too many local variables in function.");
+}
+
+// Push the value of name, or with assign set name to the top of the stack
+static void compileVariable(Compiler* compiler, Symbol* name, bool assign) {
+    int nameConstant = addConstant(compiler, makeSymbolValue(name));
+
+    int depth = 0;
+    for (Compiler* current = compiler; current != NULL; current = current->enclosing) {
+        if (current->function == NULL && !current->scope) {
+            // Reached top-level code: the name is a global
+            emitByte(compiler, assign ? OP_SET_GLOBAL : OP_GET_GLOBAL);
+            emitShort(compiler, (uint16_t)nameConstant);
+            return;
+        }
+
+        int slot = findSlot(current, name);
+        if (slot != -1) {
+            if (depth == 0) {
+                emitByte(compiler, assign ? OP_SET_LOCAL : OP_GET_LOCAL);
+            } else {
+                emitByte(compiler, assign ? OP_SET_ENCLOSING : OP_GET_ENCLOSING);
+                emitByte(compiler, (uint8_t)depth);
+            }
+            emitByte(compiler, (uint8_t)slot);
+            emitShort(compiler, (uint16_t)nameConstant);
+            return;
+        }
+
+        depth++;
+    }
+
+    // A function compiled on its own, outside of the code that created it:
+    // its enclosing scopes are unknown, so search for the name at runtime
+    emitByte(compiler, assign ? OP_SET_VARIABLE : OP_GET_VARIABLE);
+    emitShort(compiler, (uint16_t)nameConstant);
+}
+
+static Chunk* endCompiler(Compiler* compiler) {
+    Chunk* chunk = compiler->chunk;
+    if (compiler->error != NULL) {
+        chunk->count = 0;
+        chunk->constants.count = 0;
+        emitWithConstant(compiler, OP_ERROR, makeString(compiler->error));
+    }
+    emitByte(compiler, OP_RETURN);
+
+    chunk->slotCount = compiler->slotCount;
+
+    // Every cache starts out empty, version 0 is never current
+    if (chunk->constants.count > 0) {
+        size_t size = sizeof(GlobalCache) * chunk->constants.count;
+        chunk->caches = reallocate(NULL, 0, size);
+        memset(chunk->caches, 0, size);
+    }
+    return chunk;
+}
+
+static Chunk* compileBody(Compiler* enclosing, Function* function) {
+    Compiler compiler;
+    initCompiler(&compiler, enclosing, function);
+
+    // The last body expression is in tail position
+    for (int i = 0; i < function->bodyCount; i++) {
+        if (i > 0) emitByte(&compiler, OP_POP);
+        compileExpression(&compiler, function->body[i], i == function->bodyCount - 1);
+    }
+
+    if (function->bodyCount == 0) emitByte(&compiler, OP_NIL);
+    return endCompiler(&compiler);
+}
+
+static void compileFn(Compiler* compiler, List* form, bool tail) {
+    if (isDesugared(form)) {
+        compileExpression(compiler, desugarForm(form), tail);
+        return;
+    }
+
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount < 2) {
+        emitError(compiler, "Expected at least 2 arguments but got %d.", argCount);
+        return;
+    }
+
+    // First argument should be the parameter list
+    if (!IS_LIST(args[0])) {
+        emitError(compiler, "Expected parameter list.");
+        return;
+    }
+
+    List* params = AS_LIST(args[0]);
+    for (int i = 0; i < params->count; i++) {
+        if (!IS_SYMBOL(params->items[i])) {
+            emitError(compiler, "Expected parameter name.");
+            return;
+        }
+    }
+
+    // The parameter list and body expressions are shared with the source
+    Function* function = newFunction(form);
+
+    // The body is compiled once here, every call then runs the same chunk
+    function->chunk = compileBody(compiler, function);
+
+    // OP_CLOSURE pairs this template with the frame it runs in
+    emitWithConstant(compiler, OP_CLOSURE, makeFunction(function, NULL));
+}
+
+// Bind the local name to the top of the stack, leaving the value there
+static void emitDefineLocal(Compiler* compiler, Symbol* name) {
+    // Only names addSlot had no room for have no slot, and their code fails
+    int slot = findSlot(compiler, name);
+    if (slot == -1) return;
+
+    int nameConstant = addConstant(compiler, makeSymbolValue(name));
+    emitByte(compiler, OP_DEFINE_LOCAL);
+    emitByte(compiler, (uint8_t)slot);
+    emitShort(compiler, (uint16_t)nameConstant);
+}
+
+static void compileDef(Compiler* compiler, List* form, bool tail) {
+    (void)tail;
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount != 2) {
+        emitError(compiler, "Expected 2 arguments but got %d.", argCount);
+        return;
+    }
+
+    if (!IS_SYMBOL(args[0])) {
+        emitError(compiler, "Expected variable name.");
+        return;
+    }
+
+    compileExpression(compiler, args[1], false);
+
+    Symbol* name = AS_SYMBOL(args[0]);
+    if (compiler->function == NULL && !compiler->scope) {
+        emitWithConstant(compiler, OP_DEFINE_GLOBAL, makeSymbolValue(name));
+        return;
+    }
+
+    emitDefineLocal(compiler, name);
+}
+
+// Both branches are in tail position when the if is
+static void compileIf(Compiler* compiler, List* form, bool tail) {
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount != 3) {
+        emitError(compiler, "Expected 3 arguments but got %d.", argCount);
+        return;
+    }
+
+    compileExpression(compiler, args[0], false);
+    int elseJump = emitJump(compiler, OP_JUMP_IF_FALSE);
+
+    compileExpression(compiler, args[1], tail);
+    int endJump = emitJump(compiler, OP_JUMP);
+
+    patchJump(compiler, elseJump);
+    compileExpression(compiler, args[2], tail);
+    patchJump(compiler, endJump);
+}
+
+// Whether a let or loop form has a binding list of names and values,
+// reporting the problem when it doesn't
+static bool checkBindings(Compiler* compiler, List* form) {
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount < 1) {
+        emitError(compiler, "Expected at least 1 arguments but got %d.", argCount);
+        return false;
+    }
+
+    if (!IS_LIST(args[0])) {
+        emitError(compiler, "Expected binding list.");
+        return false;
+    }
+
+    List* bindings = AS_LIST(args[0]);
+    if (bindings->count % 2 != 0) {
+        emitError(compiler, "Expected a value for every binding.");
+        return false;
+    }
+    for (int i = 0; i < bindings->count; i += 2) {
+        if (!IS_SYMBOL(bindings->items[i])) {
+            emitError(compiler, "Expected variable name.");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Enter the scope of a let or loop form and bind its names, with scope
+// compiling the code inside it. A scope with more names than OP_PUSH_SCOPE
+// can count is reported instead, and false returned.
+static bool beginScope(Compiler* compiler, Compiler* scope, List* form) {
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    List* bindings = AS_LIST(args[0]);
+
+    scope->enclosing = compiler;
+    scope->chunk = compiler->chunk;
+    scope->function = compiler->function;
+    scope->scope = true;
+    scope->slotCount = 0;
+    scope->slotsFull = false;
+    scope->loopBindings = NULL;
+    scope->error = NULL;
+
+    for (int i = 0; i < bindings->count; i += 2) {
+        addSlot(scope, AS_SYMBOL(bindings->items[i]));
+    }
+    for (int i = 1; i < bindings->count; i += 2) {
+        collectLocals(scope, bindings->items[i]);
+    }
+    for (int i = 1; i < argCount; i++) {
+        collectLocals(scope, args[i]);
+    }
+    if (scope->slotsFull || scope->slotCount > UINT8_MAX) {
+        emitError(compiler, "Can't have more than %d local variables in a scope.", UINT8_MAX);
+        return false;
+    }
+
+    // A scope no closure can hold on to comes from the frame pool
+    bool captured = false;
+    for (int i = 0; i < argCount; i++) {
+        if (createsClosure(args[i])) captured = true;
+    }
+    emitByte(compiler, OP_PUSH_SCOPE);
+    emitByte(compiler, (uint8_t)scope->slotCount);
+    emitByte(compiler, captured ? 0 : 1);
+
+    // Each binding sees the ones before it
+    for (int i = 0; i < bindings->count; i += 2) {
+        compileExpression(scope, bindings->items[i + 1], false);
+        emitDefineLocal(scope, AS_SYMBOL(bindings->items[i]));
+        emitByte(compiler, OP_POP);
+    }
+    return true;
+}
+
+// [let [name value ...] body...] runs in a scope of its own, one more level
+// of environment on the current frame. The body is not in tail position,
+// since the scope ends after it.
+static void compileLet(Compiler* compiler, List* form, bool tail) {
+    (void)tail;
+    Compiler scope;
+    if (!checkBindings(compiler, form) || !beginScope(compiler, &scope, form)) return;
+
+    int argCount = form->count - 1;
+    for (int i = 1; i < argCount; i++) {
+        if (i > 1) emitByte(compiler, OP_POP);
+        compileExpression(&scope, form->items[i + 1], false);
+    }
+    if (argCount == 1) emitByte(compiler, OP_NIL);
+
+    emitByte(compiler, OP_POP_SCOPE);
+}
+
+// The last expression of a do is in tail position when the do is
+static void compileDo(Compiler* compiler, List* form, bool tail) {
+    for (int i = 1; i < form->count; i++) {
+        if (i > 1) emitByte(compiler, OP_POP);
+        compileExpression(compiler, form->items[i], tail && i == form->count - 1);
+    }
+    if (form->count == 1) emitByte(compiler, OP_NIL);
+}
+
+static void emitLoop(Compiler* compiler, int loopStart) {
+    emitByte(compiler, OP_LOOP);
+
+    // +2 to adjust for the loop offset itself
+    int offset = compiler->chunk->count - loopStart + 2;
+    if (offset > UINT16_MAX) {
+        failChunk(compiler, "Loop body too large.");
+    }
+    emitShort(compiler, (uint16_t)offset);
+}
+
+// [while condition body...] evaluates to nil
+static void compileWhile(Compiler* compiler, List* form, bool tail) {
+    (void)tail;
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount < 1) {
+        emitError(compiler, "Expected at least 1 arguments but got %d.", argCount);
+        return;
+    }
+
+    int loopStart = compiler->chunk->count;
+    compileExpression(compiler, args[0], false);
+    int exitJump = emitJump(compiler, OP_JUMP_IF_FALSE);
+
+    for (int i = 1; i < argCount; i++) {
+        compileExpression(compiler, args[i], false);
+        emitByte(compiler, OP_POP);
+    }
+    emitLoop(compiler, loopStart);
+
+    patchJump(compiler, exitJump);
+    emitByte(compiler, OP_NIL);
+}
+
+// [loop [name value ...] body...] binds like let. A [recur value ...] at
+// the tail of the body assigns the names their next values and jumps back
+// to the start of the body, so each iteration reuses the scope's slots.
+static void compileLoop(Compiler* compiler, List* form, bool tail) {
+    (void)tail;
+    Compiler scope;
+    if (!checkBindings(compiler, form) || !beginScope(compiler, &scope, form)) return;
+    scope.loopBindings = AS_LIST(form->items[1]);
+    scope.loopStart = compiler->chunk->count;
+
+    int argCount = form->count - 1;
+    for (int i = 1; i < argCount; i++) {
+        if (i > 1) emitByte(compiler, OP_POP);
+        compileExpression(&scope, form->items[i + 1], i == argCount - 1);
+    }
+    if (argCount == 1) emitByte(compiler, OP_NIL);
+
+    emitByte(compiler, OP_POP_SCOPE);
+}
+
+static void compileRecur(Compiler* compiler, List* form, bool tail) {
+    if (!tail || compiler->loopBindings == NULL) {
+        emitError(compiler, "Can only recur from the tail of a loop.");
+        return;
+    }
+
+    List* bindings = compiler->loopBindings;
+    int argCount = form->count - 1;
+    if (argCount != bindings->count / 2) {
+        emitError(compiler, "Expected %d arguments but got %d.", bindings->count / 2, argCount);
+        return;
+    }
+
+    // Every next value is computed before any name changes
+    for (int i = 1; i < form->count; i++) {
+        compileExpression(compiler, form->items[i], false);
+    }
+    for (int i = bindings->count - 2; i >= 0; i -= 2) {
+        emitDefineLocal(compiler, AS_SYMBOL(bindings->items[i]));
+        emitByte(compiler, OP_POP);
+    }
+    emitLoop(compiler, compiler->loopStart);
+}
+
+// [set name value] assigns the innermost binding of name and is the value
+static void compileSet(Compiler* compiler, List* form, bool tail) {
+    (void)tail;
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount != 2) {
+        emitError(compiler, "Expected 2 arguments but got %d.", argCount);
+        return;
+    }
+
+    if (!IS_SYMBOL(args[0])) {
+        emitError(compiler, "Expected variable name.");
+        return;
+    }
+
+    compileExpression(compiler, args[1], false);
+    compileVariable(compiler, AS_SYMBOL(args[0]), true);
+}
+
+static void compileQuote(Compiler* compiler, List* form, bool tail) {
+    (void)tail;
+    int argCount = form->count - 1;
+    if (argCount != 1) {
+        emitError(compiler, "Expected 1 arguments but got %d.", argCount);
+        return;
+    }
+
+    emitWithConstant(compiler, OP_CONSTANT, form->items[1]);
+}
+
+// The first falsey operand is the value of an and, otherwise its last one
+static void compileAnd(Compiler* compiler, Value* operands, int count, bool tail) {
+    if (count == 1) {
+        compileExpression(compiler, operands[0], tail);
+        return;
+    }
+
+    compileExpression(compiler, operands[0], false);
+    emitByte(compiler, OP_DUP);
+    int endJump = emitJump(compiler, OP_JUMP_IF_FALSE);
+    emitByte(compiler, OP_POP);
+    compileAnd(compiler, operands + 1, count - 1, tail);
+    patchJump(compiler, endJump);
+}
+
+// The first truthy operand is the value of an or, otherwise its last one
+static void compileOr(Compiler* compiler, Value* operands, int count, bool tail) {
+    if (count == 1) {
+        compileExpression(compiler, operands[0], tail);
+        return;
+    }
+
+    compileExpression(compiler, operands[0], false);
+    emitByte(compiler, OP_DUP);
+    int nextJump = emitJump(compiler, OP_JUMP_IF_FALSE);
+    int endJump = emitJump(compiler, OP_JUMP);
+    patchJump(compiler, nextJump);
+    emitByte(compiler, OP_POP);
+    compileOr(compiler, operands + 1, count - 1, tail);
+    patchJump(compiler, endJump);
+}
+
+static void compileAndForm(Compiler* compiler, List* form, bool tail) {
+    if (form->count == 1) {
+        emitWithConstant(compiler, OP_CONSTANT, makeBoolean(true));
+        return;
+    }
+    compileAnd(compiler, &form->items[1], form->count - 1, tail);
+}
+
+static void compileOrForm(Compiler* compiler, List* form, bool tail) {
+    if (form->count == 1) {
+        emitByte(compiler, OP_NIL);
+        return;
+    }
+    compileOr(compiler, &form->items[1], form->count - 1, tail);
+}
+
+// Clauses are test and expression pairs, nil when no test is truthy
+static void compileClauses(Compiler* compiler, Value* clauses, int count, bool tail) {
+    if (count == 0) {
+        emitByte(compiler, OP_NIL);
+        return;
+    }
+
+    compileExpression(compiler, clauses[0], false);
+    int nextJump = emitJump(compiler, OP_JUMP_IF_FALSE);
+    compileExpression(compiler, clauses[1], tail);
+    int endJump = emitJump(compiler, OP_JUMP);
+
+    patchJump(compiler, nextJump);
+    compileClauses(compiler, clauses + 2, count - 2, tail);
+    patchJump(compiler, endJump);
+}
+
+static void compileCond(Compiler* compiler, List* form, bool tail) {
+    int argCount = form->count - 1;
+    if (argCount % 2 != 0) {
+        emitError(compiler, "Expected an even number of arguments but got %d.", argCount);
+        return;
+    }
+
+    compileClauses(compiler, &form->items[1], argCount, tail);
+}
+
+// defmacro, quasiquote and dotimes compile as the code they stand for
+static void compileDesugared(Compiler* compiler, List* form, bool tail) {
+    compileExpression(compiler, desugarForm(form), tail);
+}
+
+static const CompileSpecialFn specialForms[SPECIAL_FORM_COUNT] = {
+    [SPECIAL_FN] = compileFn,
+    [SPECIAL_DEF] = compileDef,
+    [SPECIAL_IF] = compileIf,
+    [SPECIAL_LET] = compileLet,
+    [SPECIAL_DO] = compileDo,
+    [SPECIAL_WHILE] = compileWhile,
+    [SPECIAL_QUOTE] = compileQuote,
+    [SPECIAL_AND] = compileAndForm,
+    [SPECIAL_OR] = compileOrForm,
+    [SPECIAL_COND] = compileCond,
+    [SPECIAL_DEFMACRO] = compileDesugared,
+    [SPECIAL_QUASIQUOTE] = compileDesugared,
+    [SPECIAL_SET] = compileSet,
+    [SPECIAL_LOOP] = compileLoop,
+    [SPECIAL_RECUR] = compileRecur,
+    [SPECIAL_DOTIMES] = compileDesugared
+};
+
+static void compileCall(Compiler* compiler, List* list, bool tail) {
+    int argCount = list->count - 1;
+    if (argCount > UINT8_MAX) {
+        emitError(compiler, "Can't have more than %d arguments.", UINT8_MAX);
+        return;
+    }
+
+    // The operator is evaluated before its arguments
+    for (int i = 0; i < list->count; i++) {
+        compileExpression(compiler, list->items[i], false);
+    }
+
+    // A call in tail position reuses the frame of the function making it.
+    // At the tail of a loop body the loop's scope still has to end.
+    emitByte(compiler, tail && compiler->loopBindings == NULL ? OP_TAIL_CALL : OP_CALL);
+    emitByte(compiler, (uint8_t)argCount);
+}
+
+static void compileList(Compiler* compiler, Value expr, bool tail) {
+    List* list = AS_LIST(expr);
+
+    // The empty list evaluates to itself
+    if (list->count == 0) {
+        emitWithConstant(compiler, OP_CONSTANT, expr);
+        return;
+    }
+
+    SpecialForm special = specialForm(list);
+    if (special != SPECIAL_NONE) {
+        specialForms[special](compiler, list, tail);
+        return;
+    }
+
+    compileCall(compiler, list, tail);
+}
+
+// A tail expression's value is returned by the function body it ends
+static void compileExpression(Compiler* compiler, Value expr, bool tail) {
+    switch (valueType(expr)) {
+        case VAL_NIL:
+            emitByte(compiler, OP_NIL);
+            break;
+        case VAL_SYMBOL:
+            compileVariable(compiler, AS_SYMBOL(expr), false);
+            break;
+        case VAL_LIST:
+            compileList(compiler, expr, tail);
+            break;
+        default:
+            emitWithConstant(compiler, OP_CONSTANT, expr);
+            break;
+    }
+}
+
+// Compile a single top-level expression
+Chunk* compile(Value expr) {
+    Compiler compiler;
+    initCompiler(&compiler, NULL, NULL);
+    compileExpression(&compiler, expr, false);
+    return endCompiler(&compiler);
+}
+
+// Compile a function that was created outside the compiler, the value of the
+// last body expression is returned
+Chunk* compileFunction(Function* function) {
+    return compileBody(NULL, function);
+}
+
+// Compile a function that was created outside the compiler and closes over
+// the globals, so the names it doesn't bind are globals
+Chunk* compileGlobalFunction(Function* function) {
+    Compiler topLevel;
+    initCompiler(&topLevel, NULL, NULL);
+    Chunk* chunk = compileBody(&topLevel, function);
+    freeChunk(topLevel.chunk);
+    return chunk;
+}
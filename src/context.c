@@ -0,0 +1,299 @@
+#include "../include/hexa.h"
+
+#ifdef _WIN32
+// Condition variables need Windows Vista
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+// A program embedding Hexa makes a HexaVM, runs code in it and frees it.
+// The lexer, parser, heap, symbol table, VM and the other modules keep their
+// state in thread-local variables, so every thread that makes a HexaVM gets
+// an interpreter of its own: nothing is shared and nothing is locked, and N
+// threads run N programs as fast as N processes would. Values belong to the
+// heap of the thread that made them and must not be passed to another.
+
+struct HexaVM {
+    Environment* globals;
+    bool treeWalk;          // Run the tree-walking evaluator, not the VM
+    bool optimize;          // Fold constants in each form before it runs
+    bool dumpOptimized;     // And print the folded form
+};
+
+// The interpreter of this thread, or NULL
+static HEXA_THREAD_LOCAL HexaVM* current;
+
+// A new interpreter for this thread, or NULL if it already has one
+HexaVM* newHexaVM() {
+    if (current != NULL) return NULL;
+
+    HexaVM* hexa = reallocate(NULL, 0, sizeof(HexaVM));
+    hexa->treeWalk = false;
+    hexa->optimize = true;
+    hexa->dumpOptimized = false;
+
+    // The global environment stays reachable until the interpreter is freed
+    hexa->globals = createEnvironment();
+    pushEnvironmentRoot(hexa->globals);
+    initGlobalEnvironment(hexa->globals);
+    initVM();
+
+    current = hexa;
+    return hexa;
+}
+
+// Free everything the interpreter allocated, so the thread can make another
+void freeHexaVM(HexaVM* hexa) {
+    freeVM();
+    freeObjects();
+    freeSymbols();
+    reallocate(hexa, sizeof(HexaVM), 0);
+    current = NULL;
+}
+
+Environment* hexaGlobals(HexaVM* hexa) {
+    return hexa->globals;
+}
+
+void setTreeWalk(HexaVM* hexa, bool enabled) {
+    hexa->treeWalk = enabled;
+}
+
+// Whether forms are optimized before they run, and printed once they are
+void setOptimize(HexaVM* hexa, bool enabled, bool dump) {
+    hexa->optimize = enabled;
+    hexa->dumpOptimized = dump;
+}
+
+// Expand, optimize and run a top-level form. The caller keeps expr
+// reachable from a GC root.
+Value runForm(HexaVM* hexa, Value expr) {
+    expr = expandMacros(expr);
+    pushRoot(expr);
+    if (hexa->optimize) expr = optimize(expr, hexa->globals);
+    if (hexa->dumpOptimized) {
+        printValue(expr);
+        printf("\n");
+    }
+
+    pushRoot(expr);
+    Value result = hexa->treeWalk ? evaluate(expr, hexa->globals) : interpret(expr, hexa->globals);
+    popRoots(2);
+    return result;
+}
+
+// Run every form in source and return the last one's result. With
+// printResults, each result other than nil is printed.
+Value runSource(HexaVM* hexa, const char* source, bool printResults) {
+    initLexer(source);
+    initParser();
+
+    Value result = NIL_VAL;
+    while (getCurrentToken().type != TOKEN_EOF) {
+        Value expr = parseExpression();
+        pushRoot(expr);
+        result = runForm(hexa, expr);
+
+        if (printResults && !IS_NIL(result)) {
+            printValue(result);
+            printf("\n");
+        }
+        popRoots(1);
+    }
+    return result;
+}
+
+// Threads, for running an interpreter on each. Threads, locks and the like
+// are shared between interpreters, so they come from malloc.
+
+void* allocateShared(size_t size) {
+    return reallocateShared(NULL, size);
+}
+
+void* reallocateShared(void* memory, size_t size) {
+    memory = realloc(memory, size);
+    if (memory == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(70);
+    }
+    return memory;
+}
+
+struct HexaThread {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t thread;
+#endif
+    void (*body)(void* arg);
+    void* arg;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI threadMain(LPVOID thread) {
+    ((HexaThread*)thread)->body(((HexaThread*)thread)->arg);
+    return 0;
+}
+#else
+static void* threadMain(void* thread) {
+    ((HexaThread*)thread)->body(((HexaThread*)thread)->arg);
+    return NULL;
+}
+#endif
+
+// Run body(arg) on a new thread
+HexaThread* startThread(void (*body)(void* arg), void* arg) {
+    HexaThread* thread = allocateShared(sizeof(HexaThread));
+    thread->body = body;
+    thread->arg = arg;
+
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, threadMain, thread, 0, NULL);
+    bool started = thread->handle != NULL;
+#else
+    bool started = pthread_create(&thread->thread, NULL, threadMain, thread) == 0;
+#endif
+    if (!started) {
+        fprintf(stderr, "Could not start a thread.\n");
+        exit(71);
+    }
+    return thread;
+}
+
+// Wait for the thread to finish and free it
+void joinThread(HexaThread* thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->thread, NULL);
+#endif
+    free(thread);
+}
+
+// Let the thread run on its own and free it without waiting. The thread
+// must have started body, which it finds in the HexaThread freed here.
+void detachThread(HexaThread* thread) {
+#ifdef _WIN32
+    CloseHandle(thread->handle);
+#else
+    pthread_detach(thread->thread);
+#endif
+    free(thread);
+}
+
+// Let other threads run before this one goes on
+void yieldThread() {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+// Locks and condition variables, for threads that share data
+
+struct HexaLock {
+#ifdef _WIN32
+    CRITICAL_SECTION section;
+#else
+    pthread_mutex_t mutex;
+#endif
+};
+
+struct HexaCondition {
+#ifdef _WIN32
+    CONDITION_VARIABLE variable;
+#else
+    pthread_cond_t cond;
+#endif
+};
+
+HexaLock* newLock() {
+    HexaLock* lock = allocateShared(sizeof(HexaLock));
+#ifdef _WIN32
+    InitializeCriticalSection(&lock->section);
+#else
+    pthread_mutex_init(&lock->mutex, NULL);
+#endif
+    return lock;
+}
+
+void freeLock(HexaLock* lock) {
+#ifdef _WIN32
+    DeleteCriticalSection(&lock->section);
+#else
+    pthread_mutex_destroy(&lock->mutex);
+#endif
+    free(lock);
+}
+
+void acquireLock(HexaLock* lock) {
+#ifdef _WIN32
+    EnterCriticalSection(&lock->section);
+#else
+    pthread_mutex_lock(&lock->mutex);
+#endif
+}
+
+void releaseLock(HexaLock* lock) {
+#ifdef _WIN32
+    LeaveCriticalSection(&lock->section);
+#else
+    pthread_mutex_unlock(&lock->mutex);
+#endif
+}
+
+HexaCondition* newCondition() {
+    HexaCondition* condition = allocateShared(sizeof(HexaCondition));
+#ifdef _WIN32
+    InitializeConditionVariable(&condition->variable);
+#else
+    pthread_cond_init(&condition->cond, NULL);
+#endif
+    return condition;
+}
+
+void freeCondition(HexaCondition* condition) {
+#ifndef _WIN32
+    pthread_cond_destroy(&condition->cond);
+#endif
+    free(condition);
+}
+
+// Release lock until the condition is signalled, then take it back. Wakeups
+// can be spurious, so callers wait in a loop.
+void waitCondition(HexaCondition* condition, HexaLock* lock) {
+#ifdef _WIN32
+    SleepConditionVariableCS(&condition->variable, &lock->section, INFINITE);
+#else
+    pthread_cond_wait(&condition->cond, &lock->mutex);
+#endif
+}
+
+void signalAll(HexaCondition* condition) {
+#ifdef _WIN32
+    WakeAllConditionVariable(&condition->variable);
+#else
+    pthread_cond_broadcast(&condition->cond);
+#endif
+}
+
+// The number of processors that can run threads, at least 1
+int processorCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count < 1 ? 1 : count;
+}
@@ -0,0 +1,1042 @@
+#include "../include/hexa.h"
+#include <stdarg.h>
+
+// --emit-c translates a program to C that links against the runtime, which
+// is every source file but main.c. A top-level form becomes a C function
+// when it sticks to literals, variables, quote, if, do, let, while, loop,
+// recur, set, and, or, cond, calls and global defs. A top-level [def name [fn [params] body...]]
+// whose body does too also gets a C function, which calls of name jump to
+// directly while name still holds the closure that def made. Everything
+// else, closures inside functions in particular, runs in the embedded
+// interpreter from its source text.
+//
+// Compiled code keeps its values in a slot array, v, registered as a
+// CompiledFrame so the collector can find them.
+
+#define MAX_COMPILED_LOCALS 256
+
+// Growable C source text
+typedef struct {
+    char* chars;
+    size_t length;
+    size_t capacity;
+} Text;
+
+static void appendTextV(Text* text, const char* format, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
+    if (text->length + length + 1 > text->capacity) {
+        size_t capacity = text->capacity < 256 ? 256 : text->capacity;
+        while (capacity < text->length + length + 1) capacity *= 2;
+        text->chars = realloc(text->chars, capacity);
+        if (text->chars == NULL) {
+            fprintf(stderr, "Not enough memory to emit C.\n");
+            exit(74);
+        }
+        text->capacity = capacity;
+    }
+    vsnprintf(text->chars + text->length, length + 1, format, args);
+    text->length += length;
+}
+
+static void appendText(Text* text, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    appendTextV(text, format, args);
+    va_end(args);
+}
+
+static void freeText(Text* text) {
+    free(text->chars);
+    text->chars = NULL;
+    text->length = 0;
+    text->capacity = 0;
+}
+
+// chars as a C string literal, one line of source per line
+static void appendStringLiteral(Text* text, const char* chars, int length) {
+    appendText(text, "\"");
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        if (c == '\n' && i < length - 1) {
+            appendText(text, "\\n\"\n        \"");
+        } else if (c == '\n') {
+            appendText(text, "\\n");
+        } else if (c == '"' || c == '\\' || c == '?') {
+            // ? so no ?? starts a trigraph
+            appendText(text, "\\%c", c);
+        } else if (c < ' ' || c >= 127) {
+            appendText(text, "\\%03o", c);
+        } else {
+            appendText(text, "%c", c);
+        }
+    }
+    appendText(text, "\"");
+}
+
+// A top-level [def name [fn ...]] with a C function for its body
+typedef struct {
+    Symbol* name;
+    int arity;
+    int form;           // Index of the def among the top-level forms
+    int closure;        // Index in closures of the closure the def made
+    bool direct;        // The def is the only one of name, so calls can be direct
+    char cName[64];
+} CompiledFunction;
+
+static struct {
+    Environment* globals;   // Built-ins the program starts with
+    Text prototypes;
+    Text functions;
+    Text setup;             // Fills symbols and constants at startup
+    Text body;              // Runs the forms
+    Symbol** symbols;
+    int symbolCount;
+    int symbolCapacity;
+    int constantCount;
+    int cacheCount;
+    CompiledFunction* compiled;
+    int compiledCount;
+    int compiledCapacity;
+    Symbol** macros;        // Names the program defines macros for
+    int macroCount;
+} emitter;
+
+// What a translation that gets thrown away has to take back
+typedef struct {
+    int symbolCount;
+    int constantCount;
+    int cacheCount;
+    size_t setupLength;
+} EmitterMark;
+
+static EmitterMark markEmitter() {
+    EmitterMark mark = {emitter.symbolCount, emitter.constantCount, emitter.cacheCount,
+                        emitter.setup.length};
+    return mark;
+}
+
+static void resetEmitter(EmitterMark mark) {
+    emitter.symbolCount = mark.symbolCount;
+    emitter.constantCount = mark.constantCount;
+    emitter.cacheCount = mark.cacheCount;
+    emitter.setup.length = mark.setupLength;
+}
+
+// The index of name in symbols, interned at startup
+static int symbolIndex(Symbol* name) {
+    for (int i = 0; i < emitter.symbolCount; i++) {
+        if (emitter.symbols[i] == name) return i;
+    }
+
+    if (emitter.symbolCount == emitter.symbolCapacity) {
+        int capacity = emitter.symbolCapacity < 16 ? 16 : emitter.symbolCapacity * 2;
+        emitter.symbols = realloc(emitter.symbols, sizeof(Symbol*) * capacity);
+        if (emitter.symbols == NULL) {
+            fprintf(stderr, "Not enough memory to emit C.\n");
+            exit(74);
+        }
+        emitter.symbolCapacity = capacity;
+    }
+    emitter.symbols[emitter.symbolCount] = name;
+    appendText(&emitter.setup, "    symbols[%d] = internCString(", emitter.symbolCount);
+    appendStringLiteral(&emitter.setup, name->chars, name->length);
+    appendText(&emitter.setup, ");\n");
+    return emitter.symbolCount++;
+}
+
+// value as source text the lexer reads back as the same value
+static bool writeDatum(Text* text, Value value) {
+    switch (valueType(value)) {
+        case VAL_NIL:
+            appendText(text, "nil");
+            return true;
+        case VAL_BOOLEAN:
+            appendText(text, "%s", AS_BOOLEAN(value) ? "true" : "false");
+            return true;
+        case VAL_INT:
+            if (AS_INT(value) < 0) return false;
+            appendText(text, "%" PRId64, AS_INT(value));
+            return true;
+        case VAL_NUMBER: {
+            // There are no negative or exponent literals
+            char number[32];
+            snprintf(number, sizeof(number), "%.17g", AS_NUMBER(value));
+            if (AS_NUMBER(value) < 0 || strpbrk(number, "einIN") != NULL) return false;
+            appendText(text, strchr(number, '.') != NULL ? "%s" : "%s.0", number);
+            return true;
+        }
+        case VAL_STRING:
+            if (strchr(AS_STRING(value)->chars, '"') != NULL) return false;
+            appendText(text, "\"%s\"", AS_STRING(value)->chars);
+            return true;
+        case VAL_SYMBOL:
+            appendText(text, "%s", AS_SYMBOL(value)->chars);
+            return true;
+        case VAL_LIST: {
+            List* list = AS_LIST(value);
+            appendText(text, "[");
+            for (int i = 0; i < list->count; i++) {
+                if (i > 0) appendText(text, " ");
+                if (!writeDatum(text, list->items[i])) return false;
+            }
+            appendText(text, "]");
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// The index in constants of value, built at startup, or -1 if it can't be
+static int constantIndex(Value value) {
+    Text expr = {NULL, 0, 0};
+    bool built = true;
+    switch (valueType(value)) {
+        case VAL_BOOLEAN:
+            appendText(&expr, "makeBoolean(%s)", AS_BOOLEAN(value) ? "true" : "false");
+            break;
+        case VAL_INT:
+            appendText(&expr, "makeInt(INT64_C(%" PRId64 "))", AS_INT(value));
+            break;
+        case VAL_NUMBER: {
+            double number = AS_NUMBER(value);
+            built = number == number && number - number == 0;
+            if (built) appendText(&expr, "makeNumber(%.17g)", number);
+            break;
+        }
+        case VAL_STRING:
+            appendText(&expr, "makeStringIn(NULL, ");
+            appendStringLiteral(&expr, AS_STRING(value)->chars, AS_STRING(value)->length);
+            appendText(&expr, ", %d)", AS_STRING(value)->length);
+            break;
+        case VAL_SYMBOL:
+            appendText(&expr, "makeSymbolValue(symbols[%d])", symbolIndex(AS_SYMBOL(value)));
+            break;
+        case VAL_LIST: {
+            Text datum = {NULL, 0, 0};
+            built = writeDatum(&datum, value);
+            if (built) {
+                appendText(&expr, "programQuote(");
+                appendStringLiteral(&expr, datum.chars, (int)datum.length);
+                appendText(&expr, ")");
+            }
+            freeText(&datum);
+            break;
+        }
+        default:
+            built = false;
+            break;
+    }
+
+    int index = -1;
+    if (built) {
+        index = emitter.constantCount++;
+        appendText(&emitter.setup, "    constants[%d] = %s;\n", index, expr.chars);
+    }
+    freeText(&expr);
+    return index;
+}
+
+// The function or top-level form being translated
+typedef struct {
+    Text code;
+    Symbol* names[MAX_COMPILED_LOCALS];     // Parameters and let bindings in scope
+    int slots[MAX_COMPILED_LOCALS];
+    int localCount;
+    int slotCount;      // Slots of v in use
+    int maxSlots;
+    int function;       // Index in compiled, -1 for a top-level form
+    bool global;        // Whether def defines a global here
+    bool loops;         // Whether a self tail call jumps back to the top
+    bool unwinds;       // Whether a call can unwind out of it
+    List* loopBindings; // Bindings of the loop a recur in tail position starts over
+    int loopSlot;       // Slot of the loop's first binding, the others follow it
+    int depth;
+} Translation;
+
+static void emitLine(Translation* t, const char* format, ...) {
+    appendText(&t->code, "%*s", 4 * t->depth, "");
+    va_list args;
+    va_start(args, format);
+    appendTextV(&t->code, format, args);
+    va_end(args);
+}
+
+static int newSlot(Translation* t) {
+    int slot = t->slotCount++;
+    if (t->slotCount > t->maxSlots) t->maxSlots = t->slotCount;
+    return slot;
+}
+
+// The slot of local name, or -1 for a global
+static int localSlot(Translation* t, Symbol* name) {
+    for (int i = t->localCount - 1; i >= 0; i--) {
+        if (t->names[i] == name) return t->slots[i];
+    }
+    return -1;
+}
+
+// The compiled function a call of callee on argCount arguments can go
+// straight to, if it is still the closure its def made
+static CompiledFunction* directCallee(Translation* t, Value callee, int argCount) {
+    if (!IS_SYMBOL(callee) || localSlot(t, AS_SYMBOL(callee)) != -1) return NULL;
+
+    for (int i = 0; i < emitter.compiledCount; i++) {
+        CompiledFunction* function = &emitter.compiled[i];
+        if (function->name == AS_SYMBOL(callee)) {
+            return function->direct && function->arity == argCount ? function : NULL;
+        }
+    }
+    return NULL;
+}
+
+// The operation of the built-in callee names, if a call of it on argCount
+// arguments can run inline
+static NativeOp binaryOp(Translation* t, Value callee, int argCount) {
+    Value value;
+    if (argCount != 2 || !IS_SYMBOL(callee) || localSlot(t, AS_SYMBOL(callee)) != -1 ||
+        !lookupVariable(emitter.globals, AS_SYMBOL(callee), &value) || !IS_NATIVE(value)) {
+        return NATIVE_OP_NONE;
+    }
+    return (NativeOp)AS_NATIVE(value)->op;
+}
+
+static const char* nativeOpNames[] = {
+    [NATIVE_OP_ADD] = "NATIVE_OP_ADD",
+    [NATIVE_OP_SUBTRACT] = "NATIVE_OP_SUBTRACT",
+    [NATIVE_OP_MULTIPLY] = "NATIVE_OP_MULTIPLY",
+    [NATIVE_OP_EQUAL] = "NATIVE_OP_EQUAL",
+    [NATIVE_OP_LESS] = "NATIVE_OP_LESS",
+    [NATIVE_OP_GREATER] = "NATIVE_OP_GREATER",
+    [NATIVE_OP_LESS_EQUAL] = "NATIVE_OP_LESS_EQUAL",
+    [NATIVE_OP_GREATER_EQUAL] = "NATIVE_OP_GREATER_EQUAL"
+};
+
+static bool translateExpression(Translation* t, Value expr, int target, bool tail);
+
+// Calls of macros are expanded when the program runs, so they stay interpreted
+static bool isMacroName(Value callee) {
+    if (!IS_SYMBOL(callee)) return false;
+    for (int i = 0; i < emitter.macroCount; i++) {
+        if (emitter.macros[i] == AS_SYMBOL(callee)) return true;
+    }
+    return false;
+}
+
+// The operator is evaluated before its arguments, which take consecutive
+// slots so they can be passed as an array
+static bool translateCall(Translation* t, List* list, int target, bool tail) {
+    int argCount = list->count - 1;
+    if (argCount > UINT8_MAX || isMacroName(list->items[0])) return false;
+
+    int callee = newSlot(t);
+    if (!translateExpression(t, list->items[0], callee, false)) return false;
+    int args = t->slotCount;
+    for (int i = 1; i < list->count; i++) {
+        if (!translateExpression(t, list->items[i], newSlot(t), false)) return false;
+    }
+
+    NativeOp op = binaryOp(t, list->items[0], argCount);
+    CompiledFunction* function = directCallee(t, list->items[0], argCount);
+    if (op != NATIVE_OP_NONE) {
+        emitLine(t, "v[%d] = programBinary(v[%d], %s, v[%d], v[%d]);\n",
+                 target, callee, nativeOpNames[op], args, args + 1);
+    } else if (function != NULL && tail && t->loopBindings == NULL &&
+               function - emitter.compiled == t->function) {
+        // A self call in tail position starts the body over
+        emitLine(t, "if (isClosure(v[%d], closures[%d])) {\n", callee, function->closure);
+        for (int i = 0; i < argCount; i++) {
+            emitLine(t, "    v[%d] = v[%d];\n", i, args + i);
+        }
+        emitLine(t, "    goto top;\n");
+        emitLine(t, "}\n");
+        emitLine(t, "v[%d] = programCall(v[%d], %d, &v[%d]);\n", target, callee, argCount, args);
+        t->loops = true;
+    } else if (function != NULL) {
+        Text call = {NULL, 0, 0};
+        for (int i = 0; i < argCount; i++) {
+            appendText(&call, i > 0 ? ", v[%d]" : "v[%d]", args + i);
+        }
+        emitLine(t, "v[%d] = isClosure(v[%d], closures[%d]) ? %s(%s) : programCall(v[%d], %d, &v[%d]);\n",
+                 target, callee, function->closure, function->cName,
+                 call.chars != NULL ? call.chars : "", callee, argCount, args);
+        freeText(&call);
+    } else {
+        emitLine(t, "v[%d] = programCall(v[%d], %d, &v[%d]);\n", target, callee, argCount, args);
+    }
+
+    // Stack overflow unwinds compiled calls back to the outermost one
+    if (t->function >= 0) {
+        emitLine(t, "if (programUnwinding) goto unwind;\n");
+        t->unwinds = true;
+    }
+    return true;
+}
+
+static bool translateIf(Translation* t, List* list, int target, bool tail) {
+    if (list->count != 4) return false;
+
+    int test = newSlot(t);
+    if (!translateExpression(t, list->items[1], test, false)) return false;
+    emitLine(t, "if (isTruthy(v[%d])) {\n", test);
+    t->depth++;
+    if (!translateExpression(t, list->items[2], target, tail)) return false;
+    t->depth--;
+    emitLine(t, "} else {\n");
+    t->depth++;
+    if (!translateExpression(t, list->items[3], target, tail)) return false;
+    t->depth--;
+    emitLine(t, "}\n");
+    return true;
+}
+
+// Each binding sees the ones before it. The body isn't in tail position,
+// as it isn't in the VM.
+static bool translateLet(Translation* t, List* list, int target) {
+    if (list->count < 2 || !IS_LIST(list->items[1])) return false;
+    List* bindings = AS_LIST(list->items[1]);
+    if (bindings->count % 2 != 0) return false;
+
+    int localCount = t->localCount;
+    bool global = t->global;
+    t->global = false;
+    for (int i = 0; i < bindings->count; i += 2) {
+        if (!IS_SYMBOL(bindings->items[i]) || t->localCount == MAX_COMPILED_LOCALS) return false;
+        int slot = newSlot(t);
+        if (!translateExpression(t, bindings->items[i + 1], slot, false)) return false;
+        t->names[t->localCount] = AS_SYMBOL(bindings->items[i]);
+        t->slots[t->localCount++] = slot;
+    }
+
+    for (int i = 2; i < list->count; i++) {
+        if (!translateExpression(t, list->items[i], target, false)) return false;
+    }
+    if (list->count == 2) emitLine(t, "v[%d] = NIL_VAL;\n", target);
+    t->localCount = localCount;
+    t->global = global;
+    return true;
+}
+
+static bool translateWhile(Translation* t, List* list, int target) {
+    if (list->count < 2) return false;
+
+    int scratch = newSlot(t);
+    emitLine(t, "for (;;) {\n");
+    t->depth++;
+    emitLine(t, "collectGarbageIfNeeded();\n");
+    if (!translateExpression(t, list->items[1], scratch, false)) return false;
+    emitLine(t, "if (!isTruthy(v[%d])) break;\n", scratch);
+    for (int i = 2; i < list->count; i++) {
+        if (!translateExpression(t, list->items[i], scratch, false)) return false;
+    }
+    t->depth--;
+    emitLine(t, "}\n");
+    emitLine(t, "v[%d] = NIL_VAL;\n", target);
+    return true;
+}
+
+// A loop binds its names like let and runs its body in a C loop that a
+// recur continues, with the collector given its chance each time round like
+// in a while. Recurs are only in tail position, so never inside a while.
+static bool translateLoop(Translation* t, List* list, int target) {
+    if (list->count < 2 || !IS_LIST(list->items[1])) return false;
+    List* bindings = AS_LIST(list->items[1]);
+    if (bindings->count % 2 != 0) return false;
+
+    int localCount = t->localCount;
+    bool global = t->global;
+    List* loopBindings = t->loopBindings;
+    int loopSlot = t->loopSlot;
+    t->global = false;
+    t->loopSlot = t->slotCount;
+    for (int i = 0; i < bindings->count; i += 2) {
+        if (!IS_SYMBOL(bindings->items[i]) || t->localCount == MAX_COMPILED_LOCALS) return false;
+        int slot = newSlot(t);
+        if (!translateExpression(t, bindings->items[i + 1], slot, false)) return false;
+        t->names[t->localCount] = AS_SYMBOL(bindings->items[i]);
+        t->slots[t->localCount++] = slot;
+    }
+
+    t->loopBindings = bindings;
+    emitLine(t, "for (;;) {\n");
+    t->depth++;
+    emitLine(t, "collectGarbageIfNeeded();\n");
+    for (int i = 2; i < list->count; i++) {
+        if (!translateExpression(t, list->items[i], target, i == list->count - 1)) return false;
+    }
+    if (list->count == 2) emitLine(t, "v[%d] = NIL_VAL;\n", target);
+    emitLine(t, "break;\n");
+    t->depth--;
+    emitLine(t, "}\n");
+    t->localCount = localCount;
+    t->global = global;
+    t->loopBindings = loopBindings;
+    t->loopSlot = loopSlot;
+    return true;
+}
+
+// The new values are all computed before any binding changes. A misplaced
+// recur stays interpreted, which reports it.
+static bool translateRecur(Translation* t, List* list, bool tail) {
+    if (!tail || t->loopBindings == NULL || list->count - 1 != t->loopBindings->count / 2) {
+        return false;
+    }
+
+    int args = t->slotCount;
+    for (int i = 1; i < list->count; i++) {
+        if (!translateExpression(t, list->items[i], newSlot(t), false)) return false;
+    }
+    for (int i = 0; i < list->count - 1; i++) {
+        emitLine(t, "v[%d] = v[%d];\n", t->loopSlot + i, args + i);
+    }
+    emitLine(t, "continue;\n");
+    return true;
+}
+
+// Sets of locals write their slot, sets of globals go through the runtime
+static bool translateSet(Translation* t, List* list, int target) {
+    if (list->count != 3 || !IS_SYMBOL(list->items[1])) return false;
+    if (!translateExpression(t, list->items[2], target, false)) return false;
+
+    Symbol* name = AS_SYMBOL(list->items[1]);
+    int slot = localSlot(t, name);
+    if (slot >= 0) {
+        emitLine(t, "v[%d] = v[%d];\n", slot, target);
+    } else {
+        emitLine(t, "v[%d] = programSet(symbols[%d], v[%d]);\n", target, symbolIndex(name), target);
+    }
+    return true;
+}
+
+// The first falsey operand of an and is its value, otherwise the last one.
+// An or stops at the first truthy one.
+static bool translateAndOr(Translation* t, Value* operands, int count, bool and,
+                           int target, bool tail) {
+    if (!translateExpression(t, operands[0], target, tail && count == 1)) return false;
+    if (count == 1) return true;
+
+    emitLine(t, and ? "if (isTruthy(v[%d])) {\n" : "if (!isTruthy(v[%d])) {\n", target);
+    t->depth++;
+    if (!translateAndOr(t, operands + 1, count - 1, and, target, tail)) return false;
+    t->depth--;
+    emitLine(t, "}\n");
+    return true;
+}
+
+// Clauses are test and expression pairs, nil when no test is truthy
+static bool translateClauses(Translation* t, Value* clauses, int count, int target, bool tail) {
+    if (count == 0) {
+        emitLine(t, "v[%d] = NIL_VAL;\n", target);
+        return true;
+    }
+
+    int test = newSlot(t);
+    if (!translateExpression(t, clauses[0], test, false)) return false;
+    emitLine(t, "if (isTruthy(v[%d])) {\n", test);
+    t->depth++;
+    if (!translateExpression(t, clauses[1], target, tail)) return false;
+    t->depth--;
+    emitLine(t, "} else {\n");
+    t->depth++;
+    if (!translateClauses(t, clauses + 2, count - 2, target, tail)) return false;
+    t->depth--;
+    emitLine(t, "}\n");
+    return true;
+}
+
+static bool translateConstant(Translation* t, Value value, int target) {
+    if (IS_NIL(value)) {
+        emitLine(t, "v[%d] = NIL_VAL;\n", target);
+        return true;
+    }
+
+    int constant = constantIndex(value);
+    if (constant < 0) return false;
+    emitLine(t, "v[%d] = constants[%d];\n", target, constant);
+    return true;
+}
+
+static bool translateList(Translation* t, Value expr, int target, bool tail) {
+    List* list = AS_LIST(expr);
+
+    // The empty list evaluates to itself
+    if (list->count == 0) return translateConstant(t, expr, target);
+
+    switch (specialForm(list)) {
+        case SPECIAL_NONE:
+            return translateCall(t, list, target, tail);
+        case SPECIAL_QUOTE:
+            return list->count == 2 && translateConstant(t, list->items[1], target);
+        case SPECIAL_IF:
+            return translateIf(t, list, target, tail);
+        case SPECIAL_DO:
+            for (int i = 1; i < list->count; i++) {
+                if (!translateExpression(t, list->items[i], target, tail && i == list->count - 1)) {
+                    return false;
+                }
+            }
+            if (list->count == 1) emitLine(t, "v[%d] = NIL_VAL;\n", target);
+            return true;
+        case SPECIAL_LET:
+            return translateLet(t, list, target);
+        case SPECIAL_WHILE:
+            return translateWhile(t, list, target);
+        case SPECIAL_LOOP:
+            return translateLoop(t, list, target);
+        case SPECIAL_RECUR:
+            return translateRecur(t, list, tail);
+        case SPECIAL_SET:
+            return translateSet(t, list, target);
+        case SPECIAL_AND:
+            if (list->count == 1) return translateConstant(t, makeBoolean(true), target);
+            return translateAndOr(t, &list->items[1], list->count - 1, true, target, tail);
+        case SPECIAL_OR:
+            if (list->count == 1) return translateConstant(t, NIL_VAL, target);
+            return translateAndOr(t, &list->items[1], list->count - 1, false, target, tail);
+        case SPECIAL_COND:
+            if ((list->count - 1) % 2 != 0) return false;
+            return translateClauses(t, &list->items[1], list->count - 1, target, tail);
+        case SPECIAL_DEF:
+            // Defs in functions and let bodies bind locals, which stay interpreted
+            if (!t->global || list->count != 3 || !IS_SYMBOL(list->items[1])) return false;
+            if (!translateExpression(t, list->items[2], target, false)) return false;
+            emitLine(t, "programDefine(symbols[%d], v[%d]);\n",
+                     symbolIndex(AS_SYMBOL(list->items[1])), target);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Code that leaves the value of expr in slot target of v
+static bool translateExpression(Translation* t, Value expr, int target, bool tail) {
+    int slotCount = t->slotCount;
+    bool translated;
+
+    if (IS_SYMBOL(expr)) {
+        int slot = localSlot(t, AS_SYMBOL(expr));
+        if (slot >= 0) {
+            emitLine(t, "v[%d] = v[%d];\n", target, slot);
+        } else {
+            emitLine(t, "v[%d] = programGlobal(&caches[%d], symbols[%d]);\n",
+                     target, emitter.cacheCount++, symbolIndex(AS_SYMBOL(expr)));
+        }
+        translated = true;
+    } else if (IS_LIST(expr)) {
+        translated = translateList(t, expr, target, tail);
+    } else {
+        translated = translateConstant(t, expr, target);
+    }
+
+    t->slotCount = slotCount;
+    return translated;
+}
+
+// The C function cName for body, taking params (NULL for a top-level form).
+// It is appended to out, unless some of body can't be translated.
+static bool translateBody(Text* out, const char* cName, List* params, Value* body,
+                          int bodyCount, int function) {
+    int arity = params != NULL ? params->count : 0;
+    if (arity > MAX_COMPILED_LOCALS || bodyCount < 1) return false;
+
+    Translation t;
+    t.code = (Text){NULL, 0, 0};
+    t.localCount = 0;
+    t.slotCount = 0;
+    t.maxSlots = 0;
+    t.function = function;
+    t.global = function < 0;
+    t.loops = false;
+    t.unwinds = false;
+    t.loopBindings = NULL;
+    t.loopSlot = 0;
+    t.depth = 1;
+
+    for (int i = 0; i < arity; i++) {
+        if (!IS_SYMBOL(params->items[i]) || localSlot(&t, AS_SYMBOL(params->items[i])) != -1) {
+            return false;
+        }
+        t.names[t.localCount] = AS_SYMBOL(params->items[i]);
+        t.slots[t.localCount++] = newSlot(&t);
+    }
+
+    int result = newSlot(&t);
+    bool translated = true;
+    for (int i = 0; i < bodyCount && translated; i++) {
+        translated = translateExpression(&t, body[i], result, function >= 0 && i == bodyCount - 1);
+    }
+
+    if (translated) {
+        appendText(out, "Value %s(", cName);
+        for (int i = 0; i < arity; i++) {
+            appendText(out, i > 0 ? ", Value a%d" : "Value a%d", i);
+        }
+        appendText(out, arity == 0 ? "void) {\n" : ") {\n");
+        appendText(out, "    Value v[%d];\n", t.maxSlots);
+        appendText(out, "    CompiledFrame frame;\n");
+        appendText(out, "    if (!programEnter(&frame, v, %d)) return NIL_VAL;\n", t.maxSlots);
+        for (int i = 0; i < arity; i++) {
+            appendText(out, "    v[%d] = a%d;\n", i, i);
+        }
+        if (t.loops) appendText(out, "top:\n");
+        appendText(out, "    collectGarbageIfNeeded();\n");
+        appendText(out, "%s", t.code.chars != NULL ? t.code.chars : "");
+        appendText(out, "    programLeave(&frame);\n");
+        appendText(out, "    return v[%d];\n", result);
+        if (t.unwinds) {
+            appendText(out, "unwind:\n");
+            appendText(out, "    programLeave(&frame);\n");
+            appendText(out, "    return NIL_VAL;\n");
+        }
+        appendText(out, "}\n\n");
+    }
+    freeText(&t.code);
+    return translated;
+}
+
+// The fn form of a top-level [def name [fn [params] body...]], or NULL
+static List* definedFunction(Value form) {
+    if (!IS_LIST(form)) return NULL;
+    List* def = AS_LIST(form);
+    if (specialForm(def) != SPECIAL_DEF || def->count != 3 || !IS_SYMBOL(def->items[1]) ||
+        !IS_LIST(def->items[2])) {
+        return NULL;
+    }
+
+    List* fn = AS_LIST(def->items[2]);
+    if (specialForm(fn) != SPECIAL_FN || fn->count < 3 || !IS_LIST(fn->items[1])) return NULL;
+    return fn;
+}
+
+// How many defs and sets of name expr contains
+static int countDefinitions(Value expr, Symbol* name) {
+    if (!IS_LIST(expr)) return 0;
+
+    List* list = AS_LIST(expr);
+    SpecialForm special = specialForm(list);
+    int count = (special == SPECIAL_DEF || special == SPECIAL_SET) && list->count > 1 &&
+                IS_SYMBOL(list->items[1]) && AS_SYMBOL(list->items[1]) == name;
+    for (int i = 0; i < list->count; i++) {
+        count += countDefinitions(list->items[i], name);
+    }
+    return count;
+}
+
+// Remember the names expr defines macros for
+static void collectMacroNames(Value expr) {
+    if (!IS_LIST(expr)) return;
+
+    List* list = AS_LIST(expr);
+    SpecialForm special = specialForm(list);
+    if (special == SPECIAL_QUOTE) return;
+    if (special == SPECIAL_DEFMACRO && list->count > 1 && IS_SYMBOL(list->items[1]) &&
+        !isMacroName(list->items[1])) {
+        emitter.macros = realloc(emitter.macros, sizeof(Symbol*) * (emitter.macroCount + 1));
+        if (emitter.macros == NULL) {
+            fprintf(stderr, "Not enough memory to emit C.\n");
+            exit(74);
+        }
+        emitter.macros[emitter.macroCount++] = AS_SYMBOL(list->items[1]);
+    }
+    for (int i = 0; i < list->count; i++) {
+        collectMacroNames(list->items[i]);
+    }
+}
+
+static void addCompiledFunction(Symbol* name, int arity, int form) {
+    if (emitter.compiledCount == emitter.compiledCapacity) {
+        int capacity = emitter.compiledCapacity < 8 ? 8 : emitter.compiledCapacity * 2;
+        emitter.compiled = realloc(emitter.compiled, sizeof(CompiledFunction) * capacity);
+        if (emitter.compiled == NULL) {
+            fprintf(stderr, "Not enough memory to emit C.\n");
+            exit(74);
+        }
+        emitter.compiledCapacity = capacity;
+    }
+
+    CompiledFunction* function = &emitter.compiled[emitter.compiledCount];
+    function->name = name;
+    function->arity = arity;
+    function->form = form;
+    function->closure = emitter.compiledCount;
+    function->direct = true;
+
+    // C names keep the letters and digits of the Hexa one
+    int length = snprintf(function->cName, sizeof(function->cName), "hexa_");
+    for (int i = 0; i < name->length && length < 40; i++) {
+        char c = name->chars[i];
+        bool keep = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        function->cName[length++] = keep ? c : '_';
+    }
+    snprintf(function->cName + length, sizeof(function->cName) - length, "_%d",
+             emitter.compiledCount);
+    emitter.compiledCount++;
+}
+
+typedef struct {
+    Value form;
+    const char* source;
+    int length;
+} TopLevelForm;
+
+// Write source, read from path, to out as a C program
+bool emitProgram(const char* source, const char* path, Environment* globals, FILE* out) {
+    memset(&emitter, 0, sizeof(emitter));
+    emitter.globals = globals;
+
+    // Forms keep their source text for the interpreter to run
+    TopLevelForm* forms = NULL;
+    int formCount = 0;
+    initLexer(source);
+    initParser();
+    while (getCurrentToken().type != TOKEN_EOF) {
+        const char* start = getCurrentToken().lexeme;
+        Value form = parseExpression();
+        pushRoot(form);
+        const char* end = getCurrentToken().lexeme;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t' ||
+                               end[-1] == '\r' || end[-1] == '\n')) {
+            end--;
+        }
+
+        forms = realloc(forms, sizeof(TopLevelForm) * (formCount + 1));
+        if (forms == NULL) {
+            fprintf(stderr, "Not enough memory to emit C.\n");
+            exit(74);
+        }
+        forms[formCount].form = form;
+        forms[formCount].source = start;
+        forms[formCount].length = (int)(end - start);
+        formCount++;
+        collectMacroNames(form);
+    }
+
+    // Find the functions that compile first, so calls of functions defined
+    // further down can be direct too
+    for (int i = 0; i < formCount; i++) {
+        List* fn = definedFunction(forms[i].form);
+        if (fn == NULL) continue;
+
+        Text scratch = {NULL, 0, 0};
+        EmitterMark mark = markEmitter();
+        Symbol* name = AS_SYMBOL(AS_LIST(forms[i].form)->items[1]);
+        List* params = AS_LIST(fn->items[1]);
+        if (translateBody(&scratch, "scratch", params, &fn->items[2], fn->count - 2,
+                          emitter.compiledCount)) {
+            addCompiledFunction(name, params->count, i);
+        }
+        resetEmitter(mark);
+        freeText(&scratch);
+    }
+    for (int i = 0; i < emitter.compiledCount; i++) {
+        CompiledFunction* function = &emitter.compiled[i];
+        int definitions = 0;
+        for (int j = 0; j < formCount; j++) {
+            definitions += countDefinitions(forms[j].form, function->name);
+        }
+        function->direct = definitions == 1;
+    }
+
+    int compiled = 0;
+    for (int i = 0; i < formCount; i++) {
+        List* fn = definedFunction(forms[i].form);
+        if (compiled < emitter.compiledCount && emitter.compiled[compiled].form == i) {
+            // The interpreter makes the closure, the C function runs its calls
+            CompiledFunction* function = &emitter.compiled[compiled++];
+            translateBody(&emitter.functions, function->cName, AS_LIST(fn->items[1]),
+                          &fn->items[2], fn->count - 2, function->closure);
+            appendText(&emitter.prototypes, "Value %s(", function->cName);
+            for (int j = 0; j < function->arity; j++) {
+                appendText(&emitter.prototypes, j > 0 ? ", Value a%d" : "Value a%d", j);
+            }
+            appendText(&emitter.prototypes, function->arity == 0 ? "void);\n" : ");\n");
+
+            appendText(&emitter.body, "    programRun(");
+            appendStringLiteral(&emitter.body, forms[i].source, forms[i].length);
+            appendText(&emitter.body, ");\n");
+            appendText(&emitter.body, "    closures[%d] = programClosure(symbols[%d]);\n",
+                       function->closure, symbolIndex(function->name));
+            continue;
+        }
+
+        char cName[32];
+        snprintf(cName, sizeof(cName), "hexa_form_%d", i + 1);
+        EmitterMark mark = markEmitter();
+        if (fn == NULL && translateBody(&emitter.functions, cName, NULL, &forms[i].form, 1, -1)) {
+            appendText(&emitter.prototypes, "Value %s(void);\n", cName);
+            appendText(&emitter.body, "    programResult(%s());\n", cName);
+        } else {
+            resetEmitter(mark);
+            appendText(&emitter.body, "    programRun(");
+            appendStringLiteral(&emitter.body, forms[i].source, forms[i].length);
+            appendText(&emitter.body, ");\n");
+        }
+    }
+    popRoots(formCount);
+
+    // Arrays can't be empty
+    int symbolCount = emitter.symbolCount > 0 ? emitter.symbolCount : 1;
+    int constantCount = emitter.constantCount > 0 ? emitter.constantCount : 1;
+    int closureCount = emitter.compiledCount > 0 ? emitter.compiledCount : 1;
+    int cacheCount = emitter.cacheCount > 0 ? emitter.cacheCount : 1;
+
+    fprintf(out, "// Generated by hexai --emit-c from %s. Build it with -I include and\n", path);
+    fprintf(out, "// every file in src but main.c, and link with -lm -lpthread.\n");
+    fprintf(out, "#include \"hexa.h\"\n\n");
+    fprintf(out, "static Symbol* symbols[%d];\n", symbolCount);
+    fprintf(out, "static Value constants[%d];\n", constantCount);
+    fprintf(out, "static Value closures[%d];\n", closureCount);
+    fprintf(out, "static GlobalCache caches[%d];\n\n", cacheCount);
+    if (emitter.prototypes.length > 0) fprintf(out, "%s\n", emitter.prototypes.chars);
+    if (emitter.functions.length > 0) fprintf(out, "%s", emitter.functions.chars);
+    fprintf(out, "int main(void) {\n");
+    fprintf(out, "    programStart(constants, %d, closures, %d);\n", constantCount, closureCount);
+    if (emitter.setup.length > 0) fprintf(out, "%s", emitter.setup.chars);
+    if (emitter.body.length > 0) fprintf(out, "%s", emitter.body.chars);
+    fprintf(out, "    return programFinish();\n");
+    fprintf(out, "}\n");
+
+    freeText(&emitter.prototypes);
+    freeText(&emitter.functions);
+    freeText(&emitter.setup);
+    freeText(&emitter.body);
+    free(emitter.symbols);
+    free(emitter.compiled);
+    free(emitter.macros);
+    free(forms);
+    return !ferror(out);
+}
+
+// Runtime support for generated programs
+
+HEXA_THREAD_LOCAL bool programUnwinding = false;
+
+static HEXA_THREAD_LOCAL Environment* programGlobals;
+static HEXA_THREAD_LOCAL CompiledFrame* compiledFrames;
+static HEXA_THREAD_LOCAL int compiledDepth;
+static HEXA_THREAD_LOCAL CompiledFrame constantFrame;
+static HEXA_THREAD_LOCAL CompiledFrame closureFrame;
+
+// Set up the runtime. The constants and closures stay GC roots.
+void programStart(Value* constants, int constantCount, Value* closures, int closureCount) {
+    programGlobals = createEnvironment();
+    pushEnvironmentRoot(programGlobals);
+    initGlobalEnvironment(programGlobals);
+    initVM();
+
+    for (int i = 0; i < constantCount; i++) {
+        constants[i] = NIL_VAL;
+    }
+    for (int i = 0; i < closureCount; i++) {
+        closures[i] = NIL_VAL;
+    }
+    constantFrame = (CompiledFrame){constants, constantCount, NULL};
+    closureFrame = (CompiledFrame){closures, closureCount, &constantFrame};
+    compiledFrames = &closureFrame;
+    compiledDepth = 0;
+}
+
+int programFinish() {
+    freeVM();
+    freeObjects();
+    freeSymbols();
+    return 0;
+}
+
+// Parse, expand, optimize and run the forms in source, like hexai does
+void programRun(const char* source) {
+    initLexer(source);
+    initParser();
+    while (getCurrentToken().type != TOKEN_EOF) {
+        Value expr = parseExpression();
+        pushRoot(expr);
+        expr = expandMacros(expr);
+        pushRoot(expr);
+        Value optimized = optimize(expr, programGlobals);
+        pushRoot(optimized);
+        programResult(interpret(optimized, programGlobals));
+        popRoots(3);
+    }
+}
+
+// Print the result of a top-level form, unless it is nil
+void programResult(Value result) {
+    programUnwinding = false;
+    if (!IS_NIL(result)) {
+        printValue(result);
+        printf("\n");
+    }
+}
+
+Value programQuote(const char* source) {
+    return parse(source);
+}
+
+// The closure name holds, or nil
+Value programClosure(Symbol* name) {
+    Value value;
+    if (lookupVariable(programGlobals, name, &value) && IS_FUNCTION(value)) return value;
+    return NIL_VAL;
+}
+
+void programDefine(Symbol* name, Value value) {
+    defineVariable(programGlobals, name, value);
+}
+
+// Assign the global name, and the value of the set, nil if name is undefined
+Value programSet(Symbol* name, Value value) {
+    return assignVariable(programGlobals, name, value) ? value : NIL_VAL;
+}
+
+Value lookupProgramGlobal(GlobalCache* cache, Symbol* name) {
+    Value value;
+    if (!lookupVariable(programGlobals, name, &value)) return getVariable(programGlobals, name);
+
+    cache->version = globalsVersion;
+    cache->value = value;
+    return value;
+}
+
+Value programCall(Value callee, int argCount, Value* args) {
+    return callFunction(callee, argCount, args, programGlobals);
+}
+
+// Register the count values of a compiled function or form, all nil.
+// Forms count as a frame, like the VM's top-level code.
+bool programEnter(CompiledFrame* frame, Value* values, int count) {
+    if (compiledDepth > maxCallDepth()) {
+        runtimeError("Stack overflow: more than %d nested calls.", maxCallDepth());
+
+        // The outermost call returns nil to its form, like in the VM
+        programUnwinding = compiledDepth > 1;
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        values[i] = NIL_VAL;
+    }
+    frame->values = values;
+    frame->count = count;
+    frame->previous = compiledFrames;
+    compiledFrames = frame;
+    compiledDepth++;
+    allocStats.calls++;
+    return true;
+}
+
+void programLeave(CompiledFrame* frame) {
+    compiledFrames = frame->previous;
+    if (--compiledDepth == 1) programUnwinding = false;
+}
+
+void markProgramFrames() {
+    for (CompiledFrame* frame = compiledFrames; frame != NULL; frame = frame->previous) {
+        for (int i = 0; i < frame->count; i++) {
+            markValue(frame->values[i]);
+        }
+    }
+}
@@ -1,10 +1,24 @@
 #include "../include/hexa.h"
 
+#define TABLE_MAX_LOAD 0.75
+#define FRAME_POOL_INITIAL 64
+#define FRAME_POOL_TASK 4
+
+// Bumped whenever a global is defined or assigned, which invalidates every
+// cached global lookup. Starts at 1 so a zeroed cache is never valid.
+HEXA_THREAD_LOCAL uint32_t globalsVersion = 1;
+
+// Environments start as a tiny inline array that is scanned linearly, which
+// is all a typical call frame needs. Once that fills up the entries move to
+// an open-addressing table keyed by the symbol's precomputed hash.
+
 Environment* createEnvironment() {
-    Environment* env = malloc(sizeof(Environment));
+    Environment* env = (Environment*)allocateObject(sizeof(Environment), OBJ_ENVIRONMENT);
     env->count = 0;
-    env->capacity = 0;
-    env->entries = NULL;
+    env->capacity = ENV_INLINE_ENTRIES;
+    env->entries = env->inlineEntries;
+    env->hashed = false;
+    env->pooled = false;
     env->enclosing = NULL;
     return env;
 }
@@ -15,75 +29,271 @@ Environment* createEnclosedEnvironment(Environment* enclosing) {
     return env;
 }
 
-void freeEnvironment(Environment* env) {
-    for (int i = 0; i < env->count; i++) {
-        free(env->entries[i].key);
-        freeValue(env->entries[i].value);
+// A call frame: slotCount entries addressed by index, all unbound. Parameters
+// and locals resolved by the compiler live at fixed slots, and a slot is
+// bound by storing its name in the key.
+Environment* createFrame(Environment* enclosing, int slotCount) {
+    Environment* env = createEnclosedEnvironment(enclosing);
+    if (slotCount > ENV_INLINE_ENTRIES) {
+        env->entries = reallocate(NULL, 0, sizeof(Entry) * slotCount);
+        env->capacity = slotCount;
+    }
+
+    for (int i = 0; i < slotCount; i++) {
+        env->entries[i].key = NULL;
+        env->entries[i].value = NIL_VAL;
     }
-    
-    free(env->entries);
-    free(env);
+    env->count = slotCount;
+    return env;
 }
 
-static void ensureCapacity(Environment* env) {
-    if (env->capacity < env->count + 1) {
-        int oldCapacity = env->capacity;
-        env->capacity = oldCapacity < 8 ? 8 : oldCapacity * 2;
-        env->entries = realloc(env->entries, sizeof(Entry) * env->capacity);
+// The frame pool of the code running now. Each task has one of its own,
+// swapped in while it runs, since tasks release frames in no common order.
+static HEXA_THREAD_LOCAL FramePool pool;
+
+static void growFramePool(int capacity) {
+    int oldCapacity = pool.capacity;
+    pool.capacity = capacity;
+    pool.frames = reallocate(pool.frames, sizeof(Environment*) * oldCapacity,
+                             sizeof(Environment*) * capacity);
+
+    for (int i = oldCapacity; i < capacity; i++) {
+        Environment* env = reallocate(NULL, 0, sizeof(Environment));
+        env->obj.type = OBJ_ENVIRONMENT;
+        env->obj.inArena = false;
+        env->obj.next = NULL;
+        // Permanently marked so the collector never traces or frees it on
+        // its own, markFramePool() traces the frames in use instead
+        env->obj.isMarked = true;
+        env->entries = env->inlineEntries;
+        env->capacity = ENV_INLINE_ENTRIES;
+        env->pooled = true;
+        pool.frames[i] = env;
     }
 }
 
-void defineVariable(Environment* env, const char* name, Value value) {
-    // Check if variable already exists
+// Allocate the first frames up front, so shallow programs never grow the pool
+void initFramePool() {
+    if (pool.capacity < FRAME_POOL_INITIAL) growFramePool(FRAME_POOL_INITIAL);
+}
+
+// Like createFrame, but the frame is reused once released. Frames are
+// released in the reverse order they were acquired.
+Environment* acquireFrame(Environment* enclosing, int slotCount) {
+    // A task's pool starts empty and grows with its call depth
+    if (pool.count == pool.capacity) {
+        growFramePool(pool.capacity < FRAME_POOL_TASK ? FRAME_POOL_TASK : pool.capacity * 2);
+    }
+
+    Environment* env = pool.frames[pool.count++];
+
+    // Keep the entries of the previous use when they are big enough
+    if (slotCount > env->capacity) {
+        if (env->entries != env->inlineEntries) {
+            reallocate(env->entries, sizeof(Entry) * env->capacity, 0);
+        }
+        env->entries = reallocate(NULL, 0, sizeof(Entry) * slotCount);
+        env->capacity = slotCount;
+    }
+
+    for (int i = 0; i < slotCount; i++) {
+        env->entries[i].key = NULL;
+        env->entries[i].value = NIL_VAL;
+    }
+    env->count = slotCount;
+    env->hashed = false;
+    env->enclosing = enclosing;
+    return env;
+}
+
+void releaseFrame(Environment* env) {
+    (void)env;
+    pool.count--;
+}
+
+static void markPool(FramePool* frames) {
+    for (int i = 0; i < frames->count; i++) {
+        Environment* env = frames->frames[i];
+        for (int j = 0; j < env->capacity; j++) {
+            if (!env->hashed && j >= env->count) break;
+            if (env->entries[j].key == NULL) continue;
+            markValue(env->entries[j].value);
+        }
+        if (env->enclosing != NULL) markObject(&env->enclosing->obj);
+    }
+}
+
+static void freePool(FramePool* frames) {
+    for (int i = 0; i < frames->capacity; i++) {
+        Environment* env = frames->frames[i];
+        if (env->entries != env->inlineEntries) {
+            reallocate(env->entries, sizeof(Entry) * env->capacity, 0);
+        }
+        reallocate(env, sizeof(Environment), 0);
+    }
+    reallocate(frames->frames, sizeof(Environment*) * frames->capacity, 0);
+    frames->frames = NULL;
+    frames->count = frames->capacity = 0;
+}
+
+void markFramePool() {
+    markPool(&pool);
+}
+
+// Free the pooled frames at exit
+void freeFramePool() {
+    freePool(&pool);
+}
+
+// Make saved the pool frames come from, keeping the current one in saved
+void swapFramePool(FramePool* saved) {
+    FramePool current = pool;
+    pool = *saved;
+    *saved = current;
+}
+
+// The frames in use in the pool of a suspended task
+void markSavedFramePool(FramePool* saved) {
+    markPool(saved);
+}
+
+void freeSavedFramePool(FramePool* saved) {
+    freePool(saved);
+}
+
+static Entry* findEntry(Entry* entries, int capacity, Symbol* key) {
+    uint32_t index = key->hash & (capacity - 1);
+    for (;;) {
+        Entry* entry = &entries[index];
+        if (entry->key == key || entry->key == NULL) return entry;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void growTable(Environment* env) {
+    int capacity = env->hashed ? env->capacity * 2 : ENV_INLINE_ENTRIES * 4;
+    while (capacity * TABLE_MAX_LOAD < env->count + 1) capacity *= 2;
+    Entry* entries = reallocate(NULL, 0, sizeof(Entry) * capacity);
+    for (int i = 0; i < capacity; i++) {
+        entries[i].key = NULL;
+        entries[i].value = NIL_VAL;
+    }
+
+    // Unbound frame slots are dropped, so recount
+    int count = 0;
+    for (int i = 0; i < env->capacity; i++) {
+        if (!env->hashed && i >= env->count) break;
+        Entry* entry = &env->entries[i];
+        if (entry->key == NULL) continue;
+
+        Entry* dest = findEntry(entries, capacity, entry->key);
+        *dest = *entry;
+        count++;
+    }
+
+    if (env->entries != env->inlineEntries) {
+        reallocate(env->entries, sizeof(Entry) * env->capacity, 0);
+    }
+    env->entries = entries;
+    env->capacity = capacity;
+    env->count = count;
+    env->hashed = true;
+}
+
+// Find the entry for name in this environment only, or NULL
+static Entry* lookup(Environment* env, Symbol* name) {
+    if (env->hashed) {
+        Entry* entry = findEntry(env->entries, env->capacity, name);
+        return entry->key == NULL ? NULL : entry;
+    }
+
     for (int i = 0; i < env->count; i++) {
-        if (strcmp(env->entries[i].key, name) == 0) {
-            freeValue(env->entries[i].value);
-            env->entries[i].value = value;
-            return;
+        if (env->entries[i].key == name) return &env->entries[i];
+    }
+    return NULL;
+}
+
+void defineVariable(Environment* env, Symbol* name, Value value) {
+    if (env->enclosing == NULL) globalsVersion++;
+
+    // Check if variable already exists
+    Entry* entry = lookup(env, name);
+    if (entry != NULL) {
+        // Code folded while this global was a pure built-in no longer holds
+        if (env->enclosing == NULL && IS_NATIVE(entry->value) && AS_NATIVE(entry->value)->pure) {
+            invalidateFolds();
         }
+        entry->value = value;
+        return;
     }
-    
+
     // Add new entry
-    ensureCapacity(env);
-    env->entries[env->count].key = strdup(name);
-    env->entries[env->count].value = value;
+    if (env->hashed ? env->count + 1 > env->capacity * TABLE_MAX_LOAD
+                    : env->count == env->capacity) {
+        growTable(env);
+    }
+
+    entry = env->hashed ? findEntry(env->entries, env->capacity, name)
+                        : &env->entries[env->count];
+    entry->key = name;
+    entry->value = value;
     env->count++;
 }
 
-Value getVariable(Environment* env, const char* name) {
-    // Search in current environment
-    for (int i = 0; i < env->count; i++) {
-        if (strcmp(env->entries[i].key, name) == 0) {
-            return env->entries[i].value;
+Value getVariable(Environment* env, Symbol* name) {
+    // Search this environment, then the enclosing ones
+    for (; env != NULL; env = env->enclosing) {
+        bool global = env->enclosing == NULL;
+        if (global && name->cachedIn == env && name->cacheVersion == globalsVersion) {
+            cacheStats.globalHits++;
+            return env->entries[name->cacheSlot].value;
+        }
+
+        Entry* entry = lookup(env, name);
+        if (entry != NULL) {
+            // Remember where the global is until the globals change
+            if (global) {
+                cacheStats.globalMisses++;
+                name->cachedIn = env;
+                name->cacheVersion = globalsVersion;
+                name->cacheSlot = (int)(entry - env->entries);
+            }
+            return entry->value;
         }
     }
-    
-    // Search in enclosing environment
-    if (env->enclosing != NULL) {
-        return getVariable(env->enclosing, name);
-    }
-    
+
     // Variable not found
-    runtimeError("Undefined variable '%s'.", name);
+    runtimeError("Undefined variable '%s'.", name->chars);
     return NIL_VAL;
 }
 
-bool assignVariable(Environment* env, const char* name, Value value) {
-    // Search in current environment
-    for (int i = 0; i < env->count; i++) {
-        if (strcmp(env->entries[i].key, name) == 0) {
-            freeValue(env->entries[i].value);
-            env->entries[i].value = value;
+// Like getVariable, but without an error when name is unbound
+bool lookupVariable(Environment* env, Symbol* name, Value* value) {
+    for (; env != NULL; env = env->enclosing) {
+        Entry* entry = lookup(env, name);
+        if (entry != NULL) {
+            *value = entry->value;
             return true;
         }
     }
-    
-    // Search in enclosing environment
-    if (env->enclosing != NULL) {
-        return assignVariable(env->enclosing, name, value);
+    return false;
+}
+
+bool assignVariable(Environment* env, Symbol* name, Value value) {
+    // Search this environment, then the enclosing ones
+    for (; env != NULL; env = env->enclosing) {
+        Entry* entry = lookup(env, name);
+        if (entry != NULL) {
+            if (env->enclosing == NULL) {
+                globalsVersion++;
+                if (IS_NATIVE(entry->value) && AS_NATIVE(entry->value)->pure) invalidateFolds();
+            }
+            entry->value = value;
+            return true;
+        }
     }
-    
+
     // Variable not found
-    runtimeError("Undefined variable '%s'.", name);
+    runtimeError("Undefined variable '%s'.", name->chars);
     return false;
-} 
\ No newline at end of file
+}
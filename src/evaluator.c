@@ -1,14 +1,67 @@
 #include "../include/hexa.h"
+#include <math.h>
 #include <stdarg.h>
+#include <time.h>
+
+// Callees and arguments of the applications in progress. It is a GC root
+// and only grows, so steady-state calls don't allocate.
+typedef struct {
+    Value* values;
+    int count;
+    int capacity;
+} ValueStack;
+
+static HEXA_THREAD_LOCAL ValueStack stack;
+
+// Nesting of calls in progress, and whether a stack overflow is unwinding them
+static HEXA_THREAD_LOCAL int callDepth = 0;
+static HEXA_THREAD_LOCAL bool unwinding = false;
 
 // Forward declarations
 static Value evaluateList(Value list, Environment* env);
+static Value desugared(List* form, Environment* env, bool* tail);
+
+static void pushValue(Value value) {
+    if (stack.count == stack.capacity) {
+        int oldCapacity = stack.capacity;
+        stack.capacity = oldCapacity < 256 ? 256 : oldCapacity * 2;
+        stack.values = reallocate(stack.values, sizeof(Value) * oldCapacity,
+                                  sizeof(Value) * stack.capacity);
+    }
+    stack.values[stack.count++] = value;
+}
+
+void markEvaluatorRoots() {
+    for (int i = 0; i < stack.count; i++) {
+        markValue(stack.values[i]);
+    }
+}
+
+void freeEvaluator() {
+    reallocate(stack.values, sizeof(Value) * stack.capacity, 0);
+    stack.values = NULL;
+    stack.count = stack.capacity = 0;
+    callDepth = 0;
+    unwinding = false;
+}
+
+// While set, runtime errors are noted instead of reported, so a native can
+// be tried ahead of time
+static HEXA_THREAD_LOCAL bool quietErrors = false;
+static HEXA_THREAD_LOCAL bool quietErrorRaised = false;
 
 // Helper for error reporting
 static void runtimeErrorVA(const char* format, va_list args) {
-    fprintf(stderr, "Runtime Error: ");
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n");
+    if (quietErrors) {
+        quietErrorRaised = true;
+        return;
+    }
+
+    // One write per error, so errors of interpreters on other threads don't
+    // interleave with it
+    char message[1024];
+    vsnprintf(message, sizeof(message), format, args);
+    fprintf(stderr, "Runtime Error: %s\n", message);
 }
 
 void runtimeError(const char* format, ...) {
@@ -18,25 +71,39 @@ void runtimeError(const char* format, ...) {
     va_end(args);
 }
 
+// The caller keeps expr and env reachable from a GC root while this runs
 Value evaluate(Value expr, Environment* env) {
-    switch (expr.type) {
+    switch (valueType(expr)) {
         case VAL_NUMBER:
+        case VAL_INT:
         case VAL_BOOLEAN:
         case VAL_STRING:
         case VAL_NIL:
         case VAL_FUNCTION:
         case VAL_NATIVE:
+        case VAL_TASK:
+        case VAL_CHANNEL:
+        case VAL_VECTOR:
             return expr;
         case VAL_SYMBOL:
-            return getVariable(env, expr.as.symbol);
+            return getVariable(env, AS_SYMBOL(expr));
         case VAL_LIST:
             return evaluateList(expr, env);
         default:
-            runtimeError("Cannot evaluate unknown value type %d.", expr.type);
+            runtimeError("Cannot evaluate unknown value type %d.", valueType(expr));
             return NIL_VAL;
     }
 }
 
+// Call native without reporting errors, false if it raised one
+bool callNativeQuietly(Native* native, int argCount, Value* args, Value* result) {
+    quietErrors = true;
+    quietErrorRaised = false;
+    *result = native->function(argCount, args);
+    quietErrors = false;
+    return !quietErrorRaised;
+}
+
 // Native function implementations
 static Value nativePrint(int argCount, Value* args) {
     for (int i = 0; i < argCount; i++) {
@@ -47,312 +114,782 @@ static Value nativePrint(int argCount, Value* args) {
     return NIL_VAL;
 }
 
-static Value nativeAdd(int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeError("Expected 2 arguments but got %d.", argCount);
+// Processor time in seconds, used by the benchmark scripts
+static Value nativeClock(int argCount, Value* args) {
+    (void)args;
+    if (argCount != 0) {
+        runtimeError("Expected 0 arguments but got %d.", argCount);
         return NIL_VAL;
     }
     
-    if (args[0].type == VAL_NUMBER && args[1].type == VAL_NUMBER) {
-        return makeNumber(args[0].as.number + args[1].as.number);
+    return makeNumber((double)clock() / CLOCKS_PER_SEC);
+}
+
+// Arithmetic and comparisons take any number of arguments and fold over
+// them in one call. Integers stay integers until a result leaves HEXA_INT
+// range, then makeInt turns it into a double. Sums and differences of two
+// integers can't overflow an int64_t.
+static bool checkNumbers(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) {
+            runtimeError("Arguments must be numbers.");
+            return false;
+        }
     }
-    
-    runtimeError("Arguments must be numbers.");
-    return NIL_VAL;
+    return true;
 }
 
-static Value nativeSubtract(int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeError("Expected 2 arguments but got %d.", argCount);
+static bool checkAtLeast(int argCount, int min) {
+    if (argCount < min) {
+        runtimeError("Expected at least %d arguments but got %d.", min, argCount);
+        return false;
+    }
+    return true;
+}
+
+static Value add(Value a, Value b) {
+    if (IS_INT(a) && IS_INT(b)) return makeInt(AS_INT(a) + AS_INT(b));
+    return makeNumber(AS_NUMBER(a) + AS_NUMBER(b));
+}
+
+static Value subtract(Value a, Value b) {
+    if (IS_INT(a) && IS_INT(b)) return makeInt(AS_INT(a) - AS_INT(b));
+    return makeNumber(AS_NUMBER(a) - AS_NUMBER(b));
+}
+
+static Value multiply(Value a, Value b) {
+    if (IS_INT(a) && IS_INT(b)) {
+        // A product that is in range as a double is close enough to the
+        // real one to multiply exactly in an int64_t
+        double product = (double)AS_INT(a) * (double)AS_INT(b);
+        if (product >= (double)HEXA_INT_MIN && product <= (double)HEXA_INT_MAX) {
+            return makeInt(AS_INT(a) * AS_INT(b));
+        }
+        return makeNumber(product);
+    }
+    return makeNumber(AS_NUMBER(a) * AS_NUMBER(b));
+}
+
+// Sets *ok to false after reporting division by zero
+static Value divide(Value a, Value b, bool* ok) {
+    if (AS_NUMBER(b) == 0) {
+        runtimeError("Division by zero.");
+        *ok = false;
         return NIL_VAL;
     }
+    // Exact quotients of integers are integers, others are doubles
+    if (IS_INT(a) && IS_INT(b) && AS_INT(a) % AS_INT(b) == 0) {
+        return makeInt(AS_INT(a) / AS_INT(b));
+    }
+    return makeNumber(AS_NUMBER(a) / AS_NUMBER(b));
+}
+
+// -1, 0 or 1 as a is less than, equal to or greater than b, 2 if unordered
+static int compareNumbers(Value a, Value b) {
+    if (IS_INT(a) && IS_INT(b)) return (AS_INT(a) > AS_INT(b)) - (AS_INT(a) < AS_INT(b));
+    double x = AS_NUMBER(a), y = AS_NUMBER(b);
+    if (x != x || y != y) return 2;     // NaN is unordered
+    return (x > y) - (x < y);
+}
+
+// [+] is 0, [+ a] is a
+static Value nativeAdd(int argCount, Value* args) {
+    if (!checkNumbers(argCount, args)) return NIL_VAL;
     
-    if (args[0].type == VAL_NUMBER && args[1].type == VAL_NUMBER) {
-        return makeNumber(args[0].as.number - args[1].as.number);
+    Value result = argCount > 0 ? args[0] : makeInt(0);
+    for (int i = 1; i < argCount; i++) {
+        result = add(result, args[i]);
     }
+    return result;
+}
+
+// [- a] negates a
+static Value nativeSubtract(int argCount, Value* args) {
+    if (!checkAtLeast(argCount, 1) || !checkNumbers(argCount, args)) return NIL_VAL;
     
-    runtimeError("Arguments must be numbers.");
-    return NIL_VAL;
+    if (argCount == 1) return subtract(makeInt(0), args[0]);
+    Value result = args[0];
+    for (int i = 1; i < argCount; i++) {
+        result = subtract(result, args[i]);
+    }
+    return result;
 }
 
+// [*] is 1, [* a] is a
 static Value nativeMultiply(int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeError("Expected 2 arguments but got %d.", argCount);
-        return NIL_VAL;
-    }
+    if (!checkNumbers(argCount, args)) return NIL_VAL;
     
-    if (args[0].type == VAL_NUMBER && args[1].type == VAL_NUMBER) {
-        return makeNumber(args[0].as.number * args[1].as.number);
+    Value result = argCount > 0 ? args[0] : makeInt(1);
+    for (int i = 1; i < argCount; i++) {
+        result = multiply(result, args[i]);
     }
-    
-    runtimeError("Arguments must be numbers.");
-    return NIL_VAL;
+    return result;
 }
 
+// [/ a] is the reciprocal of a
 static Value nativeDivide(int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeError("Expected 2 arguments but got %d.", argCount);
-        return NIL_VAL;
-    }
+    if (!checkAtLeast(argCount, 1) || !checkNumbers(argCount, args)) return NIL_VAL;
     
-    if (args[0].type == VAL_NUMBER && args[1].type == VAL_NUMBER) {
-        if (args[1].as.number == 0) {
-            runtimeError("Division by zero.");
-            return NIL_VAL;
-        }
-        return makeNumber(args[0].as.number / args[1].as.number);
+    bool ok = true;
+    if (argCount == 1) return divide(makeInt(1), args[0], &ok);
+    Value result = args[0];
+    for (int i = 1; i < argCount && ok; i++) {
+        result = divide(result, args[i], &ok);
     }
-    
-    runtimeError("Arguments must be numbers.");
-    return NIL_VAL;
+    return result;
 }
 
+// Comparisons hold when they hold for every adjacent pair, so [< a b c]
+// means a < b and b < c
 static Value nativeEqual(int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeError("Expected 2 arguments but got %d.", argCount);
-        return NIL_VAL;
-    }
+    if (!checkAtLeast(argCount, 1)) return NIL_VAL;
     
-    if (args[0].type != args[1].type) {
-        return makeBoolean(false);
+    for (int i = 1; i < argCount; i++) {
+        if (!valuesEqual(args[i - 1], args[i])) return makeBoolean(false);
     }
+    return makeBoolean(true);
+}
+
+// Each comparison of adjacent numbers must give one of the two results
+// in accept
+static Value compareChain(int argCount, Value* args, int accept1, int accept2) {
+    if (!checkAtLeast(argCount, 1) || !checkNumbers(argCount, args)) return NIL_VAL;
     
-    switch (args[0].type) {
-        case VAL_NIL:
-            return makeBoolean(true);
-        case VAL_BOOLEAN:
-            return makeBoolean(args[0].as.boolean == args[1].as.boolean);
-        case VAL_NUMBER:
-            return makeBoolean(args[0].as.number == args[1].as.number);
-        case VAL_STRING:
-            return makeBoolean(strcmp(args[0].as.string, args[1].as.string) == 0);
-        case VAL_SYMBOL:
-            return makeBoolean(strcmp(args[0].as.symbol, args[1].as.symbol) == 0);
-        default:
-            return makeBoolean(false);
+    for (int i = 1; i < argCount; i++) {
+        int order = compareNumbers(args[i - 1], args[i]);
+        if (order != accept1 && order != accept2) return makeBoolean(false);
     }
+    return makeBoolean(true);
 }
 
 static Value nativeLessThan(int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeError("Expected 2 arguments but got %d.", argCount);
-        return NIL_VAL;
-    }
+    return compareChain(argCount, args, -1, -1);
+}
+
+static Value nativeGreaterThan(int argCount, Value* args) {
+    return compareChain(argCount, args, 1, 1);
+}
+
+static Value nativeLessEqual(int argCount, Value* args) {
+    return compareChain(argCount, args, -1, 0);
+}
+
+static Value nativeGreaterEqual(int argCount, Value* args) {
+    return compareChain(argCount, args, 1, 0);
+}
+
+// The smallest (order -1) or largest (order 1) argument, as it was passed
+static Value extreme(int argCount, Value* args, int order) {
+    if (!checkAtLeast(argCount, 1) || !checkNumbers(argCount, args)) return NIL_VAL;
     
-    if (args[0].type == VAL_NUMBER && args[1].type == VAL_NUMBER) {
-        return makeBoolean(args[0].as.number < args[1].as.number);
+    Value result = args[0];
+    for (int i = 1; i < argCount; i++) {
+        if (compareNumbers(args[i], result) == order) result = args[i];
+    }
+    return result;
+}
+
+static Value nativeMin(int argCount, Value* args) {
+    return extreme(argCount, args, -1);
+}
+
+static Value nativeMax(int argCount, Value* args) {
+    return extreme(argCount, args, 1);
+}
+
+static Value nativeAbs(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
     }
+    if (!checkNumbers(argCount, args)) return NIL_VAL;
     
-    runtimeError("Arguments must be numbers.");
-    return NIL_VAL;
+    if (IS_INT(args[0])) return makeInt(AS_INT(args[0]) < 0 ? -AS_INT(args[0]) : AS_INT(args[0]));
+    return makeNumber(fabs(AS_DOUBLE(args[0])));
 }
 
-static Value nativeGreaterThan(int argCount, Value* args) {
+// The remainder takes the sign of the divisor, so [mod -1 3] is 2
+static Value nativeMod(int argCount, Value* args) {
     if (argCount != 2) {
         runtimeError("Expected 2 arguments but got %d.", argCount);
         return NIL_VAL;
     }
+    if (!checkNumbers(argCount, args)) return NIL_VAL;
     
-    if (args[0].type == VAL_NUMBER && args[1].type == VAL_NUMBER) {
-        return makeBoolean(args[0].as.number > args[1].as.number);
+    if (AS_NUMBER(args[1]) == 0) {
+        runtimeError("Division by zero.");
+        return NIL_VAL;
     }
-    
-    runtimeError("Arguments must be numbers.");
-    return NIL_VAL;
+    if (IS_INT(args[0]) && IS_INT(args[1])) {
+        int64_t remainder = AS_INT(args[0]) % AS_INT(args[1]);
+        if (remainder != 0 && (remainder < 0) != (AS_INT(args[1]) < 0)) remainder += AS_INT(args[1]);
+        return makeInt(remainder);
+    }
+    double remainder = fmod(AS_NUMBER(args[0]), AS_NUMBER(args[1]));
+    if (remainder != 0 && (remainder < 0) != (AS_NUMBER(args[1]) < 0)) remainder += AS_NUMBER(args[1]);
+    return makeNumber(remainder);
 }
 
-static Value defineFn(int argCount, Value* args, Environment* env) {
-    (void)env; // Silence unused parameter warning
+// Special forms get their form unevaluated. One either returns its value,
+// or sets *tail and returns the expression left in tail position, which the
+// caller evaluates in the form's place.
+typedef Value (*SpecialFormFn)(List* form, Environment* env, bool* tail);
+
+static Value defineFn(List* form, Environment* env, bool* tail) {
+    if (isDesugared(form)) return desugared(form, env, tail);
     
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
     if (argCount < 2) {
         runtimeError("Expected at least 2 arguments but got %d.", argCount);
         return NIL_VAL;
     }
     
     // First argument should be the parameter list
-    if (args[0].type != VAL_LIST) {
+    if (!IS_LIST(args[0])) {
         runtimeError("Expected parameter list.");
         return NIL_VAL;
     }
     
-    int arity = args[0].as.list.count;
-    Value function = makeFunction(arity);
-    
-    // Copy parameter names
-    for (int i = 0; i < arity; i++) {
-        if (args[0].as.list.items[i].type != VAL_SYMBOL) {
+    // Check parameter names
+    List* params = AS_LIST(args[0]);
+    for (int i = 0; i < params->count; i++) {
+        if (!IS_SYMBOL(params->items[i])) {
             runtimeError("Expected parameter name.");
             return NIL_VAL;
         }
-        appendToList(&function.as.function.params, copyValue(args[0].as.list.items[i]));
     }
     
-    // Copy function body
-    for (int i = 1; i < argCount; i++) {
-        appendToList(&function.as.function.body, copyValue(args[i]));
-    }
+    // Share the parameter list and body expressions with the source
+    Function* function = newFunction(form);
     
-    return function;
+    // Close over the defining environment
+    return makeFunction(function, env);
 }
 
-static Value defineVar(int argCount, Value* args, Environment* env) {
+static Value defineVar(List* form, Environment* env, bool* tail) {
+    (void)tail;
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
     if (argCount != 2) {
         runtimeError("Expected 2 arguments but got %d.", argCount);
         return NIL_VAL;
     }
     
     // First argument should be the variable name
-    if (args[0].type != VAL_SYMBOL) {
+    if (!IS_SYMBOL(args[0])) {
         runtimeError("Expected variable name.");
         return NIL_VAL;
     }
     
     // Second argument is the value
     Value value = evaluate(args[1], env);
-    defineVariable(env, args[0].as.symbol, copyValue(value));
+    defineVariable(env, AS_SYMBOL(args[0]), value);
     
     return value;
 }
 
-static Value ifCondition(int argCount, Value* args, Environment* env) {
+// Both branches are in tail position
+static Value ifCondition(List* form, Environment* env, bool* tail) {
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
     if (argCount != 3) {
         runtimeError("Expected 3 arguments but got %d.", argCount);
         return NIL_VAL;
     }
     
     Value condition = evaluate(args[0], env);
+    *tail = true;
+    return isTruthy(condition) ? args[1] : args[2];
+}
+
+// A new scope for a let or loop form with its bindings evaluated in order,
+// rooted until the caller pops it, or NULL when the bindings are malformed
+static Environment* bindScope(List* form, Environment* env) {
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount < 1) {
+        runtimeError("Expected at least 1 arguments but got %d.", argCount);
+        return NULL;
+    }
     
-    // Handle type conversion for the condition
-    bool conditionResult = false;
-    switch (condition.type) {
-        case VAL_BOOLEAN:
-            conditionResult = condition.as.boolean;
-            break;
-        case VAL_NUMBER:
-            // Treat non-zero as true, zero as false
-            conditionResult = condition.as.number != 0;
-            break;
-        case VAL_NIL:
-            conditionResult = false;
-            break;
-        default:
-            // Everything else (strings, symbols, lists, functions) is treated as true
-            conditionResult = true;
-            break;
+    if (!IS_LIST(args[0])) {
+        runtimeError("Expected binding list.");
+        return NULL;
     }
     
-    if (conditionResult) {
-        return evaluate(args[1], env);
-    } else {
-        return evaluate(args[2], env);
+    List* bindings = AS_LIST(args[0]);
+    if (bindings->count % 2 != 0) {
+        runtimeError("Expected a value for every binding.");
+        return NULL;
+    }
+    for (int i = 0; i < bindings->count; i += 2) {
+        if (!IS_SYMBOL(bindings->items[i])) {
+            runtimeError("Expected variable name.");
+            return NULL;
+        }
     }
+    
+    Environment* scope = createEnclosedEnvironment(env);
+    pushEnvironmentRoot(scope);
+    
+    // Each binding sees the ones before it
+    for (int i = 0; i < bindings->count; i += 2) {
+        Value value = evaluate(bindings->items[i + 1], scope);
+        defineVariable(scope, AS_SYMBOL(bindings->items[i]), value);
+    }
+    return scope;
 }
 
-static Value evaluateList(Value list, Environment* env) {
-    if (list.as.list.count == 0) {
-        return list;
+// [let [name value ...] body...] evaluates the bindings in order and then the
+// body, all in a new scope
+static Value letScope(List* form, Environment* env, bool* tail) {
+    (void)tail;
+    Environment* scope = bindScope(form, env);
+    if (scope == NULL) return NIL_VAL;
+    
+    Value result = NIL_VAL;
+    for (int i = 2; i < form->count; i++) {
+        result = evaluate(form->items[i], scope);
     }
     
-    // Evaluate the first element
-    Value first = list.as.list.items[0];
+    popRoots(1);
+    return result;
+}
+
+// The last expression is in tail position
+static Value doSequence(List* form, Environment* env, bool* tail) {
+    if (form->count == 1) return NIL_VAL;
+    
+    for (int i = 1; i < form->count - 1; i++) {
+        evaluate(form->items[i], env);
+    }
+    *tail = true;
+    return form->items[form->count - 1];
+}
+
+static Value whileLoop(List* form, Environment* env, bool* tail) {
+    (void)tail;
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount < 1) {
+        runtimeError("Expected at least 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
     
-    // Check for special forms
-    if (first.type == VAL_SYMBOL) {
-        // Define function
-        if (strcmp(first.as.symbol, "fn") == 0) {
-            return defineFn(list.as.list.count - 1, &list.as.list.items[1], env);
+    while (!unwinding && isTruthy(evaluate(args[0], env))) {
+        for (int i = 1; i < argCount; i++) {
+            evaluate(args[i], env);
         }
-        
-        // Define variable
-        if (strcmp(first.as.symbol, "def") == 0) {
-            return defineVar(list.as.list.count - 1, &list.as.list.items[1], env);
+    }
+    return NIL_VAL;
+}
+
+static Value quoteForm(List* form, Environment* env, bool* tail) {
+    (void)env;
+    (void)tail;
+    int argCount = form->count - 1;
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    
+    return form->items[1];
+}
+
+// The first falsey operand, or the last one in tail position
+static Value andOperands(List* form, Environment* env, bool* tail) {
+    if (form->count == 1) return makeBoolean(true);
+    
+    for (int i = 1; i < form->count - 1; i++) {
+        Value value = evaluate(form->items[i], env);
+        if (!isTruthy(value)) return value;
+    }
+    *tail = true;
+    return form->items[form->count - 1];
+}
+
+// The first truthy operand, or the last one in tail position
+static Value orOperands(List* form, Environment* env, bool* tail) {
+    if (form->count == 1) return NIL_VAL;
+    
+    for (int i = 1; i < form->count - 1; i++) {
+        Value value = evaluate(form->items[i], env);
+        if (isTruthy(value)) return value;
+    }
+    *tail = true;
+    return form->items[form->count - 1];
+}
+
+// [cond test expression ...] picks the expression after the first truthy
+// test, in tail position, or is nil
+static Value condClauses(List* form, Environment* env, bool* tail) {
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount % 2 != 0) {
+        runtimeError("Expected an even number of arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    
+    for (int i = 0; i < argCount; i += 2) {
+        if (isTruthy(evaluate(args[i], env))) {
+            *tail = true;
+            return args[i + 1];
         }
+    }
+    return NIL_VAL;
+}
+
+// defmacro, quasiquote and dotimes run as the code they stand for
+static Value desugared(List* form, Environment* env, bool* tail) {
+    (void)tail;
+    Value expr = desugarForm(form);
+    pushRoot(expr);
+    Value result = evaluate(expr, env);
+    popRoots(1);
+    return result;
+}
+
+// [set name value] assigns the innermost binding of name and is the value
+static Value setVariable(List* form, Environment* env, bool* tail) {
+    (void)tail;
+    int argCount = form->count - 1;
+    Value* args = &form->items[1];
+    if (argCount != 2) {
+        runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    
+    if (!IS_SYMBOL(args[0])) {
+        runtimeError("Expected variable name.");
+        return NIL_VAL;
+    }
+    
+    Value value = evaluate(args[1], env);
+    if (!assignVariable(env, AS_SYMBOL(args[0]), value)) return NIL_VAL;
+    return value;
+}
+
+// Assign the names of a loop scope the values of a recur form's arguments
+static void recurWith(List* form, Environment* scope, List* bindings) {
+    // Every next value is computed before any name changes
+    int base = stack.count;
+    for (int i = 1; i < form->count; i++) {
+        pushValue(evaluate(form->items[i], scope));
+    }
+    for (int i = 0; i < bindings->count; i += 2) {
+        defineVariable(scope, AS_SYMBOL(bindings->items[i]), stack.values[base + i / 2]);
+    }
+    stack.count = base;
+}
+
+// The value of expr at the tail of a loop body. Tail positions are followed
+// through the forms that have them, and again is set when they end in a recur.
+static Value loopTail(Value expr, Environment* scope, List* bindings, bool* again) {
+    for (;;) {
+        if (!IS_LIST(expr)) return evaluate(expr, scope);
         
-        // If condition
-        if (strcmp(first.as.symbol, "if") == 0) {
-            return ifCondition(list.as.list.count - 1, &list.as.list.items[1], env);
+        List* list = AS_LIST(expr);
+        bool tail = false;
+        Value value;
+        switch (specialForm(list)) {
+            case SPECIAL_RECUR:
+                if (list->count - 1 != bindings->count / 2) {
+                    runtimeError("Expected %d arguments but got %d.",
+                                 bindings->count / 2, list->count - 1);
+                    return NIL_VAL;
+                }
+                recurWith(list, scope, bindings);
+                *again = true;
+                return NIL_VAL;
+            case SPECIAL_IF: value = ifCondition(list, scope, &tail); break;
+            case SPECIAL_DO: value = doSequence(list, scope, &tail); break;
+            case SPECIAL_AND: value = andOperands(list, scope, &tail); break;
+            case SPECIAL_OR: value = orOperands(list, scope, &tail); break;
+            case SPECIAL_COND: value = condClauses(list, scope, &tail); break;
+            default: return evaluate(expr, scope);
+        }
+        if (!tail) return value;
+        expr = value;
+    }
+}
+
+// [loop [name value ...] body...] binds like let, and a recur at the tail of
+// the body assigns the names and runs the body again in the same scope
+static Value loopForm(List* form, Environment* env, bool* tail) {
+    (void)tail;
+    Environment* scope = bindScope(form, env);
+    if (scope == NULL) return NIL_VAL;
+    
+    List* bindings = AS_LIST(form->items[1]);
+    Value result = NIL_VAL;
+    bool again = form->count > 2;
+    while (again && !unwinding) {
+        for (int i = 2; i < form->count - 1; i++) {
+            evaluate(form->items[i], scope);
         }
+        again = false;
+        result = loopTail(form->items[form->count - 1], scope, bindings, &again);
     }
     
-    // Function application
-    Value evaluated = evaluate(first, env);
+    popRoots(1);
+    return result;
+}
+
+// A recur anywhere but the tail of a loop
+static Value misplacedRecur(List* form, Environment* env, bool* tail) {
+    (void)form;
+    (void)env;
+    (void)tail;
+    runtimeError("Can only recur from the tail of a loop.");
+    return NIL_VAL;
+}
+
+static const SpecialFormFn specialForms[SPECIAL_FORM_COUNT] = {
+    [SPECIAL_FN] = defineFn,
+    [SPECIAL_DEF] = defineVar,
+    [SPECIAL_IF] = ifCondition,
+    [SPECIAL_LET] = letScope,
+    [SPECIAL_DO] = doSequence,
+    [SPECIAL_WHILE] = whileLoop,
+    [SPECIAL_QUOTE] = quoteForm,
+    [SPECIAL_AND] = andOperands,
+    [SPECIAL_OR] = orOperands,
+    [SPECIAL_COND] = condClauses,
+    [SPECIAL_DEFMACRO] = desugared,
+    [SPECIAL_QUASIQUOTE] = desugared,
+    [SPECIAL_SET] = setVariable,
+    [SPECIAL_LOOP] = loopForm,
+    [SPECIAL_RECUR] = misplacedRecur,
+    [SPECIAL_DOTIMES] = desugared
+};
+
+// A frame for a call of closure, enclosed by enclosing, with the parameters
+// bound to args. Frames no closure can hold on to come from the pool, the
+// others are GC roots until they are released.
+static Environment* enterCallFrame(Closure* closure, Value* args, Environment* enclosing) {
+    Function* function = closure->function;
+    Environment* frame;
+    checkFoldEpoch(function);
+    if (functionCapturesFrame(function)) {
+        frame = createFrame(enclosing, function->arity);
+        pushEnvironmentRoot(frame);
+    } else {
+        frame = acquireFrame(enclosing, function->arity);
+    }
     
-    // Prepare storage for evaluated arguments
-    Value* args = malloc(sizeof(Value) * (list.as.list.count - 1));
-    if (args == NULL) {
-        runtimeError("Failed to allocate memory for function arguments.");
+    for (int i = 0; i < function->arity; i++) {
+        frame->entries[i].key = AS_SYMBOL(function->params->items[i]);
+        frame->entries[i].value = args[i];
+    }
+    return frame;
+}
+
+// Release the frame of a call once its body is done
+static void releaseCallFrame(Environment* frame) {
+    if (frame->pooled) {
+        releaseFrame(frame);
+    } else {
+        popRoots(1);
+    }
+}
+
+// A call of a memoized function, whose arguments are on the value stack
+// from index args. The result is looked up, or else the body runs as a call
+// that isn't in tail position so its result can be stored.
+static Value callMemoized(Closure* closure, int args, Environment* env) {
+    Value result;
+    if (memoLookup(closure->memo, &stack.values[args], &result)) return result;
+    
+    if (callDepth >= maxCallDepth()) {
+        runtimeError("Stack overflow: more than %d nested calls.", maxCallDepth());
+        unwinding = true;
         return NIL_VAL;
     }
+    callDepth++;
     
-    // Evaluate arguments
-    for (int i = 1; i < list.as.list.count; i++) {
-        args[i - 1] = evaluate(list.as.list.items[i], env);
+    Environment* enclosing = closure->env != NULL ? closure->env : env;
+    Environment* frame = enterCallFrame(closure, &stack.values[args], enclosing);
+    collectGarbageIfNeeded();
+    
+    result = NIL_VAL;
+    for (int i = 0; i < closure->function->bodyCount; i++) {
+        result = evaluate(closure->function->body[i], frame);
     }
+    releaseCallFrame(frame);
+    callDepth--;
     
+    // Pushing may have moved the stack, so the arguments are found again
+    if (!unwinding) memoStore(closure->memo, &stack.values[args], result);
+    return result;
+}
+
+static Value evaluateList(Value list, Environment* env) {
+    int base = stack.count;
+    int depth = callDepth;
+    Environment* frame = NULL;      // Frame of the call whose body is running
     Value result = NIL_VAL;
     
-    if (evaluated.type == VAL_FUNCTION) {
-        Function function = evaluated.as.function;
+    // Expressions in tail position go around the loop again instead of
+    // recursing, and a call there replaces the frame of the call making it,
+    // so tail calls run in constant C stack and memory
+    for (;;) {
+        if (unwinding) break;
         
-        if (function.arity != list.as.list.count - 1) {
-            runtimeError("Expected %d arguments but got %d.", function.arity, list.as.list.count - 1);
-            free(args);
-            return NIL_VAL;
+        List* items = AS_LIST(list);
+        if (items->count == 0) {
+            result = list;
+            break;
         }
         
-        // Create a new environment for the function execution
-        Environment* functionEnv = createEnclosedEnvironment(env);
+        Value first = items->items[0];
         
-        // Bind arguments to parameters
-        for (int i = 0; i < function.arity; i++) {
-            if (function.params.items[i].type == VAL_SYMBOL) {
-                defineVariable(functionEnv, function.params.items[i].as.symbol, copyValue(args[i]));
-            } else {
-                runtimeError("Invalid parameter name in function.");
-                freeEnvironment(functionEnv);
-                free(args);
-                return NIL_VAL;
+        // Special forms dispatch on the tag of their symbol
+        SpecialForm special = specialForm(items);
+        if (special != SPECIAL_NONE) {
+            bool tail = false;
+            Value value = specialForms[special](items, env, &tail);
+            if (!tail) {
+                result = value;
+                break;
+            }
+            
+            if (IS_LIST(value)) {
+                list = value;
+                continue;
             }
+            result = evaluate(value, env);
+            break;
         }
         
-        // Evaluate the body in sequence, return the last result
-        result = NIL_VAL;
-        for (int i = 0; i < function.body.count; i++) {
-            // Free previous result if not the last expression
-            if (i > 0) {
-                freeValue(result);
-            }
-            result = evaluate(function.body.items[i], functionEnv);
+        // Function application. The callee and arguments stay on the value
+        // stack while the remaining arguments run, since any call may collect
+        // garbage.
+        int callBase = stack.count;
+        pushValue(evaluate(first, env));
+        for (int i = 1; i < items->count; i++) {
+            pushValue(evaluate(items->items[i], env));
         }
+        if (unwinding) break;
         
-        // Create a copy of the result before freeing the environment
-        Value resultCopy = copyValue(result);
+        // Pushing may move the stack, so look at it once every argument is in
+        Value evaluated = stack.values[callBase];
+        Value* args = &stack.values[callBase + 1];
+        int argCount = items->count - 1;
+        size_t allocations = allocStats.allocations;
+        allocStats.calls++;
         
-        // Free the function's environment
-        freeEnvironment(functionEnv);
+        if (IS_NATIVE(evaluated)) {
+            result = AS_NATIVE(evaluated)->function(argCount, args);
+            break;
+        }
         
-        // Return the copied result
-        result = resultCopy;
-    } else if (evaluated.type == VAL_NATIVE) {
-        result = evaluated.as.native.function(list.as.list.count - 1, args);
-    } else {
-        runtimeError("Cannot call non-function. Got type %d.", evaluated.type);
+        if (!IS_FUNCTION(evaluated)) {
+            runtimeError("Cannot call non-function. Got type %d.", valueType(evaluated));
+            break;
+        }
+        
+        Closure* closure = AS_CLOSURE(evaluated);
+        Function* function = closure->function;
+        if (function->arity != argCount) {
+            runtimeError("Expected %d arguments but got %d.", function->arity, argCount);
+            break;
+        }
+        
+        if (closure->memo != NULL) {
+            result = callMemoized(closure, callBase + 1, env);
+            break;
+        }
+        
+        // The function runs in a frame enclosed by the environment it was
+        // defined in. A tail call gives up the frame of the call making it,
+        // any other call nests one level deeper.
+        Environment* enclosing = closure->env != NULL ? closure->env : env;
+        if (frame != NULL) {
+            releaseCallFrame(frame);
+        } else if (callDepth >= maxCallDepth()) {
+            runtimeError("Stack overflow: more than %d nested calls.", maxCallDepth());
+            unwinding = true;
+            break;
+        } else {
+            callDepth++;
+        }
+        
+        frame = enterCallFrame(closure, args, enclosing);
+        allocStats.callAllocations += allocStats.allocations - allocations;
+        
+        // The frame holds the arguments now, the callee stays on the stack
+        stack.values[base] = evaluated;
+        stack.count = base + 1;
+        collectGarbageIfNeeded();
+        
+        // Evaluate the body in sequence, the last expression is the result
+        env = frame;
+        if (function->bodyCount == 0) break;
+        for (int i = 0; i < function->bodyCount - 1; i++) {
+            evaluate(function->body[i], env);
+        }
+        
+        Value last = function->body[function->bodyCount - 1];
+        if (IS_LIST(last)) {
+            list = last;
+            continue;
+        }
+        result = evaluate(last, env);
+        break;
     }
     
-    // Free the argument array
-    free(args);
+    if (frame != NULL) releaseCallFrame(frame);
+    stack.count = base;
+    callDepth = depth;
     
+    // After a stack overflow the outermost call returns nil, like in the VM
+    if (depth == 0) unwinding = false;
     return result;
 }
 
+static void defineNative(Environment* env, const char* name, NativeFn function, bool pure,
+                         NativeOp op) {
+    Value native = makeNative(function, name);
+    AS_NATIVE(native)->pure = pure;
+    AS_NATIVE(native)->op = op;
+    defineVariable(env, internCString(name), native);
+}
+
 // Initialize the global environment with native functions
 void initGlobalEnvironment(Environment* env) {
-    defineVariable(env, "print", makeNative(nativePrint, "print"));
-    defineVariable(env, "+", makeNative(nativeAdd, "+"));
-    defineVariable(env, "-", makeNative(nativeSubtract, "-"));
-    defineVariable(env, "*", makeNative(nativeMultiply, "*"));
-    defineVariable(env, "/", makeNative(nativeDivide, "/"));
-    defineVariable(env, "=", makeNative(nativeEqual, "="));
-    defineVariable(env, "<", makeNative(nativeLessThan, "<"));
-    defineVariable(env, ">", makeNative(nativeGreaterThan, ">"));
-}
\ No newline at end of file
+    defineNative(env, "print", nativePrint, false, NATIVE_OP_NONE);
+    defineNative(env, "+", nativeAdd, true, NATIVE_OP_ADD);
+    defineNative(env, "-", nativeSubtract, true, NATIVE_OP_SUBTRACT);
+    defineNative(env, "*", nativeMultiply, true, NATIVE_OP_MULTIPLY);
+    defineNative(env, "/", nativeDivide, true, NATIVE_OP_NONE);
+    defineNative(env, "=", nativeEqual, true, NATIVE_OP_EQUAL);
+    defineNative(env, "<", nativeLessThan, true, NATIVE_OP_LESS);
+    defineNative(env, ">", nativeGreaterThan, true, NATIVE_OP_GREATER);
+    defineNative(env, "<=", nativeLessEqual, true, NATIVE_OP_LESS_EQUAL);
+    defineNative(env, ">=", nativeGreaterEqual, true, NATIVE_OP_GREATER_EQUAL);
+    defineNative(env, "min", nativeMin, true, NATIVE_OP_NONE);
+    defineNative(env, "max", nativeMax, true, NATIVE_OP_NONE);
+    defineNative(env, "abs", nativeAbs, true, NATIVE_OP_NONE);
+    defineNative(env, "mod", nativeMod, true, NATIVE_OP_NONE);
+    defineNative(env, "clock", nativeClock, false, NATIVE_OP_NONE);
+    defineNative(env, "memo", nativeMemo, false, NATIVE_OP_NONE);
+    defineNative(env, "memo-stats", nativeMemoStats, false, NATIVE_OP_NONE);
+    defineNative(env, "pmap", nativePmap, false, NATIVE_OP_NONE);
+    defineNative(env, "preduce", nativePreduce, false, NATIVE_OP_NONE);
+    defineNative(env, "spawn", nativeSpawn, false, NATIVE_OP_NONE);
+    defineNative(env, "yield", nativeYield, false, NATIVE_OP_NONE);
+    defineNative(env, "await", nativeAwait, false, NATIVE_OP_NONE);
+    defineNative(env, "chan", nativeChan, false, NATIVE_OP_NONE);
+    defineNative(env, "send", nativeSend, false, NATIVE_OP_NONE);
+    defineNative(env, "recv", nativeRecv, false, NATIVE_OP_NONE);
+    defineNative(env, "select", nativeSelect, false, NATIVE_OP_NONE);
+    defineNative(env, "close", nativeClose, false, NATIVE_OP_NONE);
+    defineNative(env, "actor", nativeActor, false, NATIVE_OP_NONE);
+    defineNative(env, "conj", nativeConj, false, NATIVE_OP_NONE);
+    defineNative(env, "assoc", nativeAssoc, false, NATIVE_OP_NONE);
+    defineNative(env, "nth", nativeNth, false, NATIVE_OP_NONE);
+    defineNative(env, "pop", nativePop, false, NATIVE_OP_NONE);
+    defineNative(env, "concat", nativeConcat, false, NATIVE_OP_NONE);
+    defineNative(env, "count", nativeCount, false, NATIVE_OP_NONE);
+}
@@ -0,0 +1,572 @@
+// mmap and MAP_ANONYMOUS are not part of strict C99
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#include "../include/hexa.h"
+
+// A baseline JIT. Once a function has been called HEXA_JIT_THRESHOLD times
+// its chunk is translated instruction by instruction into x86-64 code.
+// Constants, stack shuffling, jumps and the common paths of global reads and
+// of local reads and writes are emitted inline; every other instruction
+// calls the VM's step function for just that instruction. Calls of functions
+// and returns change the frame, so the machine code stops in front of them
+// with the frame's ip pointing there. The VM runs them and enters the
+// machine code of whichever frame is current afterwards, at the instruction
+// it would run next. Native code therefore never nests, and runs with the
+// same frames, stack and garbage collection roots as the bytecode it
+// replaces.
+//
+// In machine code rbx holds the VM's stack top, r12 the frame and r13 the
+// address the stack top is written back to before the VM is called. Both
+// rbx and r12 are loaded again when the VM returns, since a native it calls
+// may run code that moves the stack and the frames.
+
+#ifdef HEXA_JIT
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+struct JitCode {
+    uint8_t* code;
+    size_t size;
+    uint32_t* offsets;  // Machine code offset of each instruction, by bytecode offset
+    int count;          // Bytecode length, offsets has one more entry
+};
+
+// Runs the machine code from target, an instruction inside it
+typedef void (*JitEntry)(CallFrame* frame, uint8_t* target);
+
+typedef enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI
+} Register;
+
+// A jump whose 32-bit displacement is patched once target is translated
+typedef struct {
+    int at;             // Offset of the displacement in the code
+    int target;         // Bytecode offset jumped to
+} Fixup;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+    Fixup* fixups;
+    int fixupCount;
+    int fixupCapacity;
+    int exit;           // Offset of the code that returns to the VM
+} Assembler;
+
+static void emitByte(Assembler* as, uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        int oldCapacity = as->capacity;
+        as->capacity = oldCapacity < 256 ? 256 : oldCapacity * 2;
+        as->code = reallocate(as->code, oldCapacity, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) {
+        emitByte(as, bytes[i]);
+    }
+}
+
+#define EMIT(...) do { \
+        static const uint8_t bytes_[] = {__VA_ARGS__}; \
+        emitBytes(as, bytes_, (int)sizeof(bytes_)); \
+    } while (0)
+
+static void emit32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emitByte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        emitByte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+// mov reg, imm64
+static void emitLoadImmediate(Assembler* as, Register reg, uint64_t value) {
+    emitByte(as, 0x48);
+    emitByte(as, (uint8_t)(0xB8 + reg));
+    emit64(as, value);
+}
+
+static void emitLoadPointer(Assembler* as, Register reg, const void* pointer) {
+    emitLoadImmediate(as, reg, (uint64_t)(uintptr_t)pointer);
+}
+
+// Emit the opcode bytes of a jump and return where its displacement goes
+static int emitJump(Assembler* as, const uint8_t* opcode, int length) {
+    emitBytes(as, opcode, length);
+    int at = as->count;
+    emit32(as, 0);
+    return at;
+}
+
+static int emitJumpAlways(Assembler* as) {
+    static const uint8_t jmp[] = {0xE9};
+    return emitJump(as, jmp, 1);
+}
+
+static int emitJumpIfEqual(Assembler* as) {
+    static const uint8_t je[] = {0x0F, 0x84};
+    return emitJump(as, je, 2);
+}
+
+static int emitJumpIfNotEqual(Assembler* as) {
+    static const uint8_t jne[] = {0x0F, 0x85};
+    return emitJump(as, jne, 2);
+}
+
+static void patchJump(Assembler* as, int at, int target) {
+    uint32_t displacement = (uint32_t)(target - (at + 4));
+    for (int i = 0; i < 4; i++) {
+        as->code[at + i] = (uint8_t)(displacement >> (8 * i));
+    }
+}
+
+// Jump to the instruction at bytecode offset target, once it's translated
+static void addFixup(Assembler* as, int at, int target) {
+    if (as->fixupCount == as->fixupCapacity) {
+        int oldCapacity = as->fixupCapacity;
+        as->fixupCapacity = oldCapacity < 16 ? 16 : oldCapacity * 2;
+        as->fixups = reallocate(as->fixups, sizeof(Fixup) * oldCapacity,
+                                sizeof(Fixup) * as->fixupCapacity);
+    }
+    as->fixups[as->fixupCount].at = at;
+    as->fixups[as->fixupCount].target = target;
+    as->fixupCount++;
+}
+
+// Push rax onto the VM's stack
+static void emitPush(Assembler* as) {
+    EMIT(0x48, 0x89, 0x03,              // mov [rbx], rax
+         0x48, 0x83, 0xC3, 0x08);       // add rbx, 8
+}
+
+// Return to the VM with the frame's ip at the instruction ip
+static void emitExit(Assembler* as, uint8_t* ip) {
+    emitLoadPointer(as, RAX, ip);
+    patchJump(as, emitJumpAlways(as), as->exit);
+}
+
+// Have the VM run the instruction at ip. If it may refuse, return to the VM
+// when it does. Natives it calls may run code that moves the frames, so r12
+// takes the frame it returns.
+static void emitStep(Assembler* as, const JitRuntime* runtime, uint8_t* ip, bool mayRefuse) {
+    EMIT(0x49, 0x89, 0x5D, 0x00,        // mov [r13], rbx
+         0x4C, 0x89, 0xE7);             // mov rdi, r12
+    emitLoadPointer(as, RSI, ip);
+    emitLoadPointer(as, RAX, (const void*)(uintptr_t)runtime->step);
+    EMIT(0xFF, 0xD0,                    // call rax
+         0x49, 0x8B, 0x5D, 0x00);       // mov rbx, [r13]
+    if (mayRefuse) {
+        // Refusing does nothing, so r12 is still the frame
+        EMIT(0x48, 0x85, 0xC0,          // test rax, rax
+             0x75, 0x0F);               // jnz over the exit, 15 bytes
+        emitExit(as, ip);
+    }
+    EMIT(0x49, 0x89, 0xC4);             // mov r12, rax
+}
+
+// Entered with the frame in rdi and the place to start in rsi, like a C
+// function. Saves the registers it uses, which the exit restores.
+static void emitPrologueAndExit(Assembler* as, const JitRuntime* runtime) {
+    EMIT(0x53,                          // push rbx
+         0x41, 0x54,                    // push r12
+         0x41, 0x55,                    // push r13
+         0x49, 0x89, 0xFC,              // mov r12, rdi
+         0x49, 0xBD);                   // mov r13, imm64
+    emit64(as, (uint64_t)(uintptr_t)runtime->stackTop);
+    EMIT(0x49, 0x8B, 0x5D, 0x00,        // mov rbx, [r13]
+         0xFF, 0xE6);                   // jmp rsi
+
+    // Exit with the bytecode address to continue at in rax
+    as->exit = as->count;
+    EMIT(0x49, 0x89, 0x84, 0x24);       // mov [r12 + ip], rax
+    emit32(as, (uint32_t)offsetof(CallFrame, ip));
+    EMIT(0x49, 0x89, 0x5D, 0x00,        // mov [r13], rbx
+         0x41, 0x5D,                    // pop r13
+         0x41, 0x5C,                    // pop r12
+         0x5B,                          // pop rbx
+         0xC3);                         // ret
+}
+
+// Push the global's cached value while the cache is valid, otherwise let
+// the VM look it up and refill the cache
+static void emitGetGlobal(Assembler* as, const JitRuntime* runtime, Chunk* chunk,
+                          uint8_t* ip, uint16_t index) {
+    emitLoadPointer(as, RAX, &chunk->caches[index]);
+    emitLoadPointer(as, RDX, &globalsVersion);
+    EMIT(0x8B, 0x08,                    // mov ecx, [rax]
+         0x3B, 0x0A);                   // cmp ecx, [rdx]
+    int miss = emitJumpIfNotEqual(as);
+
+    emitLoadPointer(as, RCX, &cacheStats.globalHits);
+    EMIT(0x48, 0xFF, 0x01,              // inc qword [rcx]
+         0x48, 0x8B, 0x40,              // mov rax, [rax + value]
+         (uint8_t)offsetof(GlobalCache, value));
+    emitPush(as);
+    int done = emitJumpAlways(as);
+
+    patchJump(as, miss, as->count);
+    emitStep(as, runtime, ip, false);
+    patchJump(as, done, as->count);
+}
+
+// Load the frame's entries into rax and jump, with the returned fixup,
+// when the slot's def hasn't run yet
+static int emitCheckSlot(Assembler* as, uint32_t entry) {
+    EMIT(0x49, 0x8B, 0x84, 0x24);       // mov rax, [r12 + env]
+    emit32(as, (uint32_t)offsetof(CallFrame, env));
+    EMIT(0x48, 0x8B, 0x80);             // mov rax, [rax + entries]
+    emit32(as, (uint32_t)offsetof(Environment, entries));
+    EMIT(0x48, 0x8B, 0x88);             // mov rcx, [rax + entry + key]
+    emit32(as, entry + (uint32_t)offsetof(Entry, key));
+    EMIT(0x48, 0x85, 0xC9);             // test rcx, rcx
+    return emitJumpIfEqual(as);
+}
+
+// Push a slot of the frame once its def has run, otherwise let the VM find
+// the enclosing binding
+static void emitGetLocal(Assembler* as, const JitRuntime* runtime, uint8_t* ip, int slot) {
+    uint32_t entry = (uint32_t)(sizeof(Entry) * slot);
+    int unbound = emitCheckSlot(as, entry);
+
+    EMIT(0x48, 0x8B, 0x80);             // mov rax, [rax + entry + value]
+    emit32(as, entry + (uint32_t)offsetof(Entry, value));
+    emitPush(as);
+    int done = emitJumpAlways(as);
+
+    patchJump(as, unbound, as->count);
+    emitStep(as, runtime, ip, false);
+    patchJump(as, done, as->count);
+}
+
+// Assign the top of the stack to a slot of the frame once its def has run,
+// otherwise let the VM assign the enclosing binding
+static void emitSetLocal(Assembler* as, const JitRuntime* runtime, uint8_t* ip, int slot) {
+    uint32_t entry = (uint32_t)(sizeof(Entry) * slot);
+    int unbound = emitCheckSlot(as, entry);
+
+    EMIT(0x48, 0x8B, 0x53, 0xF8,        // mov rdx, [rbx - 8]
+         0x48, 0x89, 0x90);             // mov [rax + entry + value], rdx
+    emit32(as, entry + (uint32_t)offsetof(Entry, value));
+    int done = emitJumpAlways(as);
+
+    patchJump(as, unbound, as->count);
+    emitStep(as, runtime, ip, false);
+    patchJump(as, done, as->count);
+}
+
+// Pop the condition and jump to target if it is falsey: nil, false, the
+// integer 0 or either zero double
+static void emitJumpIfFalse(Assembler* as, int target) {
+    EMIT(0x48, 0x83, 0xEB, 0x08,        // sub rbx, 8
+         0x48, 0x8B, 0x03);             // mov rax, [rbx]
+
+    Value falsey[] = {NIL_VAL, FALSE_VAL, makeInt(0)};
+    for (int i = 0; i < (int)(sizeof(falsey) / sizeof(falsey[0])); i++) {
+        emitLoadImmediate(as, RCX, falsey[i]);
+        EMIT(0x48, 0x39, 0xC8);         // cmp rax, rcx
+        addFixup(as, emitJumpIfEqual(as), target);
+    }
+
+    // Doubling clears the sign bit, so only 0.0 and -0.0 become zero
+    EMIT(0x48, 0x01, 0xC0);             // add rax, rax
+    addFixup(as, emitJumpIfEqual(as), target);
+}
+
+// Call with two arguments. When the callee is a NativeOp built-in and both
+// arguments are integers the result is computed inline, like OP_CALL_BINARY
+// does, otherwise the VM makes the call.
+static void emitBinaryCall(Assembler* as, const JitRuntime* runtime, uint8_t* ip) {
+    int slow[16];
+    int slowCount = 0;
+
+    // The callee must be a native, rax its address
+    EMIT(0x48, 0x8B, 0x43, 0xE8,        // mov rax, [rbx - 24]
+         0x48, 0x89, 0xC1);             // mov rcx, rax
+    emitLoadImmediate(as, RDX, SIGN_BIT | QNAN | SYMBOL_BIT);
+    EMIT(0x48, 0x21, 0xD1);             // and rcx, rdx
+    emitLoadImmediate(as, RDX, SIGN_BIT | QNAN);
+    EMIT(0x48, 0x39, 0xD1);             // cmp rcx, rdx
+    slow[slowCount++] = emitJumpIfNotEqual(as);
+    EMIT(0x48, 0xC1, 0xE0, 0x10,        // shl rax, 16
+         0x48, 0xC1, 0xE8, 0x10,        // shr rax, 16
+         0x83, 0x38, OBJ_NATIVE);       // cmp dword [rax + type], OBJ_NATIVE
+    slow[slowCount++] = emitJumpIfNotEqual(as);
+    EMIT(0x0F, 0xB6, 0x48,              // movzx ecx, byte [rax + op]
+         (uint8_t)offsetof(Native, op));
+
+    // Both arguments must be integers, sign extended into rsi and rdi
+    EMIT(0x48, 0x8B, 0x73, 0xF0,        // mov rsi, [rbx - 16]
+         0x48, 0x8B, 0x7B, 0xF8);       // mov rdi, [rbx - 8]
+    for (int i = 0; i < 2; i++) {
+        if (i == 0) {
+            EMIT(0x48, 0x89, 0xF0);     // mov rax, rsi
+        } else {
+            EMIT(0x48, 0x89, 0xF8);     // mov rax, rdi
+        }
+        emitLoadImmediate(as, RDX, SIGN_BIT | QNAN | SYMBOL_BIT);
+        EMIT(0x48, 0x21, 0xD0);         // and rax, rdx
+        emitLoadImmediate(as, RDX, QNAN | SYMBOL_BIT);
+        EMIT(0x48, 0x39, 0xD0);         // cmp rax, rdx
+        slow[slowCount++] = emitJumpIfNotEqual(as);
+    }
+    EMIT(0x48, 0xC1, 0xE6, 0x10,        // shl rsi, 16
+         0x48, 0xC1, 0xFE, 0x10,        // sar rsi, 16
+         0x48, 0xC1, 0xE7, 0x10,        // shl rdi, 16
+         0x48, 0xC1, 0xFF, 0x10);       // sar rdi, 16
+
+    // The condition code each comparison sets al with
+    static const struct {
+        NativeOp op;
+        uint8_t setcc;
+    } comparisons[] = {
+        {NATIVE_OP_EQUAL, 0x94}, {NATIVE_OP_LESS, 0x9C}, {NATIVE_OP_GREATER, 0x9F},
+        {NATIVE_OP_LESS_EQUAL, 0x9E}, {NATIVE_OP_GREATER_EQUAL, 0x9D}
+    };
+    int comparisonCount = (int)(sizeof(comparisons) / sizeof(comparisons[0]));
+
+    int toAdd, toSubtract, toMultiply, toCompare[8];
+    EMIT(0x83, 0xF9, NATIVE_OP_ADD);    // cmp ecx, op
+    toAdd = emitJumpIfEqual(as);
+    EMIT(0x83, 0xF9, NATIVE_OP_SUBTRACT);
+    toSubtract = emitJumpIfEqual(as);
+    EMIT(0x83, 0xF9, NATIVE_OP_MULTIPLY);
+    toMultiply = emitJumpIfEqual(as);
+    for (int i = 0; i < comparisonCount; i++) {
+        emitByte(as, 0x83);
+        emitByte(as, 0xF9);
+        emitByte(as, (uint8_t)comparisons[i].op);
+        toCompare[i] = emitJumpIfEqual(as);
+    }
+    slow[slowCount++] = emitJumpAlways(as);
+
+    int toBoxInt[3], toBoxBoolean[8];
+    patchJump(as, toAdd, as->count);
+    EMIT(0x48, 0x89, 0xF0,              // mov rax, rsi
+         0x48, 0x01, 0xF8);             // add rax, rdi
+    toBoxInt[0] = emitJumpAlways(as);
+    patchJump(as, toSubtract, as->count);
+    EMIT(0x48, 0x89, 0xF0,              // mov rax, rsi
+         0x48, 0x29, 0xF8);             // sub rax, rdi
+    toBoxInt[1] = emitJumpAlways(as);
+    patchJump(as, toMultiply, as->count);
+    EMIT(0x48, 0x89, 0xF0,              // mov rax, rsi
+         0x48, 0x0F, 0xAF, 0xC7,        // imul rax, rdi
+         0x0F, 0x80);                   // jo
+    slow[slowCount++] = as->count;
+    emit32(as, 0);
+    toBoxInt[2] = emitJumpAlways(as);
+    for (int i = 0; i < comparisonCount; i++) {
+        patchJump(as, toCompare[i], as->count);
+        EMIT(0x48, 0x39, 0xFE);         // cmp rsi, rdi
+        emitByte(as, 0x0F);             // setcc al
+        emitByte(as, comparisons[i].setcc);
+        emitByte(as, 0xC0);
+        toBoxBoolean[i] = emitJumpAlways(as);
+    }
+
+    // A result outside HEXA_INT range becomes a double, the native takes
+    // care of that
+    for (int i = 0; i < 3; i++) {
+        patchJump(as, toBoxInt[i], as->count);
+    }
+    EMIT(0x48, 0x89, 0xC2,              // mov rdx, rax
+         0x48, 0xC1, 0xE2, 0x10,        // shl rdx, 16
+         0x48, 0xC1, 0xFA, 0x10,        // sar rdx, 16
+         0x48, 0x39, 0xC2);             // cmp rdx, rax
+    slow[slowCount++] = emitJumpIfNotEqual(as);
+    EMIT(0x48, 0xC1, 0xE0, 0x10,        // shl rax, 16
+         0x48, 0xC1, 0xE8, 0x10);       // shr rax, 16
+    emitLoadImmediate(as, RDX, QNAN | SYMBOL_BIT);
+    EMIT(0x48, 0x09, 0xD0);             // or rax, rdx
+    int toStore = emitJumpAlways(as);
+
+    // FALSE_VAL and TRUE_VAL differ in the lowest bit
+    for (int i = 0; i < comparisonCount; i++) {
+        patchJump(as, toBoxBoolean[i], as->count);
+    }
+    EMIT(0x0F, 0xB6, 0xC0);             // movzx eax, al
+    emitLoadImmediate(as, RDX, FALSE_VAL);
+    EMIT(0x48, 0x09, 0xD0);             // or rax, rdx
+
+    // The result replaces the callee and arguments
+    patchJump(as, toStore, as->count);
+    EMIT(0x48, 0x83, 0xEB, 0x10,        // sub rbx, 16
+         0x48, 0x89, 0x43, 0xF8);       // mov [rbx - 8], rax
+    emitLoadPointer(as, RCX, &allocStats.calls);
+    EMIT(0x48, 0xFF, 0x01);             // inc qword [rcx]
+    int done = emitJumpAlways(as);
+
+    for (int i = 0; i < slowCount; i++) {
+        patchJump(as, slow[i], as->count);
+    }
+    emitStep(as, runtime, ip, true);
+    patchJump(as, done, as->count);
+}
+
+// Bytes taken by an instruction and its operands
+static int instructionLength(OpCode op) {
+    switch (op) {
+        case OP_NIL:
+        case OP_POP_SCOPE:
+        case OP_POP:
+        case OP_DUP:
+        case OP_RETURN:
+            return 1;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CALL_BINARY:
+            return 2;
+        case OP_GET_LOCAL:
+        case OP_DEFINE_LOCAL:
+        case OP_SET_LOCAL:
+            return 4;
+        case OP_GET_ENCLOSING:
+        case OP_SET_ENCLOSING:
+            return 5;
+        default:
+            return 3;
+    }
+}
+
+static void translate(Assembler* as, const JitRuntime* runtime, Chunk* chunk,
+                      uint32_t* offsets) {
+    for (int offset = 0; offset < chunk->count; ) {
+        uint8_t* ip = &chunk->code[offset];
+        OpCode op = (OpCode)ip[0];
+        int next = offset + instructionLength(op);
+        uint16_t operand = next - offset == 3 ? (uint16_t)((ip[1] << 8) | ip[2]) : 0;
+        offsets[offset] = (uint32_t)as->count;
+
+        switch (op) {
+            case OP_CONSTANT:
+                emitLoadImmediate(as, RAX, chunk->constants.items[operand]);
+                emitPush(as);
+                break;
+            case OP_NIL:
+                emitLoadImmediate(as, RAX, NIL_VAL);
+                emitPush(as);
+                break;
+            case OP_GET_GLOBAL:
+                emitGetGlobal(as, runtime, chunk, ip, operand);
+                break;
+            case OP_GET_LOCAL:
+                emitGetLocal(as, runtime, ip, ip[1]);
+                break;
+            case OP_SET_LOCAL:
+                emitSetLocal(as, runtime, ip, ip[1]);
+                break;
+            case OP_POP:
+                EMIT(0x48, 0x83, 0xEB, 0x08);           // sub rbx, 8
+                break;
+            case OP_DUP:
+                EMIT(0x48, 0x8B, 0x43, 0xF8);           // mov rax, [rbx - 8]
+                emitPush(as);
+                break;
+            case OP_JUMP:
+                addFixup(as, emitJumpAlways(as), next + operand);
+                break;
+            case OP_JUMP_IF_FALSE:
+                emitJumpIfFalse(as, next + operand);
+                break;
+            case OP_LOOP:
+                addFixup(as, emitJumpAlways(as), next - operand);
+                break;
+            case OP_CALL:
+            case OP_TAIL_CALL:
+                if (ip[1] == 2) {
+                    emitBinaryCall(as, runtime, ip);
+                } else {
+                    emitStep(as, runtime, ip, true);
+                }
+                break;
+            case OP_CALL_BINARY:
+                emitBinaryCall(as, runtime, ip);
+                break;
+            case OP_RETURN:
+                emitExit(as, ip);
+                break;
+            default:
+                emitStep(as, runtime, ip, false);
+                break;
+        }
+        offset = next;
+    }
+    offsets[chunk->count] = (uint32_t)as->count;
+
+    for (int i = 0; i < as->fixupCount; i++) {
+        patchJump(as, as->fixups[i].at, (int)offsets[as->fixups[i].target]);
+    }
+}
+
+// Machine code for a function's chunk, or NULL if it can't be made
+JitCode* jitCompile(Chunk* chunk, const JitRuntime* runtime) {
+    Assembler as = {NULL, 0, 0, NULL, 0, 0, 0};
+    uint32_t* offsets = reallocate(NULL, 0, sizeof(uint32_t) * (chunk->count + 1));
+    emitPrologueAndExit(&as, runtime);
+    translate(&as, runtime, chunk, offsets);
+    reallocate(as.fixups, sizeof(Fixup) * as.fixupCapacity, 0);
+
+    // Written while writable, then only executable
+    uint8_t* code = mmap(NULL, (size_t)as.count, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        reallocate(as.code, as.capacity, 0);
+        reallocate(offsets, sizeof(uint32_t) * (chunk->count + 1), 0);
+        return NULL;
+    }
+    memcpy(code, as.code, (size_t)as.count);
+    reallocate(as.code, as.capacity, 0);
+    mprotect(code, (size_t)as.count, PROT_READ | PROT_EXEC);
+
+    JitCode* jit = reallocate(NULL, 0, sizeof(JitCode));
+    jit->code = code;
+    jit->size = (size_t)as.count;
+    jit->offsets = offsets;
+    jit->count = chunk->count;
+    return jit;
+}
+
+// Run frame's machine code from the instruction at its ip until it stops
+// in front of one the VM has to run
+void runJit(JitCode* jit, CallFrame* frame) {
+    JitEntry entry = (JitEntry)(uintptr_t)jit->code;
+    entry(frame, jit->code + jit->offsets[frame->ip - frame->chunk->code]);
+}
+
+void freeJitCode(JitCode* jit) {
+    munmap(jit->code, jit->size);
+    reallocate(jit->offsets, sizeof(uint32_t) * (jit->count + 1), 0);
+    reallocate(jit, sizeof(JitCode), 0);
+}
+
+#else
+
+// Without the JIT every function stays in bytecode
+JitCode* jitCompile(Chunk* chunk, const JitRuntime* runtime) {
+    (void)chunk;
+    (void)runtime;
+    return NULL;
+}
+
+void runJit(JitCode* jit, CallFrame* frame) {
+    (void)jit;
+    (void)frame;
+}
+
+void freeJitCode(JitCode* jit) {
+    (void)jit;
+}
+
+#endif
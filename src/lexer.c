@@ -6,7 +6,7 @@ typedef struct {
     int line;
 } Lexer;
 
-static Lexer lexer;
+static HEXA_THREAD_LOCAL Lexer lexer;
 
 void initLexer(const char* source) {
     lexer.start = source;
@@ -104,9 +104,10 @@ static Token number() {
         advance();
 
         while (isDigit(peek())) advance();
+        return makeToken(TOKEN_NUMBER);
     }
 
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(TOKEN_INTEGER);
 }
 
 static Token identifier() {
@@ -156,6 +157,14 @@ Token scanToken() {
         case '[': return makeToken(TOKEN_LBRACKET);
         case ']': return makeToken(TOKEN_RBRACKET);
         case '"': return string();
+        case '\'': return makeToken(TOKEN_QUOTE);
+        case '`': return makeToken(TOKEN_QUASIQUOTE);
+        case ',':
+            if (peek() == '@') {
+                advance();
+                return makeToken(TOKEN_UNQUOTE_SPLICING);
+            }
+            return makeToken(TOKEN_UNQUOTE);
     }
 
     return errorToken("Unexpected character.");
@@ -0,0 +1,300 @@
+#include "../include/hexa.h"
+
+// Macros are functions from code to code. [defmacro name [params] body...]
+// defines one, and before a top-level form runs, each call [name args...]
+// in it is replaced by what the macro returns for the unevaluated args. The
+// expansion takes the call's place in the form, so it happens once however
+// often the code runs, and code built by macros costs the same as code
+// written out by hand.
+//
+// Macros usually build their result from a quasiquote template:
+// `[if ,test nil ,body] is the list [if nil] with the values of test and
+// body put where they are unquoted, and ,@args splices the items of a list.
+//
+// defmacro and quasiquote forms are rewritten into calls of built-ins no
+// program can name, so the VM and the tree-walker run them as calls.
+// dotimes is rewritten into a while loop the same way, and [fn memo [params]
+// body...] into a call of the built-in memo on the plain fn.
+
+// How many times in a row a call may expand into another macro call
+#define MAX_EXPANSIONS 1000
+
+static HEXA_THREAD_LOCAL struct {
+    bool created;
+    Value list;         // [list a b] is the list [a b]
+    Value concat;       // [concat [a] [b c]] is the list [a b c]
+    Value defineMacro;  // [define-macro 'name closure] makes closure the macro name
+    Environment* initial;   // The built-ins as every program starts with them
+} builtins;
+
+static Value listNative(int argCount, Value* args) {
+    return makeListIn(NULL, args, argCount);
+}
+
+static Value concatNative(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_LIST(args[i])) {
+            runtimeError("Spliced values must be lists.");
+            return NIL_VAL;
+        }
+    }
+
+    Value result = makeList();
+    for (int i = 0; i < argCount; i++) {
+        List* list = AS_LIST(args[i]);
+        for (int j = 0; j < list->count; j++) {
+            appendToList(AS_LIST(result), list->items[j]);
+        }
+    }
+    return result;
+}
+
+static Value defineMacroNative(int argCount, Value* args) {
+    (void)argCount;
+    AS_SYMBOL(args[0])->macro = AS_CLOSURE(args[1]);
+    return NIL_VAL;
+}
+
+static void createBuiltins() {
+    if (builtins.created) return;
+    builtins.list = makeNative(listNative, "list");
+    builtins.concat = makeNative(concatNative, "concat");
+    builtins.defineMacro = makeNative(defineMacroNative, "define-macro");
+    builtins.initial = createEnvironment();
+    initGlobalEnvironment(builtins.initial);
+    builtins.created = true;
+}
+
+// The built-in name, even where a program redefines or shadows it
+static Value initialBuiltin(const char* name) {
+    Value value = NIL_VAL;
+    lookupVariable(builtins.initial, internCString(name), &value);
+    return value;
+}
+
+static Value makeForm(Value head, Value arg) {
+    Value items[2] = {head, arg};
+    return makeListIn(NULL, items, 2);
+}
+
+static Value makeForm3(Value head, Value first, Value second) {
+    Value items[3] = {head, first, second};
+    return makeListIn(NULL, items, 3);
+}
+
+// Whether expr is [name x]
+static bool isForm(Value expr, const char* name) {
+    if (!IS_LIST(expr)) return false;
+    List* list = AS_LIST(expr);
+    return list->count == 2 && IS_SYMBOL(list->items[0]) &&
+           AS_SYMBOL(list->items[0]) == internCString(name);
+}
+
+// Whether some of template is unquoted. A nested template is left as data.
+static bool hasUnquote(Value template) {
+    if (!IS_LIST(template)) return false;
+    if (isForm(template, "unquote") || isForm(template, "unquote-splicing")) return true;
+
+    List* list = AS_LIST(template);
+    if (specialForm(list) == SPECIAL_QUASIQUOTE) return false;
+    for (int i = 0; i < list->count; i++) {
+        if (hasUnquote(list->items[i])) return true;
+    }
+    return false;
+}
+
+// Code that builds template: [list a b] for [a b], and for [a ,@xs b]
+// [concat [list a] xs [list b]], with each item built the same way
+static Value quasiquote(Value template) {
+    if (!hasUnquote(template)) return makeForm(makeSymbol("quote"), template);
+    if (isForm(template, "unquote")) return AS_LIST(template)->items[1];
+    if (isForm(template, "unquote-splicing")) {
+        runtimeError("Can only splice into a list.");
+        return NIL_VAL;
+    }
+
+    List* list = AS_LIST(template);
+    Value call = makeList();
+    appendToList(AS_LIST(call), builtins.concat);
+    Value items = NIL_VAL;
+    bool spliced = false;
+    for (int i = 0; i < list->count; i++) {
+        Value item = list->items[i];
+        if (isForm(item, "unquote-splicing")) {
+            if (!IS_NIL(items)) appendToList(AS_LIST(call), items);
+            appendToList(AS_LIST(call), AS_LIST(item)->items[1]);
+            items = NIL_VAL;
+            spliced = true;
+            continue;
+        }
+
+        if (IS_NIL(items)) {
+            items = makeList();
+            appendToList(AS_LIST(items), builtins.list);
+        }
+        appendToList(AS_LIST(items), quasiquote(item));
+    }
+
+    if (!spliced) return items;
+    if (!IS_NIL(items)) appendToList(AS_LIST(call), items);
+    return call;
+}
+
+// [dotimes [name count] body...] runs body with name bound to 0 up to
+// count - 1, as [let [limit# count name 0] [while [< name limit#] body...
+// [set name [+ name 1]]]] with the built-in < and +. The limit's name
+// can't be read, so the body can't see it.
+static Value dotimes(List* form) {
+    if (form->count < 2 || !IS_LIST(form->items[1]) || AS_LIST(form->items[1])->count != 2 ||
+        !IS_SYMBOL(AS_LIST(form->items[1])->items[0])) {
+        runtimeError("Expected [dotimes [name count] body...].");
+        return NIL_VAL;
+    }
+
+    Value name = AS_LIST(form->items[1])->items[0];
+    Value limit = makeSymbol("limit#");
+    Value bindings[4] = {limit, AS_LIST(form->items[1])->items[1], name, makeInt(0)};
+
+    Value loop = makeList();
+    appendToList(AS_LIST(loop), makeSymbol("while"));
+    appendToList(AS_LIST(loop), makeForm3(initialBuiltin("<"), name, limit));
+    for (int i = 2; i < form->count; i++) {
+        appendToList(AS_LIST(loop), form->items[i]);
+    }
+    Value step = makeForm3(initialBuiltin("+"), name, makeInt(1));
+    appendToList(AS_LIST(loop), makeForm3(makeSymbol("set"), name, step));
+
+    return makeForm3(makeSymbol("let"), makeListIn(NULL, bindings, 4), loop);
+}
+
+// The code a defmacro, quasiquote, dotimes or annotated fn form is
+// rewritten to
+Value desugarForm(List* form) {
+    createBuiltins();
+
+    switch (specialForm(form)) {
+        case SPECIAL_QUASIQUOTE:
+            if (form->count != 2) {
+                runtimeError("Expected 1 arguments but got %d.", form->count - 1);
+                return NIL_VAL;
+            }
+            return quasiquote(form->items[1]);
+        case SPECIAL_DOTIMES:
+            return dotimes(form);
+        case SPECIAL_FN: {
+            // [memo [fn [params] body...]] with the built-in memo
+            Value fn = makeListIn(NULL, &form->items[1], form->count - 1);
+            AS_LIST(fn)->items[0] = form->items[0];
+            return makeForm(initialBuiltin("memo"), fn);
+        }
+        default:
+            break;
+    }
+
+    if (form->count < 4 || !IS_SYMBOL(form->items[1]) || !IS_LIST(form->items[2])) {
+        runtimeError("Expected [defmacro name [params] body...].");
+        return NIL_VAL;
+    }
+
+    // [define-macro 'name [fn [params] body...]]
+    Value fn = makeListIn(NULL, &form->items[1], form->count - 1);
+    AS_LIST(fn)->items[0] = makeSymbol("fn");
+    return makeForm3(builtins.defineMacro, makeForm(makeSymbol("quote"), form->items[1]), fn);
+}
+
+// Whether desugarForm rewrites form: defmacro, quasiquote and dotimes forms
+// do, and fn forms annotated as [fn memo [params] body...]
+bool isDesugared(List* form) {
+    switch (specialForm(form)) {
+        case SPECIAL_DEFMACRO:
+        case SPECIAL_QUASIQUOTE:
+        case SPECIAL_DOTIMES:
+            return true;
+        case SPECIAL_FN:
+            return form->count > 2 && IS_SYMBOL(form->items[1]) &&
+                   AS_SYMBOL(form->items[1]) == internCString("memo");
+        default:
+            return false;
+    }
+}
+
+// expr with every macro call in it expanded and every defmacro, quasiquote
+// and dotimes desugared. Like the optimizer, a list is copied when one of its
+// items changes, since parse trees in an arena can't refer to new objects.
+// Each new value is a root until the caller is done, and changed is set
+// when the result isn't expr.
+static Value expand(Value expr, int* roots, bool* changed) {
+    for (int expansions = 0; IS_LIST(expr); expansions++) {
+        List* list = AS_LIST(expr);
+        SpecialForm special = specialForm(list);
+        Symbol* name = special == SPECIAL_NONE && list->count > 0 && IS_SYMBOL(list->items[0])
+            ? AS_SYMBOL(list->items[0]) : NULL;
+        if (!isDesugared(list) && (name == NULL || name->macro == NULL)) {
+            break;
+        }
+
+        if (expansions == MAX_EXPANSIONS) {
+            runtimeError("Expanding %s doesn't end.", name != NULL ? name->chars : "a template");
+            return NIL_VAL;
+        }
+
+        if (name != NULL) {
+            Closure* macro = name->macro;
+            expr = callFunction(closureValue(macro), list->count - 1, &list->items[1],
+                                globalsOf(closureValue(macro)));
+        } else {
+            expr = desugarForm(list);
+        }
+        pushRoot(expr);
+        (*roots)++;
+        *changed = true;
+    }
+
+    if (!IS_LIST(expr) || specialForm(AS_LIST(expr)) == SPECIAL_QUOTE) return expr;
+
+    List* list = AS_LIST(expr);
+    Value result = expr;
+    bool copied = false;
+    for (int i = 0; i < list->count; i++) {
+        bool itemChanged = false;
+        Value item = expand(list->items[i], roots, &itemChanged);
+        if (!itemChanged) continue;
+
+        if (!copied) {
+            result = makeListIn(NULL, list->items, list->count);
+            pushRoot(result);
+            (*roots)++;
+            copied = true;
+            *changed = true;
+            // A function prints as written, not with its body expanded
+            if (specialForm(list) == SPECIAL_FN && !isDesugared(list)) {
+                recordSourceForm(AS_LIST(result), list);
+            }
+        }
+        AS_LIST(result)->items[i] = item;
+    }
+    return result;
+}
+
+// The top-level form expr, ready to run. The caller keeps expr reachable
+// from a GC root, and the result too if it differs.
+Value expandMacros(Value expr) {
+    int roots = 0;
+    bool changed = false;
+    Value result = expand(expr, &roots, &changed);
+    popRoots(roots);
+    return result;
+}
+
+void markMacroRoots() {
+    if (!builtins.created) return;
+    markValue(builtins.list);
+    markValue(builtins.concat);
+    markValue(builtins.defineMacro);
+    markObject(&builtins.initial->obj);
+}
+
+// The built-ins are freed with the rest of the heap, and made again if used
+void freeMacros() {
+    builtins.created = false;
+}
@@ -1,11 +1,12 @@
 #include "../include/hexa.h"
+#include <limits.h>
 
 // Forward declaration of the global environment initializer
 void initGlobalEnvironment(Environment* env);
 void appendToList(List* list, Value value);
 void printValue(Value value);
 
-static void repl(Environment* env) {
+static void repl(HexaVM* hexa) {
     char line[1024];
     
     for (;;) {
@@ -17,13 +18,14 @@ static void repl(Environment* env) {
         }
         
         Value expr = parse(line);
-        Value result = evaluate(expr, env);
+        pushRoot(expr);
+        Value result = runForm(hexa, expr);
         
         printf("=> ");
         printValue(result);
         printf("\n");
         
-        freeValue(expr);
+        popRoots(1);
     }
 }
 
@@ -77,9 +79,14 @@ static void debugTokens(const char* source) {
                token.type == TOKEN_IDENTIFIER ? "IDENTIFIER" :
                token.type == TOKEN_STRING ? "STRING" :
                token.type == TOKEN_NUMBER ? "NUMBER" :
+               token.type == TOKEN_INTEGER ? "INTEGER" :
                token.type == TOKEN_BOOLEAN ? "BOOLEAN" :
                token.type == TOKEN_NIL ? "NIL" :
                token.type == TOKEN_COMMENT ? "COMMENT" :
+               token.type == TOKEN_QUOTE ? "QUOTE" :
+               token.type == TOKEN_QUASIQUOTE ? "QUASIQUOTE" :
+               token.type == TOKEN_UNQUOTE ? "UNQUOTE" :
+               token.type == TOKEN_UNQUOTE_SPLICING ? "UNQUOTE_SPLICING" :
                token.type == TOKEN_ERROR ? "ERROR" : "UNKNOWN",
                token.length, token.lexeme);
                
@@ -87,65 +94,128 @@ static void debugTokens(const char* source) {
     }
 }
 
-// Create a function to parse and evaluate multiple expressions
-static void parseAndEvaluateMultiple(const char* source, Environment* env) {
-    // Initialize the lexer with the source
-    initLexer(source);
-    
-    // Create a parser context
-    initParser();
-    
-    // Parse and evaluate expressions until we reach the end of the file
-    while (getCurrentToken().type != TOKEN_EOF) {
-        Value expr = parseExpression();
-        Value result = evaluate(expr, env);
-        
-        // Only print non-nil results
-        if (result.type != VAL_NIL) {
-            printValue(result);
-            printf("\n");
-        }
-        
-        freeValue(expr);
-        // Don't free result here as it might be part of the environment
-    }
-}
-
-static void runFile(const char* path, Environment* env) {
+static void runFile(const char* path, HexaVM* hexa) {
     char* source = readFile(path);
     
     // Debug tokens only when requested
     // debugTokens(source);
     
-    // Parse and evaluate multiple expressions
-    parseAndEvaluateMultiple(source, env);
+    // Evaluate every expression, printing the results that aren't nil
+    runSource(hexa, source, true);
     
     free(source);
 }
 
+static void usage() {
+    fprintf(stderr, "Usage: hexai [--tree-walk] [--emit-c] [--no-jit] [--jit-threshold n] [--no-opt] [--dump-opt] "
+                    "[--max-depth n] [--threads n] [--gc-stats] [--alloc-stats] [--ic-stats] "
+                    "[--gc-initial-heap bytes] [--gc-growth factor] [path]\n");
+    exit(64);
+}
+
+// A byte count with an optional K, M or G suffix
+static size_t parseSize(const char* text) {
+    char* end;
+    double size = strtod(text, &end);
+    switch (*end) {
+        case 'K': case 'k': size *= 1024; end++; break;
+        case 'M': case 'm': size *= 1024 * 1024; end++; break;
+        case 'G': case 'g': size *= 1024 * 1024 * 1024; end++; break;
+    }
+    
+    if (end == text || *end != '\0' || size < 0) usage();
+    return (size_t)size;
+}
+
 int main(int argc, char* argv[]) {
-    // Create global environment
-    Environment* globalEnv = createEnvironment();
-    initGlobalEnvironment(globalEnv);
+    bool gcStats = false;
+    bool allocationStats = false;
+    bool icStats = false;
+    bool emitC = false;
+    bool treeWalk = false;
+    bool optimizeForms = true;
+    bool dumpOptimized = false;
+    int argi = 1;
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0 &&
+           strcmp(argv[argi], "--debug") != 0) {
+        if (strcmp(argv[argi], "--tree-walk") == 0) {
+            treeWalk = true;
+        } else if (strcmp(argv[argi], "--jit") == 0) {
+            setJitEnabled(true);
+        } else if (strcmp(argv[argi], "--no-jit") == 0) {
+            setJitEnabled(false);
+        } else if (strcmp(argv[argi], "--jit-threshold") == 0 && argi + 1 < argc) {
+            char* end;
+            long calls = strtol(argv[++argi], &end, 10);
+            if (*end != '\0' || calls < 1 || calls > INT_MAX) usage();
+            setJitThreshold((int)calls);
+        } else if (strcmp(argv[argi], "--emit-c") == 0) {
+            emitC = true;
+        } else if (strcmp(argv[argi], "--no-opt") == 0) {
+            optimizeForms = false;
+        } else if (strcmp(argv[argi], "--dump-opt") == 0) {
+            dumpOptimized = true;
+        } else if (strcmp(argv[argi], "--max-depth") == 0 && argi + 1 < argc) {
+            char* end;
+            long depth = strtol(argv[++argi], &end, 10);
+            if (*end != '\0' || depth < 1 || depth > INT_MAX) usage();
+            setMaxCallDepth((int)depth);
+        } else if (strcmp(argv[argi], "--threads") == 0 && argi + 1 < argc) {
+            char* end;
+            long count = strtol(argv[++argi], &end, 10);
+            if (*end != '\0' || count < 1 || count > 1024) usage();
+            setThreadCount((int)count);
+        } else if (strcmp(argv[argi], "--gc-stats") == 0) {
+            gcStats = true;
+        } else if (strcmp(argv[argi], "--alloc-stats") == 0) {
+            allocationStats = true;
+        } else if (strcmp(argv[argi], "--ic-stats") == 0) {
+            icStats = true;
+        } else if (strcmp(argv[argi], "--gc-initial-heap") == 0 && argi + 1 < argc) {
+            setGCInitialHeap(parseSize(argv[++argi]));
+        } else if (strcmp(argv[argi], "--gc-growth") == 0 && argi + 1 < argc) {
+            char* end;
+            double factor = strtod(argv[++argi], &end);
+            if (*end != '\0' || factor <= 1) usage();
+            setGCGrowthFactor(factor);
+        } else {
+            usage();
+        }
+        argi++;
+    }
+    
+    // The interpreter, with the global environment for the whole run
+    HexaVM* hexa = newHexaVM();
+    setTreeWalk(hexa, treeWalk);
+    setOptimize(hexa, optimizeForms, dumpOptimized);
     
-    if (argc == 1) {
+    int status = 0;
+    if (emitC) {
+        // Translate the file to C on stdout instead of running it
+        if (argc - argi != 1) usage();
+        char* source = readFile(argv[argi]);
+        if (!emitProgram(source, argv[argi], hexaGlobals(hexa), stdout)) status = 74;
+        free(source);
+    } else if (argc - argi == 0) {
         // No arguments, run REPL
         printf("Hexa Language Interpreter (C Edition)\n");
         printf("Press Ctrl+C to exit\n");
-        repl(globalEnv);
-    } else if (argc == 2) {
+        repl(hexa);
+    } else if (argc - argi == 1) {
         // One argument, run file
-        runFile(argv[1], globalEnv);
-    } else if (argc == 3 && strcmp(argv[1], "--debug") == 0) {
+        runFile(argv[argi], hexa);
+    } else if (argc - argi == 2 && strcmp(argv[argi], "--debug") == 0) {
         // Debug mode
-        char* source = readFile(argv[2]);
+        char* source = readFile(argv[argi + 1]);
         debugTokens(source);
         free(source);
     } else {
-        fprintf(stderr, "Usage: hexai [path]\n");
-        exit(64);
+        usage();
     }
     
-    freeEnvironment(globalEnv);
-    return 0;
-} 
\ No newline at end of file
+    if (gcStats) printGCStats();
+    if (allocationStats) printAllocStats();
+    if (icStats) printCacheStats();
+    freeHexaVM(hexa);
+    return status;
+}
@@ -0,0 +1,236 @@
+#include "../include/hexa.h"
+
+// [memo f] is f with a cache of its results: a call with arguments equal
+// (by valuesEqual) to an earlier call's returns that call's result instead
+// of running the body again, so recursive functions like fibonacci make
+// each distinct call once. Only functions without side effects should be
+// memoized, since the effects happen only the first time.
+//
+// The cache keeps the results of the most recently used calls, up to a
+// size given as [memo f size], and forgets the least recently used one to
+// make room. Calls that find their result count as hits and the others as
+// misses; [memo-stats f] reports them.
+//
+// The VM and the tree-walker look a call up with memoLookup, and run the
+// function as usual when that misses, storing the result with memoStore
+// once it returns.
+
+typedef struct {
+    uint32_t hash;
+    int next;           // Next entry in the same bucket, or -1
+    int newer;          // Neighbours in order of use, or -1 at the ends
+    int older;
+    Value result;
+} MemoEntry;
+
+struct Memo {
+    int arity;
+    int size;           // The most results kept
+    int count;
+    int capacity;
+    MemoEntry* entries;
+    Value* keys;        // The arguments of entry i start at keys[i * arity]
+    int* buckets;       // First entry of each bucket, capacity many
+    int newest;
+    int oldest;
+    size_t hits;
+    size_t misses;
+};
+
+Memo* newMemo(int arity, int size) {
+    Memo* memo = reallocate(NULL, 0, sizeof(Memo));
+    memo->arity = arity;
+    memo->size = size;
+    memo->count = 0;
+    memo->capacity = 0;
+    memo->entries = NULL;
+    memo->keys = NULL;
+    memo->buckets = NULL;
+    memo->newest = -1;
+    memo->oldest = -1;
+    memo->hits = 0;
+    memo->misses = 0;
+    return memo;
+}
+
+// An empty memo for the same function, with the same size
+Memo* newMemoLike(Memo* memo) {
+    return newMemo(memo->arity, memo->size);
+}
+
+void freeMemo(Memo* memo) {
+    reallocate(memo->entries, sizeof(MemoEntry) * memo->capacity, 0);
+    reallocate(memo->keys, sizeof(Value) * memo->arity * memo->capacity, 0);
+    reallocate(memo->buckets, sizeof(int) * memo->capacity, 0);
+    reallocate(memo, sizeof(Memo), 0);
+}
+
+void markMemo(Memo* memo) {
+    for (int i = 0; i < memo->count; i++) {
+        markValue(memo->entries[i].result);
+    }
+    for (int i = 0; i < memo->count * memo->arity; i++) {
+        markValue(memo->keys[i]);
+    }
+}
+
+static uint32_t hashArguments(Memo* memo, Value* args) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < memo->arity; i++) {
+        hash = (hash ^ hashValue(args[i])) * 16777619;
+    }
+    return hash;
+}
+
+static int* bucketOf(Memo* memo, uint32_t hash) {
+    return &memo->buckets[hash & (memo->capacity - 1)];
+}
+
+static void unlinkEntry(Memo* memo, int index) {
+    MemoEntry* entry = &memo->entries[index];
+    if (entry->newer != -1) memo->entries[entry->newer].older = entry->older;
+    else memo->newest = entry->older;
+    if (entry->older != -1) memo->entries[entry->older].newer = entry->newer;
+    else memo->oldest = entry->newer;
+}
+
+static void linkNewest(Memo* memo, int index) {
+    MemoEntry* entry = &memo->entries[index];
+    entry->newer = -1;
+    entry->older = memo->newest;
+    if (memo->newest != -1) memo->entries[memo->newest].newer = index;
+    memo->newest = index;
+    if (memo->oldest == -1) memo->oldest = index;
+}
+
+// Double the room for entries and put them into new buckets
+static void growMemo(Memo* memo) {
+    int oldCapacity = memo->capacity;
+    int capacity = oldCapacity < 8 ? 8 : oldCapacity * 2;
+    memo->entries = reallocate(memo->entries, sizeof(MemoEntry) * oldCapacity,
+                               sizeof(MemoEntry) * capacity);
+    memo->keys = reallocate(memo->keys, sizeof(Value) * memo->arity * oldCapacity,
+                            sizeof(Value) * memo->arity * capacity);
+    memo->buckets = reallocate(memo->buckets, sizeof(int) * oldCapacity, sizeof(int) * capacity);
+    memo->capacity = capacity;
+
+    for (int i = 0; i < capacity; i++) {
+        memo->buckets[i] = -1;
+    }
+    for (int i = 0; i < memo->count; i++) {
+        int* bucket = bucketOf(memo, memo->entries[i].hash);
+        memo->entries[i].next = *bucket;
+        *bucket = i;
+    }
+}
+
+// The entry for args, or -1
+static int findEntry(Memo* memo, Value* args, uint32_t hash) {
+    if (memo->count == 0) return -1;
+
+    for (int index = *bucketOf(memo, hash); index != -1; index = memo->entries[index].next) {
+        if (memo->entries[index].hash != hash) continue;
+
+        Value* key = &memo->keys[index * memo->arity];
+        bool equal = true;
+        for (int i = 0; i < memo->arity && equal; i++) {
+            equal = valuesEqual(key[i], args[i]);
+        }
+        if (equal) return index;
+    }
+    return -1;
+}
+
+// Whether a call on args has a result, which is then the newest
+bool memoLookup(Memo* memo, Value* args, Value* result) {
+    int index = findEntry(memo, args, hashArguments(memo, args));
+    if (index == -1) {
+        memo->misses++;
+        return false;
+    }
+
+    memo->hits++;
+    unlinkEntry(memo, index);
+    linkNewest(memo, index);
+    *result = memo->entries[index].result;
+    return true;
+}
+
+// Remember result for args. A full cache gives up its least recently used
+// entry.
+void memoStore(Memo* memo, Value* args, Value result) {
+    uint32_t hash = hashArguments(memo, args);
+
+    // A recursive call may have stored the same arguments meanwhile
+    int index = findEntry(memo, args, hash);
+    if (index != -1) {
+        unlinkEntry(memo, index);
+    } else if (memo->count < memo->size) {
+        if (memo->count == memo->capacity) growMemo(memo);
+        index = memo->count++;
+        int* bucket = bucketOf(memo, hash);
+        memo->entries[index].next = *bucket;
+        *bucket = index;
+    } else {
+        // Reuse the oldest entry, taking it out of its bucket first
+        index = memo->oldest;
+        unlinkEntry(memo, index);
+        int* link = bucketOf(memo, memo->entries[index].hash);
+        while (*link != index) link = &memo->entries[*link].next;
+        *link = memo->entries[index].next;
+
+        int* bucket = bucketOf(memo, hash);
+        memo->entries[index].next = *bucket;
+        *bucket = index;
+    }
+
+    memo->entries[index].hash = hash;
+    memo->entries[index].result = result;
+    if (memo->arity > 0) {
+        memcpy(&memo->keys[index * memo->arity], args, sizeof(Value) * memo->arity);
+    }
+    linkNewest(memo, index);
+}
+
+// [memo f] or [memo f size]: a closure of f's function that caches results
+Value nativeMemo(int argCount, Value* args) {
+    if (argCount < 1 || argCount > 2) {
+        runtimeError("Expected 1 or 2 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!IS_FUNCTION(args[0])) {
+        runtimeError("Can only memoize functions.");
+        return NIL_VAL;
+    }
+
+    int size = HEXA_MEMO_DEFAULT_SIZE;
+    if (argCount == 2) {
+        if (!IS_INT(args[1]) || AS_INT(args[1]) < 1 || AS_INT(args[1]) > INT32_MAX / 2) {
+            runtimeError("Memo size must be a positive integer.");
+            return NIL_VAL;
+        }
+        size = (int)AS_INT(args[1]);
+    }
+
+    Closure* closure = AS_CLOSURE(args[0]);
+    Value memoized = makeFunction(closure->function, closure->env);
+    AS_CLOSURE(memoized)->memo = newMemo(closure->function->arity, size);
+    return memoized;
+}
+
+// [memo-stats f] is [hits misses size] for the memoized function f
+Value nativeMemoStats(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!IS_FUNCTION(args[0]) || AS_CLOSURE(args[0])->memo == NULL) {
+        runtimeError("Expected a memoized function.");
+        return NIL_VAL;
+    }
+
+    Memo* memo = AS_CLOSURE(args[0])->memo;
+    Value stats[3] = {makeInt((int64_t)memo->hits), makeInt((int64_t)memo->misses),
+                      makeInt(memo->count)};
+    return makeListIn(NULL, stats, 3);
+}
@@ -0,0 +1,441 @@
+#include "../include/hexa.h"
+#include <time.h>
+
+#define GC_DEFAULT_INITIAL_HEAP (1024 * 1024)
+#define GC_DEFAULT_GROWTH 2.0
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 8
+
+// One block of an arena. Consecutive forms share a block, and the collector
+// keeps or frees each block as a whole.
+struct ArenaBlock {
+    Obj obj;
+    ArenaBlock* continues;  // Earlier block holding the start of a form that spills into this one
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// Every heap object is linked into one list. A collection marks everything
+// reachable from the roots (the VM stack and frames, the globals, and values
+// C code pushed with pushRoot) and frees the rest.
+//
+// Collections only start from collectGarbageIfNeeded(), which the evaluator
+// and the VM call when entering a function. Allocating never collects, so C
+// code only has to root values it holds across a call into Hexa code.
+typedef struct {
+    Obj* objects;
+    size_t bytesAllocated;
+    size_t nextGC;
+    size_t initialHeap;
+    double growthFactor;
+
+    // Objects held by C code
+    Obj** roots;
+    int rootCount;
+    int rootCapacity;
+
+    // Marked objects whose references still have to be traced
+    Obj** gray;
+    int grayCount;
+    int grayCapacity;
+
+    // Totals for --gc-stats
+    int collections;
+    double totalPause;
+    double maxPause;
+    size_t bytesReclaimed;
+    size_t peakHeap;
+} Heap;
+
+static HEXA_THREAD_LOCAL Heap heap = {
+    .nextGC = GC_DEFAULT_INITIAL_HEAP,
+    .initialHeap = GC_DEFAULT_INITIAL_HEAP,
+    .growthFactor = GC_DEFAULT_GROWTH
+};
+
+HEXA_THREAD_LOCAL AllocStats allocStats;
+
+// All heap memory goes through here so the collector knows the heap size
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    heap.bytesAllocated += newSize;
+    heap.bytesAllocated -= oldSize;
+    if (heap.bytesAllocated > heap.peakHeap) heap.peakHeap = heap.bytesAllocated;
+    if (newSize > oldSize) {
+        allocStats.allocations++;
+        allocStats.bytes += newSize - oldSize;
+    }
+
+    if (newSize == 0) {
+        free(pointer);
+        return NULL;
+    }
+
+    void* result = realloc(pointer, newSize);
+    if (result == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(70);
+    }
+    return result;
+}
+
+Obj* allocateObject(size_t size, ObjType type) {
+    Obj* object = reallocate(NULL, 0, size);
+    object->type = type;
+    object->isMarked = false;
+    object->inArena = false;
+    object->next = heap.objects;
+    heap.objects = object;
+    return object;
+}
+
+void initArena(Arena* arena) {
+    arena->block = NULL;
+    arena->formStart = 0;
+}
+
+// Objects allocated from here on belong to a new form
+void beginArenaForm(Arena* arena) {
+    arena->formStart = arena->block != NULL ? arena->block->used : 0;
+}
+
+void* arenaAllocate(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaBlock* block = arena->block;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock* fresh = (ArenaBlock*)allocateObject(sizeof(ArenaBlock) + blockSize, OBJ_ARENA);
+        fresh->size = blockSize;
+        fresh->used = 0;
+
+        // A form refers back to the objects it already has in the old block
+        bool spills = block != NULL && block->used > arena->formStart;
+        fresh->continues = spills ? block : NULL;
+
+        arena->block = block = fresh;
+        arena->formStart = 0;
+    }
+
+    void* result = block->data + block->used;
+    block->used += size;
+    return result;
+}
+
+// An object living in an arena block, it is freed together with the block
+Obj* allocateArenaObject(Arena* arena, size_t size, ObjType type) {
+    Obj* object = arenaAllocate(arena, size);
+    object->type = type;
+    object->isMarked = false;
+    object->inArena = true;
+    object->next = &arena->block->obj;
+    return object;
+}
+
+// The heap object behind a value, or NULL for immediates and symbols
+Obj* asObject(Value value) {
+    return IS_OBJ(value) ? AS_OBJ(value) : NULL;
+}
+
+static void pushObjectRoot(Obj* object) {
+    if (heap.rootCount == heap.rootCapacity) {
+        int oldCapacity = heap.rootCapacity;
+        heap.rootCapacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+        heap.roots = reallocate(heap.roots, sizeof(Obj*) * oldCapacity,
+                                sizeof(Obj*) * heap.rootCapacity);
+    }
+    heap.roots[heap.rootCount++] = object;
+}
+
+// Keep a value alive until the matching popRoots
+void pushRoot(Value value) {
+    pushObjectRoot(asObject(value));
+}
+
+void pushEnvironmentRoot(Environment* env) {
+    pushObjectRoot(&env->obj);
+}
+
+void popRoots(int count) {
+    heap.rootCount -= count;
+}
+
+void markObject(Obj* object) {
+    if (object == NULL) return;
+
+    // Arena objects only refer to objects of the same form, so keeping
+    // their block (and the blocks the form continues from) is all there is to do
+    if (object->inArena) object = object->next;
+    if (object->isMarked) return;
+    object->isMarked = true;
+
+    if (heap.grayCount == heap.grayCapacity) {
+        heap.grayCapacity = heap.grayCapacity < 64 ? 64 : heap.grayCapacity * 2;
+        heap.gray = realloc(heap.gray, sizeof(Obj*) * heap.grayCapacity);
+        if (heap.gray == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(70);
+        }
+    }
+    heap.gray[heap.grayCount++] = object;
+}
+
+void markValue(Value value) {
+    markObject(asObject(value));
+}
+
+static void markValues(Value* values, int count) {
+    for (int i = 0; i < count; i++) {
+        markValue(values[i]);
+    }
+}
+
+static void blackenObject(Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+        case OBJ_CHANNEL:
+            break;
+        case OBJ_ARENA: {
+            ArenaBlock* block = (ArenaBlock*)object;
+            if (block->continues != NULL) markObject(&block->continues->obj);
+            break;
+        }
+        case OBJ_LIST: {
+            List* list = (List*)object;
+            markValues(list->items, list->count);
+            break;
+        }
+        case OBJ_VECTOR: {
+            Vector* vector = (Vector*)object;
+            markObject(&vector->root->obj);
+            markObject(&vector->tail->obj);
+            break;
+        }
+        case OBJ_VECTOR_NODE: {
+            VectorNode* node = (VectorNode*)object;
+            if (node->leaf) {
+                markValues(node->as.items, node->count);
+            } else {
+                for (int i = 0; i < node->count; i++) {
+                    markObject(&node->as.children[i]->obj);
+                }
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            Function* function = (Function*)object;
+            markObject(&function->form->obj);
+            if (function->chunk != NULL) {
+                markValues(function->chunk->constants.items, function->chunk->constants.count);
+            }
+            break;
+        }
+        case OBJ_CLOSURE: {
+            Closure* closure = (Closure*)object;
+            markObject(&closure->function->obj);
+            if (closure->env != NULL) markObject(&closure->env->obj);
+            if (closure->memo != NULL) markMemo(closure->memo);
+            break;
+        }
+        case OBJ_TASK:
+            blackenTask((Task*)object);
+            break;
+        case OBJ_ENVIRONMENT: {
+            Environment* env = (Environment*)object;
+            for (int i = 0; i < env->capacity; i++) {
+                if (!env->hashed && i >= env->count) break;
+                if (env->entries[i].key == NULL) continue;
+                markValue(env->entries[i].value);
+            }
+            if (env->enclosing != NULL) markObject(&env->enclosing->obj);
+            break;
+        }
+    }
+}
+
+static void freeObject(Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING: {
+            String* string = (String*)object;
+            reallocate(object, sizeof(String) + string->length + 1, 0);
+            break;
+        }
+        case OBJ_LIST:
+            freeList((List*)object);
+            reallocate(object, sizeof(List), 0);
+            break;
+        case OBJ_FUNCTION: {
+            Function* function = (Function*)object;
+            if (function->chunk != NULL) freeChunk(function->chunk);
+            reallocate(object, sizeof(Function), 0);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            Closure* closure = (Closure*)object;
+            if (closure->memo != NULL) freeMemo(closure->memo);
+            reallocate(object, sizeof(Closure), 0);
+            break;
+        }
+        case OBJ_NATIVE:
+            reallocate(object, sizeof(Native), 0);
+            break;
+        case OBJ_ENVIRONMENT: {
+            Environment* env = (Environment*)object;
+            // A new global table could take its place, so no cache may point here
+            if (env->enclosing == NULL) globalsVersion++;
+            if (env->entries != env->inlineEntries) {
+                reallocate(env->entries, sizeof(Entry) * env->capacity, 0);
+            }
+            reallocate(object, sizeof(Environment), 0);
+            break;
+        }
+        case OBJ_ARENA: {
+            ArenaBlock* block = (ArenaBlock*)object;
+            reallocate(object, sizeof(ArenaBlock) + block->size, 0);
+            break;
+        }
+        case OBJ_TASK:
+            freeTask((Task*)object);
+            break;
+        case OBJ_CHANNEL:
+            releaseQueue(((Channel*)object)->queue);
+            reallocate(object, sizeof(Channel), 0);
+            break;
+        case OBJ_VECTOR:
+            reallocate(object, sizeof(Vector), 0);
+            break;
+        case OBJ_VECTOR_NODE:
+            reallocate(object, sizeof(VectorNode), 0);
+            break;
+    }
+}
+
+static void markRoots() {
+    for (int i = 0; i < heap.rootCount; i++) {
+        markObject(heap.roots[i]);
+    }
+    markVMRoots();
+    markEvaluatorRoots();
+    markFramePool();
+    markParserRoots();
+    markOptimizerRoots();
+    markSymbols();
+    markMacroRoots();
+    markProgramFrames();
+    markTaskRoots();
+}
+
+static void traceReferences() {
+    while (heap.grayCount > 0) {
+        blackenObject(heap.gray[--heap.grayCount]);
+    }
+}
+
+static void sweep() {
+    Obj* previous = NULL;
+    Obj* object = heap.objects;
+    while (object != NULL) {
+        if (object->isMarked) {
+            object->isMarked = false;
+            previous = object;
+            object = object->next;
+            continue;
+        }
+
+        Obj* unreached = object;
+        object = object->next;
+        if (previous != NULL) {
+            previous->next = object;
+        } else {
+            heap.objects = object;
+        }
+        freeObject(unreached);
+    }
+}
+
+void collectGarbage() {
+    clock_t start = clock();
+    size_t before = heap.bytesAllocated;
+
+    markRoots();
+    traceReferences();
+    sweep();
+
+    size_t next = (size_t)(heap.bytesAllocated * heap.growthFactor);
+    heap.nextGC = next > heap.initialHeap ? next : heap.initialHeap;
+
+    double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+    heap.collections++;
+    heap.totalPause += pause;
+    if (pause > heap.maxPause) heap.maxPause = pause;
+    heap.bytesReclaimed += before - heap.bytesAllocated;
+}
+
+// Called at safe points, where every live value is reachable from a root
+void collectGarbageIfNeeded() {
+#ifdef HEXA_STRESS_GC
+    collectGarbage();
+#else
+    if (heap.bytesAllocated > heap.nextGC) collectGarbage();
+#endif
+}
+
+size_t heapBytesAllocated() {
+    return heap.bytesAllocated;
+}
+
+void setGCInitialHeap(size_t bytes) {
+    heap.initialHeap = bytes;
+    heap.nextGC = bytes;
+}
+
+void setGCGrowthFactor(double factor) {
+    heap.growthFactor = factor;
+}
+
+void printGCStats() {
+    fprintf(stderr, "GC collections:     %d\n", heap.collections);
+    fprintf(stderr, "GC pause total:     %.3f ms\n", heap.totalPause * 1000);
+    fprintf(stderr, "GC pause max:       %.3f ms\n", heap.maxPause * 1000);
+    fprintf(stderr, "GC bytes reclaimed: %zu\n", heap.bytesReclaimed);
+    fprintf(stderr, "Heap size:          %zu bytes (peak %zu)\n", heap.bytesAllocated, heap.peakHeap);
+}
+
+void printAllocStats() {
+    size_t calls = allocStats.calls > 0 ? allocStats.calls : 1;
+    fprintf(stderr, "Calls:              %zu\n", allocStats.calls);
+    fprintf(stderr, "Allocations:        %zu (%zu bytes)\n", allocStats.allocations, allocStats.bytes);
+    fprintf(stderr, "Allocations/call:   %.3f\n", (double)allocStats.allocations / calls);
+    fprintf(stderr, "Call setup allocs:  %zu (%.3f per call)\n", allocStats.callAllocations,
+            (double)allocStats.callAllocations / calls);
+}
+
+// Free every object at exit
+void freeObjects() {
+    freeWorkers();
+
+    Obj* object = heap.objects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+    heap.objects = NULL;
+    heap.nextGC = heap.initialHeap;
+    freeTasks();
+    freeChannels();
+    freeFramePool();
+    freeOptimizer();
+    freeParser();
+    freeMacros();
+    freeEvaluator();
+
+    reallocate(heap.roots, sizeof(Obj*) * heap.rootCapacity, 0);
+    free(heap.gray);
+    heap.roots = NULL;
+    heap.gray = NULL;
+    heap.rootCount = heap.rootCapacity = 0;
+    heap.grayCount = heap.grayCapacity = 0;
+}
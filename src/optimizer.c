@@ -0,0 +1,281 @@
+#include "../include/hexa.h"
+
+// Code is data, so each top-level form can be simplified before it runs.
+// Calls of pure built-ins whose arguments are all literals are replaced by
+// their result, and an if whose condition is a literal by the branch it
+// takes. Function bodies are folded too, so their constant subexpressions
+// are computed once when the form is optimized instead of on every call.
+//
+// A fold assumes the name still means the built-in. Names bound anywhere in
+// the form itself are never folded, and redefining a pure built-in globally
+// restores every folded function form to its source and bumps foldEpoch, so
+// functions made from them recompile and recheck their body on the next call.
+//
+// Functions print as written, so each function form that macro expansion or
+// folding rewrote is kept with the form in the source it came from.
+
+// A function form that was rewritten, and the form it was rewritten from
+typedef struct {
+    List* optimized;
+    List* original;
+} FoldedForm;
+
+typedef struct {
+    FoldedForm* forms;
+    int count;
+    int capacity;
+} FoldedForms;
+
+static HEXA_THREAD_LOCAL FoldedForms folded;
+static HEXA_THREAD_LOCAL FoldedForms written;
+
+HEXA_THREAD_LOCAL uint32_t foldEpoch;
+
+typedef struct {
+    Environment* globals;
+    bool changed;       // Whether the expression last optimized changed
+} Optimizer;
+
+// Names bound somewhere in the form being optimized
+static HEXA_THREAD_LOCAL List boundNames;
+
+static Value optimizeExpression(Optimizer* optimizer, Value expr);
+
+static void recordForm(FoldedForms* forms, List* optimized, List* original) {
+    if (forms->count == forms->capacity) {
+        int oldCapacity = forms->capacity;
+        forms->capacity = oldCapacity < 16 ? 16 : oldCapacity * 2;
+        forms->forms = reallocate(forms->forms, sizeof(FoldedForm) * oldCapacity,
+                                  sizeof(FoldedForm) * forms->capacity);
+    }
+    forms->forms[forms->count].optimized = optimized;
+    forms->forms[forms->count].original = original;
+    forms->count++;
+}
+
+// form was rewritten from source, which may itself have been rewritten
+void recordSourceForm(List* form, List* source) {
+    recordForm(&written, form, sourceForm(source));
+}
+
+static void bindName(Value name) {
+    if (IS_SYMBOL(name)) appendToList(&boundNames, name);
+}
+
+// Collect the names expr binds with def or set, fn parameters, or let, loop
+// and dotimes bindings
+static void collectBoundNames(Value expr) {
+    if (!IS_LIST(expr)) return;
+
+    List* list = AS_LIST(expr);
+    switch (specialForm(list)) {
+        case SPECIAL_QUOTE:
+            return;
+        case SPECIAL_DEF:
+        case SPECIAL_SET:
+            if (list->count > 1) bindName(list->items[1]);
+            break;
+        case SPECIAL_FN:
+        case SPECIAL_LET:
+        case SPECIAL_LOOP:
+        case SPECIAL_DOTIMES:
+            if (list->count > 1 && IS_LIST(list->items[1])) {
+                List* names = AS_LIST(list->items[1]);
+                int step = specialForm(list) == SPECIAL_FN ? 1 : 2;
+                for (int i = 0; i < names->count; i += step) {
+                    bindName(names->items[i]);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        collectBoundNames(list->items[i]);
+    }
+}
+
+static bool isBound(Symbol* name) {
+    for (int i = 0; i < boundNames.count; i++) {
+        if (AS_SYMBOL(boundNames.items[i]) == name) return true;
+    }
+    return false;
+}
+
+// Values that evaluate to themselves
+static bool isLiteral(Value value) {
+    return !IS_SYMBOL(value) && !IS_LIST(value);
+}
+
+// The list with the items from start on optimized, copied only if one
+// changes. With step 2 only every other item is, for let binding values.
+static Value optimizeItems(Optimizer* optimizer, Value expr, int start, int step) {
+    List* list = AS_LIST(expr);
+    Value result = expr;
+    bool changed = false;
+    for (int i = start; i < list->count; i += step) {
+        Value item = optimizeExpression(optimizer, list->items[i]);
+        if (!optimizer->changed) continue;
+
+        if (!changed) result = makeListIn(NULL, list->items, list->count);
+        AS_LIST(result)->items[i] = item;
+        changed = true;
+    }
+    optimizer->changed = changed;
+    return result;
+}
+
+// The result of a call of a pure built-in with literal arguments, or the
+// call itself when the callee may not be the built-in or the call fails
+static Value foldCall(Optimizer* optimizer, Value expr) {
+    List* call = AS_LIST(expr);
+    Value callee = call->items[0];
+    if (!IS_SYMBOL(callee) || isBound(AS_SYMBOL(callee))) return expr;
+
+    Value native;
+    if (!lookupVariable(optimizer->globals, AS_SYMBOL(callee), &native) ||
+        !IS_NATIVE(native) || !AS_NATIVE(native)->pure) {
+        return expr;
+    }
+
+    for (int i = 1; i < call->count; i++) {
+        if (!isLiteral(call->items[i])) return expr;
+    }
+
+    Value result;
+    if (!callNativeQuietly(AS_NATIVE(native), call->count - 1, &call->items[1], &result) ||
+        !isLiteral(result)) {
+        return expr;
+    }
+    optimizer->changed = true;
+    return result;
+}
+
+static Value optimizeList(Optimizer* optimizer, Value expr) {
+    List* list = AS_LIST(expr);
+    optimizer->changed = false;
+
+    switch (specialForm(list)) {
+        case SPECIAL_QUOTE:
+            return expr;
+        case SPECIAL_FN: {
+            if (list->count < 3 || !IS_LIST(list->items[1])) return expr;
+            Value result = optimizeItems(optimizer, expr, 2, 1);
+            if (optimizer->changed) {
+                recordForm(&folded, AS_LIST(result), list);
+                recordSourceForm(AS_LIST(result), list);
+            }
+            return result;
+        }
+        case SPECIAL_DEF:
+        case SPECIAL_SET:
+            return optimizeItems(optimizer, expr, 2, 1);
+        case SPECIAL_LET:
+        case SPECIAL_LOOP:
+        case SPECIAL_DOTIMES: {
+            if (list->count < 2 || !IS_LIST(list->items[1])) return expr;
+            Value bindings = optimizeItems(optimizer, list->items[1], 1, 2);
+            bool bindingsChanged = optimizer->changed;
+            Value result = optimizeItems(optimizer, expr, 2, 1);
+            if (bindingsChanged) {
+                if (!optimizer->changed) result = makeListIn(NULL, list->items, list->count);
+                AS_LIST(result)->items[1] = bindings;
+                optimizer->changed = true;
+            }
+            return result;
+        }
+        case SPECIAL_IF: {
+            Value result = optimizeItems(optimizer, expr, 1, 1);
+            List* form = AS_LIST(result);
+            if (form->count == 4 && isLiteral(form->items[1])) {
+                optimizer->changed = true;
+                return isTruthy(form->items[1]) ? form->items[2] : form->items[3];
+            }
+            return result;
+        }
+        case SPECIAL_NONE: {
+            if (list->count == 0) return expr;
+            Value result = optimizeItems(optimizer, expr, 0, 1);
+            bool changed = optimizer->changed;
+            result = foldCall(optimizer, result);
+            optimizer->changed |= changed;
+            return result;
+        }
+        default:
+            return optimizeItems(optimizer, expr, 1, 1);
+    }
+}
+
+static Value optimizeExpression(Optimizer* optimizer, Value expr) {
+    if (!IS_LIST(expr)) {
+        optimizer->changed = false;
+        return expr;
+    }
+    return optimizeList(optimizer, expr);
+}
+
+// An equivalent of the top-level form expr for running in globals. The
+// result shares every part that didn't change with expr.
+Value optimize(Value expr, Environment* globals) {
+    Optimizer optimizer;
+    optimizer.globals = globals;
+    optimizer.changed = false;
+
+    boundNames.count = 0;
+    collectBoundNames(expr);
+    return optimizeExpression(&optimizer, expr);
+}
+
+// A pure built-in was redefined, put the source back into every folded form
+void invalidateFolds() {
+    for (int i = 0; i < folded.count; i++) {
+        List* optimized = folded.forms[i].optimized;
+        memcpy(optimized->items, folded.forms[i].original->items, sizeof(Value) * optimized->count);
+    }
+    folded.count = 0;
+    foldEpoch++;
+}
+
+// Drop what was derived from a function's body before its form was restored
+void refreshFunction(Function* function) {
+    if (function->chunk != NULL) {
+        freeChunk(function->chunk);
+        function->chunk = NULL;
+    }
+    function->capturesFrame = -1;
+    function->epoch = foldEpoch;
+}
+
+// The form a function form was written as, before macro expansion and
+// folding, for printing it
+List* sourceForm(List* form) {
+    for (int i = 0; i < written.count; i++) {
+        if (written.forms[i].optimized == form) return written.forms[i].original;
+    }
+    return form;
+}
+
+static void markForms(FoldedForms* forms) {
+    for (int i = 0; i < forms->count; i++) {
+        markObject(&forms->forms[i].optimized->obj);
+        markObject(&forms->forms[i].original->obj);
+    }
+}
+
+void markOptimizerRoots() {
+    markForms(&folded);
+    markForms(&written);
+}
+
+static void freeForms(FoldedForms* forms) {
+    reallocate(forms->forms, sizeof(FoldedForm) * forms->capacity, 0);
+    forms->forms = NULL;
+    forms->count = forms->capacity = 0;
+}
+
+void freeOptimizer() {
+    freeList(&boundNames);
+    freeForms(&folded);
+    freeForms(&written);
+}
@@ -0,0 +1,639 @@
+#include "../include/hexa.h"
+
+// [pmap f list] is the list of [f item] for each item, and [preduce f init
+// list] is [f ... [f [f init a] b] ... z], both run by a pool of worker
+// threads. The list is cut into chunks dealt out evenly to the workers, and
+// a worker that runs out of chunks takes one from the end of another's
+// share, so one slow chunk doesn't keep the rest waiting. Results come back
+// in the order of the list.
+//
+// A worker runs an interpreter of its own (see HexaVM), so it can't share
+// values with the caller. It copies f, the globals f refers to and the items
+// of each chunk into its own heap, and the caller copies the results back
+// into its heap once every worker is done. Effects of f, such as defining
+// globals, happen in the worker and are lost, so f should be pure. preduce
+// reduces each chunk from its first item and then the chunk results from
+// init, so f must also be associative.
+//
+// The pool belongs to the thread that made it and has --threads workers,
+// one per processor by default. pmap and preduce called from a worker run
+// on that worker.
+
+#define CHUNKS_PER_WORKER 8
+
+// Values copied from another interpreter's heap into this thread's, which
+// is safe while the other interpreter waits. Closures, functions and frames
+// are looked up by address as they are copied, so cycles through them are
+// copied once. Copying never collects garbage.
+typedef struct {
+    const void* from;
+    void* to;
+} Copied;
+
+typedef struct {
+    Environment* fromGlobals;
+    Environment* toGlobals;
+    bool copyGlobals;       // Also define the globals copied functions refer to
+    Copied* copied;
+    int count;
+    int capacity;
+} Copier;
+
+static void initCopier(Copier* copier, Environment* fromGlobals, Environment* toGlobals,
+                       bool copyGlobals) {
+    copier->fromGlobals = fromGlobals;
+    copier->toGlobals = toGlobals;
+    copier->copyGlobals = copyGlobals;
+    copier->copied = NULL;
+    copier->count = 0;
+    copier->capacity = 0;
+}
+
+static void freeCopier(Copier* copier) {
+    reallocate(copier->copied, sizeof(Copied) * copier->capacity, 0);
+}
+
+static Copied* findCopied(Copied* copied, int capacity, const void* from) {
+    uint32_t index = (uint32_t)(((uintptr_t)from >> 3) * 2654435761u) & (capacity - 1);
+    for (;;) {
+        if (copied[index].from == from || copied[index].from == NULL) return &copied[index];
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// The copy of from, or NULL
+static void* copyOf(Copier* copier, const void* from) {
+    if (copier->count == 0) return NULL;
+    return findCopied(copier->copied, copier->capacity, from)->to;
+}
+
+static void rememberCopy(Copier* copier, const void* from, void* to) {
+    if (copier->count + 1 > copier->capacity * 3 / 4) {
+        int oldCapacity = copier->capacity;
+        Copied* old = copier->copied;
+        copier->capacity = oldCapacity < 16 ? 16 : oldCapacity * 2;
+        copier->copied = reallocate(NULL, 0, sizeof(Copied) * copier->capacity);
+        memset(copier->copied, 0, sizeof(Copied) * copier->capacity);
+        for (int i = 0; i < oldCapacity; i++) {
+            if (old[i].from != NULL) *findCopied(copier->copied, copier->capacity, old[i].from) = old[i];
+        }
+        reallocate(old, sizeof(Copied) * oldCapacity, 0);
+    }
+
+    Copied* entry = findCopied(copier->copied, copier->capacity, from);
+    entry->from = from;
+    entry->to = to;
+    copier->count++;
+}
+
+static Value copyValue(Copier* copier, Value value);
+
+static Symbol* copySymbol(Symbol* symbol) {
+    return internSymbol(symbol->chars, symbol->length);
+}
+
+// The built-in of the same name, or a new native for the same C function
+static Value copyNative(Copier* copier, Native* native) {
+    Value builtin;
+    if (lookupVariable(copier->toGlobals, internCString(native->name), &builtin) &&
+        IS_NATIVE(builtin) && AS_NATIVE(builtin)->function == native->function) {
+        return builtin;
+    }
+
+    Value copy = makeNative(native->function, native->name);
+    AS_NATIVE(copy)->op = native->op;
+    AS_NATIVE(copy)->pure = native->pure;
+    return copy;
+}
+
+// Define the global name has among the globals copied from, once
+static void copyGlobal(Copier* copier, Symbol* name) {
+    Value value;
+    if (copyOf(copier, name) != NULL || !lookupVariable(copier->fromGlobals, name, &value)) return;
+    rememberCopy(copier, name, name);
+
+    // Built-ins are there already
+    Symbol* copyName = copySymbol(name);
+    Value existing;
+    if (IS_NATIVE(value) && lookupVariable(copier->toGlobals, copyName, &existing) &&
+        IS_NATIVE(existing) && AS_NATIVE(existing)->function == AS_NATIVE(value)->function) {
+        return;
+    }
+    defineVariable(copier->toGlobals, copyName, copyValue(copier, value));
+}
+
+// Copy the globals named anywhere in code
+static void copyGlobalsIn(Copier* copier, Value code) {
+    if (IS_SYMBOL(code)) {
+        copyGlobal(copier, AS_SYMBOL(code));
+    } else if (IS_LIST(code)) {
+        List* list = AS_LIST(code);
+        for (int i = 0; i < list->count; i++) {
+            copyGlobalsIn(copier, list->items[i]);
+        }
+    }
+}
+
+// Frames are copied slot for slot, and the globals become the globals
+// copied to
+static Environment* copyEnvironment(Copier* copier, Environment* env) {
+    if (env->enclosing == NULL) return copier->toGlobals;
+
+    Environment* copy = copyOf(copier, env);
+    if (copy != NULL) return copy;
+
+    if (env->hashed) {
+        copy = createEnvironment();
+        rememberCopy(copier, env, copy);
+        copy->enclosing = copyEnvironment(copier, env->enclosing);
+        for (int i = 0; i < env->capacity; i++) {
+            Entry* entry = &env->entries[i];
+            if (entry->key == NULL) continue;
+            defineVariable(copy, copySymbol(entry->key), copyValue(copier, entry->value));
+        }
+        return copy;
+    }
+
+    copy = createFrame(NULL, env->count);
+    rememberCopy(copier, env, copy);
+    copy->enclosing = copyEnvironment(copier, env->enclosing);
+    for (int i = 0; i < env->count; i++) {
+        Entry* entry = &env->entries[i];
+        if (entry->key == NULL) continue;
+        copy->entries[i].key = copySymbol(entry->key);
+        copy->entries[i].value = copyValue(copier, entry->value);
+    }
+    return copy;
+}
+
+// A closure of a copy of the function, with a copy of its environment. A
+// memoized closure gets an empty memo.
+static Value copyClosure(Copier* copier, Closure* closure) {
+    Closure* copy = copyOf(copier, closure);
+    if (copy != NULL) return closureValue(copy);
+
+    Function* function = copyOf(copier, closure->function);
+    if (function == NULL) {
+        Value form = listValue(closure->function->form);
+        function = newFunction(AS_LIST(copyValue(copier, form)));
+        rememberCopy(copier, closure->function, function);
+        if (copier->copyGlobals && copier->fromGlobals != NULL) copyGlobalsIn(copier, form);
+
+        // A function defined at top level reads the globals through caches,
+        // as the original does, instead of searching for them by name
+        if (closure->env->enclosing == NULL) function->chunk = compileGlobalFunction(function);
+    }
+
+    Value value = makeFunction(function, NULL);
+    copy = AS_CLOSURE(value);
+    rememberCopy(copier, closure, copy);
+    copy->env = copyEnvironment(copier, closure->env);
+    if (closure->memo != NULL) copy->memo = newMemoLike(closure->memo);
+    return value;
+}
+
+static Value copyValue(Copier* copier, Value value) {
+    if (IS_SYMBOL(value)) return makeSymbolValue(copySymbol(AS_SYMBOL(value)));
+    if (!IS_OBJ(value)) return value;
+    if (IS_STRING(value)) return makeStringIn(NULL, AS_STRING(value)->chars, AS_STRING(value)->length);
+    if (IS_NATIVE(value)) return copyNative(copier, AS_NATIVE(value));
+    if (IS_FUNCTION(value)) return copyClosure(copier, AS_CLOSURE(value));
+
+    // A task runs on the thread that spawned it, and a channel's queue is
+    // shared by the copies
+    if (IS_TASK(value)) return NIL_VAL;
+    if (IS_CHANNEL(value)) {
+        retainQueue(AS_CHANNEL(value)->queue);
+        return makeChannel(AS_CHANNEL(value)->queue);
+    }
+    if (IS_VECTOR(value)) {
+        Vector* vector = AS_VECTOR(value);
+        Vector* transient = beginTransient(NULL);
+        for (int i = 0; i < vector->count; i++) {
+            transientAppend(transient, copyValue(copier, vectorGet(vector, i)));
+        }
+        return endTransient(transient);
+    }
+
+    List* list = AS_LIST(value);
+    Value copy = makeListIn(NULL, list->items, list->count);
+    for (int i = 0; i < list->count; i++) {
+        AS_LIST(copy)->items[i] = copyValue(copier, list->items[i]);
+    }
+    return copy;
+}
+
+typedef struct Pool Pool;
+
+typedef struct {
+    Pool* pool;
+    int index;
+    HexaThread* thread;
+    HexaLock* lock;         // Guards next and end
+    int next;               // The job's chunks [next, end) are left to run
+    int end;
+    Environment* globals;   // The worker interpreter's
+    Value results;          // A list of the job's results, in the worker's heap
+    int roots;              // GC roots the worker holds until the next job
+} Worker;
+
+// A call of pmap or preduce
+typedef struct {
+    Value function;
+    List* items;
+    bool reduce;
+    Environment* globals;   // The caller's
+    int chunkSize;
+    int chunkCount;
+    int* ranBy;             // The worker that ran each chunk
+    int* resultStart;       // Where the chunk's results start among that worker's
+} Job;
+
+struct Pool {
+    Worker* workers;
+    int count;
+    HexaLock* lock;         // Guards the fields below
+    HexaCondition* started; // A job started, or the pool is stopping
+    HexaCondition* finished;    // The last worker finished the job
+    Job* job;
+    int generation;         // Bumped for each job
+    int running;            // Workers yet to finish the job
+    bool stopping;
+};
+
+// Workers in a pool, or 0 for one per processor
+static int threads = 0;
+
+static HEXA_THREAD_LOCAL Pool* pool;
+static HEXA_THREAD_LOCAL bool onWorker;
+
+// The size of pools made from now on, see --threads
+void setThreadCount(int count) {
+    threads = count;
+}
+
+int threadCount() {
+    return threads > 0 ? threads : processorCount();
+}
+
+// The next chunk for worker to run: its own next one, otherwise the last of
+// another worker's, or -1 once there are none
+static int takeChunk(Worker* worker) {
+    Pool* workers = worker->pool;
+    for (int i = 0; i < workers->count; i++) {
+        Worker* owner = &workers->workers[(worker->index + i) % workers->count];
+        int chunk = -1;
+        acquireLock(owner->lock);
+        if (owner->next < owner->end) chunk = owner == worker ? owner->next++ : --owner->end;
+        releaseLock(owner->lock);
+        if (chunk != -1) return chunk;
+    }
+    return -1;
+}
+
+// Item i of the job's list, copied into this heap
+static Value copyItem(Job* job, Environment* globals, int i) {
+    Copier copier;
+    initCopier(&copier, job->globals, globals, true);
+    Value item = copyValue(&copier, job->items->items[i]);
+    freeCopier(&copier);
+    return item;
+}
+
+static void runJob(Worker* worker, Job* job) {
+    // The previous job's results have been copied
+    popRoots(worker->roots);
+
+    Copier copier;
+    initCopier(&copier, job->globals, worker->globals, true);
+    Value function = copyValue(&copier, job->function);
+    freeCopier(&copier);
+    pushRoot(function);
+    worker->results = makeList();
+    pushRoot(worker->results);
+    worker->roots = 2;
+
+    List* results = AS_LIST(worker->results);
+    for (int chunk = takeChunk(worker); chunk != -1; chunk = takeChunk(worker)) {
+        job->ranBy[chunk] = worker->index;
+        job->resultStart[chunk] = results->count;
+        int start = chunk * job->chunkSize;
+        int end = start + job->chunkSize < job->items->count ? start + job->chunkSize
+                                                              : job->items->count;
+
+        if (!job->reduce) {
+            for (int i = start; i < end; i++) {
+                Value item = copyItem(job, worker->globals, i);
+                pushRoot(item);
+                Value result = callFunction(function, 1, &item, worker->globals);
+                popRoots(1);
+                appendToList(results, result);
+            }
+            continue;
+        }
+
+        Value args[2];
+        args[0] = copyItem(job, worker->globals, start);
+        for (int i = start + 1; i < end; i++) {
+            pushRoot(args[0]);
+            args[1] = copyItem(job, worker->globals, i);
+            pushRoot(args[1]);
+            args[0] = callFunction(function, 2, args, worker->globals);
+            popRoots(2);
+        }
+        appendToList(results, args[0]);
+    }
+}
+
+static void runWorker(void* arg) {
+    Worker* worker = arg;
+    Pool* workers = worker->pool;
+    HexaVM* hexa = newHexaVM();
+    worker->globals = hexaGlobals(hexa);
+    worker->roots = 0;
+    onWorker = true;
+
+    int generation = 0;
+    acquireLock(workers->lock);
+    for (;;) {
+        while (!workers->stopping && workers->generation == generation) {
+            waitCondition(workers->started, workers->lock);
+        }
+        if (workers->stopping) break;
+        generation = workers->generation;
+        releaseLock(workers->lock);
+
+        runJob(worker, workers->job);
+
+        acquireLock(workers->lock);
+        if (--workers->running == 0) signalAll(workers->finished);
+    }
+    releaseLock(workers->lock);
+
+    popRoots(worker->roots);
+    freeHexaVM(hexa);
+}
+
+// This thread's pool, made or remade with threadCount() workers
+static Pool* ensurePool() {
+    int count = threadCount();
+    if (pool != NULL && pool->count == count) return pool;
+    freeWorkers();
+
+    pool = reallocate(NULL, 0, sizeof(Pool));
+    pool->workers = reallocate(NULL, 0, sizeof(Worker) * count);
+    pool->count = count;
+    pool->lock = newLock();
+    pool->started = newCondition();
+    pool->finished = newCondition();
+    pool->job = NULL;
+    pool->generation = 0;
+    pool->running = 0;
+    pool->stopping = false;
+
+    for (int i = 0; i < count; i++) {
+        Worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->lock = newLock();
+        worker->next = worker->end = 0;
+        worker->thread = startThread(runWorker, worker);
+    }
+    return pool;
+}
+
+// Stop this thread's workers, freeing their interpreters
+void freeWorkers() {
+    if (pool == NULL) return;
+
+    acquireLock(pool->lock);
+    pool->stopping = true;
+    signalAll(pool->started);
+    releaseLock(pool->lock);
+
+    for (int i = 0; i < pool->count; i++) {
+        joinThread(pool->workers[i].thread);
+        freeLock(pool->workers[i].lock);
+    }
+    freeLock(pool->lock);
+    freeCondition(pool->started);
+    freeCondition(pool->finished);
+    reallocate(pool->workers, sizeof(Worker) * pool->count, 0);
+    reallocate(pool, sizeof(Pool), 0);
+    pool = NULL;
+}
+
+// The results of running function over items, which isn't empty, on the
+// workers: a list of [f item] for each item, or when reducing of each
+// chunk's reduction, copied into this heap
+static Value runOnWorkers(Value function, List* items, bool reduce, Environment* globals) {
+    Pool* workers = ensurePool();
+
+    Job job;
+    job.function = function;
+    job.items = items;
+    job.reduce = reduce;
+    job.globals = globals;
+    int chunks = workers->count * CHUNKS_PER_WORKER;
+    job.chunkSize = (items->count + chunks - 1) / chunks;
+    job.chunkCount = (items->count + job.chunkSize - 1) / job.chunkSize;
+    job.ranBy = reallocate(NULL, 0, sizeof(int) * job.chunkCount);
+    job.resultStart = reallocate(NULL, 0, sizeof(int) * job.chunkCount);
+
+    // Deal the chunks out evenly, in order
+    for (int i = 0; i < workers->count; i++) {
+        workers->workers[i].next = (int)((int64_t)job.chunkCount * i / workers->count);
+        workers->workers[i].end = (int)((int64_t)job.chunkCount * (i + 1) / workers->count);
+    }
+
+    acquireLock(workers->lock);
+    workers->job = &job;
+    workers->running = workers->count;
+    workers->generation++;
+    signalAll(workers->started);
+    while (workers->running > 0) {
+        waitCondition(workers->finished, workers->lock);
+    }
+    releaseLock(workers->lock);
+
+    int count = reduce ? job.chunkCount : items->count;
+    Value* values = reallocate(NULL, 0, sizeof(Value) * count);
+    Copier copier;
+    initCopier(&copier, NULL, globals, false);
+    int next = 0;
+    for (int chunk = 0; chunk < job.chunkCount; chunk++) {
+        List* results = AS_LIST(workers->workers[job.ranBy[chunk]].results);
+        int start = chunk * job.chunkSize;
+        int length = reduce ? 1 : (start + job.chunkSize < items->count ? job.chunkSize
+                                                                        : items->count - start);
+        for (int i = 0; i < length; i++) {
+            values[next++] = copyValue(&copier, results->items[job.resultStart[chunk] + i]);
+        }
+    }
+    freeCopier(&copier);
+
+    Value result = makeListIn(NULL, values, count);
+    reallocate(values, sizeof(Value) * count, 0);
+    reallocate(job.ranBy, sizeof(int) * job.chunkCount, 0);
+    reallocate(job.resultStart, sizeof(int) * job.chunkCount, 0);
+    return result;
+}
+
+// A vector argument is replaced with the list of its items, which the
+// arguments keep alive
+static bool checkArguments(Value function, Value* list) {
+    if (!IS_FUNCTION(function) && !IS_NATIVE(function)) {
+        runtimeError("Cannot call non-function. Got type %d.", valueType(function));
+        return false;
+    }
+    if (IS_VECTOR(*list)) *list = vectorToList(AS_VECTOR(*list));
+    if (!IS_LIST(*list)) {
+        runtimeError("Expected a list.");
+        return false;
+    }
+    return true;
+}
+
+// [f ... [f [f init a] b] ... z] for the items of list, on this thread
+static Value reduceHere(Value function, Value init, List* list, Environment* globals) {
+    Value args[2] = {init, NIL_VAL};
+    for (int i = 0; i < list->count; i++) {
+        pushRoot(args[0]);
+        args[1] = list->items[i];
+        args[0] = callFunction(function, 2, args, globals);
+        popRoots(1);
+    }
+    return args[0];
+}
+
+// [pmap f list]
+Value nativePmap(int argCount, Value* args) {
+    if (argCount != 2) {
+        runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!checkArguments(args[0], &args[1])) return NIL_VAL;
+
+    // args is on the VM's stack, which calls of f may move
+    Value function = args[0];
+    List* items = AS_LIST(args[1]);
+    Environment* globals = globalsOf(function);
+    if (items->count == 0) return makeList();
+    if (!onWorker) return runOnWorkers(function, items, false, globals);
+
+    Value result = makeListIn(NULL, items->items, items->count);
+    pushRoot(result);
+    for (int i = 0; i < items->count; i++) {
+        Value item = items->items[i];
+        AS_LIST(result)->items[i] = callFunction(function, 1, &item, globals);
+    }
+    popRoots(1);
+    return result;
+}
+
+// [preduce f init list]
+Value nativePreduce(int argCount, Value* args) {
+    if (argCount != 3) {
+        runtimeError("Expected 3 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!checkArguments(args[0], &args[2])) return NIL_VAL;
+
+    // args is on the VM's stack, which calls of f may move
+    Value function = args[0];
+    Value init = args[1];
+    List* items = AS_LIST(args[2]);
+    Environment* globals = globalsOf(function);
+    if (items->count == 0 || onWorker) return reduceHere(function, init, items, globals);
+
+    Value reduced = runOnWorkers(function, items, true, globals);
+    pushRoot(reduced);
+    Value result = reduceHere(function, init, AS_LIST(reduced), globals);
+    popRoots(1);
+    return result;
+}
+
+// [actor f args...] runs [f args...] on a thread of its own, with an
+// interpreter of its own, and is a channel that gets the result when f
+// returns and is then closed. f and args are copied as pmap copies them,
+// while this thread waits, so from then on the actor shares nothing with
+// the caller but the channels given to it. The thread ends with f.
+
+typedef struct {
+    Value function;
+    Value* args;
+    int argCount;
+    Environment* globals;   // The caller's
+    Queue* result;
+    HexaLock* lock;         // Guards copied
+    HexaCondition* started;
+    bool copied;
+} ActorStart;
+
+static void runActor(void* arg) {
+    ActorStart* start = arg;
+    HexaVM* hexa = newHexaVM();
+    Environment* globals = hexaGlobals(hexa);
+
+    Copier copier;
+    initCopier(&copier, start->globals, globals, true);
+    Value function = copyValue(&copier, start->function);
+    pushRoot(function);
+    Value args = makeListIn(NULL, start->args, start->argCount);
+    for (int i = 0; i < start->argCount; i++) {
+        AS_LIST(args)->items[i] = copyValue(&copier, start->args[i]);
+    }
+    pushRoot(args);
+    freeCopier(&copier);
+
+    // The caller may go on once its values are copied
+    Queue* result = start->result;
+    acquireLock(start->lock);
+    start->copied = true;
+    signalAll(start->started);
+    releaseLock(start->lock);
+
+    Value value = callFunction(function, AS_LIST(args)->count, AS_LIST(args)->items, globals);
+    if (!sendTo(result, value)) sendTo(result, NIL_VAL);
+    closeQueue(result);
+    releaseQueue(result);
+
+    popRoots(2);
+    freeHexaVM(hexa);
+}
+
+Value nativeActor(int argCount, Value* args) {
+    if (argCount < 1) {
+        runtimeError("Expected at least 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!IS_FUNCTION(args[0]) && !IS_NATIVE(args[0])) {
+        runtimeError("Cannot call non-function. Got type %d.", valueType(args[0]));
+        return NIL_VAL;
+    }
+
+    // The actor's reference to the result's queue, and the caller's
+    Queue* result = newQueue(1);
+    retainQueue(result);
+
+    ActorStart start;
+    start.function = args[0];
+    start.args = args + 1;
+    start.argCount = argCount - 1;
+    start.globals = globalsOf(args[0]);
+    start.result = result;
+    start.lock = newLock();
+    start.started = newCondition();
+    start.copied = false;
+
+    HexaThread* thread = startThread(runActor, &start);
+    acquireLock(start.lock);
+    while (!start.copied) {
+        waitCondition(start.started, start.lock);
+    }
+    releaseLock(start.lock);
+    detachThread(thread);
+    freeLock(start.lock);
+    freeCondition(start.started);
+    return makeChannel(result);
+}
@@ -1,13 +1,24 @@
 #include "../include/hexa.h"
+#include <errno.h>
 
 typedef struct {
     Token current;
     Token previous;
     bool hadError;
     bool panicMode;
+    
+    // Parse trees are allocated from arena, or from the heap when useArena
+    // is off
+    bool useArena;
+    Arena arena;
+    
+    // Items of the lists being parsed, so each list is allocated once
+    Value* scratch;
+    int scratchCount;
+    int scratchCapacity;
 } Parser;
 
-static Parser parser;
+static HEXA_THREAD_LOCAL Parser parser = {.useArena = true};
 
 // Forward declarations
 static Value expression();
@@ -81,21 +92,17 @@ static Value number() {
     return makeNumber(value);
 }
 
+// Literals too large for an integer are read as doubles
+static Value integer() {
+    errno = 0;
+    long long value = strtoll(parser.previous.lexeme, NULL, 10);
+    if (errno == ERANGE || !INT_FITS(value)) return number();
+    return makeInt(value);
+}
+
 static Value string() {
-    // Extract the string without quotes
-    char* str = malloc(parser.previous.length - 1);
-    if (str == NULL) {
-        error("Out of memory");
-        return NIL_VAL;
-    }
-    
-    // Copy string content without quotes
-    memcpy(str, parser.previous.lexeme + 1, parser.previous.length - 2);
-    str[parser.previous.length - 2] = '\0';
-    
-    Value val = makeString(str);
-    free(str);
-    return val;
+    // Copy the string content without quotes straight from the source
+    return makeStringIn(parser.useArena ? &parser.arena : NULL, parser.previous.lexeme + 1, parser.previous.length - 2);
 }
 
 static Value boolean() {
@@ -111,20 +118,16 @@ static Value nil() {
 }
 
 static Value identifier() {
-    // Extract the symbol
-    char* symbol = malloc(parser.previous.length + 1);
-    if (symbol == NULL) {
-        error("Out of memory");
-        return NIL_VAL;
-    }
-    
-    // Copy symbol
-    memcpy(symbol, parser.previous.lexeme, parser.previous.length);
-    symbol[parser.previous.length] = '\0';
-    
-    Value val = makeSymbol(symbol);
-    free(symbol);
-    return val;
+    // Intern straight from the source text
+    return makeSymbolValue(internSymbol(parser.previous.lexeme, parser.previous.length));
+}
+
+// 'x, `x, ,x and ,@x read as two-item lists headed by the name of the form
+static Value shorthand(const char* name) {
+    Value items[2];
+    items[0] = makeSymbol(name);
+    items[1] = expression();
+    return makeListIn(parser.useArena ? &parser.arena : NULL, items, 2);
 }
 
 static Value primary() {
@@ -133,6 +136,10 @@ static Value primary() {
             advance();
             return number();
         }
+        case TOKEN_INTEGER: {
+            advance();
+            return integer();
+        }
         case TOKEN_STRING: {
             advance();
             return string();
@@ -152,6 +159,22 @@ static Value primary() {
         case TOKEN_LBRACKET: {
             return parseList();
         }
+        case TOKEN_QUOTE: {
+            advance();
+            return shorthand("quote");
+        }
+        case TOKEN_QUASIQUOTE: {
+            advance();
+            return shorthand("quasiquote");
+        }
+        case TOKEN_UNQUOTE: {
+            advance();
+            return shorthand("unquote");
+        }
+        case TOKEN_UNQUOTE_SPLICING: {
+            advance();
+            return shorthand("unquote-splicing");
+        }
         default: {
             error("Expected expression.");
             return NIL_VAL;
@@ -159,20 +182,33 @@ static Value primary() {
     }
 }
 
+static void pushScratch(Value value) {
+    if (parser.scratchCount == parser.scratchCapacity) {
+        parser.scratchCapacity = parser.scratchCapacity < 64 ? 64 : parser.scratchCapacity * 2;
+        parser.scratch = realloc(parser.scratch, sizeof(Value) * parser.scratchCapacity);
+        if (parser.scratch == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(70);
+        }
+    }
+    parser.scratch[parser.scratchCount++] = value;
+}
+
 static Value parseList() {
-    Value list = makeList();
+    int base = parser.scratchCount;
     
     // Consume the opening '['
     consume(TOKEN_LBRACKET, "Expected '['.");
     
     // Parse expressions until we hit a closing ']'
     while (!check(TOKEN_RBRACKET) && !check(TOKEN_EOF)) {
-        Value expr = expression();
-        appendToList(&list.as.list, expr);
+        pushScratch(expression());
     }
     
     consume(TOKEN_RBRACKET, "Expected ']' after list.");
     
+    Value list = makeListIn(parser.useArena ? &parser.arena : NULL, &parser.scratch[base], parser.scratchCount - base);
+    parser.scratchCount = base;
     return list;
 }
 
@@ -180,8 +216,34 @@ static Value expression() {
     return primary();
 }
 
+// Start a new top-level form
+static void beginForm() {
+    beginArenaForm(&parser.arena);
+    parser.scratchCount = 0;
+}
+
+// Allocate parse trees from the arena (the default) or the heap
+void setParseArena(bool enabled) {
+    parser.useArena = enabled;
+}
+
+// The block being filled stays alive for the forms still to come
+void markParserRoots() {
+    if (parser.arena.block != NULL) markObject((Obj*)parser.arena.block);
+}
+
+// Free the scratch space and forget the arena, whose blocks are freed with
+// the rest of the heap
+void freeParser() {
+    free(parser.scratch);
+    parser.scratch = NULL;
+    parser.scratchCount = parser.scratchCapacity = 0;
+    initArena(&parser.arena);
+}
+
 // Parse a single expression (for use with multiple expressions)
 Value parseExpression() {
+    beginForm();
     Value expr = expression();
     return expr;
 }
@@ -194,6 +256,7 @@ Value parse(const char* source) {
     parser.panicMode = false;
     
     advance();
+    beginForm();
     Value result = expression();
     
     consume(TOKEN_EOF, "Expected end of expression.");
@@ -0,0 +1,130 @@
+#include "../include/hexa.h"
+
+#define TABLE_MAX_LOAD 0.75
+
+// Open-addressing set of every interned symbol
+typedef struct {
+    int count;
+    int capacity;
+    Symbol** entries;
+} SymbolTable;
+
+static HEXA_THREAD_LOCAL SymbolTable table;
+
+static uint32_t hashChars(const char* chars, int length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static Symbol** findEntry(Symbol** entries, int capacity, const char* chars, int length, uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);
+    for (;;) {
+        Symbol** entry = &entries[index];
+        if (*entry == NULL) return entry;
+        if ((*entry)->hash == hash && (*entry)->length == length &&
+            memcmp((*entry)->chars, chars, length) == 0) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void growTable() {
+    int capacity = table.capacity < 256 ? 256 : table.capacity * 2;
+    Symbol** entries = calloc(capacity, sizeof(Symbol*));
+
+    for (int i = 0; i < table.capacity; i++) {
+        Symbol* symbol = table.entries[i];
+        if (symbol == NULL) continue;
+        *findEntry(entries, capacity, symbol->chars, symbol->length, symbol->hash) = symbol;
+    }
+
+    free(table.entries);
+    table.entries = entries;
+    table.capacity = capacity;
+}
+
+static const char* specialFormNames[SPECIAL_FORM_COUNT] = {
+    [SPECIAL_FN] = "fn",
+    [SPECIAL_DEF] = "def",
+    [SPECIAL_IF] = "if",
+    [SPECIAL_LET] = "let",
+    [SPECIAL_DO] = "do",
+    [SPECIAL_WHILE] = "while",
+    [SPECIAL_QUOTE] = "quote",
+    [SPECIAL_AND] = "and",
+    [SPECIAL_OR] = "or",
+    [SPECIAL_COND] = "cond",
+    [SPECIAL_DEFMACRO] = "defmacro",
+    [SPECIAL_QUASIQUOTE] = "quasiquote",
+    [SPECIAL_SET] = "set",
+    [SPECIAL_LOOP] = "loop",
+    [SPECIAL_RECUR] = "recur",
+    [SPECIAL_DOTIMES] = "dotimes"
+};
+
+// Tag the symbols naming special forms, so the parser hands out forms whose
+// head already says how to evaluate them
+static void tagSpecialForms() {
+    for (int i = SPECIAL_NONE + 1; i < SPECIAL_FORM_COUNT; i++) {
+        internCString(specialFormNames[i])->special = (uint8_t)i;
+    }
+}
+
+// Return the unique symbol for chars, creating it on first use
+Symbol* internSymbol(const char* chars, int length) {
+    bool first = table.capacity == 0;
+    if (table.count + 1 > table.capacity * TABLE_MAX_LOAD) {
+        growTable();
+    }
+
+    uint32_t hash = hashChars(chars, length);
+    Symbol** entry = findEntry(table.entries, table.capacity, chars, length, hash);
+    if (*entry == NULL) {
+        Symbol* symbol = malloc(sizeof(Symbol) + length + 1);
+        symbol->hash = hash;
+        symbol->length = length;
+        symbol->special = SPECIAL_NONE;
+        symbol->cachedIn = NULL;
+        symbol->cacheVersion = 0;
+        symbol->cacheSlot = 0;
+        symbol->macro = NULL;
+        memcpy(symbol->chars, chars, length);
+        symbol->chars[length] = '\0';
+
+        *entry = symbol;
+        table.count++;
+    }
+
+    Symbol* symbol = *entry;
+    if (first) tagSpecialForms();
+    return symbol;
+}
+
+Symbol* internCString(const char* chars) {
+    return internSymbol(chars, (int)strlen(chars));
+}
+
+// Symbols live as long as the program, and so do the macros they name
+void markSymbols() {
+    for (int i = 0; i < table.capacity; i++) {
+        Symbol* symbol = table.entries[i];
+        if (symbol != NULL && symbol->macro != NULL) markObject(&symbol->macro->obj);
+    }
+}
+
+void freeSymbols() {
+    for (int i = 0; i < table.capacity; i++) {
+        free(table.entries[i]);
+    }
+
+    free(table.entries);
+    table.entries = NULL;
+    table.count = 0;
+    table.capacity = 0;
+}
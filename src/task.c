@@ -0,0 +1,212 @@
+#include "../include/hexa.h"
+
+// [spawn f args...] makes a task that calls f on args as a coroutine, and
+// [await task] waits for it to be done and is its result. A task runs until
+// it calls [yield], which lets the other ready tasks run first, or awaits a
+// task that isn't done. Then it is suspended, and the scheduler runs the
+// next task in the run queue.
+//
+// Tasks are green threads: they take turns on the thread that spawned them.
+// Each has call frames, a value stack and a frame pool of its own on the
+// heap, which the VM swaps in to run it (see resumeTask), so suspending a
+// task leaves nothing on the C stack, and a task that calls a function and
+// yields in it takes about 1.3 KB. A task can only suspend from its own
+// bytecode: yield and await in a function a native calls, such as one
+// given to pmap, are errors.
+//
+// The program itself isn't a task. When it awaits, tasks run until the one
+// it waits for is done, and when it yields, each ready task runs once.
+// Tasks still ready when the program ends don't run.
+
+// The run queue: tasks ready to run, in the order they became ready
+static HEXA_THREAD_LOCAL Task* readyHead;
+static HEXA_THREAD_LOCAL Task* readyTail;
+static HEXA_THREAD_LOCAL int readyCount;
+
+// The task running now, or NULL while the program runs
+static HEXA_THREAD_LOCAL Task* current;
+
+static void makeReady(Task* task) {
+    task->state = TASK_READY;
+    task->next = NULL;
+    if (readyTail != NULL) {
+        readyTail->next = task;
+    } else {
+        readyHead = task;
+    }
+    readyTail = task;
+    readyCount++;
+}
+
+static Task* takeReady() {
+    Task* task = readyHead;
+    if (task == NULL) return NULL;
+
+    readyHead = task->next;
+    if (readyHead == NULL) readyTail = NULL;
+    readyCount--;
+    task->next = NULL;
+    return task;
+}
+
+// Wake the tasks waiting for task in the order they started waiting, with
+// its result as the result of their await
+static void finishTask(Task* task) {
+    task->state = TASK_DONE;
+    task->function = NIL_VAL;
+
+    Task* waiters = NULL;
+    while (task->waiters != NULL) {
+        Task* waiter = task->waiters;
+        task->waiters = waiter->next;
+        waiter->next = waiters;
+        waiters = waiter;
+    }
+    while (waiters != NULL) {
+        Task* waiter = waiters;
+        waiters = waiter->next;
+        waiter->result = task->result;
+        makeReady(waiter);
+    }
+}
+
+// Run task until it is done or suspends. A suspended task has already put
+// itself back in the run queue or among the waiters of another task.
+static void runTask(Task* task) {
+    current = task;
+    task->state = TASK_RUNNING;
+    bool done = resumeTask(task);
+    current = NULL;
+    if (done) finishTask(task);
+}
+
+// Whether callee is a native that may suspend the running task, so machine
+// code leaves its calls to the VM
+bool maySuspend(Value callee) {
+    return IS_NATIVE(callee) &&
+           (AS_NATIVE(callee)->function == nativeYield || AS_NATIVE(callee)->function == nativeAwait);
+}
+
+// [spawn f args...]
+Value nativeSpawn(int argCount, Value* args) {
+    if (argCount < 1) {
+        runtimeError("Expected at least 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!IS_FUNCTION(args[0]) && !IS_NATIVE(args[0])) {
+        runtimeError("Cannot call non-function. Got type %d.", valueType(args[0]));
+        return NIL_VAL;
+    }
+
+    // Allocating never collects, so args stays reachable until it's stored
+    Value arguments = makeListIn(NULL, args + 1, argCount - 1);
+    Task* task = (Task*)allocateObject(sizeof(Task), OBJ_TASK);
+    task->function = args[0];
+    task->args = AS_LIST(arguments);
+    task->globals = globalsOf(args[0]);
+    task->result = NIL_VAL;
+    task->started = false;
+    memset(&task->stack, 0, sizeof(TaskStack));
+    task->waiters = NULL;
+    makeReady(task);
+    return taskValue(task);
+}
+
+// [yield]
+Value nativeYield(int argCount, Value* args) {
+    (void)args;
+    if (argCount != 0) {
+        runtimeError("Expected 0 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+
+    // The program lets each task that is ready now run once
+    if (current == NULL) {
+        for (int count = readyCount; count > 0; count--) {
+            runTask(takeReady());
+        }
+        return NIL_VAL;
+    }
+
+    if (!suspendTask()) {
+        runtimeError("Cannot yield inside a call from a native function.");
+        return NIL_VAL;
+    }
+    current->result = NIL_VAL;
+    makeReady(current);
+    return NIL_VAL;
+}
+
+// [await task]
+Value nativeAwait(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    if (!IS_TASK(args[0])) {
+        runtimeError("Expected a task.");
+        return NIL_VAL;
+    }
+
+    Task* task = AS_TASK(args[0]);
+    if (task->state == TASK_DONE) return task->result;
+
+    // The program runs tasks until this one is done
+    if (current == NULL) {
+        while (task->state != TASK_DONE) {
+            Task* next = takeReady();
+            if (next == NULL) {
+                runtimeError("Deadlock: every task is waiting.");
+                return NIL_VAL;
+            }
+            runTask(next);
+        }
+        return task->result;
+    }
+
+    if (task == current) {
+        runtimeError("A task cannot await itself.");
+        return NIL_VAL;
+    }
+    if (!suspendTask()) {
+        runtimeError("Cannot await inside a call from a native function.");
+        return NIL_VAL;
+    }
+    current->state = TASK_WAITING;
+    current->next = task->waiters;
+    task->waiters = current;
+    return NIL_VAL;
+}
+
+void blackenTask(Task* task) {
+    markValue(task->function);
+    markValue(task->result);
+    if (task->args != NULL) markObject(&task->args->obj);
+    if (task->globals != NULL) markObject(&task->globals->obj);
+    for (Task* waiter = task->waiters; waiter != NULL; waiter = waiter->next) {
+        markObject(&waiter->obj);
+    }
+
+    // A running task's stacks are the VM's
+    markTaskStack(&task->stack);
+}
+
+void freeTask(Task* task) {
+    freeTaskStack(&task->stack);
+    reallocate(task, sizeof(Task), 0);
+}
+
+// Ready tasks run later even if nothing refers to them
+void markTaskRoots() {
+    for (Task* task = readyHead; task != NULL; task = task->next) {
+        markObject(&task->obj);
+    }
+    if (current != NULL) markObject(&current->obj);
+}
+
+// Forget the tasks once the heap is freed
+void freeTasks() {
+    readyHead = readyTail = NULL;
+    readyCount = 0;
+    current = NULL;
+}
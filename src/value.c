@@ -1,61 +1,197 @@
 #include "../include/hexa.h"
 
+// A value referring to a heap object
+static Value objectValue(Obj* object, ValueType type) {
+#ifdef NAN_BOXING
+    (void)type;
+    return OBJ_VAL(object);
+#else
+    Value value;
+    value.type = type;
+    value.as.obj = object;
+    return value;
+#endif
+}
+
 Value makeNumber(double num) {
+#ifdef NAN_BOXING
+    return numberToValue(num);
+#else
     Value value;
     value.type = VAL_NUMBER;
     value.as.number = num;
     return value;
+#endif
+}
+
+// An integer, or the nearest double when it doesn't fit in HEXA_INT range
+Value makeInt(int64_t integer) {
+    if (!INT_FITS(integer)) return makeNumber((double)integer);
+#ifdef NAN_BOXING
+    return INT_VAL(integer);
+#else
+    Value value;
+    value.type = VAL_INT;
+    value.as.integer = integer;
+    return value;
+#endif
 }
 
 Value makeBoolean(bool b) {
+#ifdef NAN_BOXING
+    return b ? TRUE_VAL : FALSE_VAL;
+#else
     Value value;
     value.type = VAL_BOOLEAN;
     value.as.boolean = b;
     return value;
+#endif
+}
+
+// A heap object, or an arena object when arena is not NULL
+static Obj* newObject(Arena* arena, size_t size, ObjType type) {
+    return arena != NULL ? allocateArenaObject(arena, size, type) : allocateObject(size, type);
 }
 
 Value makeString(const char* string) {
-    Value value;
-    value.type = VAL_STRING;
-    value.as.string = strdup(string);
-    return value;
+    return makeStringIn(NULL, string, (int)strlen(string));
+}
+
+// A string of length chars, which need not be terminated
+Value makeStringIn(Arena* arena, const char* chars, int length) {
+    String* object = (String*)newObject(arena, sizeof(String) + length + 1, OBJ_STRING);
+    object->length = length;
+    memcpy(object->chars, chars, length);
+    object->chars[length] = '\0';
+    return objectValue(&object->obj, VAL_STRING);
 }
 
 Value makeSymbol(const char* symbol) {
+    return makeSymbolValue(internCString(symbol));
+}
+
+Value makeSymbolValue(Symbol* symbol) {
+#ifdef NAN_BOXING
+    return SYMBOL_VAL(symbol);
+#else
     Value value;
     value.type = VAL_SYMBOL;
-    value.as.symbol = strdup(symbol);
+    value.as.symbol = symbol;
     return value;
+#endif
 }
 
 Value makeList() {
-    Value value;
-    value.type = VAL_LIST;
-    value.as.list.count = 0;
-    value.as.list.capacity = 0;
-    value.as.list.items = NULL;
-    return value;
+    List* list = (List*)allocateObject(sizeof(List), OBJ_LIST);
+    initList(list);
+    return objectValue(&list->obj, VAL_LIST);
 }
 
-Value makeFunction(int arity) {
-    Value value;
-    value.type = VAL_FUNCTION;
-    value.as.function.arity = arity;
-    value.as.function.body.count = 0;
-    value.as.function.body.capacity = 0;
-    value.as.function.body.items = NULL;
-    value.as.function.params.count = 0;
-    value.as.function.params.capacity = 0;
-    value.as.function.params.items = NULL;
-    return value;
+// A list of exactly count items. Lists in an arena can't grow.
+Value makeListIn(Arena* arena, Value* items, int count) {
+    List* list = (List*)newObject(arena, sizeof(List), OBJ_LIST);
+    list->count = count;
+    list->capacity = count;
+    list->items = NULL;
+
+    if (count > 0) {
+        size_t size = sizeof(Value) * count;
+        list->items = arena != NULL ? arenaAllocate(arena, size) : reallocate(NULL, 0, size);
+        memcpy(list->items, items, size);
+    }
+    return objectValue(&list->obj, VAL_LIST);
+}
+
+// A function for a checked [fn [params] body...] form. The parameters and
+// body are shared with the form, so this costs the same for any body size.
+Function* newFunction(List* form) {
+    Function* function = (Function*)allocateObject(sizeof(Function), OBJ_FUNCTION);
+    function->form = form;
+    function->params = AS_LIST(form->items[1]);
+    function->arity = function->params->count;
+    function->body = &form->items[2];
+    function->bodyCount = form->count - 2;
+    function->chunk = NULL;
+    function->capturesFrame = -1;
+    function->epoch = foldEpoch;
+    return function;
+}
+
+// Whether evaluating expr can create a closure
+bool createsClosure(Value expr) {
+    if (!IS_LIST(expr)) return false;
+
+    List* list = AS_LIST(expr);
+    SpecialForm special = specialForm(list);
+    if (special == SPECIAL_FN || special == SPECIAL_DEFMACRO) return true;
+    for (int i = 0; i < list->count; i++) {
+        if (createsClosure(list->items[i])) return true;
+    }
+    return false;
+}
+
+// Whether a call's frame can outlive the call, because a closure created in
+// the body keeps it as its environment. Frames that can't are pooled.
+bool functionCapturesFrame(Function* function) {
+    if (function->capturesFrame == -1) {
+        function->capturesFrame = false;
+        for (int i = 0; i < function->bodyCount; i++) {
+            if (createsClosure(function->body[i])) function->capturesFrame = true;
+        }
+    }
+    return function->capturesFrame;
+}
+
+// A closure of function over env
+Value makeFunction(Function* function, Environment* env) {
+    Closure* closure = (Closure*)allocateObject(sizeof(Closure), OBJ_CLOSURE);
+    closure->function = function;
+    closure->env = env;
+    closure->memo = NULL;
+    return objectValue(&closure->obj, VAL_FUNCTION);
+}
+
+// A value referring to an existing closure
+Value closureValue(Closure* closure) {
+    return objectValue(&closure->obj, VAL_FUNCTION);
+}
+
+// A value referring to an existing list
+Value listValue(List* list) {
+    return objectValue(&list->obj, VAL_LIST);
+}
+
+// A value referring to an existing task
+Value taskValue(Task* task) {
+    return objectValue(&task->obj, VAL_TASK);
+}
+
+// A value referring to an existing channel
+Value channelValue(Channel* channel) {
+    return objectValue(&channel->obj, VAL_CHANNEL);
+}
+
+// A value referring to an existing vector
+Value vectorValue(Vector* vector) {
+    return objectValue(&vector->obj, VAL_VECTOR);
+}
+
+// The globals function runs with, the end of its chain of environments.
+// Natives don't look at them.
+Environment* globalsOf(Value function) {
+    if (!IS_FUNCTION(function)) return NULL;
+    Environment* env = AS_CLOSURE(function)->env;
+    while (env->enclosing != NULL) env = env->enclosing;
+    return env;
 }
 
 Value makeNative(NativeFn function, const char* name) {
-    Value value;
-    value.type = VAL_NATIVE;
-    value.as.native.function = function;
-    value.as.native.name = name;
-    return value;
+    Native* native = (Native*)allocateObject(sizeof(Native), OBJ_NATIVE);
+    native->function = function;
+    native->name = name;
+    native->op = NATIVE_OP_NONE;
+    native->pure = false;
+    return objectValue(&native->obj, VAL_NATIVE);
 }
 
 void initList(List* list) {
@@ -65,7 +201,7 @@ void initList(List* list) {
 }
 
 void freeList(List* list) {
-    free(list->items);
+    reallocate(list->items, sizeof(Value) * list->capacity, 0);
     initList(list);
 }
 
@@ -73,158 +209,232 @@ void appendToList(List* list, Value value) {
     if (list->capacity < list->count + 1) {
         int oldCapacity = list->capacity;
         list->capacity = oldCapacity < 8 ? 8 : oldCapacity * 2;
-        list->items = realloc(list->items, sizeof(Value) * list->capacity);
+        list->items = reallocate(list->items, sizeof(Value) * oldCapacity,
+                                 sizeof(Value) * list->capacity);
     }
 
     list->items[list->count] = value;
     list->count++;
 }
 
+static void printList(List* list) {
+    for (int i = 0; i < list->count; i++) {
+        printValue(list->items[i]);
+        if (i < list->count - 1) printf(" ");
+    }
+}
+
+// Writes number with the fewest digits, from 15 up to 17, that read back as
+// the same double, so a number never prints rounded
+void formatNumber(char* text, size_t size, double number) {
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(text, size, "%.*g", precision, number);
+        if (strtod(text, NULL) == number) break;
+    }
+}
+
 void printValue(Value value) {
-    switch (value.type) {
+    switch (valueType(value)) {
         case VAL_NIL:
             printf("nil");
             break;
         case VAL_BOOLEAN:
-            printf("%s", value.as.boolean ? "true" : "false");
+            printf("%s", AS_BOOLEAN(value) ? "true" : "false");
             break;
-        case VAL_NUMBER:
-            printf("%g", value.as.number);
+        case VAL_NUMBER: {
+            char text[32];
+            formatNumber(text, sizeof(text), AS_NUMBER(value));
+            printf("%s", text);
+            break;
+        }
+        case VAL_INT:
+            printf("%" PRId64, AS_INT(value));
             break;
         case VAL_STRING:
-            printf("\"%s\"", value.as.string);
+            printf("\"%s\"", AS_STRING(value)->chars);
             break;
         case VAL_SYMBOL:
-            printf("%s", value.as.symbol);
+            printf("%s", AS_SYMBOL(value)->chars);
             break;
         case VAL_LIST: {
             printf("[");
-            for (int i = 0; i < value.as.list.count; i++) {
-                printValue(value.as.list.items[i]);
-                if (i < value.as.list.count - 1) printf(" ");
-            }
+            printList(AS_LIST(value));
             printf("]");
             break;
         }
-        case VAL_FUNCTION:
+        case VAL_FUNCTION: {
+            // Functions print as written, not as optimized
+            List* form = sourceForm(AS_CLOSURE(value)->function->form);
             printf("[fn ");
             printf("[");
-            for (int i = 0; i < value.as.function.params.count; i++) {
-                printValue(value.as.function.params.items[i]);
-                if (i < value.as.function.params.count - 1) printf(" ");
-            }
+            printList(AS_LIST(form->items[1]));
             printf("] ");
             // Print body
-            for (int i = 0; i < value.as.function.body.count; i++) {
-                printValue(value.as.function.body.items[i]);
-                if (i < value.as.function.body.count - 1) printf(" ");
+            for (int i = 2; i < form->count; i++) {
+                printValue(form->items[i]);
+                if (i < form->count - 1) printf(" ");
             }
             printf("]");
             break;
+        }
         case VAL_NATIVE:
-            printf("[native-fn %s]", value.as.native.name);
+            printf("[native-fn %s]", AS_NATIVE(value)->name);
             break;
-    }
-}
-
-void freeValue(Value value) {
-    switch (value.type) {
-        case VAL_STRING:
-            free(value.as.string);
+        case VAL_TASK:
+            printf(AS_TASK(value)->state == TASK_DONE ? "[task done]" : "[task]");
             break;
-        case VAL_SYMBOL:
-            free(value.as.symbol);
+        case VAL_CHANNEL:
+            printf("[channel]");
             break;
-        case VAL_LIST:
-            for (int i = 0; i < value.as.list.count; i++) {
-                freeValue(value.as.list.items[i]);
-            }
-            freeList(&value.as.list);
-            break;
-        case VAL_FUNCTION:
-            for (int i = 0; i < value.as.function.params.count; i++) {
-                freeValue(value.as.function.params.items[i]);
-            }
-            freeList(&value.as.function.params);
-            
-            for (int i = 0; i < value.as.function.body.count; i++) {
-                freeValue(value.as.function.body.items[i]);
+        case VAL_VECTOR: {
+            // Vectors print like the lists they equal
+            Vector* vector = AS_VECTOR(value);
+            printf("[");
+            for (int i = 0; i < vector->count; i++) {
+                printValue(vectorGet(vector, i));
+                if (i < vector->count - 1) printf(" ");
             }
-            freeList(&value.as.function.body);
-            break;
-        default:
+            printf("]");
             break;
+        }
     }
 }
 
-Value copyValue(Value value) {
-    switch (value.type) {
-        case VAL_NIL:
-            return NIL_VAL;
-        case VAL_BOOLEAN:
-            return makeBoolean(value.as.boolean);
-        case VAL_NUMBER:
-            return makeNumber(value.as.number);
-        case VAL_STRING:
-            return makeString(value.as.string);
-        case VAL_SYMBOL:
-            return makeSymbol(value.as.symbol);
-        case VAL_LIST: {
-            Value copy = makeList();
-            for (int i = 0; i < value.as.list.count; i++) {
-                appendToList(&copy.as.list, copyValue(value.as.list.items[i]));
-            }
-            return copy;
-        }
-        case VAL_FUNCTION: {
-            Value copy = makeFunction(value.as.function.arity);
-            
-            // Copy parameters
-            for (int i = 0; i < value.as.function.params.count; i++) {
-                appendToList(&copy.as.function.params, copyValue(value.as.function.params.items[i]));
-            }
-            
-            // Copy body
-            for (int i = 0; i < value.as.function.body.count; i++) {
-                appendToList(&copy.as.function.body, copyValue(value.as.function.body.items[i]));
-            }
-            
-            return copy;
-        }
-        case VAL_NATIVE:
-            return makeNative(value.as.native.function, value.as.native.name);
+static int sequenceLength(Value sequence) {
+    return IS_LIST(sequence) ? AS_LIST(sequence)->count : AS_VECTOR(sequence)->count;
+}
+
+static Value sequenceAt(Value sequence, int index) {
+    return IS_LIST(sequence) ? AS_LIST(sequence)->items[index] : vectorGet(AS_VECTOR(sequence), index);
+}
+
+// A vector equals a vector or list with equal items
+static bool sequencesEqual(Value a, Value b) {
+    int count = sequenceLength(a);
+    if (sequenceLength(b) != count) return false;
+    for (int i = 0; i < count; i++) {
+        if (!valuesEqual(sequenceAt(a, i), sequenceAt(b, i))) return false;
     }
-    
-    // Should never reach here
-    return NIL_VAL;
+    return true;
 }
 
 bool valuesEqual(Value a, Value b) {
-    if (a.type != b.type) return false;
-    
-    switch (a.type) {
+    // Integers and doubles compare by numeric value
+    if (IS_INT(a) && IS_INT(b)) return AS_INT(a) == AS_INT(b);
+    if (IS_NUMBER(a) && IS_NUMBER(b)) return AS_NUMBER(a) == AS_NUMBER(b);
+    if ((IS_VECTOR(a) && (IS_VECTOR(b) || IS_LIST(b))) || (IS_LIST(a) && IS_VECTOR(b))) {
+        return sequencesEqual(a, b);
+    }
+    if (valueType(a) != valueType(b)) return false;
+
+    switch (valueType(a)) {
         case VAL_NIL:
             return true;
         case VAL_BOOLEAN:
-            return a.as.boolean == b.as.boolean;
+            return AS_BOOLEAN(a) == AS_BOOLEAN(b);
         case VAL_NUMBER:
-            return a.as.number == b.as.number;
+        case VAL_INT:
+            return AS_NUMBER(a) == AS_NUMBER(b);
         case VAL_STRING:
-            return strcmp(a.as.string, b.as.string) == 0;
+            return AS_STRING(a)->length == AS_STRING(b)->length &&
+                   memcmp(AS_STRING(a)->chars, AS_STRING(b)->chars, AS_STRING(a)->length) == 0;
         case VAL_SYMBOL:
-            return strcmp(a.as.symbol, b.as.symbol) == 0;
+            return AS_SYMBOL(a) == AS_SYMBOL(b);
         case VAL_LIST:
-            if (a.as.list.count != b.as.list.count) return false;
-            for (int i = 0; i < a.as.list.count; i++) {
-                if (!valuesEqual(a.as.list.items[i], b.as.list.items[i])) return false;
+            if (AS_LIST(a)->count != AS_LIST(b)->count) return false;
+            for (int i = 0; i < AS_LIST(a)->count; i++) {
+                if (!valuesEqual(AS_LIST(a)->items[i], AS_LIST(b)->items[i])) return false;
             }
             return true;
         case VAL_FUNCTION:
         case VAL_NATIVE:
             // Functions and natives are only equal if they are the same object
             return false;
+        case VAL_TASK:
+            return AS_TASK(a) == AS_TASK(b);
+        case VAL_CHANNEL:
+            // Channels copied to another heap are the same channel
+            return AS_CHANNEL(a)->queue == AS_CHANNEL(b)->queue;
+        case VAL_VECTOR:
+            return sequencesEqual(a, b);
     }
-    
+
     // Should never reach here
     return false;
-} 
\ No newline at end of file
+}
+
+static uint32_t mixHash(uint32_t hash, uint32_t value) {
+    return (hash ^ value) * 16777619;
+}
+
+// A hash that agrees with valuesEqual: equal values hash the same, so
+// integers hash as the double they equal and lists by their items
+uint32_t hashValue(Value value) {
+    switch (valueType(value)) {
+        case VAL_NIL:
+            return 1;
+        case VAL_BOOLEAN:
+            return AS_BOOLEAN(value) ? 3 : 2;
+        case VAL_NUMBER:
+        case VAL_INT: {
+            // 0.0 for -0.0, which it equals
+            double number = AS_NUMBER(value) + 0.0;
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            return mixHash((uint32_t)bits, (uint32_t)(bits >> 32));
+        }
+        case VAL_STRING: {
+            String* string = AS_STRING(value);
+            uint32_t hash = 2166136261u;
+            for (int i = 0; i < string->length; i++) {
+                hash = mixHash(hash, (uint8_t)string->chars[i]);
+            }
+            return hash;
+        }
+        case VAL_SYMBOL:
+            return AS_SYMBOL(value)->hash;
+        case VAL_LIST: {
+            List* list = AS_LIST(value);
+            uint32_t hash = 2166136261u;
+            for (int i = 0; i < list->count; i++) {
+                hash = mixHash(hash, hashValue(list->items[i]));
+            }
+            return hash;
+        }
+        case VAL_FUNCTION:
+        case VAL_NATIVE:
+            // Functions are never equal, not even to themselves
+            return 0;
+        case VAL_TASK:
+            return mixHash(2166136261u, (uint32_t)((uintptr_t)AS_TASK(value) >> 3));
+        case VAL_CHANNEL:
+            return mixHash(2166136261u, (uint32_t)((uintptr_t)AS_CHANNEL(value)->queue >> 3));
+        case VAL_VECTOR: {
+            // The same as the list it equals
+            Vector* vector = AS_VECTOR(value);
+            uint32_t hash = 2166136261u;
+            for (int i = 0; i < vector->count; i++) {
+                hash = mixHash(hash, hashValue(vectorGet(vector, i)));
+            }
+            return hash;
+        }
+    }
+    return 0;
+}
+
+bool isTruthy(Value value) {
+    switch (valueType(value)) {
+        case VAL_BOOLEAN:
+            return AS_BOOLEAN(value);
+        case VAL_NUMBER:
+            // Treat non-zero as true, zero as false
+            return AS_NUMBER(value) != 0;
+        case VAL_INT:
+            return AS_INT(value) != 0;
+        case VAL_NIL:
+            return false;
+        default:
+            // Everything else (strings, symbols, lists, functions) is treated as true
+            return true;
+    }
+}
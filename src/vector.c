@@ -0,0 +1,433 @@
+#include "../include/hexa.h"
+
+// Persistent vectors. A vector's items are the leaves of a trie whose
+// nodes have VECTOR_WIDTH slots, indexed VECTOR_BITS bits of the index at
+// a time from the top, followed by a tail node with the last 1 to
+// VECTOR_WIDTH items. An update copies the nodes on the path to the item,
+// at most log32(count) of them, and shares the rest with the old version,
+// so conj, assoc and pop are O(log n) and nth walks the same path. Appends
+// only copy the tail until it fills up and moves into the trie.
+//
+// Lists stay arrays: code is made of them, and the evaluator, compiler and
+// VM index them directly. The natives here take a list or a vector and give
+// a vector, and a list and a vector with equal items are equal.
+//
+// Building a vector an item at a time as a transient skips the copying: a
+// transient has an edit number, the nodes it makes carry it, and it changes
+// those in place. endTransient clears the vector's edit number, so nothing
+// changes the nodes again.
+
+// Edit numbers of this thread's transients. Nodes are never shared across
+// heaps, so numbers only have to differ within one.
+static HEXA_THREAD_LOCAL uint64_t lastEdit;
+
+static VectorNode* newNode(bool leaf, uint64_t edit) {
+    VectorNode* node = (VectorNode*)allocateObject(sizeof(VectorNode), OBJ_VECTOR_NODE);
+    node->edit = edit;
+    node->count = 0;
+    node->leaf = leaf;
+    return node;
+}
+
+// node itself if edit may change it, otherwise a copy that edit owns
+static VectorNode* editable(VectorNode* node, uint64_t edit) {
+    if (edit != 0 && node->edit == edit) return node;
+
+    VectorNode* copy = newNode(node->leaf, edit);
+    copy->count = node->count;
+    if (node->leaf) {
+        memcpy(copy->as.items, node->as.items, sizeof(Value) * node->count);
+    } else {
+        memcpy(copy->as.children, node->as.children, sizeof(VectorNode*) * node->count);
+    }
+    return copy;
+}
+
+static Vector* newVector(uint64_t edit) {
+    // Allocating never collects, so the nodes are safe until stored
+    VectorNode* root = newNode(false, edit);
+    VectorNode* tail = newNode(true, edit);
+    Vector* vector = (Vector*)allocateObject(sizeof(Vector), OBJ_VECTOR);
+    vector->count = 0;
+    vector->shift = VECTOR_BITS;
+    vector->edit = edit;
+    vector->root = root;
+    vector->tail = tail;
+    return vector;
+}
+
+// A new version of vector for a persistent update to change
+static Vector* copyVector(Vector* vector) {
+    Vector* copy = (Vector*)allocateObject(sizeof(Vector), OBJ_VECTOR);
+    copy->count = vector->count;
+    copy->shift = vector->shift;
+    copy->edit = 0;
+    copy->root = vector->root;
+    copy->tail = vector->tail;
+    return copy;
+}
+
+// Index of the first item in the tail
+static int tailOffset(Vector* vector) {
+    if (vector->count < VECTOR_WIDTH) return 0;
+    return ((vector->count - 1) >> VECTOR_BITS) << VECTOR_BITS;
+}
+
+// The leaf holding index, which must be in range
+static VectorNode* leafFor(Vector* vector, int index) {
+    if (index >= tailOffset(vector)) return vector->tail;
+
+    VectorNode* node = vector->root;
+    for (int level = vector->shift; level > 0; level -= VECTOR_BITS) {
+        node = node->as.children[(index >> level) & VECTOR_MASK];
+    }
+    return node;
+}
+
+Value vectorGet(Vector* vector, int index) {
+    return leafFor(vector, index)->as.items[index & VECTOR_MASK];
+}
+
+// The items from the multiple of VECTOR_WIDTH at or below index up to the
+// next one or the end, for going through a vector a leaf at a time
+Value* vectorChunk(Vector* vector, int index) {
+    return leafFor(vector, index)->as.items;
+}
+
+// A chain of branches down from level to leaf
+static VectorNode* newPath(int level, VectorNode* leaf, uint64_t edit) {
+    if (level == 0) return leaf;
+    VectorNode* node = newNode(false, edit);
+    node->as.children[0] = newPath(level - VECTOR_BITS, leaf, edit);
+    node->count = 1;
+    return node;
+}
+
+// Put the full tail into the trie below parent at level
+static VectorNode* pushTail(Vector* vector, int level, VectorNode* parent, VectorNode* tail) {
+    int slot = ((vector->count - 1) >> level) & VECTOR_MASK;
+    VectorNode* node = editable(parent, vector->edit);
+    VectorNode* child;
+    if (level == VECTOR_BITS) {
+        child = tail;
+    } else if (slot < parent->count) {
+        child = pushTail(vector, level - VECTOR_BITS, parent->as.children[slot], tail);
+    } else {
+        child = newPath(level - VECTOR_BITS, tail, vector->edit);
+    }
+    node->as.children[slot] = child;
+    if (slot >= node->count) node->count = slot + 1;
+    return node;
+}
+
+// Add value at the end of vector, which must be a new version or a transient
+static void append(Vector* vector, Value value) {
+    int inTail = vector->count - tailOffset(vector);
+    if (inTail < VECTOR_WIDTH) {
+        vector->tail = editable(vector->tail, vector->edit);
+        vector->tail->as.items[inTail] = value;
+        vector->tail->count = inTail + 1;
+        vector->count++;
+        return;
+    }
+
+    // The tail is full: it goes into the trie, which grows a level when
+    // the root has no room left
+    VectorNode* full = vector->tail;
+    if ((vector->count >> VECTOR_BITS) > (1 << vector->shift)) {
+        VectorNode* root = newNode(false, vector->edit);
+        root->as.children[0] = vector->root;
+        root->as.children[1] = newPath(vector->shift, full, vector->edit);
+        root->count = 2;
+        vector->root = root;
+        vector->shift += VECTOR_BITS;
+    } else {
+        vector->root = pushTail(vector, vector->shift, vector->root, full);
+    }
+
+    VectorNode* tail = newNode(true, vector->edit);
+    tail->as.items[0] = value;
+    tail->count = 1;
+    vector->tail = tail;
+    vector->count++;
+}
+
+static VectorNode* assocIn(int level, VectorNode* node, int index, Value value, uint64_t edit) {
+    VectorNode* copy = editable(node, edit);
+    if (level == 0) {
+        copy->as.items[index & VECTOR_MASK] = value;
+    } else {
+        int slot = (index >> level) & VECTOR_MASK;
+        copy->as.children[slot] = assocIn(level - VECTOR_BITS, node->as.children[slot], index, value, edit);
+    }
+    return copy;
+}
+
+// Replace the item at index, which must be in range
+static void assoc(Vector* vector, int index, Value value) {
+    if (index >= tailOffset(vector)) {
+        vector->tail = editable(vector->tail, vector->edit);
+        vector->tail->as.items[index & VECTOR_MASK] = value;
+    } else {
+        vector->root = assocIn(vector->shift, vector->root, index, value, vector->edit);
+    }
+}
+
+// The trie below node at level without its last leaf, or NULL if nothing is left
+static VectorNode* popTail(Vector* vector, int level, VectorNode* node) {
+    int slot = ((vector->count - 2) >> level) & VECTOR_MASK;
+    if (level > VECTOR_BITS) {
+        VectorNode* child = popTail(vector, level - VECTOR_BITS, node->as.children[slot]);
+        if (child == NULL && slot == 0) return NULL;
+
+        VectorNode* copy = editable(node, vector->edit);
+        if (child == NULL) {
+            copy->count = slot;
+        } else {
+            copy->as.children[slot] = child;
+        }
+        return copy;
+    }
+    if (slot == 0) return NULL;
+
+    VectorNode* copy = editable(node, vector->edit);
+    copy->count = slot;
+    return copy;
+}
+
+// Remove the last item of vector, which must not be empty
+static void pop(Vector* vector) {
+    if (vector->count == 1) {
+        vector->count = 0;
+        vector->shift = VECTOR_BITS;
+        vector->root = newNode(false, vector->edit);
+        vector->tail = newNode(true, vector->edit);
+        return;
+    }
+
+    int inTail = vector->count - tailOffset(vector);
+    if (inTail > 1) {
+        vector->tail = editable(vector->tail, vector->edit);
+        vector->tail->count = inTail - 1;
+        vector->count--;
+        return;
+    }
+
+    // The last leaf of the trie becomes the tail, and a root with one
+    // child gives way to the child
+    VectorNode* tail = leafFor(vector, vector->count - 2);
+    VectorNode* root = popTail(vector, vector->shift, vector->root);
+    if (root == NULL) root = newNode(false, vector->edit);
+    if (vector->shift > VECTOR_BITS && root->count == 1) {
+        root = root->as.children[0];
+        vector->shift -= VECTOR_BITS;
+    }
+    vector->root = root;
+    vector->tail = tail;
+    vector->count--;
+}
+
+Value makeVector() {
+    return vectorValue(newVector(0));
+}
+
+// A transient to build on: empty for NULL, otherwise with vector's items
+Vector* beginTransient(Vector* vector) {
+    uint64_t edit = ++lastEdit;
+    if (vector == NULL) return newVector(edit);
+
+    Vector* transient = copyVector(vector);
+    transient->edit = edit;
+    return transient;
+}
+
+void transientAppend(Vector* transient, Value value) {
+    append(transient, value);
+}
+
+// The transient as a vector, which mustn't change from now on
+Value endTransient(Vector* transient) {
+    transient->edit = 0;
+    return vectorValue(transient);
+}
+
+Value vectorFromItems(Value* items, int count) {
+    Vector* transient = beginTransient(NULL);
+    for (int i = 0; i < count; i++) {
+        append(transient, items[i]);
+    }
+    return endTransient(transient);
+}
+
+Value vectorToList(Vector* vector) {
+    Value result = makeListIn(NULL, NULL, 0);
+    List* list = AS_LIST(result);
+    if (vector->count > 0) {
+        list->items = reallocate(NULL, 0, sizeof(Value) * vector->count);
+        list->capacity = vector->count;
+        for (int i = 0; i < vector->count; i += VECTOR_WIDTH) {
+            int count = vector->count - i < VECTOR_WIDTH ? vector->count - i : VECTOR_WIDTH;
+            memcpy(list->items + i, vectorChunk(vector, i), sizeof(Value) * count);
+        }
+        list->count = vector->count;
+    }
+    return result;
+}
+
+// The items of a list or vector, or false after an error
+static bool sequenceCount(Value value, int* count) {
+    if (IS_LIST(value)) {
+        *count = AS_LIST(value)->count;
+        return true;
+    }
+    if (IS_VECTOR(value)) {
+        *count = AS_VECTOR(value)->count;
+        return true;
+    }
+    runtimeError("Expected a list.");
+    return false;
+}
+
+static Value sequenceItem(Value sequence, int index) {
+    return IS_LIST(sequence) ? AS_LIST(sequence)->items[index] : vectorGet(AS_VECTOR(sequence), index);
+}
+
+// A new version of a list or vector to update, or NULL after an error
+static Vector* updatable(Value sequence) {
+    if (IS_VECTOR(sequence)) return copyVector(AS_VECTOR(sequence));
+    if (!IS_LIST(sequence)) {
+        runtimeError("Expected a list.");
+        return NULL;
+    }
+    List* list = AS_LIST(sequence);
+    return AS_VECTOR(vectorFromItems(list->items, list->count));
+}
+
+// An index argument in range for count items, or -1 after an error
+static int checkIndex(Value index, int count) {
+    if (!IS_INT(index)) {
+        runtimeError("Index must be an integer.");
+        return -1;
+    }
+    if (AS_INT(index) < 0 || AS_INT(index) >= count) {
+        runtimeError("Index out of range.");
+        return -1;
+    }
+    return (int)AS_INT(index);
+}
+
+// [conj list items...]: list with items added at the end, nil being empty
+Value nativeConj(int argCount, Value* args) {
+    if (argCount < 1) {
+        runtimeError("Expected at least 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+
+    Vector* vector;
+    if (IS_NIL(args[0])) {
+        vector = beginTransient(NULL);
+    } else if (IS_LIST(args[0])) {
+        List* list = AS_LIST(args[0]);
+        vector = beginTransient(NULL);
+        for (int i = 0; i < list->count; i++) append(vector, list->items[i]);
+    } else if (IS_VECTOR(args[0])) {
+        // One item updates the vector the persistent way, and more items
+        // only copy each node once
+        vector = argCount == 2 ? copyVector(AS_VECTOR(args[0])) : beginTransient(AS_VECTOR(args[0]));
+    } else {
+        runtimeError("Expected a list.");
+        return NIL_VAL;
+    }
+
+    for (int i = 1; i < argCount; i++) {
+        append(vector, args[i]);
+    }
+    return endTransient(vector);
+}
+
+// [assoc list index value]
+Value nativeAssoc(int argCount, Value* args) {
+    if (argCount != 3) {
+        runtimeError("Expected 3 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    int count;
+    if (!sequenceCount(args[0], &count)) return NIL_VAL;
+    int index = checkIndex(args[1], count);
+    if (index < 0) return NIL_VAL;
+
+    Vector* vector = updatable(args[0]);
+    assoc(vector, index, args[2]);
+    return vectorValue(vector);
+}
+
+// [nth list index]
+Value nativeNth(int argCount, Value* args) {
+    if (argCount != 2) {
+        runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    int count;
+    if (!sequenceCount(args[0], &count)) return NIL_VAL;
+    int index = checkIndex(args[1], count);
+    if (index < 0) return NIL_VAL;
+    return sequenceItem(args[0], index);
+}
+
+// [pop list]: list without its last item
+Value nativePop(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    int count;
+    if (!sequenceCount(args[0], &count)) return NIL_VAL;
+    if (count == 0) {
+        runtimeError("Cannot pop an empty list.");
+        return NIL_VAL;
+    }
+
+    Vector* vector = updatable(args[0]);
+    pop(vector);
+    return vectorValue(vector);
+}
+
+// [concat lists...]: the items of the lists in order. The first one's
+// nodes are shared, so the cost is in the items of the others.
+Value nativeConcat(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        int count;
+        if (!sequenceCount(args[i], &count)) return NIL_VAL;
+    }
+
+    Vector* vector;
+    int first = 0;
+    if (argCount > 0 && IS_VECTOR(args[0])) {
+        vector = beginTransient(AS_VECTOR(args[0]));
+        first = 1;
+    } else {
+        vector = beginTransient(NULL);
+    }
+
+    for (int i = first; i < argCount; i++) {
+        if (IS_LIST(args[i])) {
+            List* list = AS_LIST(args[i]);
+            for (int j = 0; j < list->count; j++) append(vector, list->items[j]);
+        } else {
+            Vector* other = AS_VECTOR(args[i]);
+            for (int j = 0; j < other->count; j++) append(vector, vectorGet(other, j));
+        }
+    }
+    return endTransient(vector);
+}
+
+// [count list]
+Value nativeCount(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NIL_VAL;
+    }
+    int count;
+    if (!sequenceCount(args[0], &count)) return NIL_VAL;
+    return makeInt(count);
+}
@@ -0,0 +1,926 @@
+#include "../include/hexa.h"
+
+#define FRAMES_INITIAL 64
+#define STACK_INITIAL 1024
+#define TASK_FRAMES_INITIAL 4
+
+// Frames and the stack live on the heap and grow with the call depth, up to
+// maxDepth nested calls. Both are the VM's garbage collection roots.
+typedef struct {
+    CallFrame* frames;
+    int frameCount;
+    int frameCapacity;
+    Value* stack;
+    Value* stackTop;
+    int stackCapacity;
+    Environment* globals;
+    bool suspending;    // The running task is suspending, so run() returns
+} VM;
+
+static HEXA_THREAD_LOCAL VM vm;
+static HEXA_THREAD_LOCAL int maxDepth = HEXA_DEFAULT_MAX_DEPTH;
+static HEXA_THREAD_LOCAL bool jitEnabled = true;
+static HEXA_THREAD_LOCAL int jitThreshold = HEXA_JIT_THRESHOLD;
+
+HEXA_THREAD_LOCAL CacheStats cacheStats;
+
+// The globals the caches were filled from
+static HEXA_THREAD_LOCAL Environment* cachedGlobals;
+
+// While a task runs, the stacks of the code that resumed it. A task can only
+// suspend from its own bytecode, not from a run nested in a call from C.
+static HEXA_THREAD_LOCAL TaskStack resumer;
+static HEXA_THREAD_LOCAL bool inTask;
+static HEXA_THREAD_LOCAL int nestedRuns;
+
+void initVM() {
+    if (vm.frames == NULL) {
+        vm.frames = reallocate(NULL, 0, sizeof(CallFrame) * FRAMES_INITIAL);
+        vm.frameCapacity = FRAMES_INITIAL;
+        vm.stack = reallocate(NULL, 0, sizeof(Value) * STACK_INITIAL);
+        vm.stackCapacity = STACK_INITIAL;
+    }
+
+    vm.frameCount = 0;
+    vm.stackTop = vm.stack;
+    vm.globals = NULL;
+    initFramePool();
+}
+
+void freeVM() {
+    reallocate(vm.frames, sizeof(CallFrame) * vm.frameCapacity, 0);
+    reallocate(vm.stack, sizeof(Value) * vm.stackCapacity, 0);
+    vm.frames = NULL;
+    vm.stack = vm.stackTop = NULL;
+    vm.frameCapacity = vm.stackCapacity = 0;
+    cachedGlobals = NULL;
+}
+
+// The nesting limit of calls, shared with the tree-walker
+void setMaxCallDepth(int depth) {
+    maxDepth = depth;
+}
+
+int maxCallDepth() {
+    return maxDepth;
+}
+
+// Whether hot functions are compiled to machine code, where the JIT exists
+void setJitEnabled(bool enabled) {
+    jitEnabled = enabled;
+}
+
+// The number of calls that makes a function hot
+void setJitThreshold(int calls) {
+    jitThreshold = calls;
+}
+
+static void push(Value value) {
+    *vm.stackTop = value;
+    vm.stackTop++;
+}
+
+static Value pop() {
+    vm.stackTop--;
+    return *vm.stackTop;
+}
+
+// Make room for count more values
+static void ensureStackSpace(int count) {
+    int used = (int)(vm.stackTop - vm.stack);
+    int needed = used + count;
+    if (needed <= vm.stackCapacity) return;
+
+    int capacity = vm.stackCapacity * 2 > needed ? vm.stackCapacity * 2 : needed;
+    vm.stack = reallocate(vm.stack, sizeof(Value) * vm.stackCapacity, sizeof(Value) * capacity);
+    vm.stackCapacity = capacity;
+    vm.stackTop = vm.stack + used;
+}
+
+// Make room for everything chunk can push, at most a value per instruction
+static void ensureStack(Chunk* chunk) {
+    ensureStackSpace(chunk->count + 1);
+}
+
+static bool pushFrame(Closure* closure, Chunk* chunk, Environment* env) {
+    // Top-level code has a frame too, it doesn't count as a call
+    if (closure != NULL && vm.frameCount > maxDepth) {
+        runtimeError("Stack overflow: more than %d nested calls.", maxDepth);
+        return false;
+    }
+
+    if (vm.frameCount == vm.frameCapacity) {
+        int capacity = vm.frameCapacity * 2;
+        vm.frames = reallocate(vm.frames, sizeof(CallFrame) * vm.frameCapacity,
+                               sizeof(CallFrame) * capacity);
+        vm.frameCapacity = capacity;
+    }
+    ensureStack(chunk);
+
+    CallFrame* frame = &vm.frames[vm.frameCount++];
+    frame->closure = closure;
+    frame->chunk = chunk;
+    frame->ip = chunk->code;
+    frame->env = env;
+    frame->base = (int)(vm.stackTop - vm.stack);
+    return true;
+}
+
+static CallFrame* jitStep(CallFrame* frame, uint8_t* ip);
+
+// Count a call of the function chunk belongs to, compiling it once it's hot.
+// The machine code refers to this thread's stack, which is the only one
+// that runs it.
+static void countCall(Chunk* chunk) {
+    if (chunk->calls < jitThreshold && ++chunk->calls == jitThreshold && jitEnabled) {
+        JitRuntime runtime = {&vm.stackTop, jitStep};
+        chunk->jit = jitCompile(chunk, &runtime);
+    }
+}
+
+// A frame for calling function, which takes its arguments from args
+static Environment* bindArguments(Closure* closure, Value* args) {
+    Function* function = closure->function;
+
+    // Parameters occupy the first slots of the frame. Frames no closure
+    // can hold on to come from the pool and go back on return.
+    Environment* enclosing = closure->env != NULL ? closure->env : vm.globals;
+    Environment* functionEnv = functionCapturesFrame(function)
+        ? createFrame(enclosing, function->chunk->slotCount)
+        : acquireFrame(enclosing, function->chunk->slotCount);
+    for (int i = 0; i < function->arity; i++) {
+        functionEnv->entries[i].key = AS_SYMBOL(function->params->items[i]);
+        functionEnv->entries[i].value = args[i];
+    }
+    return functionEnv;
+}
+
+// Call the value sitting below argCount arguments on the stack. Native
+// results are pushed directly, user functions get a new frame. Returns false
+// on stack overflow, leaving the callee and arguments popped.
+static bool callValue(Value callee, int argCount) {
+    Value* args = vm.stackTop - argCount;
+    size_t allocations = allocStats.allocations;
+    allocStats.calls++;
+
+    if (IS_FUNCTION(callee)) {
+        Closure* closure = AS_CLOSURE(callee);
+        Function* function = closure->function;
+
+        if (function->arity != argCount) {
+            runtimeError("Expected %d arguments but got %d.", function->arity, argCount);
+            vm.stackTop = args - 1;
+            push(NIL_VAL);
+            return true;
+        }
+
+        // A memoized function returns a result it has like a native would
+        Value result;
+        if (closure->memo != NULL && memoLookup(closure->memo, args, &result)) {
+            vm.stackTop = args - 1;
+            push(result);
+            return true;
+        }
+
+        // Functions built outside the compiler are compiled on first call
+        // (and again once their form is restored from an optimized one)
+        checkFoldEpoch(function);
+        if (function->chunk == NULL) {
+            function->chunk = compileFunction(function);
+        }
+        countCall(function->chunk);
+
+        Environment* functionEnv = bindArguments(closure, args);
+
+        // The frame keeps the callee alive while its chunk runs. The
+        // arguments of a memoized function stay on the stack below the
+        // frame, for OP_RETURN to store the result under.
+        int base = (int)(args - 1 - vm.stack);
+        if (closure->memo == NULL) vm.stackTop = args - 1;
+        bool pushed = pushFrame(closure, function->chunk, functionEnv);
+        if (pushed) {
+            vm.frames[vm.frameCount - 1].base = base;
+        } else {
+            vm.stackTop = vm.stack + base;
+            if (functionEnv->pooled) releaseFrame(functionEnv);
+        }
+        allocStats.callAllocations += allocStats.allocations - allocations;
+        return pushed;
+    }
+
+    // A native that runs code may grow the stack, so its place is kept as
+    // an index
+    int base = (int)(args - 1 - vm.stack);
+    Value result = NIL_VAL;
+    if (IS_NATIVE(callee)) {
+        result = AS_NATIVE(callee)->function(argCount, args);
+    } else {
+        runtimeError("Cannot call non-function. Got type %d.", valueType(callee));
+    }
+
+    vm.stackTop = vm.stack + base;
+    push(result);
+    return true;
+}
+
+// Replace frame with a call of callee, if it is a function taking argCount
+// arguments. The frame's own values are gone by the time its tail call
+// runs, so the callee and arguments sit at its base. Memoized functions
+// have results to store when they return, so they neither make nor take
+// tail calls.
+static bool tailCall(CallFrame* frame, Value callee, int argCount) {
+    if (!IS_FUNCTION(callee) || AS_CLOSURE(callee)->function->arity != argCount ||
+        AS_CLOSURE(callee)->memo != NULL || (frame->closure != NULL && frame->closure->memo != NULL)) {
+        return false;
+    }
+
+    Function* function = AS_CLOSURE(callee)->function;
+    checkFoldEpoch(function);
+    if (function->chunk == NULL) {
+        function->chunk = compileFunction(function);
+    }
+    countCall(function->chunk);
+
+    size_t allocations = allocStats.allocations;
+    allocStats.calls++;
+
+    // The arguments are on the stack, so the old frame can go first
+    Value* args = vm.stackTop - argCount;
+    if (frame->env->pooled) releaseFrame(frame->env);
+    frame->env = bindArguments(AS_CLOSURE(callee), args);
+    frame->closure = AS_CLOSURE(callee);
+    frame->chunk = function->chunk;
+    frame->ip = function->chunk->code;
+
+    vm.stackTop = args - 1;
+    ensureStack(function->chunk);
+    allocStats.callAllocations += allocStats.allocations - allocations;
+    return true;
+}
+
+// Drop the frames from frameIndex up, as if the call that made frameIndex
+// had returned without pushing a result
+static void unwindFrames(int frameIndex) {
+    // Pooled frames go back in the reverse order they were acquired. A frame
+    // in a let scope holds the scope's environment, in front of its own.
+    for (int i = vm.frameCount - 1; i >= frameIndex; i--) {
+        for (Environment* env = vm.frames[i].env; env != NULL && env->pooled; ) {
+            Environment* enclosing = env->enclosing;
+            releaseFrame(env);
+            env = enclosing;
+        }
+    }
+    vm.stackTop = vm.stack + vm.frames[frameIndex].base;
+    vm.frameCount = frameIndex;
+}
+
+// After a stack overflow, make the outermost call of the run at baseFrame
+// return nil. Returns true when that is the run's own frame, a function
+// called from C, so the run is over.
+static bool overflowed(int baseFrame) {
+    if (vm.frames[baseFrame].closure != NULL) {
+        unwindFrames(baseFrame);
+        return true;
+    }
+
+    if (vm.frameCount > baseFrame + 1) unwindFrames(baseFrame + 1);
+    push(NIL_VAL);
+    return false;
+}
+
+// Rewrite the call just read into OP_CALL_BINARY when it calls a NativeOp
+// built-in with two arguments. The operand keeps the original opcode for
+// when the callee changes.
+static bool quickenCall(uint8_t* ip, int argCount) {
+    Value callee = vm.stackTop[-argCount - 1];
+    if (argCount != 2 || !IS_NATIVE(callee) || AS_NATIVE(callee)->op == NATIVE_OP_NONE) {
+        return false;
+    }
+
+    cacheStats.quickened++;
+    ip[-1] = ip[-2];
+    ip[-2] = OP_CALL_BINARY;
+    return true;
+}
+
+// The global constants[index] names, through the instruction's cache
+static Value getGlobal(Chunk* chunk, uint16_t index) {
+    GlobalCache* cache = &chunk->caches[index];
+    if (cache->version == globalsVersion) {
+        cacheStats.globalHits++;
+        return cache->value;
+    }
+
+    cacheStats.globalMisses++;
+    Symbol* name = AS_SYMBOL(chunk->constants.items[index]);
+    Value value;
+    if (!lookupVariable(vm.globals, name, &value)) return getVariable(vm.globals, name);
+
+    cache->version = globalsVersion;
+    cache->value = value;
+    return value;
+}
+
+// The value in slot of env. Until its def runs a local still refers to the
+// enclosing binding of its name.
+static Value getSlot(Environment* env, int slot, Value name) {
+    Entry* entry = &env->entries[slot];
+    return entry->key != NULL ? entry->value : getVariable(env->enclosing, AS_SYMBOL(name));
+}
+
+// Assign the value on top of the stack to name in env, leaving nil there
+// when name is undefined
+static void setVariable(Environment* env, Value name) {
+    if (!assignVariable(env, AS_SYMBOL(name), vm.stackTop[-1])) vm.stackTop[-1] = NIL_VAL;
+}
+
+// Assign slot of env, or the enclosing binding of name until its def runs
+static void setSlot(Environment* env, int slot, Value name) {
+    Entry* entry = &env->entries[slot];
+    if (entry->key != NULL) {
+        entry->value = vm.stackTop[-1];
+    } else {
+        setVariable(env->enclosing, name);
+    }
+}
+
+static void pushScope(CallFrame* frame, int slotCount, bool pooled) {
+    frame->env = pooled ? acquireFrame(frame->env, slotCount) : createFrame(frame->env, slotCount);
+}
+
+static void popScope(CallFrame* frame) {
+    Environment* scope = frame->env;
+    frame->env = scope->enclosing;
+    if (scope->pooled) releaseFrame(scope);
+}
+
+// The instructions machine code leaves to the VM, one at a time. Calls of
+// natives are made here, calls of functions and returns change the frame
+// and are left to run().
+static bool stepInstruction(CallFrame* frame, uint8_t* ip) {
+    OpCode op = (OpCode)*ip++;
+    uint16_t index;
+    switch (op) {
+        case OP_GET_VARIABLE:
+            index = (uint16_t)((ip[0] << 8) | ip[1]);
+            push(getVariable(frame->env, AS_SYMBOL(frame->chunk->constants.items[index])));
+            return true;
+        case OP_GET_GLOBAL:
+            push(getGlobal(frame->chunk, (uint16_t)((ip[0] << 8) | ip[1])));
+            return true;
+        case OP_DEFINE_GLOBAL:
+            index = (uint16_t)((ip[0] << 8) | ip[1]);
+            defineVariable(vm.globals, AS_SYMBOL(frame->chunk->constants.items[index]),
+                           vm.stackTop[-1]);
+            return true;
+        case OP_GET_LOCAL:
+            index = (uint16_t)((ip[1] << 8) | ip[2]);
+            push(getSlot(frame->env, ip[0], frame->chunk->constants.items[index]));
+            return true;
+        case OP_GET_ENCLOSING: {
+            Environment* env = frame->env;
+            for (int depth = ip[0]; depth > 0; depth--) {
+                env = env->enclosing;
+            }
+            index = (uint16_t)((ip[2] << 8) | ip[3]);
+            push(getSlot(env, ip[1], frame->chunk->constants.items[index]));
+            return true;
+        }
+        case OP_DEFINE_LOCAL: {
+            Entry* slot = &frame->env->entries[ip[0]];
+            index = (uint16_t)((ip[1] << 8) | ip[2]);
+            slot->key = AS_SYMBOL(frame->chunk->constants.items[index]);
+            slot->value = vm.stackTop[-1];
+            return true;
+        }
+        case OP_SET_VARIABLE:
+            index = (uint16_t)((ip[0] << 8) | ip[1]);
+            setVariable(frame->env, frame->chunk->constants.items[index]);
+            return true;
+        case OP_SET_GLOBAL:
+            index = (uint16_t)((ip[0] << 8) | ip[1]);
+            setVariable(vm.globals, frame->chunk->constants.items[index]);
+            return true;
+        case OP_SET_LOCAL:
+            index = (uint16_t)((ip[1] << 8) | ip[2]);
+            setSlot(frame->env, ip[0], frame->chunk->constants.items[index]);
+            return true;
+        case OP_SET_ENCLOSING: {
+            Environment* env = frame->env;
+            for (int depth = ip[0]; depth > 0; depth--) {
+                env = env->enclosing;
+            }
+            index = (uint16_t)((ip[2] << 8) | ip[3]);
+            setSlot(env, ip[1], frame->chunk->constants.items[index]);
+            return true;
+        }
+        case OP_CLOSURE: {
+            index = (uint16_t)((ip[0] << 8) | ip[1]);
+            Function* function = AS_CLOSURE(frame->chunk->constants.items[index])->function;
+            push(makeFunction(function, frame->env));
+            return true;
+        }
+        case OP_PUSH_SCOPE:
+            pushScope(frame, ip[0], ip[1]);
+            return true;
+        case OP_POP_SCOPE:
+            popScope(frame);
+            return true;
+        case OP_ERROR:
+            index = (uint16_t)((ip[0] << 8) | ip[1]);
+            runtimeError("%s", AS_STRING(frame->chunk->constants.items[index])->chars);
+            push(NIL_VAL);
+            return true;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CALL_BINARY: {
+            int argCount = op == OP_CALL_BINARY ? 2 : ip[0];
+            Value callee = vm.stackTop[-argCount - 1];
+            if (IS_FUNCTION(callee) || maySuspend(callee)) return false;
+
+            // A native in tail position returns its result through OP_RETURN
+            frame->ip = ip + 1;
+            collectGarbageIfNeeded();
+            Value* args = vm.stackTop - argCount;
+            Value result;
+            if (argCount == 2 && IS_NATIVE(callee) &&
+                binaryOnInts((NativeOp)AS_NATIVE(callee)->op, args[0], args[1], &result)) {
+                allocStats.calls++;
+                vm.stackTop = args - 1;
+                push(result);
+            } else {
+                callValue(callee, argCount);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Run an instruction for machine code, and return the frame to go on with,
+// or NULL if the VM has to run it. A native called here may run code that
+// grows vm.frames, so the frame is looked up again rather than kept.
+static CallFrame* jitStep(CallFrame* frame, uint8_t* ip) {
+    if (!stepInstruction(frame, ip)) return NULL;
+    return &vm.frames[vm.frameCount - 1];
+}
+
+// Run the current frame's machine code from ip until it stops at an
+// instruction for the VM, and return where that is
+static uint8_t* runNative(uint8_t* ip) {
+    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    frame->ip = ip;
+    runJit(frame->chunk->jit, frame);
+    return vm.frames[vm.frameCount - 1].ip;
+}
+
+// Run until the frame at baseFrame returns
+static Value run(int baseFrame) {
+    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    uint8_t* ip = frame->ip;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (frame->chunk->constants.items[READ_SHORT()])
+// Machine code may call natives that grow vm.frames, which moves the frame
+#define RUN_NATIVE()                                   \
+    do {                                               \
+        if (frame->chunk->jit != NULL) {               \
+            ip = runNative(ip);                        \
+            frame = &vm.frames[vm.frameCount - 1];     \
+        }                                              \
+    } while (0)
+
+    RUN_NATIVE();
+
+#if defined(__GNUC__) && !defined(HEXA_NO_COMPUTED_GOTO)
+    static void* dispatchTable[] = {
+        &&op_OP_CONSTANT, &&op_OP_NIL, &&op_OP_GET_VARIABLE, &&op_OP_GET_GLOBAL,
+        &&op_OP_DEFINE_GLOBAL, &&op_OP_GET_LOCAL, &&op_OP_GET_ENCLOSING,
+        &&op_OP_DEFINE_LOCAL, &&op_OP_SET_VARIABLE, &&op_OP_SET_GLOBAL, &&op_OP_SET_LOCAL,
+        &&op_OP_SET_ENCLOSING, &&op_OP_CLOSURE, &&op_OP_PUSH_SCOPE, &&op_OP_POP_SCOPE,
+        &&op_OP_POP, &&op_OP_DUP, &&op_OP_JUMP, &&op_OP_JUMP_IF_FALSE, &&op_OP_LOOP,
+        &&op_OP_CALL, &&op_OP_TAIL_CALL, &&op_OP_CALL_BINARY, &&op_OP_ERROR, &&op_OP_RETURN
+    };
+#define DISPATCH() goto *dispatchTable[READ_BYTE()]
+#define CASE(op) op_##op
+    DISPATCH();
+#else
+#define DISPATCH() continue
+#define CASE(op) case op
+    for (;;) {
+        switch (READ_BYTE()) {
+#endif
+
+    CASE(OP_CONSTANT): {
+        push(READ_CONSTANT());
+        DISPATCH();
+    }
+    CASE(OP_NIL): {
+        push(NIL_VAL);
+        DISPATCH();
+    }
+    CASE(OP_GET_VARIABLE): {
+        Value name = READ_CONSTANT();
+        push(getVariable(frame->env, AS_SYMBOL(name)));
+        DISPATCH();
+    }
+    CASE(OP_GET_GLOBAL): {
+        uint16_t index = READ_SHORT();
+        push(getGlobal(frame->chunk, index));
+        DISPATCH();
+    }
+    CASE(OP_DEFINE_GLOBAL): {
+        Value name = READ_CONSTANT();
+        defineVariable(vm.globals, AS_SYMBOL(name), vm.stackTop[-1]);
+        DISPATCH();
+    }
+    CASE(OP_GET_LOCAL): {
+        int slot = READ_BYTE();
+        Value name = READ_CONSTANT();
+        push(getSlot(frame->env, slot, name));
+        DISPATCH();
+    }
+    CASE(OP_GET_ENCLOSING): {
+        Environment* env = frame->env;
+        for (int depth = READ_BYTE(); depth > 0; depth--) {
+            env = env->enclosing;
+        }
+
+        int slot = READ_BYTE();
+        Value name = READ_CONSTANT();
+        push(getSlot(env, slot, name));
+        DISPATCH();
+    }
+    CASE(OP_DEFINE_LOCAL): {
+        Entry* slot = &frame->env->entries[READ_BYTE()];
+        Value name = READ_CONSTANT();
+
+        slot->key = AS_SYMBOL(name);
+        slot->value = vm.stackTop[-1];
+        DISPATCH();
+    }
+    CASE(OP_SET_VARIABLE): {
+        Value name = READ_CONSTANT();
+        setVariable(frame->env, name);
+        DISPATCH();
+    }
+    CASE(OP_SET_GLOBAL): {
+        Value name = READ_CONSTANT();
+        setVariable(vm.globals, name);
+        DISPATCH();
+    }
+    CASE(OP_SET_LOCAL): {
+        int slot = READ_BYTE();
+        Value name = READ_CONSTANT();
+        setSlot(frame->env, slot, name);
+        DISPATCH();
+    }
+    CASE(OP_SET_ENCLOSING): {
+        Environment* env = frame->env;
+        for (int depth = READ_BYTE(); depth > 0; depth--) {
+            env = env->enclosing;
+        }
+
+        int slot = READ_BYTE();
+        Value name = READ_CONSTANT();
+        setSlot(env, slot, name);
+        DISPATCH();
+    }
+    CASE(OP_CLOSURE): {
+        Function* function = AS_CLOSURE(READ_CONSTANT())->function;
+        push(makeFunction(function, frame->env));
+        DISPATCH();
+    }
+    CASE(OP_PUSH_SCOPE): {
+        int slotCount = READ_BYTE();
+        bool pooled = READ_BYTE();
+        pushScope(frame, slotCount, pooled);
+        DISPATCH();
+    }
+    CASE(OP_POP_SCOPE): {
+        popScope(frame);
+        DISPATCH();
+    }
+    CASE(OP_POP): {
+        pop();
+        DISPATCH();
+    }
+    CASE(OP_DUP): {
+        push(vm.stackTop[-1]);
+        DISPATCH();
+    }
+    CASE(OP_JUMP): {
+        uint16_t offset = READ_SHORT();
+        ip += offset;
+        DISPATCH();
+    }
+    CASE(OP_JUMP_IF_FALSE): {
+        uint16_t offset = READ_SHORT();
+        Value condition = pop();
+        if (!isTruthy(condition)) ip += offset;
+        DISPATCH();
+    }
+    CASE(OP_LOOP): {
+        uint16_t offset = READ_SHORT();
+        ip -= offset;
+        DISPATCH();
+    }
+    CASE(OP_CALL): {
+        int argCount = READ_BYTE();
+        if (quickenCall(ip, argCount)) {
+            ip -= 2;
+            DISPATCH();
+        }
+        frame->ip = ip;
+        collectGarbageIfNeeded();
+        if (!callValue(vm.stackTop[-argCount - 1], argCount) && overflowed(baseFrame)) {
+            return NIL_VAL;
+        }
+        if (vm.suspending) return NIL_VAL;
+        frame = &vm.frames[vm.frameCount - 1];
+        ip = frame->ip;
+        RUN_NATIVE();
+        DISPATCH();
+    }
+    CASE(OP_TAIL_CALL): {
+        int argCount = READ_BYTE();
+        if (quickenCall(ip, argCount)) {
+            ip -= 2;
+            DISPATCH();
+        }
+        frame->ip = ip;
+        collectGarbageIfNeeded();
+        Value callee = vm.stackTop[-argCount - 1];
+
+        // Natives, bad calls and memoized functions are called like anywhere
+        // else, and OP_RETURN follows
+        if (!tailCall(frame, callee, argCount) && !callValue(callee, argCount) &&
+            overflowed(baseFrame)) {
+            return NIL_VAL;
+        }
+        if (vm.suspending) return NIL_VAL;
+        frame = &vm.frames[vm.frameCount - 1];
+        ip = frame->ip;
+        RUN_NATIVE();
+        DISPATCH();
+    }
+    CASE(OP_CALL_BINARY): {
+        Value callee = vm.stackTop[-3];
+        if (!IS_NATIVE(callee) || AS_NATIVE(callee)->op == NATIVE_OP_NONE) {
+            // Something else is called here now, go back to the generic call
+            cacheStats.deoptimized++;
+            ip[-1] = ip[0];
+            ip[0] = 2;
+            ip--;
+            DISPATCH();
+        }
+        ip++;
+
+        allocStats.calls++;
+        Value* args = vm.stackTop - 2;
+        Value result;
+        if (!binaryOnInts((NativeOp)AS_NATIVE(callee)->op, args[0], args[1], &result)) {
+            // The native may run code that moves the stack and frames
+            cacheStats.binaryMisses++;
+            int base = (int)(args - 1 - vm.stack);
+            result = AS_NATIVE(callee)->function(2, args);
+            vm.stackTop = vm.stack + base;
+            frame = &vm.frames[vm.frameCount - 1];
+        } else {
+            cacheStats.binaryHits++;
+            vm.stackTop = args - 1;
+        }
+        push(result);
+        DISPATCH();
+    }
+    CASE(OP_ERROR): {
+        Value message = READ_CONSTANT();
+        runtimeError("%s", AS_STRING(message)->chars);
+        push(NIL_VAL);
+        DISPATCH();
+    }
+    CASE(OP_RETURN): {
+        Value result = pop();
+        if (frame->closure != NULL && frame->closure->memo != NULL) {
+            memoStore(frame->closure->memo, vm.stack + frame->base + 1, result);
+            vm.stackTop = vm.stack + frame->base;
+        }
+        if (frame->env->pooled) releaseFrame(frame->env);
+        vm.frameCount--;
+        if (vm.frameCount == baseFrame) {
+            return result;
+        }
+
+        push(result);
+        frame = &vm.frames[vm.frameCount - 1];
+        ip = frame->ip;
+        RUN_NATIVE();
+        DISPATCH();
+    }
+
+#if !defined(__GNUC__) || defined(HEXA_NO_COMPUTED_GOTO)
+        }
+    }
+#endif
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef RUN_NATIVE
+#undef DISPATCH
+#undef CASE
+}
+
+// Compile an expression to bytecode and execute it in env. The caller keeps
+// expr reachable from a GC root while this runs.
+Value interpret(Value expr, Environment* env) {
+    Chunk* chunk = compile(expr);
+
+    int baseFrame = vm.frameCount;
+    int baseStack = (int)(vm.stackTop - vm.stack);
+    Environment* baseGlobals = vm.globals;
+    vm.globals = env;
+
+    // Caches filled from other globals are no good here
+    if (env != cachedGlobals) {
+        cachedGlobals = env;
+        globalsVersion++;
+    }
+
+    Value result = NIL_VAL;
+    nestedRuns++;
+    if (pushFrame(NULL, chunk, env)) {
+        result = run(baseFrame);
+    }
+    nestedRuns--;
+
+    vm.stackTop = vm.stack + baseStack;
+    vm.globals = baseGlobals;
+    freeChunk(chunk);
+    return result;
+}
+
+// Call callee on argCount arguments from C, running functions with globals
+// as the global environment. The caller keeps callee and args reachable
+// from GC roots while this runs.
+Value callFunction(Value callee, int argCount, Value* args, Environment* globals) {
+    int baseFrame = vm.frameCount;
+    int baseStack = (int)(vm.stackTop - vm.stack);
+    Environment* baseGlobals = vm.globals;
+    vm.globals = globals;
+
+    if (globals != cachedGlobals) {
+        cachedGlobals = globals;
+        globalsVersion++;
+    }
+
+    ensureStackSpace(argCount + 1);
+    push(callee);
+    for (int i = 0; i < argCount; i++) {
+        push(args[i]);
+    }
+
+    // Natives leave their result on the stack, functions get a frame
+    Value result = NIL_VAL;
+    nestedRuns++;
+    if (callValue(callee, argCount)) {
+        result = vm.frameCount > baseFrame ? run(baseFrame) : pop();
+    }
+    nestedRuns--;
+
+    vm.stackTop = vm.stack + baseStack;
+    vm.globals = baseGlobals;
+    return result;
+}
+
+// Exchange the VM's frames, stack and frame pool with saved
+static void swapStacks(TaskStack* saved) {
+    TaskStack current = {vm.frames, vm.frameCount, vm.frameCapacity, vm.stack,
+                         (int)(vm.stackTop - vm.stack), vm.stackCapacity, saved->pool};
+    swapFramePool(&current.pool);
+
+    vm.frames = saved->frames;
+    vm.frameCount = saved->frameCount;
+    vm.frameCapacity = saved->frameCapacity;
+    vm.stack = saved->stack;
+    vm.stackTop = saved->stack + saved->stackCount;
+    vm.stackCapacity = saved->stackCapacity;
+    *saved = current;
+}
+
+// Run task on its own stacks until it is done, and return true, or it
+// suspends. A task that hasn't started calls its function first, one that
+// was suspended gets task->result as the result of the call that suspended
+// it. Switching tasks only swaps stacks, and nothing is copied.
+bool resumeTask(Task* task) {
+    Environment* baseGlobals = vm.globals;
+    if (task->globals != NULL) vm.globals = task->globals;
+    if (vm.globals != cachedGlobals) {
+        cachedGlobals = vm.globals;
+        globalsVersion++;
+    }
+
+    swapStacks(&resumer);
+    swapStacks(&task->stack);
+    int runs = nestedRuns;
+    nestedRuns = 0;
+    inTask = true;
+
+    Value result = NIL_VAL;
+    if (!task->started) {
+        task->started = true;
+        int argCount = task->args->count;
+        vm.frames = reallocate(NULL, 0, sizeof(CallFrame) * TASK_FRAMES_INITIAL);
+        vm.frameCapacity = TASK_FRAMES_INITIAL;
+        ensureStackSpace(argCount + 1);
+        push(task->function);
+        for (int i = 0; i < argCount; i++) {
+            push(task->args->items[i]);
+        }
+        task->args = NULL;
+        if (callValue(task->function, argCount)) {
+            result = vm.frameCount > 0 ? run(0) : pop();
+        }
+    } else {
+        vm.stackTop[-1] = task->result;
+        result = run(0);
+    }
+
+    bool done = !vm.suspending;
+    vm.suspending = false;
+    inTask = false;
+    nestedRuns = runs;
+    swapStacks(&task->stack);
+    swapStacks(&resumer);
+    vm.globals = baseGlobals;
+
+    if (done) {
+        task->result = result;
+        freeTaskStack(&task->stack);
+    }
+    return done;
+}
+
+// Make the running task return to whatever resumed it once the native
+// being called returns. False if no task can suspend here.
+bool suspendTask() {
+    if (!inTask || nestedRuns > 0 || vm.frameCount == 0) return false;
+    vm.suspending = true;
+    return true;
+}
+
+static void markStack(CallFrame* frames, int frameCount, Value* stack, Value* stackTop) {
+    for (Value* slot = stack; slot < stackTop; slot++) {
+        markValue(*slot);
+    }
+
+    for (int i = 0; i < frameCount; i++) {
+        CallFrame* frame = &frames[i];
+        if (frame->closure != NULL) markObject(&frame->closure->obj);
+
+        // Pooled frames are marked with the pool
+        if (!frame->env->pooled) markObject(&frame->env->obj);
+
+        // Top-level chunks belong to no function
+        List* constants = &frame->chunk->constants;
+        for (int j = 0; j < constants->count; j++) {
+            markValue(constants->items[j]);
+        }
+    }
+}
+
+// The stacks of a suspended task, or of the code that resumed the running one
+void markTaskStack(TaskStack* stack) {
+    markStack(stack->frames, stack->frameCount, stack->stack, stack->stack + stack->stackCount);
+    markSavedFramePool(&stack->pool);
+}
+
+void freeTaskStack(TaskStack* stack) {
+    reallocate(stack->frames, sizeof(CallFrame) * stack->frameCapacity, 0);
+    reallocate(stack->stack, sizeof(Value) * stack->stackCapacity, 0);
+    freeSavedFramePool(&stack->pool);
+    stack->frames = NULL;
+    stack->stack = NULL;
+    stack->frameCount = stack->frameCapacity = 0;
+    stack->stackCount = stack->stackCapacity = 0;
+}
+
+void printCacheStats() {
+    size_t lookups = cacheStats.globalHits + cacheStats.globalMisses;
+    size_t binary = cacheStats.binaryHits + cacheStats.binaryMisses;
+    fprintf(stderr, "Global lookups:     %zu (%.1f%% cache hits)\n", lookups,
+            lookups > 0 ? 100.0 * cacheStats.globalHits / lookups : 0.0);
+    fprintf(stderr, "Quickened calls:    %zu sites, %zu deoptimized\n",
+            cacheStats.quickened, cacheStats.deoptimized);
+    fprintf(stderr, "Binary ops:         %zu (%.1f%% inline)\n", binary,
+            binary > 0 ? 100.0 * cacheStats.binaryHits / binary : 0.0);
+}
+
+void markVMRoots() {
+    markStack(vm.frames, vm.frameCount, vm.stack, vm.stackTop);
+    if (inTask) markTaskStack(&resumer);
+
+    if (vm.globals != NULL) markObject(&vm.globals->obj);
+}
@@ -4,11 +4,12 @@
 // Forward declaration
 void initGlobalEnvironment(Environment* env);
 void printValue(Value value);
+void formatNumber(char* text, size_t size, double number);
 
 static void testLexer() {
     printf("Testing lexer...\n");
     
-    initLexer("[print 123 \"hello\"]");
+    initLexer("[print 123 4.5 \"hello\"]");
     
     Token token;
     
@@ -20,9 +21,13 @@ static void testLexer() {
     assert(strncmp(token.lexeme, "print", token.length) == 0);
     
     token = scanToken();
-    assert(token.type == TOKEN_NUMBER);
+    assert(token.type == TOKEN_INTEGER);
     assert(strncmp(token.lexeme, "123", token.length) == 0);
     
+    token = scanToken();
+    assert(token.type == TOKEN_NUMBER);
+    assert(strncmp(token.lexeme, "4.5", token.length) == 0);
+    
     token = scanToken();
     assert(token.type == TOKEN_STRING);
     
@@ -32,22 +37,136 @@ static void testLexer() {
     token = scanToken();
     assert(token.type == TOKEN_EOF);
     
+    // Quote characters are tokens of their own, ,@ one token
+    initLexer("'`,,@x");
+    assert(scanToken().type == TOKEN_QUOTE);
+    assert(scanToken().type == TOKEN_QUASIQUOTE);
+    assert(scanToken().type == TOKEN_UNQUOTE);
+    assert(scanToken().type == TOKEN_UNQUOTE_SPLICING);
+    assert(scanToken().type == TOKEN_IDENTIFIER);
+    
     printf("Lexer tests passed!\n");
 }
 
+static void testValues() {
+    printf("Testing values...\n");
+    
+    Value number = makeNumber(-2.5);
+    assert(IS_NUMBER(number));
+    assert(AS_NUMBER(number) == -2.5);
+    assert(valueType(number) == VAL_NUMBER);
+    
+    // A NaN result is still a number, not some other boxed value
+    Value nan = makeNumber(0.0 / 0.0);
+    assert(IS_NUMBER(nan));
+    assert(!valuesEqual(nan, nan));
+    
+    // Integers are a number type of their own, and become doubles outside HEXA_INT range
+    Value integer = makeInt(-42);
+    assert(IS_INT(integer) && IS_NUMBER(integer) && !IS_DOUBLE(integer));
+    assert(AS_INT(integer) == -42 && AS_NUMBER(integer) == -42.0);
+    assert(valueType(integer) == VAL_INT);
+    assert(AS_INT(makeInt(HEXA_INT_MAX)) == HEXA_INT_MAX);
+    assert(AS_INT(makeInt(HEXA_INT_MIN)) == HEXA_INT_MIN);
+    assert(IS_DOUBLE(makeInt(HEXA_INT_MAX + 1)));
+    assert(valuesEqual(makeInt(3), makeNumber(3.0)));
+    
+    // Doubles print with as many digits as it takes to read back the same one
+    char text[32];
+    formatNumber(text, sizeof(text), (double)HEXA_INT_MAX + 1);
+    assert(strcmp(text, "140737488355328") == 0);
+    formatNumber(text, sizeof(text), 0.1);
+    assert(strcmp(text, "0.1") == 0);
+    formatNumber(text, sizeof(text), 0.1 + 0.2);
+    assert(strcmp(text, "0.30000000000000004") == 0);
+    formatNumber(text, sizeof(text), -2.5);
+    assert(strcmp(text, "-2.5") == 0);
+    assert(!IS_OBJ(integer) && !IS_SYMBOL(integer) && !IS_NIL(integer));
+    
+    assert(IS_NIL(NIL_VAL));
+    assert(valueType(NIL_VAL) == VAL_NIL);
+    assert(IS_BOOLEAN(makeBoolean(true)) && AS_BOOLEAN(makeBoolean(true)));
+    assert(IS_BOOLEAN(makeBoolean(false)) && !AS_BOOLEAN(makeBoolean(false)));
+    assert(!IS_BOOLEAN(NIL_VAL));
+    
+    Value symbol = makeSymbol("name");
+    assert(IS_SYMBOL(symbol) && !IS_OBJ(symbol));
+    assert(AS_SYMBOL(symbol) == internCString("name"));
+    
+    Value string = makeString("text");
+    assert(IS_STRING(string) && !IS_LIST(string));
+    assert(valueType(string) == VAL_STRING);
+    assert(strcmp(AS_STRING(string)->chars, "text") == 0);
+    
+    Value list = makeList();
+    appendToList(AS_LIST(list), number);
+    assert(IS_LIST(list));
+    assert(AS_NUMBER(AS_LIST(list)->items[0]) == -2.5);
+    
+    // Values that are equal hash the same
+    assert(hashValue(makeInt(3)) == hashValue(makeNumber(3.0)));
+    assert(hashValue(makeNumber(0.0)) == hashValue(makeNumber(-0.0)));
+    assert(hashValue(makeString("text")) == hashValue(string));
+    Value same = makeList();
+    appendToList(AS_LIST(same), makeNumber(-2.5));
+    assert(valuesEqual(list, same) && hashValue(list) == hashValue(same));
+    
+    printf("Value tests passed!\n");
+}
+
 static void testParser() {
     printf("Testing parser...\n");
     
     Value expr = parse("[print 123]");
     
-    assert(expr.type == VAL_LIST);
-    assert(expr.as.list.count == 2);
-    assert(expr.as.list.items[0].type == VAL_SYMBOL);
-    assert(strcmp(expr.as.list.items[0].as.symbol, "print") == 0);
-    assert(expr.as.list.items[1].type == VAL_NUMBER);
-    assert(expr.as.list.items[1].as.number == 123);
+    assert(IS_LIST(expr));
+    assert(AS_LIST(expr)->count == 2);
+    assert(IS_SYMBOL(AS_LIST(expr)->items[0]));
+    assert(AS_SYMBOL(AS_LIST(expr)->items[0]) == internCString("print"));
+    assert(IS_INT(AS_LIST(expr)->items[1]));
+    assert(AS_INT(AS_LIST(expr)->items[1]) == 123);
+    
+    // Symbols are interned, equal names share one handle
+    Value again = parse("[print print]");
+    assert(AS_SYMBOL(AS_LIST(again)->items[0]) == AS_SYMBOL(AS_LIST(expr)->items[0]));
+    assert(AS_SYMBOL(AS_LIST(again)->items[1]) == AS_SYMBOL(AS_LIST(expr)->items[0]));
+    
+    // Integer literals out of range are read as doubles
+    expr = parse("[1.5 140737488355328]");
+    assert(IS_DOUBLE(AS_LIST(expr)->items[0]));
+    assert(IS_DOUBLE(AS_LIST(expr)->items[1]));
+    assert(AS_NUMBER(AS_LIST(expr)->items[1]) == 140737488355328.0);
+    
+    // Forms are allocated from the parse arena unless it is turned off
+    expr = parse("[\"text\" [1 2] []]");
+    List* list = AS_LIST(expr);
+    assert(list->obj.inArena);
+    assert(list->count == 3);
+    assert(IS_STRING(list->items[0]) && AS_STRING(list->items[0])->obj.inArena);
+    assert(strcmp(AS_STRING(list->items[0])->chars, "text") == 0);
+    assert(AS_LIST(list->items[1])->count == 2);
+    assert(AS_LIST(list->items[2])->count == 0);
+    
+    setParseArena(false);
+    expr = parse("[\"text\" [1 2]]");
+    assert(!AS_LIST(expr)->obj.inArena);
+    assert(strcmp(AS_STRING(AS_LIST(expr)->items[0])->chars, "text") == 0);
+    setParseArena(true);
     
-    freeValue(expr);
+    // Special forms are recognized by a tag on their symbol
+    expr = parse("[let [x 1] x]");
+    assert(specialForm(AS_LIST(expr)) == SPECIAL_LET);
+    assert(specialForm(AS_LIST(AS_LIST(expr)->items[1])) == SPECIAL_NONE);
+    
+    // 'x, `x, ,x and ,@x read as two-item forms
+    expr = parse("`[a ,b ,@c 'd]");
+    assert(specialForm(AS_LIST(expr)) == SPECIAL_QUASIQUOTE);
+    list = AS_LIST(AS_LIST(expr)->items[1]);
+    assert(list->count == 4);
+    assert(AS_SYMBOL(AS_LIST(list->items[1])->items[0]) == internCString("unquote"));
+    assert(AS_SYMBOL(AS_LIST(list->items[2])->items[0]) == internCString("unquote-splicing"));
+    assert(specialForm(AS_LIST(list->items[3])) == SPECIAL_QUOTE);
+    assert(AS_SYMBOL(AS_LIST(list->items[3])->items[1]) == internCString("d"));
     
     printf("Parser tests passed!\n");
 }
@@ -56,38 +175,867 @@ static void testEvaluator() {
     printf("Testing evaluator...\n");
     
     Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
     initGlobalEnvironment(env);
     
     // Test addition
     Value expr = parse("[+ 1 2]");
     Value result = evaluate(expr, env);
     
-    assert(result.type == VAL_NUMBER);
-    assert(result.as.number == 3);
+    assert(IS_INT(result));
+    assert(AS_INT(result) == 3);
+    
+    // Integer arithmetic stays exact, and overflow promotes to double
+    result = evaluate(parse("[* 1000000 1000000]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1000000000000);
+    result = evaluate(parse("[* 100000000 100000000]"), env);
+    assert(IS_DOUBLE(result) && AS_NUMBER(result) == 1e16);
+    result = evaluate(parse("[+ 140737488355327 1]"), env);
+    assert(IS_DOUBLE(result) && AS_NUMBER(result) == 140737488355328.0);
+    result = evaluate(parse("[/ 12 4]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 3);
+    result = evaluate(parse("[/ 7 2]"), env);
+    assert(IS_DOUBLE(result) && AS_NUMBER(result) == 3.5);
+    result = evaluate(parse("[+ 1 0.5]"), env);
+    assert(IS_DOUBLE(result) && AS_NUMBER(result) == 1.5);
+    assert(AS_BOOLEAN(evaluate(parse("[= 2 2.0]"), env)));
+    assert(AS_BOOLEAN(evaluate(parse("[< 2 2.5]"), env)));
     
-    freeValue(expr);
+    // Arithmetic and comparisons fold over any number of arguments
+    result = evaluate(parse("[+ 1 2 3 4]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 10);
+    result = evaluate(parse("[- 5]"), env);
+    assert(IS_INT(result) && AS_INT(result) == -5);
+    result = evaluate(parse("[*]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1);
+    result = evaluate(parse("[/ 60 2 3]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 10);
+    assert(AS_BOOLEAN(evaluate(parse("[< 1 2 3]"), env)));
+    assert(!AS_BOOLEAN(evaluate(parse("[< 1 3 2]"), env)));
+    assert(AS_BOOLEAN(evaluate(parse("[>= 3 3 1]"), env)));
+    assert(AS_BOOLEAN(evaluate(parse("[= 2 2 2.0]"), env)));
+    assert(IS_NIL(evaluate(parse("[-]"), env)));
+    result = evaluate(parse("[min 4 1.5 3]"), env);
+    assert(IS_DOUBLE(result) && AS_NUMBER(result) == 1.5);
+    result = evaluate(parse("[max 4 1.5 3]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 4);
+    result = evaluate(parse("[abs [- 7]]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 7);
+    result = evaluate(parse("[mod [- 1] 3]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 2);
+    result = evaluate(parse("[mod 5.5 2]"), env);
+    assert(IS_DOUBLE(result) && AS_NUMBER(result) == 1.5);
     
     // Test function definition and application
     expr = parse("[def add [fn [a b] [+ a b]]]");
     evaluate(expr, env);
-    freeValue(expr);
     
     expr = parse("[add 5 7]");
     result = evaluate(expr, env);
     
-    assert(result.type == VAL_NUMBER);
-    assert(result.as.number == 12);
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == 12);
+    
+    // Tail calls don't nest, other calls stop at the depth limit
+    evaluate(parse("[def count [fn [n] [if [= n 0] 0 [count [- n 1]]]]]"), env);
+    result = evaluate(parse("[count 100000]"), env);
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == 0);
     
-    freeValue(expr);
-    freeEnvironment(env);
+    evaluate(parse("[def deep [fn [n] [if [= n 0] 0 [+ 1 [deep [- n 1]]]]]]"), env);
+    setMaxCallDepth(100);
+    result = evaluate(parse("[deep 99]"), env);
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == 99);
+    result = evaluate(parse("[+ 1 [deep 100]]"), env);
+    assert(IS_NIL(result));
+    setMaxCallDepth(HEXA_DEFAULT_MAX_DEPTH);
+
+    // Loops update their variables in place, and set assigns where a name is bound
+    result = evaluate(parse("[loop [i 0 s 0] [if [< i 100000] [recur [+ i 1] [+ s i]] s]]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 4999950000);
+    result = evaluate(expandMacros(parse("[let [n 0] [dotimes [i 4] [set n [+ n i]]] n]")), env);
+    assert(IS_INT(result) && AS_INT(result) == 6);
+    evaluate(parse("[def total 1]"), env);
+    evaluate(parse("[[fn [] [set total 5]]]"), env);
+    result = evaluate(parse("total"), env);
+    assert(IS_INT(result) && AS_INT(result) == 5);
+    assert(IS_NIL(evaluate(parse("[set undefined-name 1]"), env)));
+    assert(IS_NIL(evaluate(parse("[loop [i 0] [+ 1 [recur i]]]"), env)));
     
+    // A memoized function runs its body once for each distinct argument
+    evaluate(parse("[def fib [memo [fn [n] [if [< n 2] n [+ [fib [- n 1]] [fib [- n 2]]]]]]]"), env);
+    result = evaluate(parse("[fib 60]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1548008755920);
+    assert(valuesEqual(evaluate(parse("[memo-stats fib]"), env), parse("[58 61 61]")));
+
+    // Repeated global lookups hit the symbol's cache until a global changes
+    evaluate(parse("[add 1 2]"), env);
+    size_t hits = cacheStats.globalHits;
+    evaluate(parse("[add 1 2]"), env);
+    assert(cacheStats.globalHits > hits);
+    evaluate(parse("[def add -]"), env);
+    result = evaluate(parse("[add 5 7]"), env);
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == -2);
+
+    popRoots(1);
+
     printf("Evaluator tests passed!\n");
 }
 
+// before, then count copies of item, then after, for the caller to free
+static char* repeated(const char* before, const char* item, int count, const char* after) {
+    size_t length = strlen(before) + strlen(item) * count + strlen(after);
+    char* source = malloc(length + 1);
+    strcpy(source, before);
+    char* end = source + strlen(before);
+    for (int i = 0; i < count; i++) {
+        strcpy(end, item);
+        end += strlen(item);
+    }
+    strcpy(end, after);
+    return source;
+}
+
+// Append format with i and i for each i below count to text
+static void appendNumbered(char* text, size_t size, const char* format, int count) {
+    for (int i = 0; i < count; i++) {
+        size_t length = strlen(text);
+        snprintf(text + length, size - length, format, i, i);
+    }
+}
+
+static void testVM() {
+    printf("Testing VM...\n");
+    
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+    initVM();
+    
+    Value expr = parse("[+ 1 2]");
+    Value result = interpret(expr, env);
+    
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == 3);
+    
+    // Recursive function through the bytecode call path
+    expr = parse("[def fact [fn [n] [if [< n 2] 1 [* n [fact [- n 1]]]]]]");
+    interpret(expr, env);
+    
+    expr = parse("[fact 5]");
+    result = interpret(expr, env);
+    
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == 120);
+    
+    // Closures resolve free variables lexically, not in the caller
+    expr = parse("[def make-adder [fn [x] [fn [y] [+ x y]]]]");
+    interpret(expr, env);
+    
+    expr = parse("[[fn [x] [[make-adder 5] 10]] 1]");
+    result = interpret(expr, env);
+    
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == 15);
+    
+    // Lists and function bodies are shared, not copied
+    expr = parse("[def xs [fn [] [1 2 3]]]");
+    Value fn = interpret(expr, env);
+    
+    assert(IS_FUNCTION(fn));
+    assert(AS_CLOSURE(fn)->function->body == &AS_LIST(AS_LIST(expr)->items[2])->items[2]);
+    
+    // Malformed special forms evaluate to nil, like the tree-walker
+    expr = parse("[if true 1]");
+    result = interpret(expr, env);
+    
+    assert(IS_NIL(result));
+    
+    // Tail calls reuse their frame, other calls stop at the depth limit
+    interpret(parse("[def count [fn [n] [if [= n 0] 0 [count [- n 1]]]]]"), env);
+    result = interpret(parse("[count 100000]"), env);
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == 0);
+    
+    interpret(parse("[def deep [fn [n] [if [= n 0] 0 [+ 1 [deep [- n 1]]]]]]"), env);
+    setMaxCallDepth(100);
+    result = interpret(parse("[deep 99]"), env);
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == 99);
+    result = interpret(parse("[+ 1 [deep 100]]"), env);
+    assert(IS_NIL(result));
+    setMaxCallDepth(HEXA_DEFAULT_MAX_DEPTH);
+    
+    // Special forms give the same results as in the tree-walker
+    const char* forms[] = {
+        "[let [a 1 b [+ a 1]] [def c 3] [+ a [+ b c]]]",
+        "[do 1 2]",
+        "[do [def i 0] [while [< i 5] [def i [+ i 1]]] i]",
+        "[quote [1 two]]",
+        "[and 1 false 3]",
+        "[or nil 2]",
+        "[cond false 1 true 2]",
+        "[[fn [n] [let [m n] [fn [] m]]] 4]",
+        "[loop [i 0 s 0] [if [< i 5] [recur [+ i 1] [+ s i]] s]]",
+        "[let [n 0] [dotimes [i 4] [set n [+ n i]]] n]",
+        "[[fn [x] [[fn [] [set x 9]]] x] 1]",
+        "[set undefined-name 1]"
+    };
+    for (int i = 0; i < (int)(sizeof(forms) / sizeof(forms[0])); i++) {
+        expr = parse(forms[i]);
+        pushRoot(expr);
+        Value compiled = interpret(expr, env);
+        pushRoot(compiled);
+        Value walked = evaluate(expr, env);
+        assert(IS_FUNCTION(compiled) ? IS_FUNCTION(walked) : valuesEqual(compiled, walked));
+        popRoots(2);
+    }
+
+    // Global lookups are cached, but a redefinition is seen on the next one
+    interpret(parse("[def k 1]"), env);
+    interpret(parse("[def get-k [fn [] k]]"), env);
+    result = interpret(parse("[get-k]"), env);
+    size_t hits = cacheStats.globalHits;
+    result = interpret(parse("[get-k]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1);
+    assert(cacheStats.globalHits > hits);
+    interpret(parse("[def k 2]"), env);
+    result = interpret(parse("[get-k]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 2);
+
+    // Calls of binary built-ins are quickened, and go back to generic calls
+    // when the site calls something else
+    interpret(parse("[def apply2 [fn [f a b] [f a b]]]"), env);
+    size_t quickened = cacheStats.quickened;
+    result = interpret(parse("[apply2 + 2 3]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 5);
+    assert(cacheStats.quickened == quickened + 1);
+    result = interpret(parse("[apply2 < 2.5 3]"), env);
+    assert(IS_BOOLEAN(result) && AS_BOOLEAN(result));
+    size_t deoptimized = cacheStats.deoptimized;
+    result = interpret(parse("[apply2 [fn [a b] b] 2 3]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 3);
+    assert(cacheStats.deoptimized == deoptimized + 1);
+    result = interpret(parse("[apply2 - 2 3]"), env);
+    assert(IS_INT(result) && AS_INT(result) == -1);
+
+    // Hot functions are compiled to machine code and give the same results
+    interpret(parse("[def sum-to [fn [n] [let [i 0 s 0] "
+                    "[while [<= i n] [def s [+ s i]] [def i [+ i 1]]] [if s s 0]]]]"), env);
+    expr = parse("[sum-to 10]");
+    pushRoot(expr);
+    for (int i = 0; i < HEXA_JIT_THRESHOLD * 2; i++) {
+        result = interpret(expr, env);
+        assert(IS_INT(result) && AS_INT(result) == 55);
+    }
+    popRoots(1);
+    interpret(parse("[def down-from [fn [n acc] [if [= n 0] acc [down-from [- n 1] [+ acc n]]]]]"), env);
+    result = interpret(parse("[down-from 1000 0]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 500500);
+
+    // C code calls functions through the VM
+    Value callee;
+    assert(lookupVariable(env, internCString("down-from"), &callee));
+    Value args[2] = {makeInt(10), makeInt(0)};
+    result = callFunction(callee, 2, args, env);
+    assert(IS_INT(result) && AS_INT(result) == 55);
+
+    // A loop runs in one frame without allocating, however long it goes on
+    interpret(parse("[def count-up [fn [n] [loop [i 0] [if [< i n] [recur [+ i 1]] i]]]]"), env);
+    assert(lookupVariable(env, internCString("count-up"), &callee));
+    args[0] = makeInt(10);
+    callFunction(callee, 1, args, env);
+    size_t allocations = allocStats.allocations;
+    args[0] = makeInt(100000);
+    result = callFunction(callee, 1, args, env);
+    assert(IS_INT(result) && AS_INT(result) == 100000);
+    assert(allocStats.allocations == allocations);
+    assert(IS_NIL(interpret(parse("[loop [i 0] [+ 1 [recur i]]]"), env)));
+
+    // Memoized functions return cached results, keep the most recently used
+    // ones, and return from tail calls through the VM
+    interpret(parse("[def fib [memo [fn [n] [if [< n 2] n [+ [fib [- n 1]] [fib [- n 2]]]]]]]"), env);
+    result = interpret(parse("[fib 60]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1548008755920);
+    assert(valuesEqual(interpret(parse("[memo-stats fib]"), env), parse("[58 61 61]")));
+    interpret(parse("[def sq [memo [fn [x] [* x x]] 2]]"), env);
+    interpret(parse("[do [sq 1] [sq 2] [sq 1] [sq 3] [sq 1.0] [sq 2]]"), env);
+    assert(valuesEqual(interpret(parse("[memo-stats sq]"), env), parse("[2 4 2]")));
+    interpret(parse("[def down [memo [fn [n acc] [if [= n 0] acc [down [- n 1] [+ acc 1]]]]]]"), env);
+    result = interpret(parse("[down 1000 0]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1000);
+    
+    // Code too long for a jump's offset doesn't compile to a jump into the
+    // middle of an instruction, its chunk reports the error when it runs
+    char* source = repeated("[if [= 1 2] [do", " [fact 1]", 20000, "] 42]");
+    expr = parse(source);
+    free(source);
+    Chunk* chunk = compile(expr);
+    assert(chunk->code[0] == OP_ERROR && chunk->code[3] == OP_RETURN);
+    freeChunk(chunk);
+    assert(IS_NIL(interpret(expr, env)));
+    source = repeated("[def spin [fn [] [while [= 1 2]", " [fact 1]", 20000, "] 42]]");
+    interpret(parse(source), env);
+    free(source);
+    assert(IS_NIL(interpret(parse("[spin]"), env)));
+    
+    // A function with more locals than a frame has slots fails the same
+    // way, instead of sharing the last slot between the names past it
+    char many[8192] = "[def many [fn []";
+    appendNumbered(many, sizeof(many), " [def v%d %d]", 300);
+    strcat(many, " v299]]");
+    interpret(parse(many), env);
+    assert(lookupVariable(env, internCString("many"), &callee));
+    assert(AS_CLOSURE(callee)->function->chunk->code[0] == OP_ERROR);
+    assert(IS_NIL(interpret(parse("[many]"), env)));
+    
+    // A let or loop can have as many bindings as OP_PUSH_SCOPE counts, past
+    // that it reports the error instead of making its scope too small
+    char scope[8192] = "[let [";
+    appendNumbered(scope, sizeof(scope), " v%d %d", 255);
+    strcat(scope, "] [+ v0 v254]]");
+    result = interpret(parse(scope), env);
+    assert(IS_INT(result) && AS_INT(result) == 254);
+    strcpy(scope, "[let [");
+    appendNumbered(scope, sizeof(scope), " v%d %d", 300);
+    strcat(scope, "] [+ v0 v299]]");
+    assert(IS_NIL(interpret(parse(scope), env)));
+    strcpy(scope, "[loop [");
+    appendNumbered(scope, sizeof(scope), " v%d %d", 256);
+    strcat(scope, "] v255]");
+    assert(IS_NIL(interpret(parse(scope), env)));
+#ifdef HEXA_JIT
+    Value hot;
+    assert(lookupVariable(env, internCString("sum-to"), &hot));
+    assert(AS_CLOSURE(hot)->function->chunk->jit != NULL);
+    assert(lookupVariable(env, internCString("down-from"), &hot));
+    assert(AS_CLOSURE(hot)->function->chunk->jit != NULL);
+#endif
+
+    popRoots(1);
+
+    printf("VM tests passed!\n");
+}
+
+static void testOptimizer() {
+    printf("Testing optimizer...\n");
+    
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+    
+    // Calls of pure built-ins with literal arguments fold to their result
+    Value expr = optimize(parse("[+ 1 [* 2 3]]"), env);
+    assert(IS_INT(expr) && AS_INT(expr) == 7);
+    expr = optimize(parse("[if [< 1 2] \"yes\" [print \"no\"]]"), env);
+    assert(IS_STRING(expr) && strcmp(AS_STRING(expr)->chars, "yes") == 0);
+    
+    // Quoted data, names bound in the form and failing calls are left alone
+    expr = optimize(parse("[quote [+ 1 2]]"), env);
+    assert(IS_LIST(AS_LIST(expr)->items[1]));
+    expr = optimize(parse("[let [+ -] [+ 5 2]]"), env);
+    assert(IS_LIST(AS_LIST(expr)->items[2]));
+    expr = optimize(parse("[/ 1 0]"), env);
+    assert(IS_LIST(expr));
+    
+    // Function bodies are folded until the built-in is redefined
+    expr = optimize(parse("[def f [fn [] [+ 1 2]]]"), env);
+    pushRoot(expr);
+    interpret(expr, env);
+    Value body = AS_LIST(AS_LIST(expr)->items[2])->items[2];
+    assert(IS_INT(body) && AS_INT(body) == 3);
+    
+    Value result = interpret(parse("[f]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 3);
+    interpret(parse("[def + -]"), env);
+    assert(IS_LIST(AS_LIST(AS_LIST(expr)->items[2])->items[2]));
+    result = interpret(parse("[f]"), env);
+    assert(IS_INT(result) && AS_INT(result) == -1);
+    result = evaluate(parse("[f]"), env);
+    assert(IS_INT(result) && AS_INT(result) == -1);
+    
+    popRoots(2);
+    
+    printf("Optimizer tests passed!\n");
+}
+
+static void testMacros() {
+    printf("Testing macros...\n");
+    
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+    
+    // Quasiquote puts values in and splices lists in
+    Value result = interpret(expandMacros(parse("`[a ,[+ 1 2] ,@[quote [b c]] d]")), env);
+    assert(valuesEqual(result, parse("[a 3 b c d]")));
+    result = evaluate(parse("`[a ,@[quote []] [b ,[* 2 3]]]"), env);
+    assert(valuesEqual(result, parse("[a [b 6]]")));
+    
+    // A macro call is replaced by its expansion before the form runs, and
+    // the parse tree it came from is left as it was
+    interpret(expandMacros(parse("[defmacro unless [test body] `[if ,test nil ,body]]")), env);
+    Value expr = parse("[def f [fn [x] [unless [< x 0] [* x 2]]]]");
+    pushRoot(expr);
+    Value expanded = expandMacros(expr);
+    pushRoot(expanded);
+    Value body = AS_LIST(AS_LIST(expanded)->items[2])->items[2];
+    assert(specialForm(AS_LIST(body)) == SPECIAL_IF);
+    body = AS_LIST(AS_LIST(expr)->items[2])->items[2];
+    assert(AS_SYMBOL(AS_LIST(body)->items[0]) == internCString("unless"));
+    
+    interpret(expanded, env);
+    result = interpret(parse("[f 21]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 42);
+    assert(IS_NIL(evaluate(parse("[f -1]"), env)));
+    
+    // Functions print as written, with macro calls and dotimes unexpanded
+    Function* function = AS_CLOSURE(getVariable(env, internCString("f")))->function;
+    assert(sourceForm(function->form) == AS_LIST(AS_LIST(expr)->items[2]));
+    expr = parse("[def g [fn [n] [dotimes [i n] [print i]]]]");
+    pushRoot(expr);
+    interpret(expandMacros(expr), env);
+    function = AS_CLOSURE(getVariable(env, internCString("g")))->function;
+    assert(specialForm(AS_LIST(function->form->items[2])) == SPECIAL_LET);
+    assert(sourceForm(function->form) == AS_LIST(AS_LIST(expr)->items[2]));
+    
+    // Quoted code isn't expanded, and a macro that never ends is an error
+    expr = expandMacros(parse("[quote [unless true 1]]"));
+    assert(AS_SYMBOL(AS_LIST(AS_LIST(expr)->items[1])->items[0]) == internCString("unless"));
+    interpret(expandMacros(parse("[defmacro forever [] [quote [forever]]]")), env);
+    assert(IS_NIL(expandMacros(parse("[forever]"))));
+    
+    // [fn memo [params] body...] is a call of the built-in memo
+    expr = expandMacros(parse("[fn memo [n] n]"));
+    assert(IS_NATIVE(AS_LIST(expr)->items[0]));
+    assert(specialForm(AS_LIST(AS_LIST(expr)->items[1])) == SPECIAL_FN);
+    result = interpret(parse("[[fn memo [n] [* n 3]] 4]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 12);
+    
+    popRoots(4);
+    
+    printf("Macro tests passed!\n");
+}
+
+static void testEmitter() {
+    printf("Testing C emitter...\n");
+
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+
+    FILE* out = tmpfile();
+    assert(out != NULL);
+    assert(emitProgram("[def sq [fn [x] [* x x]]]\n"
+                       "[def adder [fn [n] [fn [x] [+ x n]]]]\n"
+                       "[print [sq 4] [< 1 2]]\n"
+                       "[defmacro twice [x] `[* 2 ,x]]\n"
+                       "[print [twice 3]]\n"
+                       "[def up [fn [n] [loop [i 0] [if [< i n] [recur [+ i 1]] i]]]]\n"
+                       "[set up sq]", "test.hexa", env, out));
+    char code[8192];
+    rewind(out);
+    size_t length = fread(code, 1, sizeof(code) - 1, out);
+    code[length] = '\0';
+    fclose(out);
+
+    // Functions get a C body that calls go straight to, and a closure made
+    // by the interpreter. Closures inside functions stay interpreted.
+    assert(strstr(code, "Value hexa_sq_0(Value a0) {") != NULL);
+    assert(strstr(code, "programRun(\"[def sq [fn [x] [* x x]]]\");") != NULL);
+    assert(strstr(code, "isClosure(v[3], closures[0]) ? hexa_sq_0(v[4])") != NULL);
+    assert(strstr(code, "programRun(\"[def adder") != NULL);
+    assert(strstr(code, "hexa_adder") == NULL);
+    assert(strstr(code, "programBinary(v[4], NATIVE_OP_LESS, v[5], v[6])") != NULL);
+    assert(strstr(code, "programResult(hexa_form_3());") != NULL);
+
+    // Macros are expanded by the embedded interpreter, where calls of them run
+    assert(strstr(code, "programRun(\"[print [twice 3]]\");") != NULL);
+
+    // A loop is a C loop that recur continues, and set assigns the global
+    assert(strstr(code, "Value hexa_up_1(Value a0) {") != NULL);
+    assert(strstr(code, "continue;") != NULL);
+    assert(strstr(code, "programSet(symbols[") != NULL);
+
+    popRoots(1);
+
+    printf("C emitter tests passed!\n");
+}
+
+static void testGC() {
+    printf("Testing garbage collector...\n");
+
+    // Machine code lives as long as its function and is made on some call,
+    // so it would show up in the heap and call allocation counts
+    setJitEnabled(false);
+    
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+    
+    Value expr = parse("[def make [fn [n] [def self [fn [] self]] [fn [] n]]]");
+    interpret(expr, env);
+    interpret(parse("[def kept nil]"), env);
+    
+    // Parsed up front, since a new block of the parser's arena would show
+    // up in the heap's size
+    Value call = parse("[[make 42]]");
+    pushRoot(call);
+    Value keep = parse("[def kept [make 7]]");
+    pushRoot(keep);
+    Value get = parse("[kept]");
+    pushRoot(get);
+    Value drop = parse("[def kept nil]");
+    pushRoot(drop);
+    collectGarbage();
+    size_t live = heapBytesAllocated();
+    
+    // Each call leaves behind a frame that refers to itself through self
+    for (int i = 0; i < 100; i++) {
+        Value result = interpret(call, env);
+        assert(IS_NUMBER(result));
+        assert(AS_NUMBER(result) == 42);
+    }
+    
+    // Reachable values survive a collection, the cycles do not
+    Value kept = interpret(keep, env);
+    collectGarbage();
+    assert(heapBytesAllocated() > live);
+    
+    Value result = interpret(get, env);
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == 7);
+    assert(IS_FUNCTION(kept));
+    
+    interpret(drop, env);
+    collectGarbage();
+    assert(heapBytesAllocated() == live);
+    popRoots(4);
+
+    // Frames of functions without closures are pooled, so once warmed up
+    // neither the VM nor the evaluator allocates to make a call
+    interpret(parse("[def down [fn [n] [if [= n 0] 0 [down [- n 1]]]]]"), env);
+    expr = parse("[down 50]");
+    pushRoot(expr);
+    interpret(expr, env);
+    size_t callAllocations = allocStats.callAllocations;
+    size_t calls = allocStats.calls;
+    result = interpret(expr, env);
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == 0);
+    result = evaluate(expr, env);
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == 0);
+    assert(allocStats.calls > calls + 100);
+    assert(allocStats.callAllocations == callAllocations);
+    popRoots(1);
+
+    popRoots(1);
+    setJitEnabled(true);
+    
+    printf("Garbage collector tests passed!\n");
+}
+
+static void testTasks() {
+    printf("Testing tasks...\n");
+
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+
+    // Ready tasks take turns, each running until it yields
+    interpret(parse("[def log 0]"), env);
+    interpret(parse("[def step [fn [digit times] [loop [i 0] [if [< i times] "
+                    "[do [set log [+ [* log 10] digit]] [yield] [recur [+ i 1]]] digit]]]]"), env);
+    Value a = interpret(parse("[def a [spawn step 1 3]]"), env);
+    interpret(parse("[def b [spawn step 2 2]]"), env);
+    assert(IS_TASK(a) && AS_TASK(a)->state == TASK_READY);
+    Value result = interpret(parse("[await a]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1);
+    result = interpret(parse("log"), env);
+    assert(IS_INT(result) && AS_INT(result) == 12121);
+
+    // A suspended task keeps its frames across a collection, and a task
+    // that is done keeps only its result
+    interpret(parse("[def c [spawn step 3 2]]"), env);
+    evaluate(parse("[yield]"), env);
+    collectGarbage();
+    result = evaluate(parse("[+ [await c] [await b] [await a]]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 6);
+    result = interpret(parse("log"), env);
+    assert(IS_INT(result) && AS_INT(result) == 1212133);
+    assert(AS_TASK(a)->state == TASK_DONE && AS_TASK(a)->stack.frames == NULL);
+
+    // Tasks waiting for a task wake up with its result
+    interpret(parse("[def plus-one [fn [task] [+ 1 [await task]]]]"), env);
+    result = interpret(parse("[let [slow [spawn step 4 3]] "
+                             "[+ [await [spawn plus-one slow]] [await [spawn plus-one slow]]]]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 10);
+
+    // Waiting for each other is a deadlock, and awaiting oneself an error
+    interpret(parse("[def x nil]"), env);
+    interpret(parse("[def y [spawn [fn [] [yield] [await x]]]]"), env);
+    interpret(parse("[set x [spawn [fn [] [await y]]]]"), env);
+    assert(IS_NIL(interpret(parse("[await x]"), env)));
+    interpret(parse("[def me nil]"), env);
+    interpret(parse("[set me [spawn [fn [] [await me]]]]"), env);
+    assert(IS_NIL(interpret(parse("[await me]"), env)));
+    assert(IS_NIL(interpret(parse("[await 1]"), env)));
+
+    popRoots(1);
+
+    printf("Task tests passed!\n");
+}
+
+// What one thread of testThreads computed
+typedef struct {
+    int seed;
+    int64_t result;
+    bool secondRefused;     // newHexaVM refused a second interpreter
+    bool freshGlobals;      // A new interpreter didn't see the old one's globals
+} ThreadRun;
+
+static void runThread(void* arg) {
+    ThreadRun* run = arg;
+    HexaVM* hexa = newHexaVM();
+    run->secondRefused = newHexaVM() == NULL;
+
+    // Enough calls to compile f with this thread's JIT
+    char source[128];
+    snprintf(source, sizeof(source), "[def seed %d] [defmacro twice [x] `[* 2 ,x]]", run->seed);
+    runSource(hexa, source, false);
+    Value result = runSource(hexa, "[def f [fn [n] [if [< n 1] seed [f [- n 1]]]]] [twice [f 500]]", false);
+    run->result = IS_INT(result) ? AS_INT(result) : -1;
+    freeHexaVM(hexa);
+
+    hexa = newHexaVM();
+    Value seed;
+    run->freshGlobals = !lookupVariable(hexaGlobals(hexa), internCString("seed"), &seed);
+    freeHexaVM(hexa);
+}
+
+// Parallel map and reduce, on a pool of 3 workers made by this thread
+static void runParallel(void* arg) {
+    (void)arg;
+    HexaVM* hexa = newHexaVM();
+    setThreadCount(3);
+    runSource(hexa, "[def base 10] [def add-base [fn [x] [+ x base]]]"
+                    "[def make-adder [fn [n] [fn [x] [+ x n]]]]", false);
+
+    // Results come back in order, with the globals and closures f needs
+    const char* checks[] = {
+        "[= [pmap add-base '[1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25]]"
+        "   '[11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32 33 34 35]]",
+        "[= [pmap [make-adder 100] '[1 2 3]] '[101 102 103]]",
+        "[= [pmap [fn [s] [quote \"x\"]] '[1 2]] '[\"x\" \"x\"]]",
+        "[= [preduce [fn [a b] [+ a b]] 100 [pmap add-base '[1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20]]] 510]",
+        "[= [preduce + 100 '[1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20]] 310]",
+        "[= [pmap add-base '[]] '[]]",
+        "[= [preduce + 7 '[]] 7]",
+        "[= [pmap [fn [xs] [preduce + 0 [pmap add-base xs]]] '[[1 2] [3 4]]] '[23 27]]",
+    };
+    for (int i = 0; i < (int)(sizeof(checks) / sizeof(checks[0])); i++) {
+        Value result = runSource(hexa, checks[i], false);
+        assert(IS_BOOLEAN(result) && AS_BOOLEAN(result));
+    }
+    assert(IS_NIL(runSource(hexa, "[pmap 1 '[1]]", false)));
+    assert(IS_NIL(runSource(hexa, "[preduce + 0 1]", false)));
+
+    // The workers stop with the interpreter
+    freeHexaVM(hexa);
+    setThreadCount(0);
+}
+
+// preduce combines the chunk results by calling f on this thread, which
+// grows the VM's frames under the machine code of g that called preduce
+static void runReentrant(void* arg) {
+    (void)arg;
+    HexaVM* hexa = newHexaVM();
+    setJitThreshold(1);
+    setThreadCount(2);
+    Value result = runSource(hexa, "[def down [fn [n] [if [= n 0] 0 [+ 1 [down [- n 1]]]]]]"
+                                   "[def f [fn [acc x] [+ acc [down 300]]]]"
+                                   "[def g [fn [] [let [r [preduce f 0 '[1 2 3]]] [+ r 1]]]]"
+                                   "[g]", false);
+    assert(IS_INT(result) && AS_INT(result) == 901);
+    freeHexaVM(hexa);
+    setThreadCount(0);
+}
+
+// Calls of f from pmap and preduce on this thread grow the VM's stack, which
+// their arguments are on
+static void runNested(void* arg) {
+    (void)arg;
+    HexaVM* hexa = newHexaVM();
+    setJitEnabled(false);
+    setThreadCount(1);
+    runSource(hexa, "[def deep [fn [n] [if [= n 0] 0 [+ 1 [deep [- n 1]]]]]]", false);
+    Value result = runSource(hexa, "[= [pmap [fn [x] [pmap deep '[3000 3000 3000]]] '[1]] '[[3000 3000 3000]]]",
+                             false);
+    assert(IS_BOOLEAN(result) && AS_BOOLEAN(result));
+    result = runSource(hexa, "[+ [preduce [fn [acc x] [+ acc [deep 3000]]] 0 '[1 2 3]] 1]", false);
+    assert(IS_INT(result) && AS_INT(result) == 9001);
+    freeHexaVM(hexa);
+    setThreadCount(0);
+}
+
+static void testThreads() {
+    printf("Testing interpreters on threads...\n");
+
+    // Each thread's globals, macros and heap are its own
+    ThreadRun runs[4];
+    HexaThread* threads[4];
+    for (int i = 0; i < 4; i++) {
+        runs[i].seed = i + 1;
+        threads[i] = startThread(runThread, &runs[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        joinThread(threads[i]);
+        assert(runs[i].result == 2 * (i + 1));
+        assert(runs[i].secondRefused);
+        assert(runs[i].freshGlobals);
+    }
+
+    HexaThread* thread = startThread(runParallel, NULL);
+    joinThread(thread);
+    thread = startThread(runReentrant, NULL);
+    joinThread(thread);
+    thread = startThread(runNested, NULL);
+    joinThread(thread);
+
+    printf("Thread tests passed!\n");
+}
+
+static void testChannels() {
+    printf("Testing channels and actors...\n");
+
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+
+    // Messages are copies, in the order they were sent
+    interpret(parse("[def c [chan 4]]"), env);
+    interpret(parse("[send c 1]"), env);
+    interpret(parse("[send c '[x \"y\" [2.5 nil]]]"), env);
+    collectGarbage();
+    Value result = interpret(parse("[and [= [recv c] 1] [= [recv c] '[x \"y\" [2.5 nil]]]]"), env);
+    assert(IS_BOOLEAN(result) && AS_BOOLEAN(result));
+    assert(IS_NIL(interpret(parse("[send c [fn [x] x]]"), env)));
+
+    // An actor computes with copies of its function and the globals it uses,
+    // and sends on a channel of 2 until it is full
+    interpret(parse("[def scale 3]"), env);
+    interpret(parse("[def producer [fn [out n] [dotimes [i n] [send out [* scale i]]] 'sent]]"), env);
+    interpret(parse("[def sum-of [fn [in n total] [if [= n 0] total [sum-of in [- n 1] [+ total [recv in]]]]]]"), env);
+    interpret(parse("[def numbers [chan 2]]"), env);
+    interpret(parse("[def done [actor producer numbers 100]]"), env);
+    result = interpret(parse("[sum-of numbers 100 0]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 14850);
+    result = interpret(parse("[recv done]"), env);
+    assert(IS_SYMBOL(result) && strcmp(AS_SYMBOL(result)->chars, "sent") == 0);
+    assert(IS_NIL(interpret(parse("[recv done]"), env)));
+
+    // Ping-pong, with the channel to reply on sent in the first message
+    interpret(parse("[def ponger [fn [in] [let [out [recv in]] "
+                    "[loop [n [recv in]] [if [< n 0] n [do [send out [+ n 1]] [recur [recv in]]]]]]]]"), env);
+    interpret(parse("[def ping [chan 1]]"), env);
+    interpret(parse("[def pong [chan 1]]"), env);
+    interpret(parse("[def player [actor ponger ping]]"), env);
+    interpret(parse("[send ping pong]"), env);
+    result = interpret(parse("[loop [i 0 n 0] [if [< i 50] [do [send ping n] [recur [+ i 1] [recv pong]]] n]]"),
+                       env);
+    assert(IS_INT(result) && AS_INT(result) == 50);
+    interpret(parse("[send ping [- 0 1]]"), env);
+    result = interpret(parse("[recv player]"), env);
+    assert(IS_INT(result) && AS_INT(result) == -1);
+
+    // select takes what is there, and closed channels give what was sent
+    // before they closed, then nil
+    interpret(parse("[def a [chan]]"), env);
+    interpret(parse("[def b [chan]]"), env);
+    interpret(parse("[send b 'hello]"), env);
+    result = interpret(parse("[select a b]"), env);
+    assert(IS_SYMBOL(result) && strcmp(AS_SYMBOL(result)->chars, "hello") == 0);
+    interpret(parse("[send a 7]"), env);
+    interpret(parse("[close a]"), env);
+    interpret(parse("[close b]"), env);
+    result = interpret(parse("[select `[,a ,b]]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 7);
+    assert(IS_NIL(interpret(parse("[select a b]"), env)));
+    assert(IS_NIL(interpret(parse("[recv a]"), env)));
+    result = interpret(parse("[send a 1]"), env);
+    assert(IS_BOOLEAN(result) && !AS_BOOLEAN(result));
+
+    assert(IS_NIL(interpret(parse("[chan 0]"), env)));
+    assert(IS_NIL(interpret(parse("[recv 1]"), env)));
+    assert(IS_NIL(interpret(parse("[select]"), env)));
+
+    popRoots(1);
+
+    printf("Channel tests passed!\n");
+}
+
+static void testVectors() {
+    printf("Testing vectors...\n");
+
+    Environment* env = createEnvironment();
+    pushEnvironmentRoot(env);
+    initGlobalEnvironment(env);
+
+    // Updates make new versions and leave the old ones as they were
+    interpret(parse("[def v [conj nil 1 2 3]]"), env);
+    Value result = interpret(parse("[and [= v '[1 2 3]] [= [assoc v 0 'a] '[a 2 3]] [= [pop v] '[1 2]] "
+                                   "[= [concat '[0] v v] '[0 1 2 3 1 2 3]] [= v '[1 2 3]]]"),
+                             env);
+    assert(IS_BOOLEAN(result) && AS_BOOLEAN(result));
+    result = interpret(parse("[nth '[a b c] 1]"), env);
+    assert(IS_SYMBOL(result) && strcmp(AS_SYMBOL(result)->chars, "b") == 0);
+
+    // Enough items for a trie three levels deep, updated, then popped back
+    // down past each level, with collections in between
+    interpret(parse("[def build [fn [v i n] [if [< i n] [build [conj v i] [+ i 1] n] v]]]"), env);
+    interpret(parse("[def big [build nil 0 40000]]"), env);
+    interpret(parse("[def changed [assoc big 33000 'x]]"), env);
+    collectGarbage();
+    result = interpret(parse("[+ [count big] [nth big 0] [nth big 1055] [nth big 33000] [nth big 39999]]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 40000 + 1055 + 33000 + 39999);
+    result = interpret(parse("[nth changed 33000]"), env);
+    assert(IS_SYMBOL(result) && strcmp(AS_SYMBOL(result)->chars, "x") == 0);
+    interpret(parse("[def shrink [fn [v n] [if [= n 0] v [shrink [pop v] [- n 1]]]]]"), env);
+    interpret(parse("[def small [shrink big 39990]]"), env);
+    collectGarbage();
+    result = interpret(parse("[and [= small '[0 1 2 3 4 5 6 7 8 9]] [= [count [shrink small 10]] 0] "
+                             "[= [nth big 39999] 39999]]"),
+                       env);
+    assert(IS_BOOLEAN(result) && AS_BOOLEAN(result));
+
+    // Vectors reach other interpreters as copies
+    result = interpret(parse("[preduce + 0 [pmap [fn [x] [* 2 x]] [build nil 0 100]]]"), env);
+    assert(IS_INT(result) && AS_INT(result) == 9900);
+    interpret(parse("[def c [chan]]"), env);
+    interpret(parse("[send c [conj '[1 \"two\"] [conj nil 3]]]"), env);
+    result = interpret(parse("[= [recv c] '[1 \"two\" [3]]]"), env);
+    assert(IS_BOOLEAN(result) && AS_BOOLEAN(result));
+
+    assert(IS_NIL(interpret(parse("[nth v 3]"), env)));
+    assert(IS_NIL(interpret(parse("[assoc v 1.5 0]"), env)));
+    assert(IS_NIL(interpret(parse("[pop [pop [pop [pop v]]]]"), env)));
+    assert(IS_NIL(interpret(parse("[conj 1 2]"), env)));
+
+    popRoots(1);
+
+    printf("Vector tests passed!\n");
+}
+
 int main() {
     testLexer();
+    testValues();
     testParser();
     testEvaluator();
+    testVM();
+    testOptimizer();
+    testMacros();
+    testEmitter();
+    testGC();
+    testTasks();
+    testThreads();
+    testChannels();
+    testVectors();
     
     printf("All tests passed!\n");
     return 0;